@@ -7,6 +7,7 @@
 // For commercial use, separate licencing terms must be obtained.
 
 
+#include <stddef.h>
 #include "PicoInt.h"
 
 // ym2612
@@ -15,8 +16,9 @@
 // sn76496
 extern int *sn76496_regs;
 
+#include "Patch.h"
+#include "../zlib/zlib.h"
 
-struct PicoArea { void *data; int len; char *name; };
 
 // strange observation on Symbian OS 9.1, m600 organizer fw r3a06:
 // taking an address of fread or fwrite causes "application could't be started" error
@@ -110,6 +112,9 @@ PICO_INTERNAL int PicoAreaUnpackCpu(unsigned char *cpu, int is_sub)
   context->interrupts[0] = cpu[0x4c];
   context->execinfo &= ~FM68K_HALTED;
   if (cpu[0x4d]&1) context->execinfo |= FM68K_HALTED;
+#ifdef FAMEC_DRC
+  if (!is_sub) fm68k_drc_flush(); // RAM was just loaded
+#endif
 #endif
   return 0;
 }
@@ -120,7 +125,7 @@ static int PicoAreaScan(int PmovAction,unsigned int ver, void *PmovFile)
   void *ym2612_regs;
   unsigned char cpu[0x60];
   unsigned char cpu_z80[0x60];
-  int ret;
+  int ret, i;
 
   memset(&cpu,0,sizeof(cpu));
   memset(&cpu_z80,0,sizeof(cpu_z80));
@@ -160,43 +165,741 @@ static int PicoAreaScan(int PmovAction,unsigned int ver, void *PmovFile)
       ScanVar(ym2612_regs, 0x200+4, "YM2612state", PmovFile, PmovAction); // regs + addr line
       if((PmovAction&3)==2) YM2612PicoStateLoad(); // reload YM2612 state from it's regs
     }
+
+    // SSF2 mapper banks, older states end before them
+    ret = SCAN_VAR(Pico.rom_bank,"rom_bank")
+    if((PmovAction&3)==2) {
+      if(ret) for (i = 0; i < 8; i++) Pico.rom_bank[i] = i;
+      PicoMemRemap();
+    }
   }
 
   return 0;
 }
 
 // ---------------------------------------------------------------------------
-// Helper code to save/load to a file handle
+// Savestate format v2, same for MD and MCD: header, chunk directory, chunks.
+// Every chunk is zlib compressed on it's own (stored if that doesn't help) and
+// has a crc32 of it's data, so a single chunk can be read by seeking to it
+// (PicoStateLoadGfx) and chunks can be inflated in any order.
+// Old MD (PicoAreaScan) and MCD (cd/Area.c) states are still loaded.
+
+#define STATE_V2_MAGIC "PicoSTv2"
+#define STATE_V2_MAX_CHUNKS 32
+
+struct state_v2_head
+{
+  char magic[8];
+  unsigned int ver;     // PicoVer
+  unsigned int flags;   // 1: MCD
+  unsigned int count;   // directory entries
+  unsigned int pad[3];  // 32 bytes, as old MD header
+};
+
+struct state_v2_dir
+{
+  unsigned int id;      // chunk_name_e
+  unsigned int offs;    // from start of the state
+  unsigned int len;
+  unsigned int clen;    // == len if stored
+  unsigned int crc;     // crc32 of uncompressed data
+};
+
+struct state_chunk { int id; void *data; int len; };
+
+static const char *chunk_names[] = {
+  "INVALID!",
+  "Saving.. M68K state",
+  "Saving.. RAM",
+  "Saving.. VRAM",
+  "Saving.. ZRAM",
+  "Saving.. CRAM",     // 5
+  "Saving.. VSRAM",
+  "Saving.. emu state",
+  "Saving.. VIDEO",
+  "Saving.. Z80 state",
+  "Saving.. PSG",      // 10
+  "Saving.. FM",
+  // CD stuff
+  "Saving.. S68K state",
+  "Saving.. PRG_RAM",
+  "Saving.. WORD_RAM",
+  "Saving.. PCM_RAM",  // 15
+  "Saving.. BRAM",
+  "Saving.. GATE ARRAY regs",
+  "Saving.. PCM state",
+  "Saving.. CDC",
+  "Saving.. CDD",      // 20
+  "Saving.. SCD",
+  "Saving.. GFX chip",
+  "Saving.. MCD state",
+  "Saving.. ROM banks",
+};
+
+// where the chunks come from/go to, cpus go through pack buffers.
+// all: include sound chips even if they are disabled now (for loading)
+static int state_v2_chunks(struct state_chunk *c, unsigned char *cpu,
+  unsigned char *cpu_z80, unsigned char *cpu_s68k, int all)
+{
+  int n = 0;
+
+#define CHUNK(i,d,l) { c[n].id = i; c[n].data = d; c[n].len = l; n++; }
+  CHUNK(CHUNK_M68K,  cpu,         0x60)
+  CHUNK(CHUNK_RAM,   Pico.ram,    sizeof(Pico.ram))
+  CHUNK(CHUNK_VRAM,  Pico.vram,   sizeof(Pico.vram))
+  CHUNK(CHUNK_ZRAM,  Pico.zram,   sizeof(Pico.zram))
+  CHUNK(CHUNK_CRAM,  Pico.cram,   sizeof(Pico.cram))
+  CHUNK(CHUNK_VSRAM, Pico.vsram,  sizeof(Pico.vsram))
+  CHUNK(CHUNK_MISC,  &Pico.m,     sizeof(Pico.m))
+  CHUNK(CHUNK_VIDEO, &Pico.video, sizeof(Pico.video))
+  if (all || (PicoOpt&7))
+    CHUNK(CHUNK_Z80, cpu_z80,       0x60)
+  if (all || (PicoOpt&3))
+    CHUNK(CHUNK_PSG, sn76496_regs,  28*4)
+  if (all || (PicoOpt&1))
+    CHUNK(CHUNK_FM,  YM2612GetRegs(), 0x200+4)
+  if (!(PicoMCD & 1))
+    CHUNK(CHUNK_ROM_BANK, Pico.rom_bank, sizeof(Pico.rom_bank))
+
+  if (PicoMCD & 1)
+  {
+    CHUNK(CHUNK_S68K,     cpu_s68k,              0x60)
+    CHUNK(CHUNK_PRG_RAM,  Pico_mcd->prg_ram,     sizeof(Pico_mcd->prg_ram))
+    CHUNK(CHUNK_WORD_RAM, Pico_mcd->word_ram2M,  sizeof(Pico_mcd->word_ram2M)) // in 2M format
+    CHUNK(CHUNK_PCM_RAM,  Pico_mcd->pcm_ram,     sizeof(Pico_mcd->pcm_ram))
+    CHUNK(CHUNK_BRAM,     Pico_mcd->bram,        sizeof(Pico_mcd->bram))
+    CHUNK(CHUNK_GA_REGS,  Pico_mcd->s68k_regs,   sizeof(Pico_mcd->s68k_regs)) // GA regs, not CPU regs
+    CHUNK(CHUNK_PCM,      &Pico_mcd->pcm,        sizeof(Pico_mcd->pcm))
+    CHUNK(CHUNK_CDD,      &Pico_mcd->cdd,        sizeof(Pico_mcd->cdd))
+    CHUNK(CHUNK_CDC,      &Pico_mcd->cdc,        sizeof(Pico_mcd->cdc))
+    CHUNK(CHUNK_SCD,      &Pico_mcd->scd,        sizeof(Pico_mcd->scd))
+    CHUNK(CHUNK_RC,       &Pico_mcd->rot_comp,   sizeof(Pico_mcd->rot_comp))
+    CHUNK(CHUNK_MISC_CD,  &Pico_mcd->m,          sizeof(Pico_mcd->m))
+  }
+#undef CHUNK
+
+  return n;
+}
+
+static int state_v2_save(void *file)
+{
+  unsigned char cpu[0x60], cpu_z80[0x60], cpu_s68k[0x60];
+  struct state_chunk c[STATE_V2_MAX_CHUNKS];
+  struct state_v2_dir dir[STATE_V2_MAX_CHUNKS];
+  struct state_v2_head head;
+  unsigned char *zbuf, *p;
+  unsigned int offs;
+  uLongf zlen;
+  int i, n, ret = 1;
+
+  memset(cpu, 0, sizeof(cpu));
+  memset(cpu_z80, 0, sizeof(cpu_z80));
+  memset(cpu_s68k, 0, sizeof(cpu_s68k));
+  PicoAreaPackCpu(cpu, 0);
+  if (PicoOpt&7) z80_pack(cpu_z80);
+  if (PicoMCD & 1) {
+    Pico_mcd->m.audio_offset = mp3_get_offset();
+    PicoAreaPackCpu(cpu_s68k, 1);
+    if (Pico_mcd->s68k_regs[3]&4) // 1M mode?
+      wram_1M_to_2M(Pico_mcd->word_ram2M);
+    Pico_mcd->m.hint_vector = *(unsigned short *)(Pico_mcd->bios + 0x72);
+  }
+
+  n = state_v2_chunks(c, cpu, cpu_z80, cpu_s68k, 0);
+  for (i = 0, zlen = 0; i < n; i++)
+    zlen += compressBound(c[i].len);
+  zbuf = malloc(zlen);
+  if (zbuf == NULL) goto out;
+
+  // everything is compressed first, the directory goes in front
+  offs = sizeof(head) + n * sizeof(dir[0]);
+  for (i = 0, p = zbuf; i < n; i++)
+  {
+    if (PicoStateProgressCB) PicoStateProgressCB(chunk_names[c[i].id]);
+    zlen = compressBound(c[i].len);
+    if (compress2(p, &zlen, c[i].data, c[i].len, Z_BEST_SPEED) != Z_OK || zlen >= c[i].len) {
+      memcpy(p, c[i].data, c[i].len);
+      zlen = c[i].len;
+    }
+    dir[i].id   = c[i].id;
+    dir[i].offs = offs;
+    dir[i].len  = c[i].len;
+    dir[i].clen = zlen;
+    dir[i].crc  = crc32(0, c[i].data, c[i].len);
+    offs += zlen;
+    p += zlen;
+  }
+
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, STATE_V2_MAGIC, 8);
+  head.ver = PicoVer;
+  head.flags = PicoMCD & 1;
+  head.count = n;
+  if (areaWrite(&head, 1, sizeof(head), file) == sizeof(head) &&
+      areaWrite(dir, 1, n * sizeof(dir[0]), file) == n * sizeof(dir[0]) &&
+      areaWrite(zbuf, 1, p - zbuf, file) == p - zbuf)
+    ret = 0;
+  free(zbuf);
+
+out:
+  if ((PicoMCD & 1) && (Pico_mcd->s68k_regs[3]&4)) // convert back
+    wram_2M_to_1M(Pico_mcd->word_ram2M);
+  return ret;
+}
+
+// gfx: only what is needed to draw a frame, nothing else is touched
+static int state_v2_load(void *file, const struct state_v2_head *head, int gfx)
+{
+  unsigned char cpu[0x60], cpu_z80[0x60], cpu_s68k[0x60];
+  struct state_chunk c[STATE_V2_MAX_CHUNKS];
+  struct state_v2_dir dir[STATE_V2_MAX_CHUNKS];
+  struct state_chunk *dst[STATE_V2_MAX_CHUNKS];
+  unsigned char *buf = NULL, *zbuf = NULL, *p;
+  unsigned int i, k, n, pos, total = 0, zmax = 0, loaded = 0;
+  unsigned char sram_reg = Pico.m.sram_reg, rom_bank[8];
+  uLongf len;
+  int ret = 1;
+
+  if (head->count > STATE_V2_MAX_CHUNKS || (head->flags & 1) != (PicoMCD & 1)) {
+    elprintf(EL_STATUS, "state v2: %s", (head->flags & 1) ? "MCD state, but no MCD" : "bad header");
+    return 1;
+  }
+  if (areaRead(dir, 1, head->count * sizeof(dir[0]), file) != head->count * sizeof(dir[0]))
+    return 1;
+  pos = sizeof(*head) + head->count * sizeof(dir[0]);
+
+  n = state_v2_chunks(c, cpu, cpu_z80, cpu_s68k, 1);
+  for (i = 0; i < head->count; i++)
+  {
+    dst[i] = NULL;
+    if (gfx && dir[i].id != CHUNK_VRAM && dir[i].id != CHUNK_CRAM &&
+        dir[i].id != CHUNK_VSRAM && dir[i].id != CHUNK_VIDEO)
+      continue;
+    for (k = 0; k < n; k++)
+      if (c[k].id == dir[i].id) break;
+    if (k == n) {
+      elprintf(EL_STATUS, "state v2: skipping unknown chunk %i of size %i", dir[i].id, dir[i].len);
+      continue;
+    }
+    if (dir[i].len > c[k].len || dir[i].clen > compressBound(dir[i].len)) {
+      elprintf(EL_STATUS, "state v2: bad length %i for chunk %i", dir[i].len, dir[i].id);
+      return 1;
+    }
+    dst[i] = &c[k];
+    total += dir[i].len;
+    if (dir[i].clen > zmax) zmax = dir[i].clen;
+  }
+
+  // everything is inflated and checked before any of it is used
+  buf  = malloc(total);
+  zbuf = malloc(zmax);
+  if (total && (buf == NULL || zbuf == NULL)) goto out;
+
+  for (i = 0, p = buf; i < head->count; i++)
+  {
+    if (dst[i] == NULL) continue;
+    if (dir[i].offs != pos && areaSeek(file, dir[i].offs, SEEK_SET) != 0) goto out;
+    if (areaRead(zbuf, 1, dir[i].clen, file) != dir[i].clen) goto out;
+    pos = dir[i].offs + dir[i].clen;
+
+    len = dir[i].len;
+    if (dir[i].clen == dir[i].len) memcpy(p, zbuf, len);
+    else if (uncompress(p, &len, zbuf, dir[i].clen) != Z_OK || len != dir[i].len) {
+      elprintf(EL_STATUS, "state v2: chunk %i is corrupt", dir[i].id);
+      goto out;
+    }
+    if (crc32(0, p, len) != dir[i].crc) {
+      elprintf(EL_STATUS, "state v2: chunk %i crc mismatch", dir[i].id);
+      goto out;
+    }
+    p += len;
+  }
+
+  memcpy(rom_bank, Pico.rom_bank, sizeof(rom_bank));
+  for (i = 0, p = buf; i < head->count; i++)
+  {
+    if (dst[i] == NULL) continue;
+    memcpy(dst[i]->data, p, dir[i].len); // if it got shorter, the rest is kept
+    p += dir[i].len;
+    loaded |= 1 << dst[i]->id;
+  }
+
+  if (!gfx)
+  {
+    if (!(PicoMCD & 1)) {
+      // states made before the chunk was added have no banks
+      if (!(loaded & (1 << CHUNK_ROM_BANK)))
+        for (i = 0; i < 8; i++) Pico.rom_bank[i] = i;
+      if (sram_reg != Pico.m.sram_reg || memcmp(rom_bank, Pico.rom_bank, sizeof(rom_bank)) != 0)
+        PicoMemRemap();
+    }
+    if (loaded & (1 << CHUNK_M68K)) PicoAreaUnpackCpu(cpu, 0);
+    if (loaded & (1 << CHUNK_Z80))  z80_unpack(cpu_z80);
+    else if (PicoOpt&7) z80_reset();
+    if (loaded & (1 << CHUNK_FM))   YM2612PicoStateLoad(); // reload YM2612 state from it's regs
+    if (PicoMCD & 1) {
+      if (loaded & (1 << CHUNK_S68K)) PicoAreaUnpackCpu(cpu_s68k, 1);
+      PicoCdStateLoaded();
+    }
+  }
+  ret = 0;
+
+out:
+  free(zbuf);
+  free(buf);
+  return ret;
+}
 
 // Save or load the state from PmovFile:
 int PmovState(int PmovAction, void *PmovFile)
 {
-  int minimum=0;
   unsigned char head[32];
 
+  if (PmovAction&1) return state_v2_save(PmovFile);
+  if (!(PmovAction&2)) return 0;
+
+  if (areaRead(head, 1, sizeof(head), PmovFile) != sizeof(head)) return 1;
+  if (memcmp(head, STATE_V2_MAGIC, 8) == 0) {
+    if (state_v2_load(PmovFile, (struct state_v2_head *)head, 0)) return 1;
+  }
+  else if (PicoMCD & 1) {
+    areaSeek(PmovFile, 0, SEEK_SET);
+    if (PicoCdLoadState(PmovFile)) return 1;
+  }
+  else {
+    // old MD state, header is "Pico", 0, PicoVer, minimum version
+    PicoAreaScan(PmovAction, *(unsigned int *)(head+0x8), PmovFile);
+  }
+  PicoTileCacheDirty(0, 0x10000);
+
+  return 0;
+}
+
+int PicoStateLoadGfx(void *file)
+{
+  unsigned char head[32];
+
+  if (areaRead(head, 1, sizeof(head), file) != sizeof(head)) return 1;
+  if (memcmp(head, STATE_V2_MAGIC, 8) == 0) {
+    if (state_v2_load(file, (struct state_v2_head *)head, 1)) return 1;
+  }
+  else if (memcmp(head, "PicoSMCD", 8) == 0) {
+    areaSeek(file, 0, SEEK_SET);
+    return PicoCdLoadStateGfx(file);
+  }
+  else {
+    areaSeek(file, 0x10020, SEEK_SET);  // skip header and RAM in state file
+    areaRead(Pico.vram, 1, sizeof(Pico.vram), file);
+    areaSeek(file, 0x2000, SEEK_CUR);
+    areaRead(Pico.cram, 1, sizeof(Pico.cram), file);
+    areaRead(Pico.vsram, 1, sizeof(Pico.vsram), file);
+    areaSeek(file, 0x221a0, SEEK_SET);
+    areaRead(&Pico.video, 1, sizeof(Pico.video), file);
+  }
+  PicoTileCacheDirty(0, 0x10000);
+
+  return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// Emulator snapshots
+
+// This is not a reentrant context: the emulator is still one instance living
+// in globals and module statics, and two of them can't run at the same time.
+// A context is only a copy of the whole emulator (ROM pointer, settings, CPU
+// and chip state) which can be put back later, e.g. to keep a second game
+// around. Pointers to Pico.ram, zram and cpu contexts stay valid across a load.
+// Any new global or module static that lives across frames must be added to
+// ctx_vars or to a module table in ctx_tables.
+// Not saved: frontend callbacks (PicoMessage, area*), PsndRate (sound
+// tables are shared, so all snapshots must use the same rate), mp3 player
+// and MCD read-ahead buffer (PicoCDBuffers).
+
+extern unsigned int lastSSRamWrite;
+extern unsigned int s68k_poll_adclk, s68k_poll_cnt;
+extern int CD_Present;
+
+struct PicoContext
+{
+  int size;
+  unsigned char data[0];
+};
+
+static struct PicoArea ctx_vars[] =
+{
+  CTX_VAR(Pico),
+  CTX_VAR(SRam),
+  CTX_VAR(PicoMCD),
+  CTX_VAR(PicoOpt),
+  CTX_VAR(PicoSkipFrame),
+  CTX_VAR(PicoRegionOverride),
+  CTX_VAR(PicoAutoRgnOrder),
+  CTX_VAR(PicoPad),
+  CTX_VAR(emustatus),
+  CTX_VAR(z80startCycle),
+  CTX_VAR(z80stopCycle),
+  CTX_VAR(lastSSRamWrite),
+  CTX_VAR(SekCycleCnt),
+  CTX_VAR(SekCycleAim),
+  CTX_VAR(SekCycleCntT),
+  CTX_VAR(SekCycleCntS68k),
+  CTX_VAR(SekCycleAimS68k),
+  CTX_VAR(s68k_poll_adclk),
+  CTX_VAR(s68k_poll_cnt),
+  CTX_VAR(CD_Present),
+  CTX_VAR(PicoDrawLogCur),
+#ifdef EVENT_SCHED
+  CTX_VAR(PicoLineSync),
+#endif
+#ifdef Z80_LAZY
+  CTX_VAR(PicoZ80Sync),
+#endif
+#ifdef S68K_THREAD
+  CTX_VAR(s68k_thread_reset),
+#endif
+#ifdef EMU_C68K
+  CTX_VAR(PicoCpuCM68k),
+  CTX_VAR(PicoCpuCS68k),
+#endif
+#ifdef EMU_M68K
+  CTX_VAR(PicoCpuMM68k),
+  CTX_VAR(PicoCpuMS68k),
+#endif
+#ifdef EMU_F68K
+  CTX_VAR(PicoCpuFM68k),
+  CTX_VAR(PicoCpuFS68k),
+#endif
+#ifdef _USE_DRZ80
+  CTX_VAR(drZ80),
+#endif
+#ifdef _USE_CZ80
+  CTX_VAR(CZ80),
+#endif
+  CTX_VAR(PsndLen),
+  CTX_VAR(PsndLen_exc_add),
+  CTX_VAR(PsndLen_exc_cnt),
+  CTX_VAR(PsndOut),
+  CTX_VAR(PicoWriteSound),
+  CTX_VAR(PicoScan),
+  CTX_VAR(DrawLineDest),
+  CTX_VAR(rendstatus),
+  CTX_VAR(PicoPatches),
+  CTX_VAR(PicoPatchCount),
+  { NULL }
+};
+
+static struct PicoArea *ctx_tables[] =
+{
+  ctx_vars,
+  PicoFrameCtxVars,
+  PicoFrameCtxVarsCD,
+  PsndCtxVars,
+  SekCtxVars,
+};
+
+#define CTX_SN76496_SIZE (28*4) // same thing as in savestates
+#define CTX_Z80_SIZE     0x60   // only used for mz80, which has no global context
+
+
+// copy all ctx_tables vars to (save) or from buf, returns bytes used
+static int PicoContextVars(unsigned char *buf, int save)
+{
+  struct PicoArea *v;
+  int t, size = 0;
+
+  for (t = 0; t < sizeof(ctx_tables)/sizeof(ctx_tables[0]); t++)
+    for (v = ctx_tables[t]; v->data != NULL; v++) {
+      if (buf != NULL) {
+        if (save) memcpy(buf + size, v->data, v->len);
+        else      memcpy(v->data, buf + size, v->len);
+      }
+      size += v->len;
+    }
+  return size;
+}
+
+struct PicoContext *PicoContextNew(void)
+{
+  int size = PicoContextVars(NULL, 0) + CTX_SN76496_SIZE + CTX_Z80_SIZE + YM2612ContextSize();
+  struct PicoContext *ctx;
+
+  ctx = calloc(1, sizeof(*ctx) + size);
+  if (ctx == NULL) return NULL;
+  ctx->size = size;
+  return ctx;
+}
+
+void PicoContextFree(struct PicoContext *ctx)
+{
+  free(ctx);
+}
+
+void PicoContextSave(struct PicoContext *ctx)
+{
+  unsigned char *p = ctx->data;
+
+  p += PicoContextVars(p, 1);
+  if (sn76496_regs) memcpy(p, sn76496_regs, CTX_SN76496_SIZE);
+  p += CTX_SN76496_SIZE;
+#if !defined(_USE_DRZ80) && !defined(_USE_CZ80)
+  z80_pack(p);
+#endif
+  p += CTX_Z80_SIZE;
+  YM2612ContextSave(p);
+}
+
+// ctx must have been saved before
+void PicoContextLoad(struct PicoContext *ctx)
+{
+  unsigned char *p = ctx->data;
+
+  p += PicoContextVars(p, 0);
+  if (sn76496_regs) memcpy(sn76496_regs, p, CTX_SN76496_SIZE);
+  p += CTX_SN76496_SIZE;
+#if !defined(_USE_DRZ80) && !defined(_USE_CZ80)
+  z80_unpack(p);
+#endif
+  p += CTX_Z80_SIZE;
+  YM2612ContextLoad(p);
+#ifdef YM2612_THREAD
+  if (PicoOpt & 0x200) {
+    YM2612PicoStateLoad(); // feeds regs to the worker's chip, but also resets ours..
+    YM2612ContextLoad(p);  // ..so put it back
+  }
+#endif
+
+  // rebuild stuff derived from the loaded state
+  PicoMemRemap();
+#ifdef CZ80_DRC
+  cz80_drc_flush();
+#endif
+  dac_recalculate();
+  Pico.m.dirtyPal = 1;
+  PicoTileCacheDirty(0, 0x10000);
+}
+
+
+// ---------------------------------------------------------------------------
+// In-memory states
+
+// For rewind, run-ahead and such: the machine is copied to/from a buffer as it
+// is, CPU and chip contexts included, so unlike PmovState() the result is only
+// good for the same game in the same process (contexts hold host pointers).
+// Load only rebuilds what the copy really changed (translated code, tile cache,
+// memory map), this keeps both directions down to a few memcpy()s.
+
+struct PicoStateHead
+{
+  char magic[8];        // "PicoSMEM"
+  int ver;              // PicoVer
+  unsigned int size;    // whole state, PicoStateSize()
+  unsigned int romsize; // quick check that it's still the same game
+  int pad;
+};
+
+static struct PicoArea state_vars[] =
+{
+  CTX_VAR(Pico),        // must be first, rom and romsize are not restored
+  CTX_VAR(emustatus),
+  CTX_VAR(z80startCycle),
+  CTX_VAR(z80stopCycle),
+  CTX_VAR(lastSSRamWrite),
+  CTX_VAR(SekCycleCnt),
+  CTX_VAR(SekCycleAim),
+  CTX_VAR(SekCycleCntT),
+  CTX_VAR(SekCycleCntS68k),
+  CTX_VAR(SekCycleAimS68k),
+  CTX_VAR(s68k_poll_adclk),
+  CTX_VAR(s68k_poll_cnt),
+  CTX_VAR(PsndLen_exc_cnt),
+#ifdef EMU_C68K
+  CTX_VAR(PicoCpuCM68k),
+  CTX_VAR(PicoCpuCS68k),
+#endif
+#ifdef EMU_M68K
+  CTX_VAR(PicoCpuMM68k),
+  CTX_VAR(PicoCpuMS68k),
+#endif
+#ifdef EMU_F68K
+  CTX_VAR(PicoCpuFM68k),
+  CTX_VAR(PicoCpuFS68k),
+#endif
+#ifdef _USE_DRZ80
+  CTX_VAR(drZ80),
+#endif
+#ifdef _USE_CZ80
+  CTX_VAR(CZ80),
+#endif
+};
+
+// MCD: prg_ram..pcm and cdd..rot_comp, bios and TOC (FILE pointers) stay
+#define MCD_STATE1_OFFS offsetof(mcd_state, prg_ram)
+#define MCD_STATE1_SIZE (offsetof(mcd_state, TOC) - MCD_STATE1_OFFS)
+#define MCD_STATE2_OFFS offsetof(mcd_state, cdd)
+#define MCD_STATE2_SIZE (sizeof(mcd_state) - MCD_STATE2_OFFS)
+
+size_t PicoStateSize(void)
+{
+  size_t size = sizeof(struct PicoStateHead) + CTX_SN76496_SIZE + CTX_Z80_SIZE + YM2612ContextSize();
+  int i;
+
+  for (i = 0; i < sizeof(state_vars)/sizeof(state_vars[0]); i++)
+    size += state_vars[i].len;
   if (PicoMCD & 1)
+    size += MCD_STATE1_SIZE + MCD_STATE2_SIZE;
+  return size;
+}
+
+int PicoStateSave(void *buf, size_t len)
+{
+  unsigned char *p = buf;
+  struct PicoStateHead head;
+  int i;
+
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, "PicoSMEM", 8);
+  head.ver = PicoVer;
+  head.size = PicoStateSize();
+  head.romsize = Pico.romsize;
+  if (len < head.size) return -1;
+
+  memcpy(p, &head, sizeof(head));
+  p += sizeof(head);
+
+  if (PicoMCD & 1) {
+    Pico_mcd->m.audio_offset = mp3_get_offset();
+    Pico_mcd->m.hint_vector = *(unsigned short *)(Pico_mcd->bios + 0x72);
+  }
+
+  for (i = 0; i < sizeof(state_vars)/sizeof(state_vars[0]); i++) {
+    memcpy(p, state_vars[i].data, state_vars[i].len);
+    p += state_vars[i].len;
+  }
+
+  if (sn76496_regs) memcpy(p, sn76496_regs, CTX_SN76496_SIZE);
+  p += CTX_SN76496_SIZE;
+#if !defined(_USE_DRZ80) && !defined(_USE_CZ80)
+  z80_pack(p);
+#endif
+  p += CTX_Z80_SIZE;
+  YM2612ContextSave(p);
+  p += YM2612ContextSize();
+
+  if (PicoMCD & 1) {
+    memcpy(p, (unsigned char *)Pico_mcd + MCD_STATE1_OFFS, MCD_STATE1_SIZE);
+    p += MCD_STATE1_SIZE;
+    memcpy(p, (unsigned char *)Pico_mcd + MCD_STATE2_OFFS, MCD_STATE2_SIZE);
+  }
+
+  return 0;
+}
+
+// drop translated code and decoded tiles of whatever the state to be loaded changes
+static void PicoStateInvalidate(const struct Pico *s)
+{
+#ifdef FAMEC_DRC
+  {
+    int a;
+    for (a = 0; a < 0x100; a++)
+      if (fm68k_drc_ram_code[a] && memcmp(Pico.ram + (a<<8), s->ram + (a<<8), 0x100))
+        fm68k_drc_invalidate(a<<8, 0x100);
+  }
+#endif
+#ifdef CZ80_DRC
+  {
+    int a;
+    for (a = 0; a < 0x2000; a++)
+      if (cz80_drc_code[a] && Pico.zram[a] != s->zram[a])
+        cz80_drc_invalidate(a);
+  }
+#endif
+#if defined(DRAW_TILE_CACHE) || defined(DRAW2_DIRTY)
   {
-    if (PmovAction&1) return PicoCdSaveState(PmovFile);
-    if (PmovAction&2) return PicoCdLoadState(PmovFile);
+    int a, b;
+    // in 32 byte (tile) blocks, runs of them at once
+    for (a = 0; a < 0x10000; a = b + 0x20) {
+      for (; a < 0x10000; a += 0x20)
+        if (memcmp((char *)Pico.vram + a, (char *)s->vram + a, 0x20)) break;
+      for (b = a; b < 0x10000; b += 0x20)
+        if (!memcmp((char *)Pico.vram + b, (char *)s->vram + b, 0x20)) break;
+      if (b > a) PicoTileCacheDirty(a, b - a);
+    }
   }
+#endif
+}
 
-  memset(head,0,sizeof(head));
+int PicoStateLoad(const void *buf, size_t len)
+{
+  const unsigned char *p = buf;
+  const struct Pico *s;
+  struct PicoStateHead head;
+  unsigned char *rom;
+  unsigned int romsize;
+  int remap, pal, dirty_pal, audio_track = 0, i;
+
+  if (len < sizeof(head)) return -1;
+  memcpy(&head, p, sizeof(head));
+  if (memcmp(head.magic, "PicoSMEM", 8) != 0 || head.ver != PicoVer ||
+      head.size != PicoStateSize() || head.size > len || head.romsize != Pico.romsize) {
+    elprintf(EL_STATUS, "PicoStateLoad: state is not for this game/build");
+    return -1;
+  }
+  p += sizeof(head);
+
+  // see what needs rebuilding before it's overwritten (Pico is the first thing there)
+  s = (const struct Pico *)p;
+  PicoStateInvalidate(s);
+  remap = !(PicoMCD & 1) && (s->m.sram_reg != Pico.m.sram_reg ||
+    memcmp(s->rom_bank, Pico.rom_bank, sizeof(Pico.rom_bank)) != 0);
+  pal = s->m.pal != Pico.m.pal;
+  dirty_pal = memcmp(s->cram, Pico.cram, sizeof(Pico.cram)) != 0;
+  if (PicoMCD & 1) audio_track = Pico_mcd->m.audio_track;
+
+  rom = Pico.rom;
+  romsize = Pico.romsize;
+  for (i = 0; i < sizeof(state_vars)/sizeof(state_vars[0]); i++) {
+    memcpy(state_vars[i].data, p, state_vars[i].len);
+    p += state_vars[i].len;
+  }
+  Pico.rom = rom;
+  Pico.romsize = romsize;
 
-  // Find out minimal compatible version:
-  //PicoAreaScan(PmovAction&0xc,&minimum);
-  minimum = 0x0021;
+  if (sn76496_regs) memcpy(sn76496_regs, p, CTX_SN76496_SIZE);
+  p += CTX_SN76496_SIZE;
+#if !defined(_USE_DRZ80) && !defined(_USE_CZ80)
+  z80_unpack(p);
+#endif
+  p += CTX_Z80_SIZE;
+  YM2612ContextLoad(p);
+#ifdef YM2612_THREAD
+  if (PicoOpt & 0x200) {
+    YM2612PicoStateLoad(); // feeds regs to the worker's chip, but also resets ours..
+    YM2612ContextLoad(p);  // ..so put it back
+  }
+#endif
+  p += YM2612ContextSize();
 
-  memcpy(head,"Pico",4);
-  *(unsigned int *)(head+0x8)=PicoVer;
-  *(unsigned int *)(head+0xc)=minimum;
+  if (PicoMCD & 1) {
+    memcpy((unsigned char *)Pico_mcd + MCD_STATE1_OFFS, p, MCD_STATE1_SIZE);
+    p += MCD_STATE1_SIZE;
+    memcpy((unsigned char *)Pico_mcd + MCD_STATE2_OFFS, p, MCD_STATE2_SIZE);
 
-  // Scan header:
-  if (PmovAction&1) areaWrite(head,1,sizeof(head),PmovFile);
-  if (PmovAction&2) areaRead (head,1,sizeof(head),PmovFile);
+    PicoMemResetCD(Pico_mcd->s68k_regs[3]);
+#ifdef _ASM_CD_MEMORY_C
+    if (Pico_mcd->s68k_regs[3]&4)
+      PicoMemResetCDdecode(Pico_mcd->s68k_regs[3]);
+#endif
+    *(unsigned short *)(Pico_mcd->bios + 0x72) = Pico_mcd->m.hint_vector;
+    // CDDA keeps playing unless it's a different track now
+    if (Pico_mcd->m.audio_track != audio_track &&
+        Pico_mcd->m.audio_track > 0 && Pico_mcd->m.audio_track < Pico_mcd->TOC.Last_Track)
+      mp3_start_play(Pico_mcd->TOC.Tracks[Pico_mcd->m.audio_track].F, Pico_mcd->m.audio_offset);
+  }
 
-  // Scan memory areas:
-  PicoAreaScan(PmovAction, *(unsigned int *)(head+0x8), PmovFile);
+  if (remap) PicoMemRemap();
+  if (pal) dac_recalculate();
+  if (dirty_pal) Pico.m.dirtyPal = 1;
 
   return 0;
 }
-
@@ -1,5 +1,223 @@
 #include "PicoInt.h"
 
+#ifdef FAMEC_DRC_COMPARE
+// Compare mode for the FAME x86-64 translator: every 68k run is done with
+// translated code while memory accesses are recorded, then plain famec redoes
+// it from a copy of the starting context, fed with the recorded read data
+// (and whatever the handlers did to the cycle counter and interrupt level).
+// Both must end in the same state, having done the same accesses.
+
+#define ACC_MAX 0x40000
+
+struct cmp_access {
+  unsigned int a, d;
+  int size;       // 1, 2, 4, +8 for writes
+  int cyc;        // cycles left when the access was done
+  int cyc_after;  // ..and after the handler (SekEndRun)
+  int irq_after;
+  int fetch;      // fetch map the write switched to, or -1
+};
+
+static struct cmp_access *acc;
+static int acc_cnt, acc_pos, acc_err, runs;
+static M68K_CONTEXT cmp_ctx;     // famec runs this one
+static M68K_CONTEXT real_ctx;    // real handlers
+static unsigned char ram_start[0x10000];
+static unsigned int fetch_maps[16][M68K_FETCHBANK1]; // after bank switches
+static int fetch_cnt;
+
+#undef dprintf
+#define dprintf(f,...) printf("%05i:%03i: " f "\n",Pico.m.frame_count,Pico.m.scanline,##__VA_ARGS__)
+
+static struct cmp_access *rec_add(unsigned int a, int size)
+{
+  struct cmp_access *p = &acc[acc_cnt < ACC_MAX ? acc_cnt : ACC_MAX-1];
+  acc_cnt++;
+  p->a = a; p->d = 0; p->size = size;
+  p->cyc = PicoCpuFM68k.io_cycle_counter;
+  p->fetch = -1;
+  return p;
+}
+
+static void rec_done(struct cmp_access *p)
+{
+  p->cyc_after = PicoCpuFM68k.io_cycle_counter;
+  p->irq_after = PicoCpuFM68k.interrupts[0];
+}
+
+static unsigned int rec_read8(unsigned int a)
+{
+  struct cmp_access *p = rec_add(a, 1);
+  p->d = real_ctx.read_byte(a); rec_done(p);
+  return p->d;
+}
+
+static unsigned int rec_read16(unsigned int a)
+{
+  struct cmp_access *p = rec_add(a, 2);
+  p->d = real_ctx.read_word(a); rec_done(p);
+  return p->d;
+}
+
+static unsigned int rec_read32(unsigned int a)
+{
+  struct cmp_access *p = rec_add(a, 4);
+  p->d = real_ctx.read_long(a); rec_done(p);
+  return p->d;
+}
+
+static void rec_write(unsigned int a, unsigned int d, int size)
+{
+  struct cmp_access *p = rec_add(a, 8+size);
+  unsigned int *fetch = fetch_cnt ? fetch_maps[fetch_cnt-1] : cmp_ctx.Fetch;
+  p->d = d;
+  if      (size == 1) real_ctx.write_byte(a, d);
+  else if (size == 2) real_ctx.write_word(a, d);
+  else                real_ctx.write_long(a, d);
+  rec_done(p);
+  // mapper writes change what famec has to fetch code from
+  if ((a&0xe00000) != 0xe00000 && memcmp(fetch, PicoCpuFM68k.Fetch, sizeof(fetch_maps[0]))) {
+    if (fetch_cnt < 16) memcpy(fetch_maps[fetch_cnt], PicoCpuFM68k.Fetch, sizeof(fetch_maps[0]));
+    p->fetch = fetch_cnt++;
+  }
+}
+
+static void rec_write8 (unsigned int a, unsigned char  d) { rec_write(a, d, 1); }
+static void rec_write16(unsigned int a, unsigned short d) { rec_write(a, d, 2); }
+static void rec_write32(unsigned int a, unsigned int   d) { rec_write(a, d, 4); }
+
+static struct cmp_access *rep_next(unsigned int a, int size)
+{
+  struct cmp_access *p;
+  if (acc_pos >= acc_cnt) {
+    if (!acc_err) dprintf("access %i: extra %s%i %06x", acc_pos, size&8 ? "w" : "r", (size&7)*8, a&0xffffff);
+    acc_err = 1;
+    return NULL;
+  }
+  p = &acc[acc_pos];
+  if (p->a != a || p->size != size || p->cyc != cmp_ctx.io_cycle_counter) {
+    if (!acc_err)
+      dprintf("access %i: %s%i %06x @%i vs %s%i %06x @%i", acc_pos, p->size&8 ? "w" : "r", (p->size&7)*8,
+        p->a&0xffffff, p->cyc, size&8 ? "w" : "r", (size&7)*8, a&0xffffff, cmp_ctx.io_cycle_counter);
+    acc_err = 1;
+  }
+  acc_pos++;
+  cmp_ctx.io_cycle_counter += p->cyc_after - p->cyc;
+  cmp_ctx.interrupts[0] = p->irq_after;
+  return p;
+}
+
+static unsigned int rep_read(unsigned int a, int size)
+{
+  struct cmp_access *p = rep_next(a, size);
+  return p ? p->d : 0;
+}
+
+static unsigned int rep_read8 (unsigned int a) { return rep_read(a, 1); }
+static unsigned int rep_read16(unsigned int a) { return rep_read(a, 2); }
+static unsigned int rep_read32(unsigned int a) { return rep_read(a, 4); }
+
+static void rep_write(unsigned int a, unsigned int d, int size)
+{
+  struct cmp_access *p = rep_next(a, 8+size);
+  if (p != NULL && p->d != d) {
+    if (!acc_err) dprintf("access %i: w%i %06x: %08x vs %08x", acc_pos-1, size*8, a&0xffffff, p->d, d);
+    acc_err = 1;
+  }
+  if (p != NULL && p->fetch >= 0)
+    memcpy(cmp_ctx.Fetch, fetch_maps[p->fetch], sizeof(fetch_maps[0]));
+  // famec fetches code from RAM directly, so it needs the writes there
+  if ((a&0xe00000) == 0xe00000) {
+    a &= 0xffff;
+    if      (size == 1) Pico.ram[a^1] = d;
+    else if (size == 2) *(unsigned short *)(Pico.ram+(a&~1)) = d;
+    else {
+      *(unsigned short *)(Pico.ram+(a&~1)) = d>>16;
+      *(unsigned short *)(Pico.ram+((a+2)&0xfffe)) = d;
+    }
+  }
+}
+
+static void rep_write8 (unsigned int a, unsigned char  d) { rep_write(a, d, 1); }
+static void rep_write16(unsigned int a, unsigned short d) { rep_write(a, d, 2); }
+static void rep_write32(unsigned int a, unsigned int   d) { rep_write(a, d, 4); }
+
+static void dump_ctx(const char *name, M68K_CONTEXT *c, int cyc)
+{
+  int i;
+  dprintf("%s: pc %06x sr %04x asp %08x execinfo %04x cycles %i", name, c->pc, c->sr, c->asp, c->execinfo, cyc);
+  for (i = 0; i < 8; i++)
+    dprintf("  d%i=%08x a%i=%08x", i, c->dreg[i].D, i, c->areg[i].D);
+}
+
+int CM_compareRun(int cyc, int is_sub)
+{
+  M68K_CONTEXT *ctx = &PicoCpuFM68k, *drc_ctx = fm68k_drc_ctx;
+  static unsigned char ram_end[0x10000];
+  int cyc_drc, cyc_famec, err = 0;
+
+  if (acc == NULL) {
+    acc = malloc(ACC_MAX * sizeof(acc[0]));
+    if (acc == NULL) return fm68k_emulate(cyc, 0);
+  }
+
+  // translated run with recording handlers
+  memcpy(ram_start, Pico.ram, sizeof(ram_start));
+  cmp_ctx = *ctx;
+  real_ctx = *ctx;
+  ctx->read_byte  = rec_read8;  ctx->read_word  = rec_read16;  ctx->read_long  = rec_read32;
+  ctx->write_byte = rec_write8; ctx->write_word = rec_write16; ctx->write_long = rec_write32;
+  acc_cnt = fetch_cnt = 0;
+  g_m68kcontext = ctx;
+  cyc_drc = fm68k_emulate(cyc, 0);
+  ctx->read_byte  = real_ctx.read_byte;  ctx->read_word  = real_ctx.read_word;  ctx->read_long  = real_ctx.read_long;
+  ctx->write_byte = real_ctx.write_byte; ctx->write_word = real_ctx.write_word; ctx->write_long = real_ctx.write_long;
+  runs++;
+
+  if (acc_cnt > ACC_MAX || fetch_cnt > 16) {
+    dprintf("run %i: too many accesses (%i) or bank switches, not compared", runs, acc_cnt);
+    return cyc_drc;
+  }
+
+  // famec, replaying it
+  memcpy(ram_end, Pico.ram, sizeof(ram_end));
+  memcpy(Pico.ram, ram_start, sizeof(ram_start));
+  cmp_ctx.read_byte  = rep_read8;  cmp_ctx.read_word  = rep_read16;  cmp_ctx.read_long  = rep_read32;
+  cmp_ctx.write_byte = rep_write8; cmp_ctx.write_word = rep_write16; cmp_ctx.write_long = rep_write32;
+  cmp_ctx.iack_handler = NULL;
+  acc_pos = acc_err = 0;
+  fm68k_drc_ctx = NULL;
+  g_m68kcontext = &cmp_ctx;
+  cyc_famec = fm68k_emulate(cyc, 0);
+  g_m68kcontext = ctx;
+  fm68k_drc_ctx = drc_ctx;
+
+  if (acc_err || acc_pos != acc_cnt) {
+    if (!acc_err) dprintf("accesses: %i vs %i", acc_cnt, acc_pos);
+    err = 1;
+  }
+  if (cyc_drc != cyc_famec || memcmp(ctx->dreg, cmp_ctx.dreg, sizeof(ctx->dreg) + sizeof(ctx->areg))
+      || ctx->pc != cmp_ctx.pc || ctx->sr != cmp_ctx.sr || ctx->asp != cmp_ctx.asp
+      || ctx->execinfo != cmp_ctx.execinfo)
+    err = 1;
+  if (memcmp(Pico.ram, ram_end, sizeof(ram_end))) {
+    dprintf("RAM differs");
+    err = 1;
+  }
+  memcpy(Pico.ram, ram_end, sizeof(ram_end));
+
+  if (err) {
+    dprintf("run %i mismatch, started at %06x", runs, real_ctx.pc);
+    dump_ctx("drc  ", ctx, cyc_drc);
+    dump_ctx("famec", &cmp_ctx, cyc_famec);
+    exit(1);
+  }
+
+  return cyc_drc;
+}
+
+#else
+
 // note: set SPLIT_MOVEL_PD to 0
 
 typedef unsigned char  u8;
@@ -31,7 +249,7 @@ int dbg_irq_level = 0, dbg_irq_level_sub = 0;
 #define other_is_stopped() ((g_m68kcontext->execinfo&FM68K_HALTED)?1:0)
 #define other_is_tracing() ((g_m68kcontext->execinfo&FM68K_EMULATE_TRACE)?1:0)
 #else
-#error other core missing, don't compile this file
+#error other core missing, do not compile this file
 #endif
 
 static int otherRun(void)
@@ -216,3 +434,5 @@ int CM_compareRun(int cyc, int is_sub)
 
   return cyc_done;
 }
+
+#endif // FAMEC_DRC_COMPARE
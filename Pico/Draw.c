@@ -31,6 +31,93 @@ char HighSprZ[320+8+8]; // Z-buffer for accurate sprites and shadow/hilight mode
 int rendstatus;
 int Scanline=0; // Scanline
 
+// VDP state to draw from, a recorded snapshot when replaying a PicoDrawLog
+static struct Pico *DrawSrc=&Pico;
+
+#ifdef DRAW_TILE_CACHE
+// Decoded tile cache: every 8x8 tile as 64 bytes of pixels (0-15), decoded from
+// DrawSrc->vram on first use. VDP writes drop the tiles they touch (see
+// PicoTileCacheDirty), H-flipped rows are just byteswapped.
+static unsigned long long TileCache[0x800][8];
+static unsigned char TileCacheOk[0x800];
+// tiles written while drawing is pipelined and no log is open, go with the next log
+static unsigned char TileCachePending[0x800];
+static int TileCachePendingAny = 0;
+
+static void TileCacheFill(int tile)
+{
+  unsigned int *ps = (unsigned int *)(DrawSrc->vram + (tile<<4)), pack;
+  unsigned char *pd = (unsigned char *)TileCache[tile];
+  int i;
+
+  for (i = 8; i; i--, pd += 8) {
+    pack = *ps++;
+    pd[0] = (pack>>12)&0xf; pd[1] = (pack>> 8)&0xf; pd[2] = (pack>> 4)&0xf; pd[3] = pack&0xf;
+    pd[4] = (pack>>28);     pd[5] = (pack>>24)&0xf; pd[6] = (pack>>20)&0xf; pd[7] = (pack>>16)&0xf;
+  }
+  TileCacheOk[tile] = 1;
+}
+
+// row of pixels for VRAM word address addr
+static __inline unsigned long long TileCacheRow(int addr)
+{
+  int tile = addr >> 4;
+  if (!TileCacheOk[tile]) TileCacheFill(tile);
+  return TileCache[tile][(addr>>1)&7];
+}
+
+PICO_INTERNAL unsigned char *PicoTileCacheGet(int tile)
+{
+  tile &= 0x7ff;
+  if (!TileCacheOk[tile]) TileCacheFill(tile);
+  return (unsigned char *)TileCache[tile];
+}
+
+// drop the pending tiles (drawing is not pipelined any more)
+PICO_INTERNAL void PicoTileCacheSync(void)
+{
+  int i;
+
+  if (!TileCachePendingAny) return;
+  for (i = 0; i < 0x800; i++)
+    if (TileCachePending[i]) { TileCacheOk[i] = 0; TileCachePending[i] = 0; }
+  TileCachePendingAny = 0;
+}
+
+// decode all the tiles now, so that they can be drawn from several threads
+PICO_INTERNAL void PicoTileCacheFillAll(void)
+{
+  int i;
+
+  for (i = 0; i < 0x800; i++)
+    if (!TileCacheOk[i]) TileCacheFill(i);
+}
+#endif
+
+#if defined(DRAW_TILE_CACHE) || defined(DRAW2_DIRTY)
+// VRAM bytes a..a+len-1 were written
+PICO_INTERNAL void PicoTileCacheDirty(unsigned int a, int len)
+{
+#ifdef DRAW_TILE_CACHE
+  int t = (a >> 5) & 0x7ff, n = ((a & 0x1f) + len + 0x1f) >> 5;
+#endif
+
+#ifdef DRAW2_DIRTY
+  PicoDraw2VramDirty(a, len);
+#endif
+#ifdef DRAW_TILE_CACHE
+  if (PicoDrawLogCur != NULL) return; // logged, replay will drop them
+  if (n > 0x800) n = 0x800;
+  if (PicoDrawLogGet == NULL) {
+    for (; n > 0; n--, t = (t+1) & 0x7ff) TileCacheOk[t] = 0;
+  } else {
+    for (; n > 0; n--, t = (t+1) & 0x7ff) TileCachePending[t] = 1;
+    TileCachePendingAny = 1;
+  }
+#endif
+}
+#endif
+
 static int SpriteBlocks;
 //unsigned short ppt[] = { 0x0f11, 0x0ff1, 0x01f1, 0x011f, 0x01ff, 0x0f1f, 0x0f0e, 0x0e7c };
 
@@ -65,27 +152,237 @@ void blockcpy_or(void *dst, void *src, size_t n, int pat)
 }
 #endif
 
+// line conversion loops, PicoDrawSimdInit() may replace these
+#ifdef PSP
+extern void amips_clut(unsigned short *dst, unsigned char *src, unsigned short *pal, int count);
+#else
+static void DrawClutC(unsigned short *pd, unsigned char *ps, unsigned short *pal, int len)
+{
+  int i;
+  for (i = 0; i < len; i++)
+    pd[i] = pal[ps[i]];
+}
+#endif
+
+static void DrawClut32C(unsigned int *pd, unsigned char *ps, unsigned int *pal, int len)
+{
+  int i;
+  for (i = 0; i < len; i++)
+    pd[i] = pal[ps[i]];
+}
+
+#ifdef PSP
+void (*DrawClut)(unsigned short *pd, unsigned char *ps, unsigned short *pal, int len) = amips_clut;
+#else
+void (*DrawClut)(unsigned short *pd, unsigned char *ps, unsigned short *pal, int len) = DrawClutC;
+#endif
+void (*DrawClut32)(unsigned int *pd, unsigned char *ps, unsigned int *pal, int len) = DrawClut32C;
+void (*DrawCpyOr)(void *dst, void *src, size_t n, int pat) = blockcpy_or;
+
+
+// tile row decoders: 8 pixels from a 4bpp VRAM long to pd, 0 is transparent.
+// Z versions also check/update the sprite z-buffer and return collision flag.
+#if !(defined(_ASM_DRAW_C_AMIPS) || defined(DRAW_TILE_CACHE)) || defined(DRAW_SIMD)
+static void TileRowNorm(unsigned char *pd, unsigned int pack, int pal)
+{
+  unsigned int t;
+
+  t=pack&0x0000f000; if (t) pd[0]=(unsigned char)(pal|(t>>12));
+  t=pack&0x00000f00; if (t) pd[1]=(unsigned char)(pal|(t>> 8));
+  t=pack&0x000000f0; if (t) pd[2]=(unsigned char)(pal|(t>> 4));
+  t=pack&0x0000000f; if (t) pd[3]=(unsigned char)(pal|(t    ));
+  t=pack&0xf0000000; if (t) pd[4]=(unsigned char)(pal|(t>>28));
+  t=pack&0x0f000000; if (t) pd[5]=(unsigned char)(pal|(t>>24));
+  t=pack&0x00f00000; if (t) pd[6]=(unsigned char)(pal|(t>>20));
+  t=pack&0x000f0000; if (t) pd[7]=(unsigned char)(pal|(t>>16));
+}
+
+static void TileRowFlip(unsigned char *pd, unsigned int pack, int pal)
+{
+  unsigned int t;
+
+  t=pack&0x000f0000; if (t) pd[0]=(unsigned char)(pal|(t>>16));
+  t=pack&0x00f00000; if (t) pd[1]=(unsigned char)(pal|(t>>20));
+  t=pack&0x0f000000; if (t) pd[2]=(unsigned char)(pal|(t>>24));
+  t=pack&0xf0000000; if (t) pd[3]=(unsigned char)(pal|(t>>28));
+  t=pack&0x0000000f; if (t) pd[4]=(unsigned char)(pal|(t    ));
+  t=pack&0x000000f0; if (t) pd[5]=(unsigned char)(pal|(t>> 4));
+  t=pack&0x00000f00; if (t) pd[6]=(unsigned char)(pal|(t>> 8));
+  t=pack&0x0000f000; if (t) pd[7]=(unsigned char)(pal|(t>>12));
+}
+#endif
+
+// tile renderers for hacky operator sprite support
+#define sh_pix(x) \
+  if(!t); \
+  else if(t==0xe) pd[x]=(unsigned char)((pd[x]&0x3f)|0x80); /* hilight */ \
+  else if(t==0xf) pd[x]=(unsigned char)((pd[x]&0x3f)|0xc0); /* shadow  */ \
+  else pd[x]=(unsigned char)(pal|t)
+
+#if !defined(_ASM_DRAW_C) || defined(DRAW_SIMD)
+static void TileRowNormSH(unsigned char *pd, unsigned int pack, int pal)
+{
+  unsigned int t;
+
+  t=(pack&0x0000f000)>>12; sh_pix(0);
+  t=(pack&0x00000f00)>> 8; sh_pix(1);
+  t=(pack&0x000000f0)>> 4; sh_pix(2);
+  t=(pack&0x0000000f)    ; sh_pix(3);
+  t=(pack&0xf0000000)>>28; sh_pix(4);
+  t=(pack&0x0f000000)>>24; sh_pix(5);
+  t=(pack&0x00f00000)>>20; sh_pix(6);
+  t=(pack&0x000f0000)>>16; sh_pix(7);
+}
+
+static void TileRowFlipSH(unsigned char *pd, unsigned int pack, int pal)
+{
+  unsigned int t;
+
+  t=(pack&0x000f0000)>>16; sh_pix(0);
+  t=(pack&0x00f00000)>>20; sh_pix(1);
+  t=(pack&0x0f000000)>>24; sh_pix(2);
+  t=(pack&0xf0000000)>>28; sh_pix(3);
+  t=(pack&0x0000000f)    ; sh_pix(4);
+  t=(pack&0x000000f0)>> 4; sh_pix(5);
+  t=(pack&0x00000f00)>> 8; sh_pix(6);
+  t=(pack&0x0000f000)>>12; sh_pix(7);
+}
+#endif
+
+static int TileRowNormZ(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval)
+{
+  unsigned int t;
+  int collision = 0, zb_s;
+
+  t=pack&0x0000f000; if(t) { zb_s=zb[0]; if(zb_s) collision=1; if(zval>zb_s) { pd[0]=(unsigned char)(pal|(t>>12)); zb[0]=(char)zval; } }
+  t=pack&0x00000f00; if(t) { zb_s=zb[1]; if(zb_s) collision=1; if(zval>zb_s) { pd[1]=(unsigned char)(pal|(t>> 8)); zb[1]=(char)zval; } }
+  t=pack&0x000000f0; if(t) { zb_s=zb[2]; if(zb_s) collision=1; if(zval>zb_s) { pd[2]=(unsigned char)(pal|(t>> 4)); zb[2]=(char)zval; } }
+  t=pack&0x0000000f; if(t) { zb_s=zb[3]; if(zb_s) collision=1; if(zval>zb_s) { pd[3]=(unsigned char)(pal|(t    )); zb[3]=(char)zval; } }
+  t=pack&0xf0000000; if(t) { zb_s=zb[4]; if(zb_s) collision=1; if(zval>zb_s) { pd[4]=(unsigned char)(pal|(t>>28)); zb[4]=(char)zval; } }
+  t=pack&0x0f000000; if(t) { zb_s=zb[5]; if(zb_s) collision=1; if(zval>zb_s) { pd[5]=(unsigned char)(pal|(t>>24)); zb[5]=(char)zval; } }
+  t=pack&0x00f00000; if(t) { zb_s=zb[6]; if(zb_s) collision=1; if(zval>zb_s) { pd[6]=(unsigned char)(pal|(t>>20)); zb[6]=(char)zval; } }
+  t=pack&0x000f0000; if(t) { zb_s=zb[7]; if(zb_s) collision=1; if(zval>zb_s) { pd[7]=(unsigned char)(pal|(t>>16)); zb[7]=(char)zval; } }
+
+  return collision;
+}
+
+static int TileRowFlipZ(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval)
+{
+  unsigned int t;
+  int collision = 0, zb_s;
+
+  t=pack&0x000f0000; if(t) { zb_s=zb[0]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[0]=(unsigned char)(pal|(t>>16)); zb[0]=(char)zval; } }
+  t=pack&0x00f00000; if(t) { zb_s=zb[1]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[1]=(unsigned char)(pal|(t>>20)); zb[1]=(char)zval; } }
+  t=pack&0x0f000000; if(t) { zb_s=zb[2]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[2]=(unsigned char)(pal|(t>>24)); zb[2]=(char)zval; } }
+  t=pack&0xf0000000; if(t) { zb_s=zb[3]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[3]=(unsigned char)(pal|(t>>28)); zb[3]=(char)zval; } }
+  t=pack&0x0000000f; if(t) { zb_s=zb[4]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[4]=(unsigned char)(pal|(t    )); zb[4]=(char)zval; } }
+  t=pack&0x000000f0; if(t) { zb_s=zb[5]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[5]=(unsigned char)(pal|(t>> 4)); zb[5]=(char)zval; } }
+  t=pack&0x00000f00; if(t) { zb_s=zb[6]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[6]=(unsigned char)(pal|(t>> 8)); zb[6]=(char)zval; } }
+  t=pack&0x0000f000; if(t) { zb_s=zb[7]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[7]=(unsigned char)(pal|(t>>12)); zb[7]=(char)zval; } }
+
+  return collision;
+}
+
+
+#define sh_pixZ(x) \
+  if(t) { \
+    if(zb[x]) collision=1; \
+    if(zval>zb[x]) { \
+      if     (t==0xe) { pd[x]=(unsigned char)((pd[x]&0x3f)|0x80); /* hilight */ } \
+      else if(t==0xf) { pd[x]=(unsigned char)((pd[x]&0x3f)|0xc0); /* shadow  */ } \
+      else            { zb[x]=(char)zval; pd[x]=(unsigned char)(pal|t); } \
+    } \
+  }
+
+static int TileRowNormZSH(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval)
+{
+  unsigned int t;
+  int collision = 0;
+
+  t=(pack&0x0000f000)>>12; sh_pixZ(0);
+  t=(pack&0x00000f00)>> 8; sh_pixZ(1);
+  t=(pack&0x000000f0)>> 4; sh_pixZ(2);
+  t=(pack&0x0000000f)    ; sh_pixZ(3);
+  t=(pack&0xf0000000)>>28; sh_pixZ(4);
+  t=(pack&0x0f000000)>>24; sh_pixZ(5);
+  t=(pack&0x00f00000)>>20; sh_pixZ(6);
+  t=(pack&0x000f0000)>>16; sh_pixZ(7);
+
+  return collision;
+}
+
+static int TileRowFlipZSH(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval)
+{
+  unsigned int t;
+  int collision = 0;
+
+  t=(pack&0x000f0000)>>16; sh_pixZ(0);
+  t=(pack&0x00f00000)>>20; sh_pixZ(1);
+  t=(pack&0x0f000000)>>24; sh_pixZ(2);
+  t=(pack&0xf0000000)>>28; sh_pixZ(3);
+  t=(pack&0x0000000f)    ; sh_pixZ(4);
+  t=(pack&0x000000f0)>> 4; sh_pixZ(5);
+  t=(pack&0x00000f00)>> 8; sh_pixZ(6);
+  t=(pack&0x0000f000)>>12; sh_pixZ(7);
+
+  return collision;
+}
+
+#ifdef DRAW_SIMD
+// PicoDrawSimdInit() may replace these with vector versions
+void (*DrawTileNorm)  (unsigned char *pd, unsigned int pack, int pal) = TileRowNorm;
+void (*DrawTileFlip)  (unsigned char *pd, unsigned int pack, int pal) = TileRowFlip;
+void (*DrawTileNormSH)(unsigned char *pd, unsigned int pack, int pal) = TileRowNormSH;
+void (*DrawTileFlipSH)(unsigned char *pd, unsigned int pack, int pal) = TileRowFlipSH;
+int  (*DrawTileNormZ)  (unsigned char *pd, char *zb, unsigned int pack, int pal, int zval) = TileRowNormZ;
+int  (*DrawTileFlipZ)  (unsigned char *pd, char *zb, unsigned int pack, int pal, int zval) = TileRowFlipZ;
+int  (*DrawTileNormZSH)(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval) = TileRowNormZSH;
+int  (*DrawTileFlipZSH)(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval) = TileRowFlipZSH;
+#else
+#define DrawTileNorm    TileRowNorm
+#define DrawTileFlip    TileRowFlip
+#define DrawTileNormSH  TileRowNormSH
+#define DrawTileFlipSH  TileRowFlipSH
+#define DrawTileNormZ   TileRowNormZ
+#define DrawTileFlipZ   TileRowFlipZ
+#define DrawTileNormZSH TileRowNormZSH
+#define DrawTileFlipZSH TileRowFlipZSH
+#endif
 
 #ifdef _ASM_DRAW_C_AMIPS
 int TileNorm(int sx,int addr,int pal);
 int TileFlip(int sx,int addr,int pal);
-#else
+#elif defined(DRAW_TILE_CACHE)
 static int TileNorm(int sx,int addr,int pal)
 {
-  unsigned char *pd = HighCol+sx;
-  unsigned int pack=0; unsigned int t=0;
+  unsigned long long pix=TileCacheRow(addr); // Get 8 pixels
+  if (pix)
+  {
+    TILE_CACHE_PUT(HighCol+sx, pix, pal);
+    return 0;
+  }
+
+  return 1; // Tile blank
+}
 
-  pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
+static int TileFlip(int sx,int addr,int pal)
+{
+  unsigned long long pix=TileCacheRow(addr); // Get 8 pixels
+  if (pix)
+  {
+    pix=__builtin_bswap64(pix);
+    TILE_CACHE_PUT(HighCol+sx, pix, pal);
+    return 0;
+  }
+  return 1; // Tile blank
+}
+#else
+static int TileNorm(int sx,int addr,int pal)
+{
+  unsigned int pack=*(unsigned int *)(DrawSrc->vram+addr); // Get 8 pixels
   if (pack)
   {
-    t=pack&0x0000f000; if (t) pd[0]=(unsigned char)(pal|(t>>12));
-    t=pack&0x00000f00; if (t) pd[1]=(unsigned char)(pal|(t>> 8));
-    t=pack&0x000000f0; if (t) pd[2]=(unsigned char)(pal|(t>> 4));
-    t=pack&0x0000000f; if (t) pd[3]=(unsigned char)(pal|(t    ));
-    t=pack&0xf0000000; if (t) pd[4]=(unsigned char)(pal|(t>>28));
-    t=pack&0x0f000000; if (t) pd[5]=(unsigned char)(pal|(t>>24));
-    t=pack&0x00f00000; if (t) pd[6]=(unsigned char)(pal|(t>>20));
-    t=pack&0x000f0000; if (t) pd[7]=(unsigned char)(pal|(t>>16));
+    DrawTileNorm(HighCol+sx, pack, pal);
     return 0;
   }
 
@@ -94,50 +391,23 @@ static int TileNorm(int sx,int addr,int pal)
 
 static int TileFlip(int sx,int addr,int pal)
 {
-  unsigned char *pd = HighCol+sx;
-  unsigned int pack=0; unsigned int t=0;
-
-  pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
+  unsigned int pack=*(unsigned int *)(DrawSrc->vram+addr); // Get 8 pixels
   if (pack)
   {
-    t=pack&0x000f0000; if (t) pd[0]=(unsigned char)(pal|(t>>16));
-    t=pack&0x00f00000; if (t) pd[1]=(unsigned char)(pal|(t>>20));
-    t=pack&0x0f000000; if (t) pd[2]=(unsigned char)(pal|(t>>24));
-    t=pack&0xf0000000; if (t) pd[3]=(unsigned char)(pal|(t>>28));
-    t=pack&0x0000000f; if (t) pd[4]=(unsigned char)(pal|(t    ));
-    t=pack&0x000000f0; if (t) pd[5]=(unsigned char)(pal|(t>> 4));
-    t=pack&0x00000f00; if (t) pd[6]=(unsigned char)(pal|(t>> 8));
-    t=pack&0x0000f000; if (t) pd[7]=(unsigned char)(pal|(t>>12));
+    DrawTileFlip(HighCol+sx, pack, pal);
     return 0;
   }
   return 1; // Tile blank
 }
 #endif
 
-// tile renderers for hacky operator sprite support
-#define sh_pix(x) \
-  if(!t); \
-  else if(t==0xe) pd[x]=(unsigned char)((pd[x]&0x3f)|0x80); /* hilight */ \
-  else if(t==0xf) pd[x]=(unsigned char)((pd[x]&0x3f)|0xc0); /* shadow  */ \
-  else pd[x]=(unsigned char)(pal|t)
-
 #ifndef _ASM_DRAW_C
 static int TileNormSH(int sx,int addr,int pal)
 {
-  unsigned int pack=0; unsigned int t=0;
-  unsigned char *pd = HighCol+sx;
-
-  pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
+  unsigned int pack=*(unsigned int *)(DrawSrc->vram+addr); // Get 8 pixels
   if (pack)
   {
-    t=(pack&0x0000f000)>>12; sh_pix(0);
-    t=(pack&0x00000f00)>> 8; sh_pix(1);
-    t=(pack&0x000000f0)>> 4; sh_pix(2);
-    t=(pack&0x0000000f)    ; sh_pix(3);
-    t=(pack&0xf0000000)>>28; sh_pix(4);
-    t=(pack&0x0f000000)>>24; sh_pix(5);
-    t=(pack&0x00f00000)>>20; sh_pix(6);
-    t=(pack&0x000f0000)>>16; sh_pix(7);
+    DrawTileNormSH(HighCol+sx, pack, pal);
     return 0;
   }
 
@@ -146,20 +416,10 @@ static int TileNormSH(int sx,int addr,int pal)
 
 static int TileFlipSH(int sx,int addr,int pal)
 {
-  unsigned int pack=0; unsigned int t=0;
-  unsigned char *pd = HighCol+sx;
-
-  pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
+  unsigned int pack=*(unsigned int *)(DrawSrc->vram+addr); // Get 8 pixels
   if (pack)
   {
-    t=(pack&0x000f0000)>>16; sh_pix(0);
-    t=(pack&0x00f00000)>>20; sh_pix(1);
-    t=(pack&0x0f000000)>>24; sh_pix(2);
-    t=(pack&0xf0000000)>>28; sh_pix(3);
-    t=(pack&0x0000000f)    ; sh_pix(4);
-    t=(pack&0x000000f0)>> 4; sh_pix(5);
-    t=(pack&0x00000f00)>> 8; sh_pix(6);
-    t=(pack&0x0000f000)>>12; sh_pix(7);
+    DrawTileFlipSH(HighCol+sx, pack, pal);
     return 0;
   }
   return 1; // Tile blank
@@ -168,23 +428,11 @@ static int TileFlipSH(int sx,int addr,int pal)
 
 static int TileNormZ(int sx,int addr,int pal,int zval)
 {
-  unsigned int pack=0; unsigned int t=0;
-  unsigned char *pd = HighCol+sx;
-  char *zb = HighSprZ+sx;
-  int collision = 0, zb_s;
-
-  pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
+  unsigned int pack=*(unsigned int *)(DrawSrc->vram+addr); // Get 8 pixels
   if (pack)
   {
-    t=pack&0x0000f000; if(t) { zb_s=zb[0]; if(zb_s) collision=1; if(zval>zb_s) { pd[0]=(unsigned char)(pal|(t>>12)); zb[0]=(char)zval; } }
-    t=pack&0x00000f00; if(t) { zb_s=zb[1]; if(zb_s) collision=1; if(zval>zb_s) { pd[1]=(unsigned char)(pal|(t>> 8)); zb[1]=(char)zval; } }
-    t=pack&0x000000f0; if(t) { zb_s=zb[2]; if(zb_s) collision=1; if(zval>zb_s) { pd[2]=(unsigned char)(pal|(t>> 4)); zb[2]=(char)zval; } }
-    t=pack&0x0000000f; if(t) { zb_s=zb[3]; if(zb_s) collision=1; if(zval>zb_s) { pd[3]=(unsigned char)(pal|(t    )); zb[3]=(char)zval; } }
-    t=pack&0xf0000000; if(t) { zb_s=zb[4]; if(zb_s) collision=1; if(zval>zb_s) { pd[4]=(unsigned char)(pal|(t>>28)); zb[4]=(char)zval; } }
-    t=pack&0x0f000000; if(t) { zb_s=zb[5]; if(zb_s) collision=1; if(zval>zb_s) { pd[5]=(unsigned char)(pal|(t>>24)); zb[5]=(char)zval; } }
-    t=pack&0x00f00000; if(t) { zb_s=zb[6]; if(zb_s) collision=1; if(zval>zb_s) { pd[6]=(unsigned char)(pal|(t>>20)); zb[6]=(char)zval; } }
-    t=pack&0x000f0000; if(t) { zb_s=zb[7]; if(zb_s) collision=1; if(zval>zb_s) { pd[7]=(unsigned char)(pal|(t>>16)); zb[7]=(char)zval; } }
-    if(collision) Pico.video.status|=0x20;
+    if (DrawTileNormZ(HighCol+sx, HighSprZ+sx, pack, pal, zval))
+      DrawSrc->video.status|=0x20;
     return 0;
   }
 
@@ -193,58 +441,23 @@ static int TileNormZ(int sx,int addr,int pal,int zval)
 
 static int TileFlipZ(int sx,int addr,int pal,int zval)
 {
-  unsigned int pack=0; unsigned int t=0;
-  unsigned char *pd = HighCol+sx;
-  char *zb = HighSprZ+sx;
-  int collision = 0, zb_s;
-
-  pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
+  unsigned int pack=*(unsigned int *)(DrawSrc->vram+addr); // Get 8 pixels
   if (pack)
   {
-    t=pack&0x000f0000; if(t) { zb_s=zb[0]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[0]=(unsigned char)(pal|(t>>16)); zb[0]=(char)zval; } }
-    t=pack&0x00f00000; if(t) { zb_s=zb[1]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[1]=(unsigned char)(pal|(t>>20)); zb[1]=(char)zval; } }
-    t=pack&0x0f000000; if(t) { zb_s=zb[2]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[2]=(unsigned char)(pal|(t>>24)); zb[2]=(char)zval; } }
-    t=pack&0xf0000000; if(t) { zb_s=zb[3]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[3]=(unsigned char)(pal|(t>>28)); zb[3]=(char)zval; } }
-    t=pack&0x0000000f; if(t) { zb_s=zb[4]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[4]=(unsigned char)(pal|(t    )); zb[4]=(char)zval; } }
-    t=pack&0x000000f0; if(t) { zb_s=zb[5]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[5]=(unsigned char)(pal|(t>> 4)); zb[5]=(char)zval; } }
-    t=pack&0x00000f00; if(t) { zb_s=zb[6]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[6]=(unsigned char)(pal|(t>> 8)); zb[6]=(char)zval; } }
-    t=pack&0x0000f000; if(t) { zb_s=zb[7]&0x1f; if(zb_s) collision=1; if(zval>zb_s) { pd[7]=(unsigned char)(pal|(t>>12)); zb[7]=(char)zval; } }
-    if(collision) Pico.video.status|=0x20;
+    if (DrawTileFlipZ(HighCol+sx, HighSprZ+sx, pack, pal, zval))
+      DrawSrc->video.status|=0x20;
     return 0;
   }
   return 1; // Tile blank
 }
 
-
-#define sh_pixZ(x) \
-  if(t) { \
-    if(zb[x]) collision=1; \
-    if(zval>zb[x]) { \
-      if     (t==0xe) { pd[x]=(unsigned char)((pd[x]&0x3f)|0x80); /* hilight */ } \
-      else if(t==0xf) { pd[x]=(unsigned char)((pd[x]&0x3f)|0xc0); /* shadow  */ } \
-      else            { zb[x]=(char)zval; pd[x]=(unsigned char)(pal|t); } \
-    } \
-  }
-
 static int TileNormZSH(int sx,int addr,int pal,int zval)
 {
-  unsigned int pack=0; unsigned int t=0;
-  unsigned char *pd = HighCol+sx;
-  char *zb = HighSprZ+sx;
-  int collision = 0;
-
-  pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
+  unsigned int pack=*(unsigned int *)(DrawSrc->vram+addr); // Get 8 pixels
   if (pack)
   {
-    t=(pack&0x0000f000)>>12; sh_pixZ(0);
-    t=(pack&0x00000f00)>> 8; sh_pixZ(1);
-    t=(pack&0x000000f0)>> 4; sh_pixZ(2);
-    t=(pack&0x0000000f)    ; sh_pixZ(3);
-    t=(pack&0xf0000000)>>28; sh_pixZ(4);
-    t=(pack&0x0f000000)>>24; sh_pixZ(5);
-    t=(pack&0x00f00000)>>20; sh_pixZ(6);
-    t=(pack&0x000f0000)>>16; sh_pixZ(7);
-    if(collision) Pico.video.status|=0x20;
+    if (DrawTileNormZSH(HighCol+sx, HighSprZ+sx, pack, pal, zval))
+      DrawSrc->video.status|=0x20;
     return 0;
   }
 
@@ -253,23 +466,11 @@ static int TileNormZSH(int sx,int addr,int pal,int zval)
 
 static int TileFlipZSH(int sx,int addr,int pal,int zval)
 {
-  unsigned int pack=0; unsigned int t=0;
-  unsigned char *pd = HighCol+sx;
-  char *zb = HighSprZ+sx;
-  int collision = 0;
-
-  pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
+  unsigned int pack=*(unsigned int *)(DrawSrc->vram+addr); // Get 8 pixels
   if (pack)
   {
-    t=(pack&0x000f0000)>>16; sh_pixZ(0);
-    t=(pack&0x00f00000)>>20; sh_pixZ(1);
-    t=(pack&0x0f000000)>>24; sh_pixZ(2);
-    t=(pack&0xf0000000)>>28; sh_pixZ(3);
-    t=(pack&0x0000000f)    ; sh_pixZ(4);
-    t=(pack&0x000000f0)>> 4; sh_pixZ(5);
-    t=(pack&0x00000f00)>> 8; sh_pixZ(6);
-    t=(pack&0x0000f000)>>12; sh_pixZ(7);
-    if(collision) Pico.video.status|=0x20;
+    if (DrawTileFlipZSH(HighCol+sx, HighSprZ+sx, pack, pal, zval))
+      DrawSrc->video.status|=0x20;
     return 0;
   }
   return 1; // Tile blank
@@ -297,7 +498,7 @@ static void DrawStrip(struct TileStrip *ts, int plane_sh, int cellskip)
   {
     int zero=0;
 
-    code=Pico.vram[ts->nametab+(tilex&ts->xmask)];
+    code=DrawSrc->vram[ts->nametab+(tilex&ts->xmask)];
     if (code==blank) continue;
     if (code>>15) { // high priority tile
       int cval = code | (dx<<16) | (ty<<25);
@@ -350,7 +551,7 @@ void DrawStripVSRam(struct TileStrip *ts, int plane_sh, int cellskip)
     //if((cell&1)==0)
     {
       int line,vscroll;
-      vscroll=Pico.vsram[(plane_sh&1)+(cell&~1)];
+      vscroll=DrawSrc->vsram[(plane_sh&1)+(cell&~1)];
 
       // Find the line in the name table
       line=(vscroll+scan)&ts->line&0xffff; // ts->line is really ymask ..
@@ -358,7 +559,7 @@ void DrawStripVSRam(struct TileStrip *ts, int plane_sh, int cellskip)
       ty=(line&7)<<1; // Y-Offset into tile
     }
 
-    code=Pico.vram[ts->nametab+nametabadd+(tilex&ts->xmask)];
+    code=DrawSrc->vram[ts->nametab+nametabadd+(tilex&ts->xmask)];
     if (code==blank) continue;
     if (code>>15) { // high priority tile
       int cval = code | (dx<<16) | (ty<<25);
@@ -408,7 +609,7 @@ void DrawStripInterlace(struct TileStrip *ts)
   {
     int zero=0;
 
-    code=Pico.vram[ts->nametab+(tilex&ts->xmask)];
+    code=DrawSrc->vram[ts->nametab+(tilex&ts->xmask)];
     if (code==blank) continue;
     if (code>>15) { // high priority tile
       int cval = (code&0xfc00) | (dx<<16) | (ty<<25);
@@ -424,7 +625,7 @@ void DrawStripInterlace(struct TileStrip *ts)
       addr=(code&0x7ff)<<5;
       if (code&0x1000) addr+=30-ty; else addr+=ty; // Y-flip
 
-//      pal=Pico.cram+((code>>9)&0x30);
+//      pal=DrawSrc->cram+((code>>9)&0x30);
       pal=((code>>9)&0x30);
     }
 
@@ -443,7 +644,7 @@ void DrawStripInterlace(struct TileStrip *ts)
 #ifndef _ASM_DRAW_C
 static void DrawLayer(int plane_sh, int *hcache, int cellskip, int maxcells)
 {
-  struct PicoVideo *pvid=&Pico.video;
+  struct PicoVideo *pvid=&DrawSrc->video;
   const char shift[4]={5,6,5,7}; // 32,64 or 128 sized tilemaps (2 is invalid)
   struct TileStrip ts;
   int width, height, ymask;
@@ -473,11 +674,11 @@ static void DrawLayer(int plane_sh, int *hcache, int cellskip, int maxcells)
   htab+=plane_sh&1; // A or B
 
   // Get horizontal scroll value, will be masked later
-  ts.hscroll=Pico.vram[htab&0x7fff];
+  ts.hscroll=DrawSrc->vram[htab&0x7fff];
 
   if((pvid->reg[12]&6) == 6) {
     // interlace mode 2
-    vscroll=Pico.vsram[plane_sh&1]; // Get vertical scroll value
+    vscroll=DrawSrc->vsram[plane_sh&1]; // Get vertical scroll value
 
     // Find the line in the name table
     ts.line=(vscroll+(Scanline<<1))&((ymask<<1)|1);
@@ -490,7 +691,7 @@ static void DrawLayer(int plane_sh, int *hcache, int cellskip, int maxcells)
     ts.line=ymask|(shift[width]<<24); // save some stuff instead of line
     DrawStripVSRam(&ts, plane_sh, cellskip);
   } else {
-    vscroll=Pico.vsram[plane_sh&1]; // Get vertical scroll value
+    vscroll=DrawSrc->vsram[plane_sh&1]; // Get vertical scroll value
 
     // Find the line in the name table
     ts.line=(vscroll+Scanline)&ymask;
@@ -506,7 +707,7 @@ static void DrawLayer(int plane_sh, int *hcache, int cellskip, int maxcells)
 // tstart & tend are tile pair numbers
 static void DrawWindow(int tstart, int tend, int prio, int sh) // int *hcache
 {
-  struct PicoVideo *pvid=&Pico.video;
+  struct PicoVideo *pvid=&DrawSrc->video;
   int tilex=0,ty=0,nametab,code=0;
   int blank=-1; // The tile we know is blank
 
@@ -529,7 +730,7 @@ static void DrawWindow(int tstart, int tend, int prio, int sh) // int *hcache
 
   if(!(rendstatus&2)) {
     // check the first tile code
-    code=Pico.vram[nametab+tilex];
+    code=DrawSrc->vram[nametab+tilex];
     // if the whole window uses same priority (what is often the case), we may be able to skip this field
     if((code>>15) != prio) return;
   }
@@ -542,7 +743,7 @@ static void DrawWindow(int tstart, int tend, int prio, int sh) // int *hcache
       int addr=0,zero=0;
       int pal;
 
-      code=Pico.vram[nametab+tilex];
+      code=DrawSrc->vram[nametab+tilex];
       if(code==blank) continue;
       if((code>>15) != prio) {
         rendstatus|=2;
@@ -568,7 +769,7 @@ static void DrawWindow(int tstart, int tend, int prio, int sh) // int *hcache
       int addr=0,zero=0;
       int pal, tmp, *zb;
 
-      code=Pico.vram[nametab+tilex];
+      code=DrawSrc->vram[nametab+tilex];
       if(code==blank) continue;
       if((code>>15) != prio) {
         rendstatus|=2;
@@ -684,7 +885,7 @@ static void DrawTilesFromCache(int *hc, int sh, int rlim)
 
 last_cut_tile:
   {
-    unsigned int t, pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
+    unsigned int t, pack=*(unsigned int *)(DrawSrc->vram+addr); // Get 8 pixels
     unsigned char *pd = HighCol+dx;
     if (!pack) return;
     if (code&0x0800)
@@ -877,7 +1078,7 @@ static void DrawSpriteInterlace(unsigned int *sprite)
 
 static void DrawAllSpritesInterlace(int pri, int maxwidth)
 {
-  struct PicoVideo *pvid=&Pico.video;
+  struct PicoVideo *pvid=&DrawSrc->video;
   int i,u,table,link=0,sline=Scanline<<1;
   unsigned int *sprites[80]; // Sprite index
 
@@ -890,7 +1091,7 @@ static void DrawAllSpritesInterlace(int pri, int maxwidth)
     unsigned int *sprite;
     int code, sx, sy, height;
 
-    sprite=(unsigned int *)(Pico.vram+((table+(link<<2))&0x7ffc)); // Find sprite
+    sprite=(unsigned int *)(DrawSrc->vram+((table+(link<<2))&0x7ffc)); // Find sprite
 
     // get sprite info
     code = sprite[0];
@@ -970,7 +1171,7 @@ static void DrawSpritesFromCache(int *hc, int sh)
 
 static void PrepareSprites(int full)
 {
-  struct PicoVideo *pvid=&Pico.video;
+  struct PicoVideo *pvid=&DrawSrc->video;
   int u=0,link=0,sblocks=0;
   int table=0;
   int *pd = HighPreSpr;
@@ -988,7 +1189,7 @@ static void PrepareSprites(int full)
       unsigned int *sprite;
       int code, code2, sx, sy, skip=0;
 
-      sprite=(unsigned int *)(Pico.vram+((table+(link<<2))&0x7ffc)); // Find sprite
+      sprite=(unsigned int *)(DrawSrc->vram+((table+(link<<2))&0x7ffc)); // Find sprite
 
       // parse sprite info
       code  = sprite[0];
@@ -1019,7 +1220,7 @@ static void PrepareSprites(int full)
       unsigned int *sprite;
       int code, code2, sx, sy, hv, height, width, skip=0, sx_min;
 
-      sprite=(unsigned int *)(Pico.vram+((table+(link<<2))&0x7ffc)); // Find sprite
+      sprite=(unsigned int *)(DrawSrc->vram+((table+(link<<2))&0x7ffc)); // Find sprite
 
       // parse sprite info
       code = sprite[0];
@@ -1171,16 +1372,35 @@ static void BackFill(int reg7, int sh)
 // --------------------------------------------
 
 unsigned short HighPal[0x100];
+static unsigned int HighPal32[0x100]; // for FinalizeLineXRGB8888
+
+// CRAM in BGR444, with shadowed (0x40, 0xc0) and hilighted (0x80) copies if sh
+static void PalMakeBGR444(unsigned short *pal, int sh)
+{
+  int i, t;
+
+  blockcpy(pal, DrawSrc->cram, 0x40*2);
+  if (!sh) return;
+
+  // shadowed pixels
+  for(i = 0x3f; i >= 0; i--)
+    pal[0x40|i] = pal[0xc0|i] = (unsigned short)((pal[i]>>1)&0x0777);
+  // hilighted pixels
+  for(i = 0x3f; i >= 0; i--) {
+    t=pal[i]&0xeee;t+=0x444;if(t&0x10)t|=0xe;if(t&0x100)t|=0xe0;if(t&0x1000)t|=0xe00;t&=0xeee;
+    pal[0x80|i]=(unsigned short)t;
+  }
+}
 
 #ifndef _ASM_DRAW_C
 static void FinalizeLineBGR444(int sh)
 {
   unsigned short *pd=DrawLineDest;
   unsigned char  *ps=HighCol+8;
-  unsigned short *pal=Pico.cram;
-  int len, i, t;
+  unsigned short *pal=DrawSrc->cram;
+  int len;
 
-  if (Pico.video.reg[12]&1) {
+  if (DrawSrc->video.reg[12]&1) {
     len = 320;
   } else {
     if(!(PicoOpt&0x100)) pd+=32;
@@ -1189,22 +1409,13 @@ static void FinalizeLineBGR444(int sh)
 
   if(sh) {
     pal=HighPal;
-    if(Pico.m.dirtyPal) {
-      blockcpy(pal, Pico.cram, 0x40*2);
-      // shadowed pixels
-      for(i = 0x3f; i >= 0; i--)
-        pal[0x40|i] = pal[0xc0|i] = (unsigned short)((pal[i]>>1)&0x0777);
-      // hilighted pixels
-      for(i = 0x3f; i >= 0; i--) {
-        t=pal[i]&0xeee;t+=0x444;if(t&0x10)t|=0xe;if(t&0x100)t|=0xe0;if(t&0x1000)t|=0xe00;t&=0xeee;
-        pal[0x80|i]=(unsigned short)t;
-      }
-      Pico.m.dirtyPal = 0;
+    if(DrawSrc->m.dirtyPal) {
+      PalMakeBGR444(pal, 1);
+      DrawSrc->m.dirtyPal = 0;
     }
   }
 
-  for(i = 0; i < len; i++)
-    pd[i] = pal[ps[i]];
+  DrawClut(pd, ps, pal, len);
 }
 
 
@@ -1213,11 +1424,11 @@ static void FinalizeLineRGB555(int sh)
   unsigned short *pd=DrawLineDest;
   unsigned char  *ps=HighCol+8;
   unsigned short *pal=HighPal;
-  int len, i, t, dirtyPal = Pico.m.dirtyPal;
+  int len, i, t, dirtyPal = DrawSrc->m.dirtyPal;
 
   if (dirtyPal)
   {
-    unsigned int *spal=(void *)Pico.cram;
+    unsigned int *spal=(void *)DrawSrc->cram;
     unsigned int *dpal=(void *)HighPal;
     for (i = 0x3f/2; i >= 0; i--)
 #ifdef USE_BGR555
@@ -1225,7 +1436,7 @@ static void FinalizeLineRGB555(int sh)
 #else
       dpal[i] = ((spal[i]&0x000f000f)<<12)|((spal[i]&0x00f000f0)<<3)|((spal[i]&0x0f000f00)>>7);
 #endif
-    Pico.m.dirtyPal = 0;
+    DrawSrc->m.dirtyPal = 0;
   }
 
   if (sh)
@@ -1242,24 +1453,71 @@ static void FinalizeLineRGB555(int sh)
     }
   }
 
-  if (Pico.video.reg[12]&1) {
+  if (DrawSrc->video.reg[12]&1) {
     len = 320;
   } else {
     if (!(PicoOpt&0x100)) pd+=32;
     len = 256;
   }
 
-#ifndef PSP
-  for (i = 0; i < len; i++)
-    pd[i] = pal[ps[i]];
-#else
+  DrawClut(pd, ps, pal, len);
+}
+#endif
+
+// BGR444 component (0-7 normal, up to 0xe with shadow/hilight) to 8 bits, 0xe -> 0xff
+#define C4TO8(c) (((c)<<4)|((c)<<1)|((c)>>2))
+
+// full range RGB565 (white is 0xffff), for displays which take it directly
+static void FinalizeLineRGB565(int sh)
+{
+  unsigned short *pd=DrawLineDest;
+  unsigned short *pal=HighPal;
+  int len, i, r, g, b;
+
+  if (DrawSrc->m.dirtyPal)
   {
-    extern void amips_clut(unsigned short *dst, unsigned char *src, unsigned short *pal, int count);
-    amips_clut(pd, ps, pal, len);
+    PalMakeBGR444(pal, sh);
+    for (i = sh ? 0xff : 0x3f; i >= 0; i--) {
+      r = C4TO8(pal[i]&0xf); g = C4TO8((pal[i]>>4)&0xf); b = C4TO8((pal[i]>>8)&0xf);
+      pal[i] = (unsigned short)(((r&0xf8)<<8)|((g&0xfc)<<3)|(b>>3));
+    }
+    DrawSrc->m.dirtyPal = 0;
   }
-#endif
+
+  if (DrawSrc->video.reg[12]&1) {
+    len = 320;
+  } else {
+    if (!(PicoOpt&0x100)) pd+=32;
+    len = 256;
+  }
+
+  DrawClut(pd, HighCol+8, pal, len);
+}
+
+// XRGB8888, DrawLineDest must have room for 320 longs
+static void FinalizeLineXRGB8888(int sh)
+{
+  unsigned int *pd=DrawLineDest;
+  unsigned short pal[0x100];
+  int len, i;
+
+  if (DrawSrc->m.dirtyPal)
+  {
+    PalMakeBGR444(pal, sh);
+    for (i = sh ? 0xff : 0x3f; i >= 0; i--)
+      HighPal32[i] = (C4TO8(pal[i]&0xf)<<16)|(C4TO8((pal[i]>>4)&0xf)<<8)|C4TO8((pal[i]>>8)&0xf);
+    DrawSrc->m.dirtyPal = 0;
+  }
+
+  if (DrawSrc->video.reg[12]&1) {
+    len = 320;
+  } else {
+    if (!(PicoOpt&0x100)) pd+=32;
+    len = 256;
+  }
+
+  DrawClut32(pd, HighCol+8, HighPal32, len);
 }
-#endif
 
 static void FinalizeLine8bit(int sh)
 {
@@ -1267,7 +1525,7 @@ static void FinalizeLine8bit(int sh)
   int len, rs = rendstatus;
   static int dirty_count;
 
-  if (!sh && Pico.m.dirtyPal == 1 && Scanline < 222) {
+  if (!sh && DrawSrc->m.dirtyPal == 1 && Scanline < 222) {
     // a hack for mid-frame palette changes
     if (!(rs & 0x20))
          dirty_count = 1;
@@ -1275,13 +1533,13 @@ static void FinalizeLine8bit(int sh)
     rs |= 0x20;
     rendstatus = rs;
     if (dirty_count == 3) {
-      blockcpy(HighPal, Pico.cram, 0x40*2);
+      blockcpy(HighPal, DrawSrc->cram, 0x40*2);
     } else if (dirty_count == 11) {
-      blockcpy(HighPal+0x40, Pico.cram, 0x40*2);
+      blockcpy(HighPal+0x40, DrawSrc->cram, 0x40*2);
     }
   }
 
-  if (Pico.video.reg[12]&1) {
+  if (DrawSrc->video.reg[12]&1) {
     len = 320;
   } else {
     if(!(PicoOpt&0x100)) pd+=32;
@@ -1290,9 +1548,9 @@ static void FinalizeLine8bit(int sh)
 
   if (!sh && rs & 0x20) {
     if (dirty_count >= 11) {
-      blockcpy_or(pd, HighCol+8, len, 0x80);
+      DrawCpyOr(pd, HighCol+8, len, 0x80);
     } else {
-      blockcpy_or(pd, HighCol+8, len, 0x40);
+      DrawCpyOr(pd, HighCol+8, len, 0x40);
     }
   } else {
     blockcpy(pd, HighCol+8, len);
@@ -1305,7 +1563,7 @@ static void (*FinalizeLine)(int sh) = FinalizeLineBGR444;
 
 static int DrawDisplay(int sh)
 {
-  struct PicoVideo *pvid=&Pico.video;
+  struct PicoVideo *pvid=&DrawSrc->video;
   int win=0,edge=0,hvwind=0;
   int maxw, maxcells;
 
@@ -1363,7 +1621,7 @@ static int DrawDisplay(int sh)
     int *c, a, b;
     for (a = 0, c = HighCacheA; *c; c++, a++);
     for (b = 0, c = HighCacheB; *c; c++, b++);
-    printf("%i:%03i: a=%i, b=%i\n", Pico.m.frame_count, Scanline, a, b);
+    printf("%i:%03i: a=%i, b=%i\n", DrawSrc->m.frame_count, Scanline, a, b);
   }
 #endif
 
@@ -1373,51 +1631,220 @@ static int DrawDisplay(int sh)
 
 static int Skip=0;
 
-PICO_INTERNAL void PicoFrameStart(void)
+static void DrawFrameStart(void)
 {
   // prepare to do this frame
   rendstatus = (PicoOpt&0x80)>>5;    // accurate sprites
   if(rendstatus)
-       Pico.video.status &= ~0x0020;
-  else Pico.video.status |=  0x0020; // sprite collision
-  if((Pico.video.reg[12]&6) == 6) rendstatus |= 8; // interlace mode
-  if(Pico.m.dirtyPal) Pico.m.dirtyPal = 2; // reset dirty if needed
+       DrawSrc->video.status &= ~0x0020;
+  else DrawSrc->video.status |=  0x0020; // sprite collision
+  if((DrawSrc->video.reg[12]&6) == 6) rendstatus |= 8; // interlace mode
+  if(DrawSrc->m.dirtyPal) DrawSrc->m.dirtyPal = 2; // reset dirty if needed
 
   PrepareSprites(1);
   Skip=0;
 }
 
-PICO_INTERNAL int PicoLine(int scan)
+static void DrawLine(int scan)
 {
   int sh;
-  if (Skip>0) { Skip--; return 0; } // Skip rendering lines
+  if (Skip>0) { Skip--; return; } // Skip rendering lines
 
+  pprof_start(draw);
   Scanline=scan;
-  sh=(Pico.video.reg[0xC]&8)>>3; // shadow/hilight?
+  sh=(DrawSrc->video.reg[0xC]&8)>>3; // shadow/hilight?
 
   // Draw screen:
-  BackFill(Pico.video.reg[7], sh);
-  if (Pico.video.reg[1]&0x40)
+  BackFill(DrawSrc->video.reg[7], sh);
+  if (DrawSrc->video.reg[1]&0x40)
     DrawDisplay(sh);
 
   if (FinalizeLine != NULL)
     FinalizeLine(sh);
 
   Skip=PicoScan(Scanline,DrawLineDest);
+  pprof_end(draw);
+}
+
+// --------------------------------------------
+
+// Pipelined drawing: PicoFrame() only records VDP changes between the lines,
+// and PicoDrawLogReplay() draws them later, usually on another thread while
+// the next frame is emulated. Raster effects are kept, as every line is drawn
+// from the VDP state the CPUs left at that line.
+
+struct PicoDrawLog
+{
+  struct Pico snap;    // VDP state when recording started (only vram, cram, vsram, video and m)
+  int frame_start;     // else continues the previous log, which ran full
+  int count;
+#ifdef DRAW_TILE_CACHE
+  int tile_dirty_any;
+  unsigned char tile_dirty[0x800]; // tiles written since the previous log
+#endif
+  unsigned int ents[DRAW_LOG_SIZE]; // (key<<16)|data, see DRAW_LOG_* keys
+};
+
+struct PicoDrawLog *(*PicoDrawLogGet)(void) = NULL;
+void (*PicoDrawLogPut)(struct PicoDrawLog *log) = NULL;
+struct PicoDrawLog *PicoDrawLogCur = NULL;
+
+static void DrawLogOpen(int frame_start)
+{
+  struct PicoDrawLog *log = PicoDrawLogGet();
+  if (log == NULL) return;
+
+  memcpy(log->snap.vram,  Pico.vram,  sizeof(Pico.vram));
+  memcpy(log->snap.cram,  Pico.cram,  sizeof(Pico.cram));
+  memcpy(log->snap.vsram, Pico.vsram, sizeof(Pico.vsram));
+  log->snap.video = Pico.video;
+  log->snap.m = Pico.m;
+  if (frame_start) Pico.m.dirtyPal = 0; // the renderer takes care of it now
+  log->frame_start = frame_start;
+  log->count = 0;
+#ifdef DRAW_TILE_CACHE
+  log->tile_dirty_any = TileCachePendingAny;
+  if (TileCachePendingAny) {
+    memcpy(log->tile_dirty, TileCachePending, sizeof(TileCachePending));
+    memset(TileCachePending, 0, sizeof(TileCachePending));
+    TileCachePendingAny = 0;
+  }
+#endif
+  PicoDrawLogCur = log;
+}
+
+static void DrawLogClose(void)
+{
+  struct PicoDrawLog *log = PicoDrawLogCur;
+  PicoDrawLogCur = NULL;
+  PicoDrawLogPut(log);
+}
+
+PICO_INTERNAL void PicoDrawLogWrite(unsigned int key, unsigned int d)
+{
+  struct PicoDrawLog *log = PicoDrawLogCur;
+
+  if (log->count >= DRAW_LOG_SIZE) {
+    // continue in a new log, starting from current state
+    DrawLogClose();
+    DrawLogOpen(0);
+    if ((log = PicoDrawLogCur) == NULL) return;
+  }
+  log->ents[log->count++] = (key<<16) | (d&0xffff);
+}
+
+struct PicoDrawLog *PicoDrawLogNew(void)
+{
+  return malloc(sizeof(struct PicoDrawLog));
+}
+
+void PicoDrawLogFree(struct PicoDrawLog *log)
+{
+  free(log);
+}
 
+void PicoDrawLogReplay(struct PicoDrawLog *log)
+{
+  static int dirtyPal; // left by previous log
+  unsigned int *e = log->ents, *end = e + log->count, k, d;
+
+  DrawSrc = &log->snap;
+#ifdef DRAW_TILE_CACHE
+  if (log->tile_dirty_any) {
+    int i;
+    for (i = 0; i < 0x800; i++)
+      if (log->tile_dirty[i]) TileCacheOk[i] = 0;
+  }
+#endif
+  if (log->frame_start)
+    DrawFrameStart();
+  else
+    DrawSrc->m.dirtyPal = dirtyPal;
+
+  for (; e < end; e++)
+  {
+    k = *e >> 16;
+    d = *e & 0xffff;
+    if (k < DRAW_LOG_CRAM) {
+      DrawSrc->vram[k] = d;
+#ifdef DRAW_TILE_CACHE
+      TileCacheOk[k>>4] = 0;
+#endif
+      rendstatus |= 0x10;
+      continue;
+    }
+    switch (k & 0xff00)
+    {
+      case DRAW_LOG_CRAM:
+        DrawSrc->cram[k&0x3f] = d;
+        DrawSrc->m.dirtyPal = 1;
+        break;
+      case DRAW_LOG_VSRAM:
+        DrawSrc->vsram[k&0x3f] = d;
+        break;
+      case DRAW_LOG_REG:
+        DrawSrc->video.reg[k&0x1f] = d;
+        if ((k&0x1f) == 5) rendstatus |= 1;
+        else if ((k&0x1f) == 0xc) DrawSrc->m.dirtyPal = 2;
+        break;
+      case DRAW_LOG_LINE:
+        DrawLine(d);
+        break;
+    }
+  }
+
+  dirtyPal = DrawSrc->m.dirtyPal;
+  DrawSrc = &Pico;
+}
+
+PICO_INTERNAL void PicoFrameStart(void)
+{
+  if (PicoDrawLogGet != NULL) {
+    // only the status bit the 68k can see is handled here, the rest is done when replaying
+    if (PicoOpt&0x80)
+         Pico.video.status &= ~0x0020;
+    else Pico.video.status |=  0x0020;
+    if (PicoDrawLogCur) DrawLogClose();
+    if (!PicoSkipFrame) DrawLogOpen(1);
+    return;
+  }
+
+#ifdef DRAW_TILE_CACHE
+  PicoTileCacheSync();
+#endif
+  DrawFrameStart();
+}
+
+PICO_INTERNAL int PicoLine(int scan)
+{
+  if (PicoDrawLogGet != NULL) {
+    if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_LINE, scan);
+    return 0;
+  }
+
+  DrawLine(scan);
   return 0;
 }
 
+// done with the lines of this frame
+PICO_INTERNAL void PicoFrameFinish(void)
+{
+  if (PicoDrawLogCur) DrawLogClose();
+}
+
 
 void PicoDrawSetColorFormat(int which)
 {
   switch (which)
   {
+    case 4: FinalizeLine = FinalizeLineXRGB8888; break;
+    case 3: FinalizeLine = FinalizeLineRGB565; break;
     case 2: FinalizeLine = FinalizeLine8bit;   break;
     case 1: FinalizeLine = FinalizeLineRGB555; break;
     case 0: FinalizeLine = FinalizeLineBGR444; break;
     default:FinalizeLine = NULL; break;
   }
+  Pico.m.dirtyPal = 1; // HighPal is in another format now
 #if OVERRIDE_HIGHCOL
   if (which) HighCol=DefHighCol;
 #endif
@@ -28,9 +28,119 @@
 #endif
 
 int currpri = 0;
+int PicoDraw2Threads = 0;
 
-static int HighCache2A[41*(TILE_ROWS+1)+1+1]; // caches for high layers
-static int HighCache2B[41*(TILE_ROWS+1)+1+1];
+#ifdef DRAW2_THREADS
+#ifdef _ASM_DRAW_C
+#error "DRAW2_THREADS needs the C version of this renderer"
+#endif
+#include <limits.h>
+#include <pthread.h>
+// Band rendering: PicoDraw2FB is split to horizontal bands of lines, each drawn
+// by it's own thread (the emu thread does the first one). Every band walks the
+// layers and sprites as usual, but skips tile rows outside of it and clips the
+// tiles crossing it's edges, so no pixel is written by two threads. High tile
+// caches are per thread, sprite lists are built before the bands start.
+#define DRAW2_BANDS_MAX 8
+#define DRAW2_TLS __thread
+
+struct Draw2Band {
+	int y0, y1; // PicoDraw2FB lines y0..y1-1
+	unsigned char tmp[7*LINE_WIDTH+8];
+};
+
+static struct Draw2Band Bands[DRAW2_BANDS_MAX];
+static DRAW2_TLS struct Draw2Band *Band; // this thread's band, NULL when drawing everything
+
+// anything of 8 lines from p in our band? (+1 line for tiles wrapping on the right)
+static __inline int RowInBand(unsigned char *p)
+{
+	int y = (p - PicoDraw2FB) / LINE_WIDTH;
+	return y + 8 >= Band->y0 && y < Band->y1;
+}
+#else
+#define DRAW2_TLS
+#endif
+
+static DRAW2_TLS int HighCache2A[41*(TILE_ROWS+1)+1+1]; // caches for high layers
+static DRAW2_TLS int HighCache2B[41*(TILE_ROWS+1)+1+1];
+
+#ifdef DRAW2_DIRTY
+#ifdef _ASM_DRAW_C
+#error "DRAW2_DIRTY needs the C version of this renderer"
+#endif
+// Incremental redraw: only the 8x8 cells of PicoDraw2FB which may look different
+// from last frame are drawn again, the rest is left as is. A marking pass walks
+// layers and sprites just like drawing does, marking cells under name table
+// entries, tiles and sprites changed since (VRAM is tracked in 32 byte blocks).
+// Anything which moves the whole picture (scroll, VDP regs) redraws everything.
+#define CELLS_X ((LINE_WIDTH+7)/8)
+#define CELLS_Y (END_ROW-START_ROW+4)
+
+enum { DRAW2_ALL = 0, DRAW2_MARK, DRAW2_CLIP };
+static int Draw2Mode = DRAW2_ALL;
+static unsigned char VramDirty2[0x800]; // 32 byte VRAM blocks written since last frame
+static int VramDirty2Any = 0, Draw2RedrawAll = 1;
+static unsigned char CellDirty[CELLS_Y*CELLS_X+1]; // last one is for anything outside
+static unsigned char RowDirty[CELLS_Y+1];
+static int CellDirtyCount = 0;
+static DRAW2_TLS unsigned char Draw2Tmp[7*LINE_WIDTH+8];
+
+// everything is redrawn when any of this changes
+struct Draw2Key {
+	unsigned char *fb;
+	unsigned char reg[12];
+	unsigned short vscroll[2];
+	int winprio;
+};
+static struct Draw2Key Draw2KeyLast;
+static DRAW2_TLS int WinPrio; // priority of each window part, see DrawWindowFull
+
+// sprites drawn last frame, for each priority
+static unsigned int SpritesLast[2][80][2];
+static int SpritesLastCount[2];
+
+PICO_INTERNAL void PicoDraw2VramDirty(unsigned int a, int len)
+{
+	int b = (a >> 5) & 0x7ff, n = ((a & 0x1f) + len + 0x1f) >> 5;
+
+	if (n >= 0x800) { Draw2RedrawAll = 1; return; }
+	for (; n > 0; n--, b = (b+1) & 0x7ff) VramDirty2[b] = 1;
+	VramDirty2Any = 1;
+}
+
+static __inline int CellIdx(unsigned char *p)
+{
+	int off = p - PicoDraw2FB, y = off / LINE_WIDTH;
+	off = ((y>>3)*CELLS_X) + ((off - y*LINE_WIDTH)>>3);
+	return off < CELLS_Y*CELLS_X ? off : CELLS_Y*CELLS_X;
+}
+
+// mark cells under 8x8 pixels at pd (rows can wrap to the next line on the right)
+static void MarkTile(unsigned char *pd)
+{
+	int c[4], i;
+
+	c[0] = CellIdx(pd); c[1] = CellIdx(pd+7);
+	c[2] = CellIdx(pd+7*LINE_WIDTH); c[3] = CellIdx(pd+7*LINE_WIDTH+7);
+	for (i = 0; i < 4; i++)
+		if (!CellDirty[c[i]]) {
+			CellDirty[c[i]] = 1;
+			RowDirty[c[i] / CELLS_X] = 1;
+			CellDirtyCount++;
+		}
+}
+
+// anything to draw in 8 lines from p?
+static __inline int RowsDirty(unsigned char *p)
+{
+	int r = (p - PicoDraw2FB) / LINE_WIDTH >> 3;
+	return r >= CELLS_Y-1 || RowDirty[r] || RowDirty[r+1];
+}
+
+// name table entry at word address ent or it's tile changed?
+#define ENTRY_CHANGED(ent,code) (VramDirty2[((ent)>>4)&0x7ff] | VramDirty2[(code)&0x7ff])
+#endif
 
 unsigned short *PicoCramHigh=Pico.cram; // pointer to CRAM buff (0x40 shorts), converted to native device color (works only with 16bit for now)
 void (*PicoPrepareCram)()=0;            // prepares PicoCramHigh for renderer to use
@@ -45,12 +155,41 @@ void DrawWindowFull(int start, int end, int prio);
 void DrawSpriteFull(unsigned int *sprite);
 #else
 
+#ifdef DRAW_TILE_CACHE
+// same as the functions below, but from the decoded tile cache
+static int TileFromCache(unsigned char *pd, unsigned char *tc, int xflip, int yflip, unsigned char pal)
+{
+	unsigned long long pix;
+	int i, step = 8, blank = 1;
+
+	if (yflip) { tc += 7*8; step = -8; }
+	for(i=8; i; i--, tc += step, pd += LINE_WIDTH) {
+		memcpy(&pix, tc, 8);
+		if(!pix) continue;
+		if(xflip) pix = __builtin_bswap64(pix);
+		TILE_CACHE_PUT(pd, pix, pal);
+		blank = 0;
+	}
+
+	return blank; // Tile blank?
+}
+
+// the cache follows the pipelined renderer then, which is on another thread
+#define TILE_FROM_CACHE(xflip,yflip) \
+	if (PicoDrawLogGet == NULL) \
+		return TileFromCache(pd, PicoTileCacheGet(addr>>4), xflip, yflip, pal)
+#else
+#define TILE_FROM_CACHE(xflip,yflip)
+#endif
+
 
 static int TileXnormYnorm(unsigned char *pd,int addr,unsigned char pal)
 {
 	unsigned int pack=0; unsigned int t=0, blank = 1;
 	int i;
 
+	TILE_FROM_CACHE(0, 0);
+
 	for(i=8; i; i--, addr+=2, pd += LINE_WIDTH) {
 		pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
 		if(!pack) continue;
@@ -74,6 +213,8 @@ static int TileXflipYnorm(unsigned char *pd,int addr,unsigned char pal)
 	unsigned int pack=0; unsigned int t=0, blank = 1;
 	int i;
 
+	TILE_FROM_CACHE(1, 0);
+
 	for(i=8; i; i--, addr+=2, pd += LINE_WIDTH) {
 		pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
 		if(!pack) continue;
@@ -96,6 +237,8 @@ static int TileXnormYflip(unsigned char *pd,int addr,unsigned char pal)
 	unsigned int pack=0; unsigned int t=0, blank = 1;
 	int i;
 
+	TILE_FROM_CACHE(0, 1);
+
 	addr+=14;
 	for(i=8; i; i--, addr-=2, pd += LINE_WIDTH) {
 		pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
@@ -120,6 +263,8 @@ static int TileXflipYflip(unsigned char *pd,int addr,unsigned char pal)
 	unsigned int pack=0; unsigned int t=0, blank = 1;
 	int i;
 
+	TILE_FROM_CACHE(1, 1);
+
 	addr+=14;
 	for(i=8; i; i--, addr-=2, pd += LINE_WIDTH) {
 		pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
@@ -138,6 +283,90 @@ static int TileXflipYflip(unsigned char *pd,int addr,unsigned char pal)
 	return blank; // Tile blank?
 }
 
+static int TileAny(unsigned char *pd,int addr,unsigned char pal,int flip)
+{
+	switch(flip) {
+		case 0: return TileXnormYnorm(pd,addr,pal);
+		case 1: return TileXflipYnorm(pd,addr,pal);
+		case 2: return TileXnormYflip(pd,addr,pal);
+		default:return TileXflipYflip(pd,addr,pal);
+	}
+}
+
+#ifdef DRAW2_DIRTY
+static int TileDirty(unsigned char *pd,int addr,unsigned char pal,int flip)
+{
+	int c0, c1, c2, c3, x, y, o, x0, y0, inside, blank;
+	unsigned char *cd;
+
+	if (Draw2Mode == DRAW2_ALL) return TileAny(pd,addr,pal,flip);
+	if (Draw2Mode == DRAW2_MARK) { MarkTile(pd); return 0; }
+
+	o = pd - PicoDraw2FB;
+	y0 = o / LINE_WIDTH; x0 = o - y0*LINE_WIDTH;
+	inside = x0 <= LINE_WIDTH-8 && y0 <= (CELLS_Y-1)*8;
+	if (inside) {
+		cd = CellDirty + (y0>>3)*CELLS_X + (x0>>3);
+		x = (x0&7) != 0; y = (y0&7) ? CELLS_X : 0;
+		c0 = cd[0]; c1 = cd[x]; c2 = cd[y]; c3 = cd[x+y];
+	} else {
+		c0 = CellDirty[CellIdx(pd)]; c1 = CellDirty[CellIdx(pd+7)];
+		c2 = CellDirty[CellIdx(pd+7*LINE_WIDTH)]; c3 = CellDirty[CellIdx(pd+7*LINE_WIDTH+7)];
+	}
+	if (c0 & c1 & c2 & c3) return TileAny(pd,addr,pal,flip);
+	if (!(c0 | c1 | c2 | c3)) return 0; // nothing changed here
+
+	// partly in changed cells: draw aside, then copy only to those
+	for (y = 0; y < 8; y++) memset(Draw2Tmp+y*LINE_WIDTH, 0, 8);
+	blank = TileAny(Draw2Tmp,addr,pal,flip);
+	for (y = 0; y < 8; y++) {
+		cd = CellDirty + ((y0+y)>>3)*CELLS_X;
+		for (x = 0, o = y*LINE_WIDTH; x < 8; x++, o++) {
+			if (!Draw2Tmp[o]) continue;
+			if (inside ? cd[(x0+x)>>3] : CellDirty[CellIdx(pd+o)]) pd[o] = Draw2Tmp[o];
+		}
+	}
+
+	return blank;
+}
+#else
+#define TileDirty TileAny
+#endif
+
+#ifdef DRAW2_THREADS
+// draw only the lines which are in our band
+static int TileFull(unsigned char *pd,int addr,unsigned char pal,int flip)
+{
+	int o = pd - PicoDraw2FB, y = o / LINE_WIDTH, x, l, blank;
+	unsigned char *tmp;
+
+	if (Band == NULL) return TileDirty(pd,addr,pal,flip);
+	if (y >= Band->y0 && y + (o - y*LINE_WIDTH > LINE_WIDTH-8 ? 9 : 8) <= Band->y1)
+		return TileDirty(pd,addr,pal,flip);
+	if (y + 8 < Band->y0 || y >= Band->y1) return 0;
+
+	// crosses the band edge: draw aside, then copy the pixels which are ours
+	tmp = Band->tmp;
+	for (y = 0; y < 8; y++) memset(tmp+y*LINE_WIDTH, 0, 8);
+	blank = TileAny(tmp,addr,pal,flip);
+	for (y = 0; y < 8; y++) {
+		for (x = 0, o = y*LINE_WIDTH; x < 8; x++, o++) {
+			if (!tmp[o]) continue;
+			l = (pd + o - PicoDraw2FB) / LINE_WIDTH;
+			if (l < Band->y0 || l >= Band->y1) continue;
+#ifdef DRAW2_DIRTY
+			if (Draw2Mode == DRAW2_CLIP && !CellDirty[CellIdx(pd+o)]) continue;
+#endif
+			pd[o] = tmp[o];
+		}
+	}
+
+	return blank;
+}
+#else
+#define TileFull TileDirty
+#endif
+
 
 // start: (tile_start<<16)|row_start, end: [same]
 static void DrawWindowFull(int start, int end, int prio)
@@ -168,6 +397,9 @@ static void DrawWindowFull(int start, int end, int prio)
 
 	// check priority
 	code=Pico.vram[nametab+tile_start];
+#ifdef DRAW2_DIRTY
+	if (!prio) WinPrio = (WinPrio<<1) | (code>>15);
+#endif
 	if ((code>>15) != prio) return; // hack: just assume that whole window uses same priority
 
 	scrpos+=8*LINE_WIDTH+8;
@@ -175,6 +407,12 @@ static void DrawWindowFull(int start, int end, int prio)
 
 	// do a window until we reach planestart row
 	for(trow = start; trow < end; trow++, nametab+=nametab_step) { // current tile row
+#ifdef DRAW2_DIRTY
+		if (Draw2Mode == DRAW2_CLIP && !RowsDirty(scrpos)) { scrpos += LINE_WIDTH*8; continue; }
+#endif
+#ifdef DRAW2_THREADS
+		if (Band != NULL && !RowInBand(scrpos)) { scrpos += LINE_WIDTH*8; continue; }
+#endif
 		for (tilex=tile_start; tilex<tile_end; tilex++)
 		{
 			int code,addr,zero=0;
@@ -183,6 +421,12 @@ static void DrawWindowFull(int start, int end, int prio)
 
 			code=Pico.vram[nametab+tilex];
 			if (code==blank) continue;
+#ifdef DRAW2_DIRTY
+			if (Draw2Mode == DRAW2_MARK) {
+				if (ENTRY_CHANGED(nametab+tilex, code)) MarkTile(scrpos+(tilex<<3));
+				continue;
+			}
+#endif
 
 			// Get tile address/2:
 			addr=(code&0x7ff)<<4;
@@ -190,12 +434,7 @@ static void DrawWindowFull(int start, int end, int prio)
 //			pal=PicoCramHigh+((code>>9)&0x30);
 			pal=(unsigned char)((code>>9)&0x30);
 
-			switch((code>>11)&3) {
-				case 0: zero=TileXnormYnorm(scrpos+(tilex<<3),addr,pal); break;
-				case 1: zero=TileXflipYnorm(scrpos+(tilex<<3),addr,pal); break;
-				case 2: zero=TileXnormYflip(scrpos+(tilex<<3),addr,pal); break;
-				case 3: zero=TileXflipYflip(scrpos+(tilex<<3),addr,pal); break;
-			}
+			zero=TileFull(scrpos+(tilex<<3),addr,pal,(code>>11)&3);
 			if(zero) blank=code; // We know this tile is blank now
 		}
 
@@ -258,6 +497,13 @@ static void DrawLayerFull(int plane, int *hcache, int planestart, int planeend)
 	for(trow = planestart; trow < planeend; trow++) { // current tile row
 		int cellc=cells,tilex,dx;
 
+#ifdef DRAW2_DIRTY
+		if (Draw2Mode == DRAW2_CLIP && !RowsDirty(scrpos)) { scrpos += LINE_WIDTH*8; continue; }
+#endif
+#ifdef DRAW2_THREADS
+		if (Band != NULL && !RowInBand(scrpos)) { scrpos += LINE_WIDTH*8; continue; }
+#endif
+
 		// Find the tile row in the name table
 		//ts.line=(vscroll+Scanline)&ymask;
 		//ts.nametab+=(ts.line>>3)<<shift[width];
@@ -283,6 +529,12 @@ static void DrawLayerFull(int plane, int *hcache, int planestart, int planeend)
 
 			code=Pico.vram[nametab_row+(tilex&xmask)];
 			if (code==blank) continue;
+#ifdef DRAW2_DIRTY
+			if (Draw2Mode == DRAW2_MARK) { // high ones too, hcache stays empty
+				if (ENTRY_CHANGED(nametab_row+(tilex&xmask), code)) MarkTile(scrpos+dx);
+				continue;
+			}
+#endif
 
 #ifdef USE_CACHE
 			if (code>>15) { // high priority tile
@@ -299,12 +551,7 @@ static void DrawLayerFull(int plane, int *hcache, int planestart, int planeend)
 //			pal=PicoCramHigh+((code>>9)&0x30);
 			pal=(unsigned char)((code>>9)&0x30);
 
-			switch((code>>11)&3) {
-				case 0: zero=TileXnormYnorm(scrpos+dx,addr,pal); break;
-				case 1: zero=TileXflipYnorm(scrpos+dx,addr,pal); break;
-				case 2: zero=TileXnormYflip(scrpos+dx,addr,pal); break;
-				case 3: zero=TileXflipYflip(scrpos+dx,addr,pal); break;
-			}
+			zero=TileFull(scrpos+dx,addr,pal,(code>>11)&3);
 			if(zero) blank=code; // We know this tile is blank now
 		}
 
@@ -341,12 +588,7 @@ static void DrawTilesFromCacheF(int *hc)
 //		pal=PicoCramHigh+((code>>9)&0x30);
 		pal=(unsigned char)((code>>9)&0x30);
 
-		switch((code>>11)&3) {
-			case 0: zero=TileXnormYnorm(pd+((code>>16)&0x1ff),addr,pal); break;
-			case 1: zero=TileXflipYnorm(pd+((code>>16)&0x1ff),addr,pal); break;
-			case 2: zero=TileXnormYflip(pd+((code>>16)&0x1ff),addr,pal); break;
-			case 3: zero=TileXflipYflip(pd+((code>>16)&0x1ff),addr,pal); break;
-		}
+		zero=TileFull(pd+((code>>16)&0x1ff),addr,pal,(code>>11)&3);
 
 		if(zero) blank=(short)code;
 	}
@@ -400,12 +642,7 @@ static void DrawSpriteFull(unsigned int *sprite)
 			if(x>=328) break; // Offscreen
 
 			t&=0x7fff; // Clip tile address
-			switch((code>>11)&3) {
-				case 0: TileXnormYnorm(scrpos+x,t<<4,pal); break;
-				case 1: TileXflipYnorm(scrpos+x,t<<4,pal); break;
-				case 2: TileXnormYflip(scrpos+x,t<<4,pal); break;
-				case 3: TileXflipYflip(scrpos+x,t<<4,pal); break;
-			}
+			TileFull(scrpos+x,t<<4,pal,(code>>11)&3);
 		}
 
 		scrpos+=8*LINE_WIDTH;
@@ -414,12 +651,49 @@ static void DrawSpriteFull(unsigned int *sprite)
 #endif
 
 
-static void DrawAllSpritesFull(int prio, int maxwidth)
+#ifdef DRAW2_DIRTY
+// compare sprite list with last frame's, marking cells of any which changed
+static void SpritesUpdate(int prio, unsigned int **sprites, int count)
+{
+	unsigned int (*last)[2] = SpritesLast[prio], s[2];
+	int i, t, tiles, count_last = SpritesLastCount[prio];
+
+	for (i = 0; i < count || i < count_last; i++)
+	{
+		if (i >= count) {
+			if (Draw2Mode == DRAW2_MARK) DrawSpriteFull(last[i]);
+			continue;
+		}
+
+		s[0] = sprites[i][0] & 0x0f0001ff; // size and y, not link
+		s[1] = sprites[i][1] & 0x01ffffff;
+		if (Draw2Mode == DRAW2_MARK) {
+			if (i >= count_last || s[0] != last[i][0] || s[1] != last[i][1]) {
+				if (i < count_last) DrawSpriteFull(last[i]);
+				DrawSpriteFull(s);
+			} else {
+				tiles = (((s[0]>>24)&3)+1) * (((s[0]>>26)&3)+1);
+				for (t = s[1]; tiles > 0; tiles--, t++)
+					if (VramDirty2[t&0x7ff]) { DrawSpriteFull(s); break; }
+			}
+		}
+		last[i][0] = s[0];
+		last[i][1] = s[1];
+	}
+	SpritesLastCount[prio] = count;
+}
+#endif
+
+// sprites to draw for each priority, shared by all bands
+static unsigned int *Sprites2[2][80];
+static int Sprites2Count[2];
+
+static void PrepareSpritesFull(int prio, int maxwidth)
 {
 	struct PicoVideo *pvid=&Pico.video;
 	int table=0,maskrange=0;
 	int i,u,link=0;
-	unsigned int *sprites[80]; // Sprites
+	unsigned int **sprites=Sprites2[prio]; // Sprites
 	int y_min=START_ROW*8, y_max=END_ROW*8; // for a simple sprite masking
 
 	table=pvid->reg[5]&0x7f;
@@ -475,17 +749,48 @@ static void DrawAllSpritesFull(int prio, int maxwidth)
 		if(!link) break; // End of sprites
 	}
 
+	Sprites2Count[prio]=i;
+#ifdef DRAW2_DIRTY
+	SpritesUpdate(prio, sprites, i);
+#endif
+}
+
+static void DrawAllSpritesFull(int prio)
+{
+	unsigned int **sprites=Sprites2[prio];
+	int i;
+
+#ifdef DRAW2_DIRTY
+	if (Draw2Mode == DRAW2_MARK) return; // done by PrepareSpritesFull
+#endif
+
 	// Go through sprites backwards:
-	for (i-- ;i>=0; i--)
+	for (i=Sprites2Count[prio]-1; i>=0; i--)
 	{
+#ifdef DRAW2_THREADS
+		if (Band != NULL) {
+			int sy=(sprites[i][0]&0x1ff)-0x78-START_ROW*8;
+			if (sy+((sprites[i][0]>>21)&0x18)+8 < Band->y0 || sy >= Band->y1) continue;
+		}
+#endif
 		DrawSpriteFull(sprites[i]);
 	}
 }
 
+// sprite lists for DrawDisplayFull
+static void SpritesFull(void)
+{
+	int maxw=(Pico.video.reg[12]&1) ? 328 : 264; // max width
+
+	PrepareSpritesFull(0, maxw);
+	PrepareSpritesFull(1, maxw);
+}
+
 #ifndef _ASM_DRAW_C
 static void BackFillFull(int reg7)
 {
 	unsigned int back;
+	int y0 = 0, y1 = 8+(END_ROW-START_ROW)*8;
 
 	// Start with a background color:
 //	back=PicoCramHigh[reg7&0x3f];
@@ -493,7 +798,42 @@ static void BackFillFull(int reg7)
 	back|=back<<8;
 	back|=back<<16;
 
-	memset32((int *)PicoDraw2FB, back, LINE_WIDTH*(8+(END_ROW-START_ROW)*8)/4);
+#ifdef DRAW2_THREADS
+	if (Band != NULL) {
+		if (y0 < Band->y0) y0 = Band->y0;
+		if (y1 > Band->y1) y1 = Band->y1;
+		if (y0 >= y1) return;
+	}
+#endif
+	memset32((int *)(PicoDraw2FB + y0*LINE_WIDTH), back, LINE_WIDTH*(y1-y0)/4);
+}
+#endif
+
+#ifdef DRAW2_DIRTY
+// BackFillFull for changed cells only
+static void BackFillCells(int reg7)
+{
+	unsigned char *pd;
+	int x, y, i, w, ys, ye;
+
+	for (y = 0; y < END_ROW-START_ROW+1; y++)
+	{
+		ys = y*8; ye = ys+8; // lines
+#ifdef DRAW2_THREADS
+		if (Band != NULL) {
+			if (ys < Band->y0) ys = Band->y0;
+			if (ye > Band->y1) ye = Band->y1;
+		}
+#endif
+		for (x = 0; x < CELLS_X; x++)
+		{
+			if (!CellDirty[y*CELLS_X+x]) continue;
+			w = LINE_WIDTH - x*8;
+			if (w > 8) w = 8;
+			pd = PicoDraw2FB + ys*LINE_WIDTH + x*8;
+			for (i = ys; i < ye; i++, pd += LINE_WIDTH) memset(pd, reg7&0x3f, w);
+		}
+	}
 }
 #endif
 
@@ -503,13 +843,10 @@ static void DrawDisplayFull()
 	int win, edge=0, hvwin=0; // LSb->MSb: hwin&plane, vwin&plane, full
 	int planestart=START_ROW, planeend=END_ROW; // plane A start/end when window shares display with plane A (in tile rows or columns)
 	int winstart=START_ROW, winend=END_ROW;     // same for window
-	int maxw, maxcolc; // max width and col cells
+	int maxcolc; // max col cells
 
-	if(pvid->reg[12]&1) {
-		maxw = 328; maxcolc = 40;
-	} else {
-		maxw = 264; maxcolc = 32;
-	}
+	if(pvid->reg[12]&1) maxcolc = 40;
+	else                maxcolc = 32;
 
 	// horizontal window?
 	if((win=pvid->reg[0x12])) {
@@ -585,7 +922,7 @@ static void DrawDisplayFull()
 		DrawLayerFull(0, HighCache2A, START_ROW, (maxcolc<<16)|END_ROW);
 		break;
 	}
-	DrawAllSpritesFull(0, maxw);
+	DrawAllSpritesFull(0);
 
 #ifdef USE_CACHE
 	if(HighCache2B[1]) DrawTilesFromCacheF(HighCache2B);
@@ -612,17 +949,189 @@ static void DrawDisplayFull()
 	currpri = 1;
 	// TODO
 #endif
-	DrawAllSpritesFull(1, maxw);
+	DrawAllSpritesFull(1);
 }
 
 
+#ifdef DRAW2_DIRTY
+// returns 1 if everything must be redrawn, else marks changed cells
+static int Draw2Begin(void)
+{
+	static const unsigned char key_regs[12] = { 1, 2, 3, 4, 5, 7, 11, 12, 13, 16, 17, 18 };
+	struct PicoVideo *pvid=&Pico.video;
+	struct Draw2Key key;
+	int i, hs, full = Draw2RedrawAll;
+
+	memset(&key, 0, sizeof(key));
+	key.fb = PicoDraw2FB;
+	for (i = 0; i < 12; i++) key.reg[i] = pvid->reg[key_regs[i]];
+	key.reg[0] &= 0x40; // display enable only
+	key.vscroll[0] = Pico.vsram[0]&0x1ff;
+	key.vscroll[1] = Pico.vsram[1]&0x1ff;
+	key.winprio = Draw2KeyLast.winprio;
+	if (memcmp(&key, &Draw2KeyLast, sizeof(key)) != 0) full = 1;
+	Draw2KeyLast = key;
+
+	// hscroll table (in 32 byte blocks)
+	hs = pvid->reg[13]<<5;
+	if (!(pvid->reg[11]&3)) full |= VramDirty2[hs&0x7ff];
+	else for (i = -1; i <= 0x1d; i++) full |= VramDirty2[(hs+i)&0x7ff];
+
+	memset(CellDirty, 0, sizeof(CellDirty)-1);
+	memset(RowDirty, 0, sizeof(RowDirty));
+	CellDirty[CELLS_Y*CELLS_X] = 1; // always draw outside
+	CellDirtyCount = 0;
+	WinPrio = 1;
+	if (full || !(pvid->reg[1]&0x40)) return full;
+
+	Draw2Mode = DRAW2_MARK;
+	SpritesFull();
+	DrawDisplayFull();
+	if (WinPrio != Draw2KeyLast.winprio) full = 1; // window moved to other priority
+	if (CellDirtyCount > CELLS_Y*CELLS_X/2) full = 1; // not worth clipping
+	Draw2Mode = full ? DRAW2_ALL : DRAW2_CLIP;
+	WinPrio = 1;
+
+	return full;
+}
+
+static void Draw2End(int full)
+{
+	if (full) Draw2KeyLast.winprio = WinPrio;
+	if (VramDirty2Any) memset(VramDirty2, 0, sizeof(VramDirty2));
+	VramDirty2Any = Draw2RedrawAll = 0;
+	Draw2Mode = DRAW2_ALL;
+}
+#endif
+
+// draw the frame (or our band of it), sprite lists must be ready
+static void DrawFrameFull(int full)
+{
+#ifdef DRAW2_DIRTY
+	WinPrio = 1;
+	if (!full) {
+		if (CellDirtyCount) {
+			BackFillCells(Pico.video.reg[7]);
+			DrawDisplayFull();
+		}
+		return;
+	}
+#endif
+	BackFillFull(Pico.video.reg[7]);
+	if (Pico.video.reg[1]&0x40) DrawDisplayFull();
+}
+
+#ifdef DRAW2_THREADS
+static pthread_mutex_t BandLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  BandCond = PTHREAD_COND_INITIALIZER;
+static int BandWorkers = 0;                  // started threads, for bands 1..BandWorkers
+static int BandSeq = 0, BandSeen[DRAW2_BANDS_MAX];
+static int BandCount, BandBusy, BandDrawFull; // current frame
+
+static void *BandThread(void *arg)
+{
+	int n = (long)arg;
+
+	pthread_mutex_lock(&BandLock);
+	for (;;)
+	{
+		while (BandSeen[n] == BandSeq)
+			pthread_cond_wait(&BandCond, &BandLock);
+		BandSeen[n] = BandSeq;
+		if (n >= BandCount) continue; // fewer bands this frame
+		pthread_mutex_unlock(&BandLock);
+
+		Band = &Bands[n];
+		DrawFrameFull(BandDrawFull);
+
+		pthread_mutex_lock(&BandLock);
+		if (--BandBusy == 0)
+			pthread_cond_broadcast(&BandCond);
+	}
+
+	return NULL;
+}
+
+// fork() only keeps the calling thread, start new ones in the child
+static void BandAtforkChild(void)
+{
+	BandWorkers = 0;
+}
+
+static void DrawBands(int full)
+{
+	int n = PicoDraw2Threads, rows = END_ROW-START_ROW, i;
+	pthread_t thread;
+
+	if (n > DRAW2_BANDS_MAX) n = DRAW2_BANDS_MAX;
+	if (BandWorkers == 0 && n > 1) pthread_atfork(NULL, NULL, BandAtforkChild);
+	while (BandWorkers < n-1) {
+		BandSeen[BandWorkers+1] = BandSeq;
+		if (pthread_create(&thread, NULL, BandThread, (void *)(long)(BandWorkers+1)) != 0) {
+			elprintf(EL_STATUS, "draw2: failed to create band thread");
+			break;
+		}
+		pthread_detach(thread);
+		BandWorkers++;
+	}
+	if (n > BandWorkers+1) n = BandWorkers+1;
+	if (n <= 1) { DrawFrameFull(full); return; }
+
+	// whole tile rows, first and last bands also get the borders
+	for (i = 0; i < n; i++) {
+		Bands[i].y0 = i > 0   ? 8 + rows*i/n*8     : 0;
+		Bands[i].y1 = i < n-1 ? 8 + rows*(i+1)/n*8 : INT_MAX;
+	}
+#ifdef DRAW_TILE_CACHE
+	// tiles are decoded on first use, don't let several threads do that
+	if (PicoDrawLogGet == NULL) PicoTileCacheFillAll();
+#endif
+
+	pthread_mutex_lock(&BandLock);
+	BandCount = n;
+	BandBusy = n - 1;
+	BandDrawFull = full;
+	BandSeq++;
+	pthread_cond_broadcast(&BandCond);
+	pthread_mutex_unlock(&BandLock);
+
+	Band = &Bands[0];
+	DrawFrameFull(full);
+	Band = NULL;
+
+	pthread_mutex_lock(&BandLock);
+	while (BandBusy > 0)
+		pthread_cond_wait(&BandCond, &BandLock);
+	pthread_mutex_unlock(&BandLock);
+}
+#endif
+
 PICO_INTERNAL void PicoFrameFull()
 {
+	int full = 1;
+	pprof_start(draw);
+
+#ifdef DRAW_TILE_CACHE
+	if (PicoDrawLogGet == NULL) PicoTileCacheSync();
+#endif
+
 	// prepare cram?
 	if(PicoPrepareCram) PicoPrepareCram();
 
 	// Draw screen:
-	BackFillFull(Pico.video.reg[7]);
-	if (Pico.video.reg[1]&0x40) DrawDisplayFull();
+#ifdef DRAW2_DIRTY
+	full = Draw2Begin();
+#endif
+	if (Pico.video.reg[1]&0x40) SpritesFull();
+#ifdef DRAW2_THREADS
+	if (PicoDraw2Threads > 1) DrawBands(full);
+	else
+#endif
+	DrawFrameFull(full);
+#ifdef DRAW2_DIRTY
+	Draw2End(full);
+#endif
+
+	pprof_end(draw);
 }
 
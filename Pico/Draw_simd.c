@@ -0,0 +1,357 @@
+// SIMD versions of the line conversion loops and tile row decoders in Draw.c,
+// for hosts without Draw.s. Selected once by PicoDrawSimdInit() (called from
+// PicoInit) from what the CPU supports, the plain C versions are used otherwise.
+
+#include <limits.h>
+#include "PicoInt.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// len is 256 or 320 (the 32 column border is handled by the callers),
+// pal can have up to 0x100 entries in shadow/hilight mode.
+
+#ifdef SIMD_X86
+__attribute__((target("sse2")))
+static void DrawClutSSE2(unsigned short *pd, unsigned char *ps, unsigned short *pal, int len)
+{
+  __m128i v;
+  int i;
+
+  // no gather in SSE2, but building the vector with pinsrw saves the 16bit stores
+  for (i = 0; i < len; i += 8, ps += 8) {
+    v = _mm_cvtsi32_si128(pal[ps[0]]);
+    v = _mm_insert_epi16(v, pal[ps[1]], 1);
+    v = _mm_insert_epi16(v, pal[ps[2]], 2);
+    v = _mm_insert_epi16(v, pal[ps[3]], 3);
+    v = _mm_insert_epi16(v, pal[ps[4]], 4);
+    v = _mm_insert_epi16(v, pal[ps[5]], 5);
+    v = _mm_insert_epi16(v, pal[ps[6]], 6);
+    v = _mm_insert_epi16(v, pal[ps[7]], 7);
+    _mm_storeu_si128((__m128i *)(pd + i), v);
+  }
+}
+
+__attribute__((target("avx2")))
+static __m256i clut8_avx2(const unsigned short *pal, __m256i idx)
+{
+  // gather aligned entry pairs, so that nothing past the palette is read, then pick the half
+  __m256i pair = _mm256_i32gather_epi32((const int *)pal, _mm256_srli_epi32(idx, 1), 4);
+  __m256i sh   = _mm256_slli_epi32(_mm256_and_si256(idx, _mm256_set1_epi32(1)), 4);
+  return _mm256_and_si256(_mm256_srlv_epi32(pair, sh), _mm256_set1_epi32(0xffff));
+}
+
+__attribute__((target("avx2")))
+static void DrawClutAVX2(unsigned short *pd, unsigned char *ps, unsigned short *pal, int len)
+{
+  __m128i idx;
+  __m256i lo, hi;
+  int i;
+
+  for (i = 0; i < len; i += 16) {
+    idx = _mm_loadu_si128((const __m128i *)(ps + i));
+    lo = clut8_avx2(pal, _mm256_cvtepu8_epi32(idx));
+    hi = clut8_avx2(pal, _mm256_cvtepu8_epi32(_mm_srli_si128(idx, 8)));
+    // packus works within 128bit lanes, fix the order afterwards
+    lo = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xd8);
+    _mm256_storeu_si256((__m256i *)(pd + i), lo);
+  }
+}
+
+__attribute__((target("avx2")))
+static void DrawClut32AVX2(unsigned int *pd, unsigned char *ps, unsigned int *pal, int len)
+{
+  __m256i idx;
+  int i;
+
+  for (i = 0; i < len; i += 8) {
+    idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(ps + i)));
+    _mm256_storeu_si256((__m256i *)(pd + i), _mm256_i32gather_epi32((const int *)pal, idx, 4));
+  }
+}
+
+__attribute__((target("sse2")))
+static void DrawCpyOrSSE2(void *dst, void *src, size_t n, int pat)
+{
+  unsigned char *pd = dst, *ps = src;
+  __m128i p = _mm_set1_epi8((char)pat);
+
+  for (; n >= 16; n -= 16, pd += 16, ps += 16)
+    _mm_storeu_si128((__m128i *)pd, _mm_or_si128(_mm_loadu_si128((const __m128i *)ps), p));
+  for (; n; n--)
+    *pd++ = (unsigned char) (*ps++ | pat);
+}
+
+// Tile rows: a VRAM long has pixels in byte order 1 0 3 2, high nibble first
+// (flipped: 2 3 0 1, low nibble first). One pshufb doubles every byte to a
+// word, then each half of the word keeps one nibble. Transparent (0) pixels
+// are merged back from the old line, so the 8 pixels are written at once.
+#define TILE_SSSE3 __attribute__((target("ssse3")))
+
+TILE_SSSE3
+static inline __m128i tile_sel(__m128i m, __m128i a, __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+
+TILE_SSSE3
+static inline __m128i tile_pix(unsigned int pack, int flip)
+{
+  __m128i w, m_lo = _mm_set1_epi16(0x000f), m_hi = _mm_set1_epi16(0x0f00);
+
+  if (flip) {
+    w = _mm_shuffle_epi8(_mm_cvtsi32_si128(pack), _mm_setr_epi8(2,2,3,3,0,0,1,1, -1,-1,-1,-1,-1,-1,-1,-1));
+    return _mm_or_si128(_mm_and_si128(w, m_lo), _mm_and_si128(_mm_srli_epi16(w, 4), m_hi));
+  }
+  w = _mm_shuffle_epi8(_mm_cvtsi32_si128(pack), _mm_setr_epi8(1,1,0,0,3,3,2,2, -1,-1,-1,-1,-1,-1,-1,-1));
+  return _mm_or_si128(_mm_and_si128(_mm_srli_epi16(w, 4), m_lo), _mm_and_si128(w, m_hi));
+}
+
+// signed compare of z-buffer bytes, like the C code does with char
+TILE_SSSE3
+static inline __m128i tile_zgt(__m128i a, __m128i b)
+{
+#if CHAR_MIN == 0
+  a = _mm_xor_si128(a, _mm_set1_epi8((char)0x80));
+  b = _mm_xor_si128(b, _mm_set1_epi8((char)0x80));
+#endif
+  return _mm_cmpgt_epi8(a, b);
+}
+
+// shadow/hilight operator pixels: (old&0x3f)|0x80 for 0xe, |0xc0 for 0xf
+TILE_SSSE3
+static inline __m128i tile_shop(__m128i pix, __m128i old, __m128i *ef)
+{
+  __m128i f = _mm_cmpeq_epi8(pix, _mm_set1_epi8(0xf));
+  *ef = _mm_or_si128(f, _mm_cmpeq_epi8(pix, _mm_set1_epi8(0xe)));
+  return _mm_or_si128(_mm_and_si128(old, _mm_set1_epi8(0x3f)),
+                      _mm_or_si128(_mm_set1_epi8((char)0x80), _mm_and_si128(f, _mm_set1_epi8(0x40))));
+}
+
+TILE_SSSE3
+static inline void tile_row(unsigned char *pd, unsigned int pack, int pal, int flip)
+{
+  __m128i pix = tile_pix(pack, flip);
+  __m128i old = _mm_loadl_epi64((__m128i *)pd);
+  __m128i tr  = _mm_cmpeq_epi8(pix, _mm_setzero_si128());
+
+  pix = _mm_or_si128(pix, _mm_set1_epi8(pal));
+  _mm_storel_epi64((__m128i *)pd, tile_sel(tr, old, pix));
+}
+
+TILE_SSSE3
+static inline void tile_row_sh(unsigned char *pd, unsigned int pack, int pal, int flip)
+{
+  __m128i pix = tile_pix(pack, flip);
+  __m128i old = _mm_loadl_epi64((__m128i *)pd);
+  __m128i tr  = _mm_cmpeq_epi8(pix, _mm_setzero_si128());
+  __m128i ef, shv = tile_shop(pix, old, &ef);
+
+  pix = tile_sel(ef, shv, _mm_or_si128(pix, _mm_set1_epi8(pal)));
+  _mm_storel_epi64((__m128i *)pd, tile_sel(tr, old, pix));
+}
+
+TILE_SSSE3
+static inline int tile_row_z(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval, int flip)
+{
+  __m128i pix = tile_pix(pack, flip);
+  __m128i old = _mm_loadl_epi64((__m128i *)pd);
+  __m128i zold = _mm_loadl_epi64((__m128i *)zb), zs = zold;
+  __m128i zv = _mm_set1_epi8(zval), zero = _mm_setzero_si128();
+  __m128i nz = _mm_xor_si128(_mm_cmpeq_epi8(pix, zero), _mm_set1_epi8(-1));
+  __m128i w;
+
+  if (flip) zs = _mm_and_si128(zold, _mm_set1_epi8(0x1f)); // TileFlipZ only checks these
+  w = _mm_and_si128(nz, tile_zgt(zv, zs));
+  _mm_storel_epi64((__m128i *)pd, tile_sel(w, _mm_or_si128(pix, _mm_set1_epi8(pal)), old));
+  _mm_storel_epi64((__m128i *)zb, tile_sel(w, zv, zold));
+
+  return _mm_movemask_epi8(_mm_andnot_si128(_mm_cmpeq_epi8(zs, zero), nz)) != 0;
+}
+
+TILE_SSSE3
+static inline int tile_row_zsh(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval, int flip)
+{
+  __m128i pix = tile_pix(pack, flip);
+  __m128i old = _mm_loadl_epi64((__m128i *)pd);
+  __m128i zold = _mm_loadl_epi64((__m128i *)zb);
+  __m128i zv = _mm_set1_epi8(zval), zero = _mm_setzero_si128();
+  __m128i nz = _mm_xor_si128(_mm_cmpeq_epi8(pix, zero), _mm_set1_epi8(-1));
+  __m128i w = _mm_and_si128(nz, tile_zgt(zv, zold));
+  __m128i ef, shv = tile_shop(pix, old, &ef);
+
+  // operator pixels don't update the z-buffer
+  pix = tile_sel(ef, shv, _mm_or_si128(pix, _mm_set1_epi8(pal)));
+  _mm_storel_epi64((__m128i *)pd, tile_sel(w, pix, old));
+  _mm_storel_epi64((__m128i *)zb, tile_sel(_mm_andnot_si128(ef, w), zv, zold));
+
+  return _mm_movemask_epi8(_mm_andnot_si128(_mm_cmpeq_epi8(zold, zero), nz)) != 0;
+}
+
+TILE_SSSE3 static void TileNormSSSE3(unsigned char *pd, unsigned int pack, int pal) { tile_row(pd, pack, pal, 0); }
+TILE_SSSE3 static void TileFlipSSSE3(unsigned char *pd, unsigned int pack, int pal) { tile_row(pd, pack, pal, 1); }
+TILE_SSSE3 static void TileNormSH_SSSE3(unsigned char *pd, unsigned int pack, int pal) { tile_row_sh(pd, pack, pal, 0); }
+TILE_SSSE3 static void TileFlipSH_SSSE3(unsigned char *pd, unsigned int pack, int pal) { tile_row_sh(pd, pack, pal, 1); }
+TILE_SSSE3 static int TileNormZ_SSSE3(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval)
+{ return tile_row_z(pd, zb, pack, pal, zval, 0); }
+TILE_SSSE3 static int TileFlipZ_SSSE3(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval)
+{ return tile_row_z(pd, zb, pack, pal, zval, 1); }
+TILE_SSSE3 static int TileNormZSH_SSSE3(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval)
+{ return tile_row_zsh(pd, zb, pack, pal, zval, 0); }
+TILE_SSSE3 static int TileFlipZSH_SSSE3(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval)
+{ return tile_row_zsh(pd, zb, pack, pal, zval, 1); }
+#endif // SIMD_X86
+
+#ifdef SIMD_NEON
+static void DrawClutNEON(unsigned short *pd, unsigned char *ps, unsigned short *pal, int len)
+{
+  uint8x16x4_t tlo[4], thi[4];
+  uint8x16x2_t v;
+  uint8x16_t idx, i64 = vdupq_n_u8(64), lo, hi;
+  int i, t, tabs;
+
+  // split the palette to low and high byte tables, 64 entries per tbl lookup.
+  // Only HighPal has more than 0x40 entries (cram doesn't)
+  tabs = pal == HighPal ? 4 : 1;
+  for (t = 0; t < tabs; t++)
+    for (i = 0; i < 4; i++) {
+      v = vld2q_u8((const uint8_t *)(pal + t*64 + i*16));
+      tlo[t].val[i] = v.val[0];
+      thi[t].val[i] = v.val[1];
+    }
+
+  for (i = 0; i < len; i += 16) {
+    idx = vld1q_u8(ps + i);
+    lo = vqtbl4q_u8(tlo[0], idx);
+    hi = vqtbl4q_u8(thi[0], idx);
+    for (t = 1; t < tabs; t++) {
+      // out of range indexes leave the previous result in place
+      idx = vsubq_u8(idx, i64);
+      lo = vqtbx4q_u8(lo, tlo[t], idx);
+      hi = vqtbx4q_u8(hi, thi[t], idx);
+    }
+    v.val[0] = lo;
+    v.val[1] = hi;
+    vst2q_u8((uint8_t *)(pd + i), v);
+  }
+}
+
+static void DrawCpyOrNEON(void *dst, void *src, size_t n, int pat)
+{
+  unsigned char *pd = dst, *ps = src;
+  uint8x16_t p = vdupq_n_u8(pat);
+
+  for (; n >= 16; n -= 16, pd += 16, ps += 16)
+    vst1q_u8(pd, vorrq_u8(vld1q_u8(ps), p));
+  for (; n; n--)
+    *pd++ = (unsigned char) (*ps++ | pat);
+}
+
+// tile rows, see the x86 version above: split nibbles, zip them and put in
+// screen order with one vtbl
+static inline uint8x8_t tile_pix_neon(unsigned int pack, int flip)
+{
+  static const uint8_t ord_n[8] = { 2,3,0,1,6,7,4,5 }, ord_f[8] = { 5,4,7,6,1,0,3,2 };
+  uint8x8_t v = vreinterpret_u8_u32(vdup_n_u32(pack));
+  uint8x8x2_t z = vzip_u8(vshr_n_u8(v, 4), vand_u8(v, vdup_n_u8(0x0f)));
+  return vtbl1_u8(z.val[0], vld1_u8(flip ? ord_f : ord_n));
+}
+
+#if CHAR_MIN < 0
+#define tile_zgt_neon(a, b) vcgt_s8(vreinterpret_s8_u8(a), vreinterpret_s8_u8(b))
+#else
+#define tile_zgt_neon(a, b) vcgt_u8(a, b)
+#endif
+
+static inline uint8x8_t tile_shop_neon(uint8x8_t pix, uint8x8_t old, uint8x8_t *ef)
+{
+  uint8x8_t f = vceq_u8(pix, vdup_n_u8(0xf));
+  *ef = vorr_u8(f, vceq_u8(pix, vdup_n_u8(0xe)));
+  return vorr_u8(vand_u8(old, vdup_n_u8(0x3f)), vorr_u8(vdup_n_u8(0x80), vand_u8(f, vdup_n_u8(0x40))));
+}
+
+static inline void tile_row_neon(unsigned char *pd, unsigned int pack, int pal, int flip, int sh)
+{
+  uint8x8_t pix = tile_pix_neon(pack, flip), old = vld1_u8(pd), ef = vdup_n_u8(0), shv = old;
+  uint8x8_t tr = vceq_u8(pix, vdup_n_u8(0));
+
+  if (sh) shv = tile_shop_neon(pix, old, &ef);
+  pix = vorr_u8(pix, vdup_n_u8(pal));
+  if (sh) pix = vbsl_u8(ef, shv, pix);
+  vst1_u8(pd, vbsl_u8(tr, old, pix));
+}
+
+static inline int tile_row_z_neon(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval, int flip, int sh)
+{
+  uint8x8_t pix = tile_pix_neon(pack, flip), old = vld1_u8(pd);
+  uint8x8_t zold = vld1_u8((uint8_t *)zb), zs = zold, zv = vdup_n_u8(zval);
+  uint8x8_t nz = vtst_u8(pix, pix), w, ef = vdup_n_u8(0), shv = old;
+
+  if (flip && !sh) zs = vand_u8(zold, vdup_n_u8(0x1f)); // TileFlipZ only checks these
+  w = vand_u8(nz, tile_zgt_neon(zv, zs));
+  if (sh) shv = tile_shop_neon(pix, old, &ef);
+  pix = vorr_u8(pix, vdup_n_u8(pal));
+  if (sh) pix = vbsl_u8(ef, shv, pix);
+  vst1_u8(pd, vbsl_u8(w, pix, old));
+  vst1_u8((uint8_t *)zb, vbsl_u8(vbic_u8(w, ef), zv, zold));
+
+  return vget_lane_u64(vreinterpret_u64_u8(vand_u8(vtst_u8(zs, zs), nz)), 0) != 0;
+}
+
+static void TileNormNEON(unsigned char *pd, unsigned int pack, int pal)   { tile_row_neon(pd, pack, pal, 0, 0); }
+static void TileFlipNEON(unsigned char *pd, unsigned int pack, int pal)   { tile_row_neon(pd, pack, pal, 1, 0); }
+static void TileNormSH_NEON(unsigned char *pd, unsigned int pack, int pal) { tile_row_neon(pd, pack, pal, 0, 1); }
+static void TileFlipSH_NEON(unsigned char *pd, unsigned int pack, int pal) { tile_row_neon(pd, pack, pal, 1, 1); }
+static int TileNormZ_NEON(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval)
+{ return tile_row_z_neon(pd, zb, pack, pal, zval, 0, 0); }
+static int TileFlipZ_NEON(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval)
+{ return tile_row_z_neon(pd, zb, pack, pal, zval, 1, 0); }
+static int TileNormZSH_NEON(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval)
+{ return tile_row_z_neon(pd, zb, pack, pal, zval, 0, 1); }
+static int TileFlipZSH_NEON(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval)
+{ return tile_row_z_neon(pd, zb, pack, pal, zval, 1, 1); }
+#endif // SIMD_NEON
+
+PICO_INTERNAL void PicoDrawSimdInit(void)
+{
+#ifdef SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    DrawClut  = DrawClutSSE2;
+    DrawCpyOr = DrawCpyOrSSE2;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    DrawClut   = DrawClutAVX2;
+    DrawClut32 = DrawClut32AVX2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    DrawTileNorm    = TileNormSSSE3;
+    DrawTileFlip    = TileFlipSSSE3;
+    DrawTileNormSH  = TileNormSH_SSSE3;
+    DrawTileFlipSH  = TileFlipSH_SSSE3;
+    DrawTileNormZ   = TileNormZ_SSSE3;
+    DrawTileFlipZ   = TileFlipZ_SSSE3;
+    DrawTileNormZSH = TileNormZSH_SSSE3;
+    DrawTileFlipZSH = TileFlipZSH_SSSE3;
+  }
+#endif
+#ifdef SIMD_NEON
+  // always there on aarch64
+  DrawClut  = DrawClutNEON;
+  DrawCpyOr = DrawCpyOrNEON;
+  DrawTileNorm    = TileNormNEON;
+  DrawTileFlip    = TileFlipNEON;
+  DrawTileNormSH  = TileNormSH_NEON;
+  DrawTileFlipSH  = TileFlipSH_NEON;
+  DrawTileNormZ   = TileNormZ_NEON;
+  DrawTileFlipZ   = TileFlipZ_NEON;
+  DrawTileNormZSH = TileNormZSH_NEON;
+  DrawTileFlipZSH = TileFlipZSH_NEON;
+#endif
+}
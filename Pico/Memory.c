@@ -21,11 +21,22 @@ typedef unsigned int   u32;
 
 extern unsigned int lastSSRamWrite; // used by serial SRAM code
 
+#ifdef FAMEC_DRC
+// drop translated code from the RAM pages a write of len bytes went to
+#define DRC_RAM_WRITTEN(a,len) \
+  if (fm68k_drc_ram_code[((a)&0xffff)>>8] | fm68k_drc_ram_code[(((a)+(len)-1)&0xffff)>>8]) \
+    fm68k_drc_invalidate((a)&0xffff, len)
+#else
+#define DRC_RAM_WRITTEN(a,len)
+#endif
+
 #ifdef _ASM_MEMORY_C
 u32  PicoRead8(u32 a);
 u32  PicoRead16(u32 a);
 void PicoWrite8(u32 a,u8 d);
 void PicoWriteRomHW_SSF2(u32 a,u32 d);
+#else
+static void PicoWriteRomHW_SSF2(u32 a,u32 d);
 #endif
 
 
@@ -35,6 +46,14 @@ int lrp_cyc=0, lrp_mus=0, lwp_cyc=0, lwp_mus=0;
 extern unsigned int ppop;
 #endif
 
+// 68k memory map page size (see the map code below)
+#define M68K_MEM_SHIFT 19
+#define M68K_MEM_PAGES (0x1000000 >> M68K_MEM_SHIFT)
+
+#ifndef _ASM_MEMORY_C
+static void m68k_read_map_setup(void);
+#endif
+
 #ifdef IO_STATS
 void log_io(unsigned int addr, int bits, int rw);
 #else
@@ -93,12 +112,6 @@ PICO_INTERNAL int PicoInitPc(u32 pc)
   return 0;
 }
 
-#ifndef _ASM_MEMORY_C
-PICO_INTERNAL_ASM void PicoMemReset(void)
-{
-}
-#endif
-
 // -----------------------------------------------------------------
 
 int PadRead(int i)
@@ -175,6 +188,9 @@ static void SRAMWrite(u32 a, u32 d)
       elprintf(EL_SRAMIO, "eeprom detected.");
       sreg|=4; // this should be a game with EEPROM (like NBA Jam)
       SRam.start=0x200000; SRam.end=SRam.start+1;
+#ifndef _ASM_MEMORY_C
+      m68k_read_map_setup(); // SRAM moved
+#endif
     } else
       elprintf(EL_SRAMIO, "normal sram detected.");
     sreg|=0x10;
@@ -287,21 +303,11 @@ static void OtherWrite8End(u32 a,u32 d,int realsize)
     return;
   }
 
-#ifdef _ASM_MEMORY_C
   // special ROM hardware (currently only banking and sram reg supported)
   if((a&0xfffff1) == 0xA130F1) {
     PicoWriteRomHW_SSF2(a, d); // SSF2 or SRAM
     return;
   }
-#else
-  // sram access register
-  if(a == 0xA130F1) {
-    elprintf(EL_SRAMIO, "sram reg=%02x", d);
-    Pico.m.sram_reg &= ~3;
-    Pico.m.sram_reg |= (u8)(d&3);
-    return;
-  }
-#endif
   elprintf(EL_UIO, "strange w%i: %06x, %08x @%06x", realsize, a&0xffffff, d, SekPc);
 
   if(a >= 0xA13004 && a < 0xA13040) {
@@ -312,6 +318,9 @@ static void OtherWrite8End(u32 a,u32 d,int realsize)
     if (len <= 0) return; // invalid/missing bank
     if (len > 0x200000) len = 0x200000; // 2 megs
     memcpy(Pico.rom, Pico.rom+a, len); // code which does this is in RAM so this is safe.
+#ifdef FAMEC_DRC
+    fm68k_drc_flush();
+#endif
     return;
   }
 
@@ -325,37 +334,286 @@ static void OtherWrite8End(u32 a,u32 d,int realsize)
 
 
 // -----------------------------------------------------------------
-//                     Read Rom and read Ram
+//                          68k memory map
+
+// The 68k address space is split to 32 pages of 512K, the same way
+// m_read*_table in Memory.s does it. A page either points directly to
+// host memory (ROM, RAM) or is served by handlers (I/O, SRAM, VDP).
+
+typedef u32  (m68k_read_f)(u32 a);
+typedef void (m68k_write_f)(u32 a, u32 d);
 
 #ifndef _ASM_MEMORY_C
-PICO_INTERNAL_ASM u32 PicoRead8(u32 a)
+// host pointer (page address already subtracted) or NULL for handler pages
+static u8  *m68k_read_map[M68K_MEM_PAGES];
+static u32  m68k_read_mask[M68K_MEM_PAGES]; // RAM is mirrored, ROM is not
+static m68k_read_f *m68k_read8_table[M68K_MEM_PAGES];
+static m68k_read_f *m68k_read16_table[M68K_MEM_PAGES];
+static m68k_read_f *m68k_read32_table[M68K_MEM_PAGES];
+
+// SSF2 style mapper state is Pico.rom_bank: ROM bank number for each of the first 8 pages
+#define ROM_BANKED(a) \
+  ((a) < 0x400000 ? ((Pico.rom_bank[(a)>>M68K_MEM_SHIFT]<<M68K_MEM_SHIFT)|((a)&0x7ffff)) : (a))
+#else
+#define ROM_BANKED(a) (a)
+#endif
+// only RAM can be written directly, everything else may be some hardware
+static u8  *m68k_write_map[M68K_MEM_PAGES];
+static m68k_write_f *m68k_write8_table[M68K_MEM_PAGES];
+static m68k_write_f *m68k_write16_table[M68K_MEM_PAGES];
+static m68k_write_f *m68k_write32_table[M68K_MEM_PAGES];
+
+
+#ifndef _ASM_MEMORY_C
+// I/O area, VDP, unused space and whatever is above ROM
+static u32 m68k_read8_io(u32 a)
 {
-  u32 d=0;
+  u32 d;
+  log_io(a, 8, 0);
+  if ((a&0xff4000)==0xa00000) return z80Read8(a); // Z80 Ram
 
-  if ((a&0xe00000)==0xe00000) { d = *(u8 *)(Pico.ram+((a^1)&0xffff)); goto end; } // Ram
+  if ((a&0xe700e0)==0xc00000) // VDP
+       d=PicoVideoRead(a);
+  else d=OtherRead16(a&~1, 8);
+  if ((a&1)==0) d>>=8;
+  return d;
+}
 
-  a&=0xffffff;
+static u32 m68k_read16_io(u32 a)
+{
+  log_io(a, 16, 0);
+  if ((a&0xe700e0)==0xc00000)
+    return PicoVideoRead(a);
+  return OtherRead16(a, 16);
+}
 
+static u32 m68k_read32_io(u32 a)
+{
+  log_io(a, 32, 0);
+  if ((a&0xe700e0)==0xc00000)
+    return (PicoVideoRead(a)<<16)|PicoVideoRead(a+2);
+  return (OtherRead16(a, 32)<<16)|OtherRead16(a+2, 32);
+}
+
+// pages with SRAM somewhere in them (SRAM may also overlap ROM)
+static u32 m68k_read8_sram(u32 a)
+{
 #ifndef EMU_CORE_DEBUG
-  // sram
   if (a >= SRam.start && a <= SRam.end && (Pico.m.sram_reg&5)) {
-    d = SRAMRead(a);
+    u32 d = SRAMRead(a);
     elprintf(EL_SRAMIO, "sram r8 [%06x] %02x @ %06x", a, d, SekPc);
-    goto end;
+    return d;
   }
 #endif
+  if (ROM_BANKED(a)<Pico.romsize) return *(u8 *)(Pico.rom+(ROM_BANKED(a)^1)); // Rom
+  return m68k_read8_io(a);
+}
 
-  if (a<Pico.romsize) { d = *(u8 *)(Pico.rom+(a^1)); goto end; } // Rom
-  log_io(a, 8, 0);
-  if ((a&0xff4000)==0xa00000) { d=z80Read8(a); goto end; } // Z80 Ram
+static u32 m68k_read16_sram(u32 a)
+{
+#ifndef EMU_CORE_DEBUG
+  if (a >= SRam.start && a <= SRam.end && (Pico.m.sram_reg&5)) {
+    u32 d = SRAMRead16(a);
+    elprintf(EL_SRAMIO, "sram r16 [%06x] %04x @ %06x", a, d, SekPc);
+    return d;
+  }
+#endif
+  if (ROM_BANKED(a)<Pico.romsize) return *(u16 *)(Pico.rom+ROM_BANKED(a)); // Rom
+  return m68k_read16_io(a);
+}
 
-  if ((a&0xe700e0)==0xc00000) // VDP
-       d=PicoVideoRead(a);
-  else d=OtherRead16(a&~1, 8);
-  if ((a&1)==0) d>>=8;
+static u32 m68k_read32_sram(u32 a)
+{
+  if (a >= SRam.start && a <= SRam.end && (Pico.m.sram_reg&5)) {
+    u32 d = (SRAMRead16(a)<<16)|SRAMRead16(a+2);
+    elprintf(EL_SRAMIO, "sram r32 [%06x] %08x @ %06x", a, d, SekPc);
+    return d;
+  }
+  if (ROM_BANKED(a)<Pico.romsize) { u16 *pm=(u16 *)(Pico.rom+ROM_BANKED(a)); return (pm[0]<<16)|pm[1]; } // Rom
+  return m68k_read32_io(a);
+}
 
-end:
-  elprintf(EL_IO, "r8 : %06x,   %02x @%06x", a&0xffffff, (u8)d, SekPc);
+static void m68k_read_map_page(int i)
+{
+  u32 start = i << M68K_MEM_SHIFT, end = start + (1<<M68K_MEM_SHIFT) - 1;
+  int rom_pages, bank = i < 8 ? Pico.rom_bank[i] : i;
+
+  // ROM allocation is padded (and zero filled) to 512K, so last page can be direct too.
+  // Don't let oversized ROMs cover the I/O area.
+  rom_pages = (Pico.romsize + (1<<M68K_MEM_SHIFT) - 1) >> M68K_MEM_SHIFT;
+  if (rom_pages > (0xa00000>>M68K_MEM_SHIFT)) rom_pages = 0xa00000>>M68K_MEM_SHIFT;
+
+  m68k_read_map[i]  = NULL;
+  m68k_read_mask[i] = 0xffffff;
+  if (start >= 0xe00000) {
+    // 64K of RAM, mirrored
+    m68k_read_map[i]  = Pico.ram;
+    m68k_read_mask[i] = 0xffff;
+  }
+  else if (start <= SRam.end && end >= SRam.start) {
+    m68k_read8_table[i]  = m68k_read8_sram;
+    m68k_read16_table[i] = m68k_read16_sram;
+    m68k_read32_table[i] = m68k_read32_sram;
+  }
+  else if (bank < rom_pages) {
+    m68k_read_map[i]  = Pico.rom + (bank<<M68K_MEM_SHIFT) - start;
+  }
+  else {
+    m68k_read8_table[i]  = m68k_read8_io;
+    m68k_read16_table[i] = m68k_read16_io;
+    m68k_read32_table[i] = m68k_read32_io;
+  }
+}
+
+// needs to be redone every time ROM size or SRAM location changes
+static void m68k_read_map_setup(void)
+{
+  int i;
+  for (i = 0; i < M68K_MEM_PAGES; i++)
+    m68k_read_map_page(i);
+}
+
+#ifdef EMU_F68K
+// let FAME fetch code from the bank which is currently mapped to the page
+static void m68k_fetch_map_page(int i)
+{
+  int f = i << (M68K_MEM_SHIFT-(24-FAMEC_FETCHBITS));
+  int fend = f + (1 << (M68K_MEM_SHIFT-(24-FAMEC_FETCHBITS)));
+  u32 bank_addr = Pico.rom_bank[i] << M68K_MEM_SHIFT;
+
+  for (; f < fend; f++) {
+    if (bank_addr + ((f<<(24-FAMEC_FETCHBITS))&0x7ffff) < Pico.romsize)
+         PicoCpuFM68k.Fetch[f] = (unsigned int)(unsigned long)Pico.rom + bank_addr - (i<<M68K_MEM_SHIFT);
+    else PicoCpuFM68k.Fetch[f] = (unsigned int)(unsigned long)Pico.rom - (f<<(24-FAMEC_FETCHBITS)); // no such bank, same as PicoMemSetup()
+  }
+#ifdef FAMEC_DRC
+  fm68k_drc_flush(); // translated code is looked up by 68k address
+#endif
+}
+#endif
+
+// SSF2 mapper: 0xA130F3-0xA130FF select 512K ROM banks for 0x080000-0x3FFFFF,
+// 0xA130F1 is the SRAM access register. Switching only swaps page pointers.
+static void PicoWriteRomHW_SSF2(u32 a, u32 d)
+{
+  int page = (a>>1)&7;
+
+  if (page == 0) {
+    elprintf(EL_SRAMIO, "sram reg=%02x", d);
+    Pico.m.sram_reg &= ~3;
+    Pico.m.sram_reg |= (u8)(d&3);
+    return;
+  }
+
+  elprintf(EL_UIO, "ssf2 bank%i=%02x @%06x", page, d, SekPc);
+  Pico.rom_bank[page] = (u8)(d&0x1f);
+  m68k_read_map_page(page);
+#ifdef EMU_F68K
+  m68k_fetch_map_page(page);
+#endif
+}
+
+PICO_INTERNAL_ASM void PicoMemReset(void)
+{
+  int i;
+
+  // unmap SSF2 banks (they are all 0 after PicoInit(), MCD has it's own fetchmap)
+  for (i = 0; i < 8; i++) {
+    if (Pico.rom_bank[i] == i) continue;
+    Pico.rom_bank[i] = i;
+#ifdef EMU_F68K
+    if (!(PicoMCD & 1))
+      m68k_fetch_map_page(i);
+#endif
+  }
+  m68k_read_map_setup();
+}
+#endif
+
+// called after emulator instance switch and state load (Area.c), the maps are
+// shared and must be rebuilt for ROM, SRAM and SSF2 banks of the current state
+PICO_INTERNAL void PicoMemRemap(void)
+{
+#ifdef _ASM_MEMORY_C
+  PicoMemReset(); // asm version only updates the ROM area of its tables
+#else
+  m68k_read_map_setup();
+#ifdef EMU_F68K
+  if (!(PicoMCD & 1)) {
+    int i;
+    for (i = 0; i < 8; i++)
+      m68k_fetch_map_page(i);
+  }
+#endif
+#endif
+#ifdef FAMEC_DRC
+  fm68k_drc_flush();
+#endif
+}
+
+static void m68k_write16_vdp(u32 a, u32 d)
+{
+  if ((a&0xe700e0)==0xc00000) { PicoVideoWrite(a,(u16)d); return; }
+  OtherWrite16(a,d);
+}
+
+static void m68k_write32_vdp(u32 a, u32 d)
+{
+  if ((a&0xe700e0)==0xc00000) {
+    PicoVideoWrite(a,  (u16)(d>>16));
+    PicoVideoWrite(a+2,(u16)d);
+    return;
+  }
+  OtherWrite16(a,  (u16)(d>>16));
+  OtherWrite16(a+2,(u16)d);
+}
+
+static void m68k_write32_other(u32 a, u32 d)
+{
+  OtherWrite16(a,  (u16)(d>>16));
+  OtherWrite16(a+2,(u16)d);
+}
+
+// writes don't depend on ROM or SRAM setup, so this is done only once
+static void m68k_write_map_setup(void)
+{
+  int i;
+
+  for (i = 0; i < M68K_MEM_PAGES; i++)
+  {
+    m68k_write_map[i] = NULL;
+    m68k_write8_table[i]  = OtherWrite8;
+    m68k_write16_table[i] = OtherWrite16;
+    m68k_write32_table[i] = m68k_write32_other;
+  }
+  // VDP, mirrored through 0xC00000 - 0xDFFFFF (PSG is handled by OtherWrite8)
+  for (i = 0xc00000>>M68K_MEM_SHIFT; i < (0xe00000>>M68K_MEM_SHIFT); i++)
+  {
+    m68k_write16_table[i] = m68k_write16_vdp;
+    m68k_write32_table[i] = m68k_write32_vdp;
+  }
+  // RAM
+  for (; i < M68K_MEM_PAGES; i++)
+    m68k_write_map[i] = Pico.ram;
+}
+
+
+// -----------------------------------------------------------------
+//                     Read Rom and read Ram
+
+#ifndef _ASM_MEMORY_C
+PICO_INTERNAL_ASM u32 PicoRead8(u32 a)
+{
+  u32 d, page;
+
+  a&=0xffffff;
+  page=a>>M68K_MEM_SHIFT;
+
+  if (m68k_read_map[page] != NULL)
+       d = m68k_read_map[page][(a&m68k_read_mask[page])^1]; // Rom, Ram
+  else d = m68k_read8_table[page](a);
+
+  elprintf(EL_IO, "r8 : %06x,   %02x @%06x", a, (u8)d, SekPc);
 #ifdef EMU_CORE_DEBUG
   if (a>=Pico.romsize) {
     lastread_a = a;
@@ -367,30 +625,16 @@ end:
 
 PICO_INTERNAL_ASM u32 PicoRead16(u32 a)
 {
-  u32 d=0;
-
-  if ((a&0xe00000)==0xe00000) { d=*(u16 *)(Pico.ram+(a&0xfffe)); goto end; } // Ram
+  u32 d, page;
 
   a&=0xfffffe;
+  page=a>>M68K_MEM_SHIFT;
 
-#ifndef EMU_CORE_DEBUG
-  // sram
-  if (a >= SRam.start && a <= SRam.end && (Pico.m.sram_reg&5)) {
-    d = SRAMRead16(a);
-    elprintf(EL_SRAMIO, "sram r16 [%06x] %04x @ %06x", a, d, SekPc);
-    goto end;
-  }
-#endif
-
-  if (a<Pico.romsize) { d = *(u16 *)(Pico.rom+a); goto end; } // Rom
-  log_io(a, 16, 0);
+  if (m68k_read_map[page] != NULL)
+       d = *(u16 *)(m68k_read_map[page]+(a&m68k_read_mask[page]));
+  else d = m68k_read16_table[page](a);
 
-  if ((a&0xe700e0)==0xc00000)
-       d = PicoVideoRead(a);
-  else d = OtherRead16(a, 16);
-
-end:
-  elprintf(EL_IO, "r16: %06x, %04x  @%06x", a&0xffffff, d, SekPc);
+  elprintf(EL_IO, "r16: %06x, %04x  @%06x", a, d, SekPc);
 #ifdef EMU_CORE_DEBUG
   if (a>=Pico.romsize) {
     lastread_a = a;
@@ -402,28 +646,18 @@ end:
 
 PICO_INTERNAL_ASM u32 PicoRead32(u32 a)
 {
-  u32 d=0;
-
-  if ((a&0xe00000)==0xe00000) { u16 *pm=(u16 *)(Pico.ram+(a&0xfffe)); d = (pm[0]<<16)|pm[1]; goto end; } // Ram
+  u32 d, page;
 
   a&=0xfffffe;
+  page=a>>M68K_MEM_SHIFT;
 
-  // sram
-  if(a >= SRam.start && a <= SRam.end && (Pico.m.sram_reg&5)) {
-    d = (SRAMRead16(a)<<16)|SRAMRead16(a+2);
-    elprintf(EL_SRAMIO, "sram r32 [%06x] %08x @ %06x", a, d, SekPc);
-    goto end;
+  if (m68k_read_map[page] != NULL) {
+    u16 *pm=(u16 *)(m68k_read_map[page]+(a&m68k_read_mask[page]));
+    d = (pm[0]<<16)|pm[1];
   }
+  else d = m68k_read32_table[page](a);
 
-  if (a<Pico.romsize) { u16 *pm=(u16 *)(Pico.rom+a); d = (pm[0]<<16)|pm[1]; goto end; } // Rom
-  log_io(a, 32, 0);
-
-  if ((a&0xe700e0)==0xc00000)
-       d = (PicoVideoRead(a)<<16)|PicoVideoRead(a+2);
-  else d = (OtherRead16(a, 32)<<16)|OtherRead16(a+2, 32);
-
-end:
-  elprintf(EL_IO, "r32: %06x, %08x @%06x", a&0xffffff, d, SekPc);
+  elprintf(EL_IO, "r32: %06x, %08x @%06x", a, d, SekPc);
 #ifdef EMU_CORE_DEBUG
   if (a>=Pico.romsize) {
     lastread_a = a;
@@ -434,73 +668,100 @@ end:
 }
 #endif
 
+// ROM and RAM reads without going through handlers, for idle loop detection.
+// returns 0 for anything which might have read side effects
+PICO_INTERNAL int PicoReadPeek(u32 a, int size, u32 *d)
+{
+  u8 *base;
+
+  if (PicoMCD&1) return 0;
+  a&=0xffffff;
+  if (size == 4) {
+    u32 hi, lo;
+    if (!PicoReadPeek(a, 2, &hi) || !PicoReadPeek(a+2, 2, &lo)) return 0;
+    *d = (hi<<16)|lo;
+    return 1;
+  }
+
+#ifndef _ASM_MEMORY_C
+  base = m68k_read_map[a>>M68K_MEM_SHIFT];
+  if (base == NULL) return 0;
+  a &= m68k_read_mask[a>>M68K_MEM_SHIFT];
+#else
+  if (a >= 0xe00000)         { base = Pico.ram; a &= 0xffff; }
+  else if (a < Pico.romsize) base = Pico.rom;
+  else return 0;
+#endif
+  if (size == 1) *d = base[a^1];
+  else           *d = *(u16 *)(base+a);
+  return 1;
+}
+
 // -----------------------------------------------------------------
 //                            Write Ram
 
 #if !defined(_ASM_MEMORY_C) || defined(_ASM_MEMORY_C_AMIPS)
 PICO_INTERNAL_ASM void PicoWrite8(u32 a,u8 d)
 {
+  u32 page;
   elprintf(EL_IO, "w8 : %06x,   %02x @%06x", a&0xffffff, d, SekPc);
 #ifdef EMU_CORE_DEBUG
   lastwrite_cyc_d[lwp_cyc++&15] = d;
 #endif
 
-  if ((a&0xe00000)==0xe00000) { *(u8 *)(Pico.ram+((a^1)&0xffff))=d; return; } // Ram
+  a&=0xffffff;
+  page=a>>M68K_MEM_SHIFT;
+  if (m68k_write_map[page] != NULL) { m68k_write_map[page][(a^1)&0xffff]=d; DRC_RAM_WRITTEN(a,1); return; } // Ram
   log_io(a, 8, 1);
 
-  a&=0xffffff;
-  OtherWrite8(a,d);
+  m68k_write8_table[page](a, d);
 }
 #endif
 
 void PicoWrite16(u32 a,u16 d)
 {
+  u32 page;
   elprintf(EL_IO, "w16: %06x, %04x", a&0xffffff, d);
 #ifdef EMU_CORE_DEBUG
   lastwrite_cyc_d[lwp_cyc++&15] = d;
 #endif
 
-  if ((a&0xe00000)==0xe00000) { *(u16 *)(Pico.ram+(a&0xfffe))=d; return; } // Ram
+  a&=0xfffffe;
+  page=a>>M68K_MEM_SHIFT;
+  if (m68k_write_map[page] != NULL) { *(u16 *)(m68k_write_map[page]+(a&0xffff))=d; DRC_RAM_WRITTEN(a,2); return; } // Ram
   log_io(a, 16, 1);
 
-  a&=0xfffffe;
-  if ((a&0xe700e0)==0xc00000) { PicoVideoWrite(a,(u16)d); return; } // VDP
-  OtherWrite16(a,d);
+  m68k_write16_table[page](a, d);
 }
 
 static void PicoWrite32(u32 a,u32 d)
 {
+  u32 page;
   elprintf(EL_IO, "w32: %06x, %08x", a&0xffffff, d);
 #ifdef EMU_CORE_DEBUG
   lastwrite_cyc_d[lwp_cyc++&15] = d;
 #endif
 
-  if ((a&0xe00000)==0xe00000)
+  a&=0xfffffe;
+  page=a>>M68K_MEM_SHIFT;
+  if (m68k_write_map[page] != NULL)
   {
     // Ram:
-    u16 *pm=(u16 *)(Pico.ram+(a&0xfffe));
+    u16 *pm=(u16 *)(m68k_write_map[page]+(a&0xffff));
     pm[0]=(u16)(d>>16); pm[1]=(u16)d;
+    DRC_RAM_WRITTEN(a,4);
     return;
   }
   log_io(a, 32, 1);
 
-  a&=0xfffffe;
-  if ((a&0xe700e0)==0xc00000)
-  {
-    // VDP:
-    PicoVideoWrite(a,  (u16)(d>>16));
-    PicoVideoWrite(a+2,(u16)d);
-    return;
-  }
-
-  OtherWrite16(a,  (u16)(d>>16));
-  OtherWrite16(a+2,(u16)d);
+  m68k_write32_table[page](a, d);
 }
 
-
 // -----------------------------------------------------------------
 PICO_INTERNAL void PicoMemSetup(void)
 {
+  m68k_write_map_setup();
+
   // Setup memory callbacks:
 #ifdef EMU_C68K
   PicoCpuCM68k.checkpc=PicoCheckPc;
@@ -545,7 +806,7 @@ unsigned int  m68k_read_pcrelative_CD32(unsigned int a);
 static unsigned int  m68k_read_8 (unsigned int a, int do_fake)
 {
   a&=0xffffff;
-  if(a<Pico.romsize && m68ki_cpu_p==&PicoCpuMM68k)    return *(u8 *)(Pico.rom+(a^1)); // Rom
+  if(ROM_BANKED(a)<Pico.romsize && m68ki_cpu_p==&PicoCpuMM68k) return *(u8 *)(Pico.rom+(ROM_BANKED(a)^1)); // Rom
 #ifdef EMU_CORE_DEBUG
   if(do_fake&&((ppop&0x3f)==0x3a||(ppop&0x3f)==0x3b)) return lastread_d[lrp_mus++&15];
 #endif
@@ -556,7 +817,7 @@ static unsigned int  m68k_read_8 (unsigned int a, int do_fake)
 static unsigned int  m68k_read_16(unsigned int a, int do_fake)
 {
   a&=0xffffff;
-  if(a<Pico.romsize && m68ki_cpu_p==&PicoCpuMM68k)    return *(u16 *)(Pico.rom+(a&~1)); // Rom
+  if(ROM_BANKED(a)<Pico.romsize && m68ki_cpu_p==&PicoCpuMM68k) return *(u16 *)(Pico.rom+ROM_BANKED(a&~1)); // Rom
 #ifdef EMU_CORE_DEBUG
   if(do_fake&&((ppop&0x3f)==0x3a||(ppop&0x3f)==0x3b)) return lastread_d[lrp_mus++&15];
 #endif
@@ -567,7 +828,7 @@ static unsigned int  m68k_read_16(unsigned int a, int do_fake)
 static unsigned int  m68k_read_32(unsigned int a, int do_fake)
 {
   a&=0xffffff;
-  if(a<Pico.romsize && m68ki_cpu_p==&PicoCpuMM68k) { u16 *pm=(u16 *)(Pico.rom+(a&~1)); return (pm[0]<<16)|pm[1]; }
+  if(ROM_BANKED(a)<Pico.romsize && m68ki_cpu_p==&PicoCpuMM68k) { u16 *pm=(u16 *)(Pico.rom+ROM_BANKED(a&~1)); return (pm[0]<<16)|pm[1]; }
 #ifdef EMU_CORE_DEBUG
   if(do_fake&&((ppop&0x3f)==0x3a||(ppop&0x3f)==0x3b)) return lastread_d[lrp_mus++&15];
 #endif
@@ -590,8 +851,8 @@ unsigned int m68k_read_disassembler_32(unsigned int a) { return m68k_read_32(a,
 unsigned int m68k_read_memory_8(unsigned int a)
 {
   u8 d;
-  if (a<Pico.romsize && m68ki_cpu_p==&PicoCpuMM68k)
-       d = *(u8 *) (Pico.rom+(a^1));
+  if (ROM_BANKED(a)<Pico.romsize && m68ki_cpu_p==&PicoCpuMM68k)
+       d = *(u8 *) (Pico.rom+(ROM_BANKED(a)^1));
   else d = (u8) lastread_d[lrp_mus++&15];
   elprintf(EL_IO, "r8_mu : %06x,   %02x @%06x", a&0xffffff, d, SekPc);
   return d;
@@ -599,8 +860,8 @@ unsigned int m68k_read_memory_8(unsigned int a)
 unsigned int m68k_read_memory_16(unsigned int a)
 {
   u16 d;
-  if (a<Pico.romsize && m68ki_cpu_p==&PicoCpuMM68k)
-       d = *(u16 *)(Pico.rom+(a&~1));
+  if (ROM_BANKED(a)<Pico.romsize && m68ki_cpu_p==&PicoCpuMM68k)
+       d = *(u16 *)(Pico.rom+ROM_BANKED(a&~1));
   else d = (u16) lastread_d[lrp_mus++&15];
   elprintf(EL_IO, "r16_mu: %06x, %04x @%06x", a&0xffffff, d, SekPc);
   return d;
@@ -608,8 +869,8 @@ unsigned int m68k_read_memory_16(unsigned int a)
 unsigned int m68k_read_memory_32(unsigned int a)
 {
   u32 d;
-  if (a<Pico.romsize && m68ki_cpu_p==&PicoCpuMM68k)
-       { u16 *pm=(u16 *)(Pico.rom+(a&~1));d=(pm[0]<<16)|pm[1]; }
+  if (ROM_BANKED(a)<Pico.romsize && m68ki_cpu_p==&PicoCpuMM68k)
+       { u16 *pm=(u16 *)(Pico.rom+ROM_BANKED(a&~1));d=(pm[0]<<16)|pm[1]; }
   else if (a <= 0x78) d = m68k_read_32(a, 0);
   else d = lastread_d[lrp_mus++&15];
   elprintf(EL_IO, "r32_mu: %06x, %08x @%06x", a&0xffffff, d, SekPc);
@@ -673,6 +934,7 @@ PICO_INTERNAL unsigned char z80_read(unsigned short a)
 
   if ((a>>13)==2) // 0x4000-0x5fff (Charles MacDonald)
   {
+    Z80_SND_SYNC();
     if (PicoOpt&1) ret = (u8) YM2612Read();
     return ret;
   }
@@ -706,6 +968,7 @@ PICO_INTERNAL_ASM void z80_write(unsigned int a, unsigned char data)
 {
   if ((a>>13)==2) // 0x4000-0x5fff (Charles MacDonald)
   {
+    Z80_SND_SYNC();
     if(PicoOpt&1) emustatus|=YM2612Write(a, data) & 1;
     return;
   }
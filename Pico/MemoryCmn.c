@@ -21,6 +21,8 @@ static
 #endif
 u8 z80Read8(u32 a)
 {
+  LINE_SYNC();
+  Z80_SYNC();
   if(Pico.m.z80Run&1) return 0;
 
   a&=0x1fff;
@@ -51,7 +53,9 @@ static
 #endif
 u32 z80ReadBusReq(void)
 {
-  u32 d=Pico.m.z80Run&1;
+  u32 d;
+  Z80_SYNC();
+  d=Pico.m.z80Run&1;
   if (!d && Pico.m.scanline != -1) {
     // needed by buggy Terminator (Sega CD)
     int stop_before = SekCyclesDone() - z80stopCycle;
@@ -71,6 +75,7 @@ static
 #endif
 void z80WriteBusReq(u32 d)
 {
+  Z80_SYNC();
   d&=1; d^=1;
   {
     if (!d)
@@ -80,7 +85,7 @@ void z80WriteBusReq(u32 d)
         int lineCycles;
         z80stopCycle = SekCyclesDone();
         if ((Pico.m.z80Run&2) && Pico.m.scanline != -1)
-             lineCycles=(488-SekCyclesLeft)&0x1ff;
+             lineCycles=(488-SekCyclesLeftLine)&0x1ff;
         else lineCycles=z80stopCycle-z80startCycle; // z80 was started at current line
         if (lineCycles > 0) { // && lineCycles <= 488) {
           //dprintf("zrun: %i/%i cycles", lineCycles, (lineCycles>>1)-(lineCycles>>5));
@@ -89,8 +94,12 @@ void z80WriteBusReq(u32 d)
         }
       }
     } else {
-      if (!Pico.m.z80Run)
+      if (!Pico.m.z80Run) {
         z80startCycle = SekCyclesDone();
+        // z80 time for this line is counted from where the 68k ends it, which
+        // the event scheduler only knows for the last line of a run
+        LINE_SYNC_STOP();
+      }
       else
         d|=Pico.m.z80Run;
     }
@@ -106,6 +115,8 @@ u32 OtherRead16(u32 a, int realsize)
 {
   u32 d=0;
 
+  LINE_SYNC();
+
   if ((a&0xffffe0)==0xa10000) { // I/O ports
     a=(a>>1)&0xf;
     switch(a) {
@@ -125,6 +136,7 @@ u32 OtherRead16(u32 a, int realsize)
   }
 
   if ((a&0xff0000)==0xa00000) {
+    Z80_SYNC();
     if ((a&0x4000)==0x0000) { d=z80Read8(a); d|=d<<8; goto end; } // Z80 ram (not byteswaped)
     if ((a&0x6000)==0x4000) { // 0x4000-0x5fff, Fudge if disabled
       if(PicoOpt&1) d=YM2612Read();
@@ -164,9 +176,11 @@ static
 #endif
 void OtherWrite8(u32 a,u32 d)
 {
+  LINE_SYNC();
+  if ((a&0xff0000)==0xa00000 || a==0xa11200) Z80_SYNC(); // z80 side (busreq syncs itself)
 #if !defined(_ASM_MEMORY_C) || defined(_ASM_MEMORY_C_AMIPS)
   if ((a&0xe700f9)==0xc00011||(a&0xff7ff9)==0xa07f11) { if(PicoOpt&2) SN76496Write(d); return; } // PSG Sound
-  if ((a&0xff4000)==0xa00000)  { if(!(Pico.m.z80Run&1)) Pico.zram[a&0x1fff]=(u8)d; return; } // Z80 ram
+  if ((a&0xff4000)==0xa00000)  { if(!(Pico.m.z80Run&1)) { Pico.zram[a&0x1fff]=(u8)d; Z80_RAM_WRITTEN(a); } return; } // Z80 ram
   if ((a&0xff6000)==0xa04000)  { if(PicoOpt&1) emustatus|=YM2612Write(a&3, d)&1; return; } // FM Sound
   if ((a&0xffffe0)==0xa10000)  { IoWrite8(a, d); return; } // I/O ports
 #endif
@@ -200,10 +214,12 @@ static
 #endif
 void OtherWrite16(u32 a,u32 d)
 {
+  LINE_SYNC();
+  if ((a&0xff0000)==0xa00000 || a==0xa11200) Z80_SYNC();
   if (a==0xa11100)            { z80WriteBusReq(d>>8); return; }
   if (a==0xa11200)            { elprintf(EL_BUSREQ, "write z80reset: %04x", d); if(!(d&0x100)) z80_reset(); return; }
   if ((a&0xffffe0)==0xa10000) { IoWrite8(a, d); return; } // I/O ports
-  if ((a&0xff4000)==0xa00000) { if(!(Pico.m.z80Run&1)) Pico.zram[a&0x1fff]=(u8)(d>>8); return; } // Z80 ram (MSB only)
+  if ((a&0xff4000)==0xa00000) { if(!(Pico.m.z80Run&1)) { Pico.zram[a&0x1fff]=(u8)(d>>8); Z80_RAM_WRITTEN(a); } return; } // Z80 ram (MSB only)
   if ((a&0xe700f8)==0xc00010||(a&0xff7ff8)==0xa07f10) { if(PicoOpt&2) SN76496Write(d); return; } // PSG Sound
   if ((a&0xff6000)==0xa04000)  { if(PicoOpt&1) emustatus|=YM2612Write(a&3, d)&1; return; } // FM Sound (??)
   if ((a&0xff7f00)==0xa06000) // Z80 BANK register
@@ -333,5 +333,8 @@ void PicoPatchApply(void)
 				PicoWrite16(addr, PicoPatches[i].data);
 		}
 	}
+#ifdef FAMEC_DRC
+	fm68k_drc_flush();
+#endif
 }
 
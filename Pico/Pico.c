@@ -21,6 +21,12 @@ void (*PicoWriteSound)(int len) = 0; // called once per frame at the best time t
 
 struct PicoSRAM SRam = {0,};
 int z80startCycle, z80stopCycle; // in 68k cycles
+#ifdef EVENT_SCHED
+void (*PicoLineSync)(int stop) = NULL;
+#endif
+#ifdef Z80_LAZY
+void (*PicoZ80Sync)(int z80_side) = NULL;
+#endif
 int PicoPad[2];  // Joypads, format is SACB RLDU
 int PicoMCD = 0; // mega CD status: scd_started
 
@@ -30,6 +36,7 @@ int PicoInit(void)
   // Blank space for state:
   memset(&Pico,0,sizeof(Pico));
   memset(&PicoPad,0,sizeof(PicoPad));
+  PicoTileCacheDirty(0, 0x10000);
 
   // Init CPUs:
   SekInit();
@@ -37,6 +44,10 @@ int PicoInit(void)
 
   PicoInitMCD();
 
+#ifdef DRAW_SIMD
+  PicoDrawSimdInit();
+#endif
+
   SRam.data=0;
 
   return 0;
@@ -47,6 +58,7 @@ void PicoExit(void)
 {
   if (PicoMCD&1)
     PicoExitMCD();
+  SekExit();
   z80_exit();
 
   if(SRam.data) free(SRam.data); SRam.data=0;
@@ -203,6 +215,10 @@ static __inline void SekRunM68k(int cyc)
   int cyc_do;
   SekCycleAim+=cyc;
   if((cyc_do=SekCycleAim-SekCycleCnt) <= 0) return;
+#if defined(SEK_IDLE) && !defined(EMU_CORE_DEBUG)
+  { int skip=SekIdle(cyc_do); SekCycleCnt+=skip; cyc_do-=skip; }
+#endif
+  pprof_start(m68k);
 #if defined(EMU_CORE_DEBUG)
   // this means we do run-compare
   SekCycleCnt+=CM_compareRun(cyc_do, 0);
@@ -212,9 +228,12 @@ static __inline void SekRunM68k(int cyc)
   SekCycleCnt+=cyc_do-PicoCpuCM68k.cycles;
 #elif defined(EMU_M68K)
   SekCycleCnt+=m68k_execute(cyc_do);
+#elif defined(FAMEC_DRC_COMPARE)
+  SekCycleCnt+=CM_compareRun(cyc_do+1, 0);
 #elif defined(EMU_F68K)
   SekCycleCnt+=fm68k_emulate(cyc_do+1, 0);
 #endif
+  pprof_end(m68k);
 }
 
 static __inline void SekStep(void)
@@ -229,6 +248,8 @@ static __inline void SekStep(void)
   SekCycleCnt+=1-PicoCpuCM68k.cycles;
 #elif defined(EMU_M68K)
   SekCycleCnt+=m68k_execute(1);
+#elif defined(FAMEC_DRC_COMPARE)
+  SekCycleCnt+=CM_compareRun(1, 0);
 #elif defined(EMU_F68K)
   SekCycleCnt+=fm68k_emulate(1, 0);
 #endif
@@ -296,11 +317,16 @@ static void PicoRunZ80Simple(int line_from, int line_to)
       Psnd_timers_and_dac(line);
       if ((line == 224 || line == line_sample) && PsndOut) getSamples(line);
       if (line == 32 && PsndOut) emustatus &= ~1;
-      if (line >= line_from_r && line < line_to_r)
+      if (line >= line_from_r && line < line_to_r) {
+        pprof_start(z80);
         z80_run_nr(228);
+        pprof_end(z80);
+      }
     }
   } else if (line_to_r-line_from_r > 0) {
+    pprof_start(z80);
     z80_run_nr(228*(line_to_r-line_from_r));
+    pprof_end(z80);
     // samples will be taken by caller
   }
 }
@@ -390,6 +416,7 @@ static int PicoFrameSimple(void)
       for (y=0;y<224;y++) PicoLine(y);
 #endif
     else PicoFrameFull();
+    PicoFrameFinish();
 #ifdef DRAW_FINISH_FUNC
     DRAW_FINISH_FUNC();
 #endif
@@ -457,6 +484,14 @@ int PicoFrame(void)
 
   Pico.m.frame_count++;
 
+#ifdef FAMEC_DRC
+  // translated code only for the main 68k, MCD memory map is not handled
+  fm68k_drc_ctx = ((PicoOpt & 0x80000) || (PicoMCD & 1)) ? NULL : &PicoCpuFM68k;
+#endif
+#ifdef CZ80_DRC
+  cz80_drc_ctx = (PicoOpt & 0x100000) ? NULL : &CZ80;
+#endif
+
   if (PicoMCD & 1) {
     PicoFrameMCD();
     return 0;
@@ -483,8 +518,13 @@ int PicoFrame(void)
 void PicoFrameDrawOnly(void)
 {
   int y;
+  // frontends use this to draw VRAM they changed directly (savestate previews),
+  // so don't trust the decoded tile cache before or after
+  PicoTileCacheDirty(0, 0x10000);
   PicoFrameStart();
   for (y=0;y<224;y++) PicoLine(y);
+  PicoFrameFinish();
+  PicoTileCacheDirty(0, 0x10000);
 }
 
 // callback to output message from emu
@@ -34,7 +34,8 @@ void mp3_update(int *buffer, int length, int stereo);
 // alt_renderer, 6button_gamepad, accurate_timing, accurate_sprites,
 // draw_no_32col_border, external_ym2612, enable_cd_pcm, enable_cd_cdda
 // enable_cd_gfx, cd_perfect_sync, soft_32col_scaling, enable_cd_ramcart
-// disable_vdp_fifo
+// disable_vdp_fifo, per_line_sched, no_68k_idle_skip, no_68k_drc, no_z80_drc,
+// cd_s68k_thread
 extern int PicoOpt;
 extern int PicoVer;
 extern int PicoSkipFrame; // skip rendering frame, but still do sound (if enabled) and emulation stuff
@@ -67,9 +68,22 @@ extern areaeof *areaEof;
 extern areaseek *areaSeek;
 extern areaclose *areaClose;
 extern void (*PicoStateProgressCB)(const char *str);
+// in-memory states (rewind, run-ahead), only for the same game in the same process
+size_t PicoStateSize(void);
+int PicoStateSave(void *buf, size_t len); // 0 on success
+int PicoStateLoad(const void *buf, size_t len);
+// whole emulator snapshots (ROM pointer and settings included). Not separate instances:
+// there is still only one emulator, Save copies it out and Load puts it back.
+struct PicoContext;
+struct PicoContext *PicoContextNew(void);
+void PicoContextFree(struct PicoContext *ctx);
+void PicoContextSave(struct PicoContext *ctx);
+void PicoContextLoad(struct PicoContext *ctx);
+
+int PicoStateLoadGfx(void *file); // only VRAM, CRAM, VSRAM and VDP regs, for menu thumbnails
 
 // cd/Area.c
-int PicoCdLoadStateGfx(void *file);
+int PicoCdLoadStateGfx(void *file); // old MCD states only, PicoStateLoadGfx() handles all
 
 // cd/buffering.c
 void PicoCDBufferInit(void);
@@ -105,12 +119,21 @@ extern void (*PicoCartLoadProgressCB)(int percent);
 extern void (*PicoCDLoadProgressCB)(int percent);
 
 // Draw.c
-void PicoDrawSetColorFormat(int which); // 0=BGR444, 1=RGB555, 2=8bit(HighPal pal)
+void PicoDrawSetColorFormat(int which); // 0=BGR444, 1=RGB555, 2=8bit(HighPal pal), 3=RGB565 (full range), 4=XRGB8888
 extern void *DrawLineDest;
 #if OVERRIDE_HIGHCOL
 extern unsigned char *HighCol;
 #endif
 extern int (*PicoScan)(unsigned int num, void *data);
+// pipelined drawing (C renderer only): when PicoDrawLogGet is set, PicoFrame() doesn't draw, but records
+// VDP changes for the visible lines to logs taken from it (may block until one is free), and hands
+// them to PicoDrawLogPut. PicoDrawLogReplay() then draws them, logs must be replayed in that order.
+struct PicoDrawLog;
+extern struct PicoDrawLog *(*PicoDrawLogGet)(void);
+extern void (*PicoDrawLogPut)(struct PicoDrawLog *log);
+struct PicoDrawLog *PicoDrawLogNew(void);
+void PicoDrawLogFree(struct PicoDrawLog *log);
+void PicoDrawLogReplay(struct PicoDrawLog *log);
 // internals
 extern unsigned short HighPal[0x100];
 extern int rendstatus;
@@ -125,6 +148,8 @@ void vidConvCpyRGB565(void *to, void *from, int pixels);
 // Draw2.c
 // stuff below is optional
 extern unsigned char  *PicoDraw2FB;  // buffer for fasr renderer in format (8+320)x(8+224+8) (eights for borders)
+                                     // with DRAW2_DIRTY only changed parts are redrawn, so don't draw to it yourself
+extern int PicoDraw2Threads;         // with DRAW2_THREADS: split the frame to this many bands, each drawn on it's own thread
 extern unsigned short *PicoCramHigh; // pointer to CRAM buff (0x40 shorts), converted to native device color (works only with 16bit for now)
 extern void (*PicoPrepareCram)();    // prepares PicoCramHigh for renderer to use
 
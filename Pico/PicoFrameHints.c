@@ -16,29 +16,48 @@
     if(Pico.m.padDelay[1]++ > 25) Pico.m.padTHPhase[1]=0; \
   }
 
-#define Z80_RUN(z80_cycles) \
+#if defined(Z80_LAZY) && !defined(PICO_CD)
+// lazy z80: Z80_RUN only moves the aim and remembers it for every line
+#define Z80_LAZY_ON z80_lazy
+#define Z80_LINE_DONE() if (z80_lazy) z80_line_aim[z80_lines++] = z80CycleAim
+#define SND_TIMERS(y) if (!z80_lazy && (PicoOpt&1)) Psnd_timers_and_dac(y)
+#define Z80_CATCH_UP() if (z80_lazy) PicoZ80CatchUp()
+#else
+#define Z80_LAZY_ON 0
+#define Z80_LINE_DONE()
+#define SND_TIMERS(y) if (PicoOpt&1) Psnd_timers_and_dac(y)
+#define Z80_CATCH_UP()
+#endif
+
+// m68k_done: 68k cycles done at the end of the line z80 is run for
+#define Z80_RUN(z80_cycles,m68k_done) \
 { \
   if ((PicoOpt&4) && Pico.m.z80Run) \
   { \
     int cnt; \
     if (Pico.m.z80Run & 2) z80CycleAim += z80_cycles; \
     else { \
-      cnt = SekCyclesDone() - z80startCycle; \
+      cnt = (m68k_done) - z80startCycle; \
       cnt = (cnt>>1)-(cnt>>5); \
       if (cnt < 0 || cnt > (z80_cycles)) cnt = z80_cycles; \
       Pico.m.z80Run |= 2; \
       z80CycleAim+=cnt; \
     } \
     cnt=z80CycleAim-total_z80; \
-    if (cnt > 0) total_z80+=z80_run(cnt); \
+    if (cnt > 0 && !Z80_LAZY_ON) { \
+      pprof_start(z80); \
+      total_z80+=z80_run(cnt); \
+      pprof_end(z80); \
+    } \
   } \
+  Z80_LINE_DONE(); \
 }
 
 // CPUS_RUN
 #ifndef PICO_CD
 #define CPUS_RUN(m68k_cycles,z80_cycles,s68k_cycles) \
     SekRunM68k(m68k_cycles); \
-    Z80_RUN(z80_cycles);
+    Z80_RUN(z80_cycles, SekCyclesDone());
 #else
 #define CPUS_RUN(m68k_cycles,z80_cycles,s68k_cycles) \
 { \
@@ -49,16 +68,236 @@
       if ((Pico_mcd->m.busreq&3) == 1) /* no busreq/no reset */ \
         SekRunS68k(s68k_cycles); \
     } \
-    Z80_RUN(z80_cycles); \
+    Z80_RUN(z80_cycles, SekCyclesDone()); \
+}
+#endif
+
+static int hint; // H-Int counter
+static int lines_vis, line_sample, skip;
+static int total_z80, z80CycleAim;
+
+#if defined(Z80_LAZY) && !defined(PICO_CD)
+// Lazy z80: it is not run every line, but only when the 68k accesses it's side
+// (PicoZ80Sync from the handlers), before sound is rendered and on V-Int. Then
+// it runs in one go up to where it would be with per line scheduling. YM timers
+// and DAC are done lazily too, up to the line z80 is in, when it accesses YM.
+static int z80_lazy, z80_run_len, z80_lines, snd_line;
+static int z80_line_aim[320]; // z80CycleAim after every line, [0] is before line 0
+
+static void PicoZ80Run(void)
+{
+  int cnt = z80CycleAim - total_z80;
+
+  // like the per line loop, only run the aims of lines z80 has run through,
+  // not what's left from before it was started or from the last frame
+  if (cnt > 0 && (PicoOpt&4) && (Pico.m.z80Run&2) && z80_lines > 0 && !z80_run_len) {
+#ifdef EVENT_SCHED
+    void (*line_sync)(int stop) = PicoLineSync;
+    PicoLineSync = NULL; // not for z80 accesses
+#endif
+    z80_run_len = cnt;
+    pprof_start(z80);
+    total_z80 += z80_run(cnt);
+    pprof_end(z80);
+    z80_run_len = 0;
+#ifdef EVENT_SCHED
+    PicoLineSync = line_sync;
+#endif
+  }
+}
+
+// YM timers and DAC, up to and including line y
+static void PicoSndCatchUp(int y)
+{
+  if (y >= z80_lines) y = z80_lines - 1; // scanline is stale before line 0
+  for (; snd_line <= y; snd_line++)
+    if (PicoOpt&1)
+      Psnd_timers_and_dac(snd_line);
+}
+
+static void PicoZ80CatchUp(void)
+{
+  PicoZ80Run();
+  PicoSndCatchUp(Pico.m.scanline);
+}
+
+static void PicoZ80SyncHints(int z80_side)
+{
+  if (z80_side) {
+    // z80 is in the line before the first one which has it's aim past it
+    int i, pos;
+    if (!z80_run_len) return;
+    pos = total_z80 + z80_run_len - z80_cyclesLeft;
+    for (i = snd_line; i < z80_lines && z80_line_aim[i] <= pos; i++);
+    PicoSndCatchUp(i-1);
+    return;
+  }
+
+  if (z80CycleAim > total_z80) {
+    pprof_end(m68k);
+    PicoZ80Run();
+    pprof_start(m68k);
+  }
+  PicoSndCatchUp(Pico.m.scanline);
+}
+#endif
+
+// things done at the start of every active scan line
+static void PicoLineStartVis(int y)
+{
+  struct PicoVideo *pv=&Pico.video;
+
+  Pico.m.scanline=(short)y;
+
+  // VDP FIFO
+  pv->lwrite_cnt -= 12;
+  if (pv->lwrite_cnt <= 0) {
+    pv->lwrite_cnt=0;
+    Pico.video.status|=0x200;
+  }
+
+  PAD_DELAY
+#ifdef PICO_CD
+  check_cd_dma();
+#endif
+
+  // H-Interrupts:
+  if (--hint < 0) // y <= lines_vis: Comix Zone, Golden Axe
+  {
+    hint=pv->reg[10]; // Reload H-Int counter
+    pv->pending_ints|=0x10;
+    if (pv->reg[0]&0x10) {
+      elprintf(EL_INTS, "hint: @ %06x [%i]", SekPc, SekCycleCnt);
+      SekInterrupt(4);
+    }
+  }
+
+  // decide if we draw this line
+#if CAN_HANDLE_240_LINES
+  if(!skip && ((!(pv->reg[1]&8) && y<224) || (pv->reg[1]&8)) )
+#else
+  if(!skip && y<224)
+#endif
+    PicoLine(y);
+
+  SND_TIMERS(y);
+
+#ifndef PICO_CD
+  // get samples from sound chips
+  if(y == 32 || y == 224 || y == line_sample)
+    Z80_CATCH_UP();
+  if(y == 32 && PsndOut)
+    emustatus &= ~1;
+  else if((y == 224 || y == line_sample) && PsndOut)
+    getSamples(y);
+#endif
+}
+
+// ..and of every line after the V-Int one
+static void PicoLineStartVBlank(int y)
+{
+  Pico.m.scanline=(short)y;
+
+  PAD_DELAY
+#ifdef PICO_CD
+  check_cd_dma();
+#endif
+
+  SND_TIMERS(y);
+}
+
+#if defined(EVENT_SCHED) && !defined(PICO_CD)
+// Event driven scheduling: the 68k is not stopped at every line, but run up to
+// the next line where something it can notice happens (H-Int, V-Int, DMA).
+// Start of line work and the z80 are done for the lines it has passed when it
+// touches hardware (PicoLineSync from the handlers) or when the run is over.
+static int run_line_last; // the line current 68k run ends with
+
+// do line events and run the z80 up to the start of line y_to
+static void PicoLinesCatchUp(int y_to)
+{
+  int y, line_end = SekCycleAim - (run_line_last - Pico.m.scanline) * CYCLES_M68K_LINE;
+
+  for (y = Pico.m.scanline; y < y_to; y++, line_end += CYCLES_M68K_LINE)
+  {
+    Z80_RUN(CYCLES_Z80_LINE, line_end);
+    if (y+1 < lines_vis)
+         PicoLineStartVis(y+1);
+    else PicoLineStartVBlank(y+1);
+  }
+}
+
+static void PicoLineSyncHints(int stop)
+{
+  int left = SekCyclesLeft, y = run_line_last;
+
+  // still in the same line? (the common case, when 68k polls something)
+  if (left > (run_line_last - Pico.m.scanline) * CYCLES_M68K_LINE && !stop)
+    return;
+
+  if (left > 0) y -= (left-1) / CYCLES_M68K_LINE; // the line 68k is in
+
+  if (y > Pico.m.scanline) {
+    pprof_end(m68k);
+    PicoLineSync = NULL; // z80 can access the same hardware
+    PicoLinesCatchUp(y);
+    PicoLineSync = PicoLineSyncHints;
+    pprof_start(m68k);
+  }
+
+  if (stop && y < run_line_last) {
+    // the rest needs per line handling, so end the run with this line
+    int cut = (run_line_last - y) * CYCLES_M68K_LINE;
+    SekCycleAim -= cut;
+    SekCycleCnt -= cut;
+    SekSetCyclesLeftNoMCD(SekCyclesLeftNoMCD - cut);
+    run_line_last = y;
+  }
 }
+
+// run 68k from current line to the end of y_last, returns the line it stopped at
+static int PicoRunLines(int y_last)
+{
+  run_line_last = y_last;
+  PicoLineSync = PicoLineSyncHints;
+  SekRunM68k((y_last - Pico.m.scanline + 1) * CYCLES_M68K_LINE);
+  while (SekCycleCnt < SekCycleAim) // returned early to take an irq
+    SekRunM68k(0);
+  PicoLineSync = NULL;
+
+  PicoLinesCatchUp(run_line_last);
+  Z80_RUN(CYCLES_Z80_LINE, SekCyclesDone());
+
+  return run_line_last;
+}
+
+// per line compatibility mode is PicoOpt 0x20000
+#define RUN_LINES(y,y_last) \
+  if (!(PicoOpt&0x20000) && !Pico.m.dma_xfers && (y_last) > y) { \
+    y = PicoRunLines(y_last); \
+    continue; \
+  }
+#else
+#define RUN_LINES(y,y_last)
 #endif
 
 // Accurate but slower frame which does hints
 static int PicoFrameHints(void)
 {
   struct PicoVideo *pv=&Pico.video;
-  int lines, y, lines_vis = 224, total_z80 = 0, z80CycleAim = 0, line_sample, skip;
-  int hint; // Hint counter
+  int lines, y;
+
+  lines_vis = 224;
+  total_z80 = 0;
+#if defined(Z80_LAZY) && !defined(PICO_CD)
+  // per line compatibility mode runs z80 every line too
+  z80_lazy = !(PicoOpt&0x20000);
+  z80_lines = snd_line = 0;
+  PicoZ80Sync = z80_lazy ? PicoZ80SyncHints : NULL;
+#ifdef Z80_IDLE
+  z80_idle_ym = !z80_lazy; // timers move while lazy z80 runs
+#endif
+#endif
 
   if ((PicoOpt&0x10) && !PicoSkipFrame) {
     // draw a frame just after vblank in alternative render mode
@@ -99,52 +338,12 @@ static int PicoFrameHints(void)
 
   for (y=0;y<lines_vis;y++)
   {
-    Pico.m.scanline=(short)y;
-
-    // VDP FIFO
-    pv->lwrite_cnt -= 12;
-    if (pv->lwrite_cnt <= 0) {
-      pv->lwrite_cnt=0;
-      Pico.video.status|=0x200;
-    }
-
-    PAD_DELAY
-#ifdef PICO_CD
-    check_cd_dma();
-#endif
-
-    // H-Interrupts:
-    if (--hint < 0) // y <= lines_vis: Comix Zone, Golden Axe
-    {
-      hint=pv->reg[10]; // Reload H-Int counter
-      pv->pending_ints|=0x10;
-      if (pv->reg[0]&0x10) {
-        elprintf(EL_INTS, "hint: @ %06x [%i]", SekPc, SekCycleCnt);
-        SekInterrupt(4);
-      }
-    }
-
-    // decide if we draw this line
-#if CAN_HANDLE_240_LINES
-    if(!skip && ((!(pv->reg[1]&8) && y<224) || (pv->reg[1]&8)) )
-#else
-    if(!skip && y<224)
-#endif
-      PicoLine(y);
-
-    if(PicoOpt&1)
-      Psnd_timers_and_dac(y);
-
-#ifndef PICO_CD
-    // get samples from sound chips
-    if(y == 32 && PsndOut)
-      emustatus &= ~1;
-    else if((y == 224 || y == line_sample) && PsndOut)
-      getSamples(y);
-#endif
+    PicoLineStartVis(y);
 
     // Run scanline:
     if (Pico.m.dma_xfers) SekCyclesBurn(CheckDMA());
+    // ..or lines up to the next H-Int
+    RUN_LINES(y, (pv->reg[0]&0x10) && y+hint < lines_vis-1 ? y+hint : lines_vis-1);
     CPUS_RUN(CYCLES_M68K_LINE, CYCLES_Z80_LINE, CYCLES_S68K_LINE);
 
 #ifdef PICO_CD
@@ -152,6 +351,8 @@ static int PicoFrameHints(void)
 #endif
   }
 
+  if (!skip)
+    PicoFrameFinish();
 #ifdef DRAW_FINISH_FUNC
   if (!skip)
     DRAW_FINISH_FUNC();
@@ -191,11 +392,11 @@ static int PicoFrameHints(void)
     elprintf(EL_INTS, "vint: @ %06x [%i]", SekPc, SekCycleCnt);
     SekInterrupt(6);
   }
+  Z80_CATCH_UP(); // lazy z80 must get to the V-Int first
   if (Pico.m.z80Run && (PicoOpt&4))
     z80_int();
 
-  if (PicoOpt&1)
-    Psnd_timers_and_dac(y);
+  SND_TIMERS(y);
 
   // get samples from sound chips
 #ifndef PICO_CD
@@ -218,18 +419,11 @@ static int PicoFrameHints(void)
 
   for (y++;y<lines;y++)
   {
-    Pico.m.scanline=(short)y;
-
-    PAD_DELAY
-#ifdef PICO_CD
-    check_cd_dma();
-#endif
-
-    if(PicoOpt&1)
-      Psnd_timers_and_dac(y);
+    PicoLineStartVBlank(y);
 
     // Run scanline:
     if (Pico.m.dma_xfers) SekCyclesBurn(CheckDMA());
+    RUN_LINES(y, lines-1);
     CPUS_RUN(CYCLES_M68K_LINE, CYCLES_Z80_LINE, CYCLES_S68K_LINE);
 
 #ifdef PICO_CD
@@ -237,10 +431,49 @@ static int PicoFrameHints(void)
 #endif
   }
 
+  Z80_CATCH_UP();
+#if defined(Z80_LAZY) && !defined(PICO_CD)
+  PicoZ80Sync = NULL;
+#ifdef Z80_IDLE
+  z80_idle_ym = 1;
+#endif
+#endif
+
   return 0;
 }
 
+// frame loop state for PicoContextSave() (Area.c)
+#ifdef PICO_CD
+struct PicoArea PicoFrameCtxVarsCD[] =
+#else
+struct PicoArea PicoFrameCtxVars[] =
+#endif
+{
+  CTX_VAR(hint),
+  CTX_VAR(lines_vis),
+  CTX_VAR(line_sample),
+  CTX_VAR(skip),
+  CTX_VAR(total_z80),
+  CTX_VAR(z80CycleAim),
+#if defined(Z80_LAZY) && !defined(PICO_CD)
+  CTX_VAR(z80_lazy),
+  CTX_VAR(z80_run_len),
+  CTX_VAR(z80_lines),
+  CTX_VAR(snd_line),
+  CTX_VAR(z80_line_aim),
+#endif
+#if defined(EVENT_SCHED) && !defined(PICO_CD)
+  CTX_VAR(run_line_last),
+#endif
+  { NULL }
+};
+
 #undef PAD_DELAY
 #undef Z80_RUN
 #undef CPUS_RUN
+#undef RUN_LINES
+#undef Z80_LAZY_ON
+#undef Z80_LINE_DONE
+#undef SND_TIMERS
+#undef Z80_CATCH_UP
 
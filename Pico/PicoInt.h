@@ -24,6 +24,15 @@
 #define PICO_INTERNAL_ASM
 #endif
 
+// profiling points (used by the headless benchmark port)
+#ifdef PPROF
+#include "../platform/bench/pprof.h"
+#else
+#define pprof_start(point)
+#define pprof_end(point)
+#define pprof_sampled(n) 0
+#endif
+
 // to select core, define EMU_C68K, EMU_M68K or EMU_F68K in your makefile or project
 
 #ifdef __cplusplus
@@ -145,6 +154,22 @@ extern unsigned int SekCycleCntT; // total cycle counter, updated once per frame
 	SekSetCyclesLeft(after); \
 }
 
+#ifdef EVENT_SCHED
+// in accurate mode the 68k may be run for several lines at once (see PicoFrameHints.c),
+// handlers of hardware it can observe call this to do line events and z80 up to now.
+// stop also ends the run with current line, for things which need per line handling.
+extern void (*PicoLineSync)(int stop);
+#define LINE_SYNC()      { if (PicoLineSync) PicoLineSync(0); }
+#define LINE_SYNC_STOP() { if (PicoLineSync) PicoLineSync(1); }
+// cycles left till the end of the line 68k is in
+#define SekCyclesLeftLine \
+	((PicoLineSync && SekCyclesLeft > 488) ? (SekCyclesLeft-1)%488+1 : SekCyclesLeft)
+#else
+#define LINE_SYNC()
+#define LINE_SYNC_STOP()
+#define SekCyclesLeftLine SekCyclesLeft
+#endif
+
 extern int SekCycleCntS68k;
 extern int SekCycleAimS68k;
 
@@ -170,8 +195,7 @@ extern int SekCycleAimS68k;
 #if defined(_USE_MZ80)
 #include "../../cpu/mz80/mz80.h"
 
-#define z80_run(cycles)    mz80_run(cycles)
-#define z80_run_nr(cycles) mz80_run(cycles)
+#define z80_exec(cycles)   mz80_run(cycles)
 #define z80_int()          mz80int(0)
 #define z80_resetCycles()  mz80GetElapsedTicks(1)
 
@@ -180,8 +204,7 @@ extern int SekCycleAimS68k;
 
 extern struct DrZ80 drZ80;
 
-#define z80_run(cycles)    ((cycles) - DrZ80Run(&drZ80, cycles))
-#define z80_run_nr(cycles) DrZ80Run(&drZ80, cycles)
+#define z80_exec(cycles)   ((cycles) - DrZ80Run(&drZ80, cycles))
 #define z80_int() { \
   drZ80.z80irqvector = 0xFF; /* default IRQ vector RST opcode */ \
   drZ80.Z80_IRQ = 1; \
@@ -191,8 +214,8 @@ extern struct DrZ80 drZ80;
 #elif defined(_USE_CZ80)
 #include "../../cpu/cz80/cz80.h"
 
-#define z80_run(cycles)    Cz80_Exec(&CZ80, cycles)
-#define z80_run_nr(cycles) Cz80_Exec(&CZ80, cycles)
+#define z80_exec(cycles)   Cz80_Exec(&CZ80, cycles)
+#define z80_cyclesLeft     CZ80.ICount // valid in memhandlers only
 #define z80_int()          Cz80_Set_IRQ(&CZ80, 0, HOLD_LINE)
 #define z80_resetCycles()
 
@@ -205,6 +228,41 @@ extern struct DrZ80 drZ80;
 
 #endif
 
+#ifdef z80_exec
+#ifdef Z80_IDLE
+// runs are skipped while z80 spins in a loop which can't exit by itself (see sound.c)
+PICO_INTERNAL int z80_run_idle(int cycles);
+extern int z80_idle_ym;
+#define z80_run(cycles)    z80_run_idle(cycles)
+#define z80_run_nr(cycles) z80_run_idle(cycles)
+#else
+#define z80_run(cycles)    z80_exec(cycles)
+#define z80_run_nr(cycles) z80_exec(cycles)
+#endif
+#endif
+
+#ifdef Z80_LAZY
+#ifndef z80_cyclesLeft
+#error Z80_LAZY needs a z80 core with z80_cyclesLeft (cz80)
+#endif
+// in accurate mode z80 is run only when something needs it (see PicoFrameHints.c).
+// 68k handlers of z80 RAM, YM, bank and busreq/reset call Z80_SYNC to run it up to
+// now, z80 handlers call Z80_SND_SYNC before YM access to get timers and DAC to it.
+extern void (*PicoZ80Sync)(int z80_side);
+#define Z80_SYNC()     { if (PicoZ80Sync) PicoZ80Sync(0); }
+#define Z80_SND_SYNC() { if (PicoZ80Sync) PicoZ80Sync(1); }
+#else
+#define Z80_SYNC()
+#define Z80_SND_SYNC()
+#endif
+
+#ifdef CZ80_DRC
+// z80 RAM at a was written, drop translated code there
+#define Z80_RAM_WRITTEN(a) { if (cz80_drc_code[(a)&0x1fff]) cz80_drc_invalidate((a)&0x1fff); }
+#else
+#define Z80_RAM_WRITTEN(a)
+#endif
+
 // ---------------------------------------------------------
 
 extern int PicoMCD;
@@ -267,6 +325,8 @@ struct Pico
 
   struct PicoMisc m;
   struct PicoVideo video;
+
+  unsigned char rom_bank[8];   // SSF2 mapper (C memory handlers only)
 };
 
 // sram
@@ -359,12 +419,48 @@ typedef struct
 #define Pico_mcd ((mcd_state *)Pico.rom)
 
 // Area.c
+struct PicoArea { void *data; int len; char *name; };
+#define CTX_VAR(x) { &x, sizeof(x), #x }
 PICO_INTERNAL int PicoAreaPackCpu(unsigned char *cpu, int is_sub);
 PICO_INTERNAL int PicoAreaUnpackCpu(unsigned char *cpu, int is_sub);
+// module statics which are saved with contexts, NULL terminated
+extern struct PicoArea PicoFrameCtxVars[];   // Pico.c
+extern struct PicoArea PicoFrameCtxVarsCD[]; // cd/Pico.c
+extern struct PicoArea SekCtxVars[];         // Sek.c
+extern struct PicoArea PsndCtxVars[];        // sound/sound.c
+
+// savestate chunk ids, used by v2 states (Area.c) and old MCD ones (cd/Area.c)
+typedef enum {
+	CHUNK_M68K = 1,
+	CHUNK_RAM,
+	CHUNK_VRAM,
+	CHUNK_ZRAM,
+	CHUNK_CRAM,	// 5
+	CHUNK_VSRAM,
+	CHUNK_MISC,
+	CHUNK_VIDEO,
+	CHUNK_Z80,
+	CHUNK_PSG,	// 10
+	CHUNK_FM,
+	// CD stuff
+	CHUNK_S68K,
+	CHUNK_PRG_RAM,
+	CHUNK_WORD_RAM,
+	CHUNK_PCM_RAM,	// 15
+	CHUNK_BRAM,
+	CHUNK_GA_REGS,
+	CHUNK_PCM,
+	CHUNK_CDC,
+	CHUNK_CDD,	// 20
+	CHUNK_SCD,
+	CHUNK_RC,
+	CHUNK_MISC_CD,
+	CHUNK_ROM_BANK,	// SSF2 mapper, v2 states only
+} chunk_name_e;
 
 // cd/Area.c
-PICO_INTERNAL int PicoCdSaveState(void *file);
 PICO_INTERNAL int PicoCdLoadState(void *file);
+PICO_INTERNAL void PicoCdStateLoaded(void);
 
 // Cart.c
 PICO_INTERNAL void PicoCartDetect(void);
@@ -375,15 +471,66 @@ int CM_compareRun(int cyc, int is_sub);
 // Draw.c
 PICO_INTERNAL int PicoLine(int scan);
 PICO_INTERNAL void PicoFrameStart(void);
+PICO_INTERNAL void PicoFrameFinish(void);
+// PicoDrawLog entry keys
+#define DRAW_LOG_SIZE  0x10000 // entries per log
+#define DRAW_LOG_VRAM  0x0000  // | word address
+#define DRAW_LOG_CRAM  0x8000  // | word address
+#define DRAW_LOG_VSRAM 0x8100  // | word address
+#define DRAW_LOG_REG   0x8200  // | reg number
+#define DRAW_LOG_LINE  0x8300  // draw line (data)
+extern struct PicoDrawLog *PicoDrawLogCur; // log being recorded, or NULL
+PICO_INTERNAL void PicoDrawLogWrite(unsigned int key, unsigned int d);
+extern void (*DrawClut)(unsigned short *pd, unsigned char *ps, unsigned short *pal, int len);
+extern void (*DrawClut32)(unsigned int *pd, unsigned char *ps, unsigned int *pal, int len);
+extern void (*DrawCpyOr)(void *dst, void *src, size_t n, int pat);
+#ifdef DRAW_SIMD
+// tile row decoders, pack is a VRAM long (8 pixels); Z versions return collision
+extern void (*DrawTileNorm)  (unsigned char *pd, unsigned int pack, int pal);
+extern void (*DrawTileFlip)  (unsigned char *pd, unsigned int pack, int pal);
+extern void (*DrawTileNormSH)(unsigned char *pd, unsigned int pack, int pal);
+extern void (*DrawTileFlipSH)(unsigned char *pd, unsigned int pack, int pal);
+extern int  (*DrawTileNormZ)  (unsigned char *pd, char *zb, unsigned int pack, int pal, int zval);
+extern int  (*DrawTileFlipZ)  (unsigned char *pd, char *zb, unsigned int pack, int pal, int zval);
+extern int  (*DrawTileNormZSH)(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval);
+extern int  (*DrawTileFlipZSH)(unsigned char *pd, char *zb, unsigned int pack, int pal, int zval);
+#endif
+
+#if defined(DRAW_TILE_CACHE) || defined(DRAW2_DIRTY)
+PICO_INTERNAL void PicoTileCacheDirty(unsigned int a, int len); // VRAM bytes a..a+len-1 written
+#else
+#define PicoTileCacheDirty(a,len)
+#endif
+#ifdef DRAW_TILE_CACHE
+PICO_INTERNAL unsigned char *PicoTileCacheGet(int tile); // 8x8 pixel bytes
+PICO_INTERNAL void PicoTileCacheSync(void);
+PICO_INTERNAL void PicoTileCacheFillAll(void);
+// put 8 cached pixels to pd, 0 is transparent (no carries between bytes, pixels are < 16)
+#define TILE_CACHE_PUT(pd,pix,pal) { \
+  unsigned long long m_, o_; \
+  m_ = ((((pix) + 0x7f7f7f7f7f7f7f7fULL) & 0x8080808080808080ULL) >> 7) * 0xff; \
+  memcpy(&o_, pd, 8); \
+  o_ = (o_ & ~m_) | (((pix) | (pal) * 0x0101010101010101ULL) & m_); \
+  memcpy(pd, &o_, 8); \
+}
+#endif
+
+// Draw_simd.c
+PICO_INTERNAL void PicoDrawSimdInit(void);
 
 // Draw2.c
 PICO_INTERNAL void PicoFrameFull();
+#ifdef DRAW2_DIRTY
+PICO_INTERNAL void PicoDraw2VramDirty(unsigned int a, int len);
+#endif
 
 // Memory.c
 PICO_INTERNAL int PicoInitPc(unsigned int pc);
 PICO_INTERNAL_ASM unsigned int PicoRead32(unsigned int a);
 PICO_INTERNAL void PicoMemSetup(void);
 PICO_INTERNAL_ASM void PicoMemReset(void);
+PICO_INTERNAL void PicoMemRemap(void);
+PICO_INTERNAL int PicoReadPeek(unsigned int a, int size, unsigned int *d);
 PICO_INTERNAL int PadRead(int i);
 PICO_INTERNAL unsigned char z80_read(unsigned short a);
 #ifndef _USE_CZ80
@@ -417,12 +564,25 @@ PICO_INTERNAL int SekInit(void);
 PICO_INTERNAL int SekReset(void);
 PICO_INTERNAL void SekState(int *data);
 PICO_INTERNAL void SekSetRealTAS(int use_real);
+PICO_INTERNAL void SekExit(void);
+#ifdef SEK_IDLE
+PICO_INTERNAL int SekIdle(int cycles);
+#endif
 
 // cd/Sek.c
 PICO_INTERNAL int SekInitS68k(void);
 PICO_INTERNAL int SekResetS68k(void);
 PICO_INTERNAL int SekInterruptS68k(int irq);
 
+// cd/s68k_thread.c
+#ifdef S68K_THREAD
+extern volatile int s68k_thread_active;
+extern int s68k_thread_reset;
+PICO_INTERNAL int  s68k_thread_run(void);
+PICO_INTERNAL void s68k_thread_sync_m68k(int barrier);
+PICO_INTERNAL void s68k_thread_sync_s68k(int barrier);
+#endif
+
 // sound/sound.c
 extern int PsndLen_exc_cnt;
 extern int PsndLen_exc_add;
@@ -430,6 +590,7 @@ extern int PsndLen_exc_add;
 // VideoPort.c
 PICO_INTERNAL_ASM void PicoVideoWrite(unsigned int a,unsigned short d);
 PICO_INTERNAL_ASM unsigned int PicoVideoRead(unsigned int a);
+PICO_INTERNAL unsigned int PicoVideoStatus(void);
 
 // Misc.c
 PICO_INTERNAL void SRAMWriteEEPROM(unsigned int d);
@@ -449,6 +610,7 @@ PICO_INTERNAL void PicoCDBufferRead(void *dest, int lba);
 
 // sound/sound.c
 PICO_INTERNAL void PsndReset(void);
+PICO_INTERNAL void dac_recalculate(void);
 PICO_INTERNAL void Psnd_timers_and_dac(int raster);
 PICO_INTERNAL int  PsndRender(int offset, int length);
 PICO_INTERNAL void PsndClear(void);
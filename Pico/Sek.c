@@ -128,6 +128,11 @@ PICO_INTERNAL int SekInit()
     PicoCpuFM68k.sr = 0x2704; // Z flag
     g_m68kcontext = oldcontext;
   }
+#ifdef FAMEC_DRC
+  if (fm68k_drc_init() != 0)
+    elprintf(EL_STATUS, "68k translator init failed, using famec only");
+  fm68k_drc_set_ram(Pico.ram, 0x10000);
+#endif
 #endif
 
   return 0;
@@ -159,6 +164,9 @@ PICO_INTERNAL int SekReset()
     g_m68kcontext = &PicoCpuFM68k;
     fm68k_reset();
   }
+#ifdef FAMEC_DRC
+  fm68k_drc_flush();
+#endif
 #endif
 
   return 0;
@@ -189,3 +197,347 @@ PICO_INTERNAL void SekSetRealTAS(int use_real)
 #endif
 }
 
+
+#ifdef SEK_IDLE
+// Idle loop detection. Games often wait for V-Int in short loops which poll VDP
+// status or a RAM flag set by the interrupt handler. If the loop at PC keeps
+// going round the same way with what is in memory now, whole trips around it
+// are skipped: only an interrupt or other hardware can change that memory,
+// which happens between runs. The core still runs the last trip, so it stops
+// exactly where it would.
+static int idle_runs, idle_skips;
+
+// status bits which may change during a run (hblank, dma, sprites, fifo)
+#define IDLE_ST_VOLATILE 0x0366
+
+struct sek_idle {
+  unsigned int pc;
+  unsigned int d[8];
+  unsigned int dv[8]; // volatile bits in data regs, can't be relied on
+  int n, z, v, c, fknown; // flags, fknown: NZVC bitmask
+  int cycles;
+};
+
+#define IF_N 8
+#define IF_Z 4
+#define IF_V 2
+#define IF_C 1
+
+static unsigned int idle_mask(int size)
+{
+  return size == 1 ? 0xff : size == 2 ? 0xffff : 0xffffffff;
+}
+
+// memory which can only change between runs
+static int idle_read(unsigned int a, int size, unsigned int *d, unsigned int *dv)
+{
+  unsigned int st, m = IDLE_ST_VOLATILE;
+
+  a &= 0xffffff;
+  *dv = 0;
+  if ((a&0xe700e0) == 0xc00000 && (a&0x1c) == 4) {
+    st = PicoVideoStatus();
+    if      (size == 1) { *d = (a&1) ? (st&0xff) : (st>>8); *dv = (a&1) ? (m&0xff) : (m>>8); }
+    else if (size == 2) { *d = st; *dv = m; }
+    else                { *d = (st<<16) | st; *dv = (m<<16) | m; }
+    return 1;
+  }
+  return PicoReadPeek(a, size, d);
+}
+
+// source operand: Dn, (An), d16(An), (xxx).w, (xxx).l, #imm
+static int idle_ea(struct sek_idle *s, int *regs, int ea, int size, unsigned int *val, unsigned int *vv)
+{
+  int mode = (ea >> 3) & 7, r = ea & 7, l = size == 4 ? 4 : 0;
+  unsigned int a, w;
+
+  switch (mode) {
+    case 0: // Dn
+      *val = s->d[r] & idle_mask(size);
+      *vv = s->dv[r] & idle_mask(size);
+      return 1;
+    case 2: // (An)
+      a = regs[8+r];
+      s->cycles += 4 + l;
+      break;
+    case 5: // d16(An)
+      if (!PicoReadPeek(s->pc, 2, &w)) return 0;
+      a = regs[8+r] + (short)w;
+      s->pc += 2;
+      s->cycles += 8 + l;
+      break;
+    case 7:
+      if (r == 0) { // (xxx).w
+        if (!PicoReadPeek(s->pc, 2, &w)) return 0;
+        a = (short)w; s->pc += 2;
+        s->cycles += 8 + l;
+      } else if (r == 1) { // (xxx).l
+        if (!PicoReadPeek(s->pc, 4, &a)) return 0;
+        s->pc += 4;
+        s->cycles += 12 + l;
+      } else if (r == 4) { // #imm
+        if (!PicoReadPeek(s->pc + (size == 1), size, val)) return 0;
+        s->pc += l ? 4 : 2;
+        s->cycles += 4 + l;
+        *vv = 0;
+        return 1;
+      } else return 0;
+      break;
+    default:
+      return 0;
+  }
+
+  if (size > 1 && (a&1)) return 0;
+  return idle_read(a, size, val, vv);
+}
+
+static void idle_flags_nz(struct sek_idle *s, unsigned int v, unsigned int vv, int size)
+{
+  unsigned int m = idle_mask(size), top = 1 << (size*8 - 1);
+
+  v &= m; vv &= m;
+  s->n = !!(v & top);
+  s->z = v == 0;
+  s->v = s->c = 0;
+  s->fknown = IF_V|IF_C;
+  if (!(vv & top)) s->fknown |= IF_N;
+  if (!vv || (v & ~vv)) s->fknown |= IF_Z;
+}
+
+static void idle_flags_cmp(struct sek_idle *s, unsigned int dst, unsigned int src, unsigned int vv, int size)
+{
+  unsigned int m = idle_mask(size), r = (dst - src) & m;
+  int sh = size*8 - 1;
+
+  dst &= m; src &= m;
+  s->n = (r >> sh) & 1;
+  s->z = r == 0;
+  s->v = (((dst ^ src) & (dst ^ r)) >> sh) & 1;
+  s->c = src > dst;
+  s->fknown = (vv & m) ? 0 : IF_N|IF_Z|IF_V|IF_C;
+}
+
+static int idle_cond(struct sek_idle *s, int cc)
+{
+  static const unsigned char need[16] = {
+    0, 0, IF_C|IF_Z, IF_C|IF_Z, IF_C, IF_C, IF_Z, IF_Z,
+    IF_V, IF_V, IF_N, IF_N, IF_N|IF_V, IF_N|IF_V, IF_N|IF_V|IF_Z, IF_N|IF_V|IF_Z
+  };
+
+  if ((s->fknown & need[cc]) != need[cc]) return -1;
+  switch (cc) {
+    case 0:  return 1;
+    case 1:  return 0;
+    case 2:  return !s->c && !s->z;
+    case 3:  return s->c || s->z;
+    case 4:  return !s->c;
+    case 5:  return s->c;
+    case 6:  return !s->z;
+    case 7:  return s->z;
+    case 8:  return !s->v;
+    case 9:  return s->v;
+    case 10: return !s->n;
+    case 11: return s->n;
+    case 12: return s->n == s->v;
+    case 13: return s->n != s->v;
+    case 14: return !s->z && s->n == s->v;
+    default: return s->z || s->n != s->v;
+  }
+}
+
+// execute one instruction of a possible idle loop, adding it's cycles.
+// Returns 0 if such loop can't have it or it's outcome isn't certain.
+static int idle_step(struct sek_idle *s, int *regs)
+{
+  static const unsigned char sizes[4] = { 1, 2, 4, 0 }; // b w l
+  static const unsigned char msizes[4] = { 0, 1, 4, 2 }; // move b l w
+  unsigned int op, v, vv, imm, ivv;
+  int size, r, cc;
+
+  if (!PicoReadPeek(s->pc, 2, &op)) return 0;
+  s->pc += 2;
+
+  if (op == 0x4e71) { // nop
+    s->cycles += 4;
+    return 1;
+  }
+
+  if ((op & 0xf000) == 0x6000) { // Bcc
+    unsigned int target;
+    cc = (op >> 8) & 0xf;
+    if (cc == 1) return 0; // bsr
+    if ((op & 0xff) == 0) {
+      if (!PicoReadPeek(s->pc, 2, &v)) return 0;
+      target = s->pc + (short)v; s->pc += 2;
+    } else
+      target = s->pc + (signed char)op;
+    switch (idle_cond(s, cc)) {
+      case 1:  s->pc = target; s->cycles += 10; return 1;
+      case 0:  s->cycles += (op & 0xff) ? 8 : 12; return 1;
+      default: return 0;
+    }
+  }
+
+  if ((op & 0xc000) == 0 && (op & 0x3000) && (op & 0x01c0) == 0) { // move <ea>,Dn
+    size = msizes[(op >> 12) & 3];
+    r = (op >> 9) & 7;
+    if (!idle_ea(s, regs, op & 0x3f, size, &v, &vv)) return 0;
+    s->d[r]  = (s->d[r]  & ~idle_mask(size)) | v;
+    s->dv[r] = (s->dv[r] & ~idle_mask(size)) | vv;
+    idle_flags_nz(s, v, vv, size);
+    s->cycles += 4;
+    return 1;
+  }
+
+  if ((op & 0xff00) == 0x4a00 && (op & 0xc0) != 0xc0) { // tst
+    size = sizes[(op >> 6) & 3];
+    if (!idle_ea(s, regs, op & 0x3f, size, &v, &vv)) return 0;
+    idle_flags_nz(s, v, vv, size);
+    s->cycles += 4;
+    return 1;
+  }
+
+  if ((op & 0xffc0) == 0x0800 || (op & 0xf1c0) == 0x0100) { // btst #n,<ea> / btst Dn,<ea>
+    if (op & 0x0100) {
+      r = (op >> 9) & 7;
+      if (s->dv[r] & 0x1f) return 0;
+      imm = s->d[r];
+      s->cycles += 4;
+    } else {
+      if (!PicoReadPeek(s->pc, 2, &imm)) return 0;
+      s->pc += 2;
+      s->cycles += 8;
+    }
+    if ((op & 0x38) == 0) { // Dn
+      r = op & 7;
+      v = s->d[r]; vv = s->dv[r];
+      imm &= 31;
+      s->cycles += 2;
+    } else {
+      if (!idle_ea(s, regs, op & 0x3f, 1, &v, &vv)) return 0;
+      imm &= 7; // bit number is mod 8 for memory
+    }
+    if (vv & (1 << imm)) return 0;
+    s->z = !(v & (1 << imm));
+    s->fknown |= IF_Z;
+    return 1;
+  }
+
+  if ((op & 0xff00) == 0x0c00 && (op & 0xc0) != 0xc0) { // cmpi #imm,<ea>
+    size = sizes[(op >> 6) & 3];
+    if (!idle_ea(s, regs, 0x3c, size, &imm, &ivv)) return 0;
+    if (!idle_ea(s, regs, op & 0x3f, size, &v, &vv)) return 0;
+    idle_flags_cmp(s, v, imm, vv, size);
+    s->cycles += (size == 4 && !(op & 0x38)) ? 6 : 4;
+    return 1;
+  }
+
+  if ((op & 0xff38) == 0x0200 && (op & 0xc0) != 0xc0) { // andi #imm,Dn
+    size = sizes[(op >> 6) & 3];
+    r = op & 7;
+    if (!idle_ea(s, regs, 0x3c, size, &imm, &ivv)) return 0;
+    v  = s->d[r]  & imm & idle_mask(size);
+    vv = s->dv[r] & imm & idle_mask(size);
+    s->d[r]  = (s->d[r]  & ~idle_mask(size)) | v;
+    s->dv[r] = (s->dv[r] & ~idle_mask(size)) | vv;
+    idle_flags_nz(s, v, vv, size);
+    s->cycles += size == 4 ? 6 : 4;
+    return 1;
+  }
+
+  if ((op & 0xf100) == 0xb000 && (op & 0xc0) != 0xc0) { // cmp <ea>,Dn
+    size = sizes[(op >> 6) & 3];
+    r = (op >> 9) & 7;
+    if (!idle_ea(s, regs, op & 0x3f, size, &v, &vv)) return 0;
+    idle_flags_cmp(s, s->d[r], v, vv | s->dv[r], size);
+    s->cycles += size == 4 ? 6 : 4;
+    return 1;
+  }
+
+  return 0;
+}
+
+// one trip around the loop from pc back to it, 0 if it doesn't get there
+static int idle_trip(struct sek_idle *s, int *regs, unsigned int pc)
+{
+  int i;
+
+  s->cycles = 0;
+  for (i = 0; i < 16; i++) {
+    if (!idle_step(s, regs)) return 0;
+    if (s->pc == pc) return s->cycles;
+  }
+  return 0;
+}
+
+// returns cycles a trip around the idle loop at pc takes, 0 if it's not one
+static int SekIsIdle(unsigned int pc)
+{
+  struct sek_idle s;
+  int regs[0x11], r;
+  unsigned int sr = 0;
+
+  SekState(regs);
+#ifdef EMU_C68K
+  sr = CycloneGetSr(&PicoCpuCM68k);
+#elif defined(EMU_M68K)
+  sr = m68k_get_reg(&PicoCpuMM68k, M68K_REG_SR);
+#elif defined(EMU_F68K)
+  sr = PicoCpuFM68k.sr;
+#endif
+  memset(&s, 0, sizeof(s));
+  memcpy(s.d, regs, sizeof(s.d));
+  s.n = (sr >> 3) & 1; s.z = (sr >> 2) & 1; s.v = (sr >> 1) & 1; s.c = sr & 1;
+  s.fknown = IF_N|IF_Z|IF_V|IF_C;
+  s.pc = pc;
+
+  // go around once from the current state, registers and flags must come back
+  // the same (apart from volatile bits), else the loop is about to exit or
+  // has not settled yet
+  if (!idle_trip(&s, regs, pc)) return 0;
+  for (r = 0; r < 8; r++)
+    if ((s.d[r] ^ regs[r]) & ~s.dv[r]) return 0;
+  if ((((s.n << 3) | (s.z << 2) | (s.v << 1) | s.c) & s.fknown) != (sr & s.fknown)) return 0;
+
+  // second trip must not depend on bits which may change meanwhile
+  return idle_trip(&s, regs, pc);
+}
+
+// called before a run, returns how many cycles of it can be skipped
+PICO_INTERNAL int SekIdle(int cycles)
+{
+  int trip;
+
+  if (PicoOpt & 0x40000) return 0;
+
+  idle_runs++;
+  if (SekShouldInterrupt) return 0;
+  trip = SekIsIdle(SekPc);
+  if (trip == 0 || cycles <= trip) return 0;
+
+  idle_skips++;
+  return (cycles - 1) / trip * trip;
+}
+#endif
+
+// for PicoContextSave() (Area.c)
+struct PicoArea SekCtxVars[] =
+{
+#ifdef SEK_IDLE
+  CTX_VAR(idle_runs),
+  CTX_VAR(idle_skips),
+#endif
+  { NULL }
+};
+
+PICO_INTERNAL void SekExit(void)
+{
+#ifdef SEK_IDLE
+  if (idle_runs)
+    elprintf(EL_STATUS, "68k idle skips: %i/%i (%i%%)\n", idle_skips, idle_runs,
+      (int)((double)idle_skips * 100 / idle_runs));
+#endif
+#ifdef FAMEC_DRC
+  fm68k_drc_exit();
+#endif
+}
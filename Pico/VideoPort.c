@@ -15,6 +15,11 @@ extern const unsigned char  hcounts_40[];
 extern const unsigned short vcounts[];
 extern int rendstatus;
 
+// when drawing is pipelined, rendstatus belongs to the render thread, which
+// sets the flags itself while replaying the logged writes
+#define VRAM_CHANGED() \
+  if (PicoDrawLogGet == NULL) rendstatus|=0x10
+
 #ifndef UTYPES_DEFINED
 typedef unsigned char  u8;
 typedef unsigned short u16;
@@ -36,10 +41,16 @@ static void VideoWrite(u16 d)
   {
     case 1: if(a&1) d=(u16)((d<<8)|(d>>8)); // If address is odd, bytes are swapped (which game needs this?)
             Pico.vram [(a>>1)&0x7fff]=d;
-            rendstatus|=0x10; break;
+            if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_VRAM|((a>>1)&0x7fff), d);
+            PicoTileCacheDirty(a&0xfffe, 2);
+            VRAM_CHANGED(); break;
     case 3: Pico.m.dirtyPal = 1;
-            Pico.cram [(a>>1)&0x003f]=d; break; // wraps (Desert Strike)
-    case 5: Pico.vsram[(a>>1)&0x003f]=d; break;
+            Pico.cram [(a>>1)&0x003f]=d; // wraps (Desert Strike)
+            if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_CRAM|((a>>1)&0x003f), d);
+            break;
+    case 5: Pico.vsram[(a>>1)&0x003f]=d;
+            if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_VSRAM|((a>>1)&0x003f), d);
+            break;
 #ifndef A320
     default:elprintf(EL_ANOMALY, "VDP write %04x with bad type %i", d, Pico.video.type); break;
 #else
@@ -97,6 +108,7 @@ static void DmaSlow(int len)
     SekCyclesDone(), SekPc);
 
   if(Pico.m.scanline != -1) {
+    LINE_SYNC_STOP();
     Pico.m.dma_xfers += len;
     if ((PicoMCD&1) && (PicoOpt & 0x2000)) SekCyclesBurn(CheckDMA());
     else SekSetCyclesLeftNoMCD(SekCyclesLeftNoMCD - CheckDMA());
@@ -160,7 +172,12 @@ static void DmaSlow(int len)
       {
         // most used DMA mode
         memcpy16(r + (a>>1), pd, len);
-        a += len*2;
+        PicoTileCacheDirty(a, len*2);
+        if (PicoDrawLogCur)
+          for (; len; len--, a += 2)
+            PicoDrawLogWrite(DRAW_LOG_VRAM|(a>>1), r[a>>1]);
+        else
+          a += len*2;
       }
       else
       {
@@ -169,13 +186,15 @@ static void DmaSlow(int len)
           d=*pd++;
           if(a&1) d=(d<<8)|(d>>8);
           r[a>>1] = (u16)d; // will drop the upper bits
+          if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_VRAM|(a>>1), r[a>>1]);
+          PicoTileCacheDirty(a&~1, 2);
           // AutoIncrement
           a=(u16)(a+inc);
           // didn't src overlap?
           //if(pd >= pdend) pd-=0x8000; // should be good for RAM, bad for ROM
         }
       }
-      rendstatus|=0x10;
+      VRAM_CHANGED();
       break;
 
     case 3: // cram
@@ -184,6 +203,7 @@ static void DmaSlow(int len)
       for(a2=a&0x7f; len; len--)
       {
         r[a2>>1] = (u16)*pd++; // bit 0 is ignored
+        if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_CRAM|(a2>>1), r[a2>>1]);
         // AutoIncrement
         a2+=inc;
         // didn't src overlap?
@@ -199,6 +219,7 @@ static void DmaSlow(int len)
       for(a2=a&0x7f; len; len--)
       {
         r[a2>>1] = (u16)*pd++;
+        if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_VSRAM|(a2>>1), r[a2>>1]);
         // AutoIncrement
         a2+=inc;
         // didn't src overlap?
@@ -227,8 +248,10 @@ static void DmaCopy(int len)
   elprintf(EL_VDPDMA, "DmaCopy len %i [%i]", len, SekCyclesDone());
 
   Pico.m.dma_xfers += len;
-  if(Pico.m.scanline != -1)
+  if(Pico.m.scanline != -1) {
     Pico.video.status|=2; // dma busy
+    LINE_SYNC_STOP();
+  }
 
   source =Pico.video.reg[0x15];
   source|=Pico.video.reg[0x16]<<8;
@@ -239,12 +262,14 @@ static void DmaCopy(int len)
   for(;len;len--)
   {
     vr[a] = *vrs++;
+    if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_VRAM|(a>>1), Pico.vram[a>>1]);
+    PicoTileCacheDirty(a, 1);
     // AutoIncrement
     a=(u16)(a+inc);
   }
   // remember addr
   Pico.video.addr=a;
-  rendstatus|=0x10;
+  VRAM_CHANGED();
 }
 
 // check: Contra, Megaman
@@ -261,12 +286,16 @@ static void DmaFill(int data)
   elprintf(EL_VDPDMA, "DmaFill len %i inc %i [%i]", len, inc, SekCyclesDone());
 
   Pico.m.dma_xfers += len;
-  if(Pico.m.scanline != -1)
+  if(Pico.m.scanline != -1) {
     Pico.video.status|=2; // dma busy (in accurate mode)
+    LINE_SYNC_STOP();
+  }
 
   // from Charles MacDonald's genvdp.txt:
   // Write lower byte to address specified
   vr[a] = (unsigned char) data;
+  if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_VRAM|(a>>1), Pico.vram[a>>1]);
+  PicoTileCacheDirty(a, 1);
   a=(u16)(a+inc);
 
   if(!inc) len=1;
@@ -275,6 +304,8 @@ static void DmaFill(int data)
     // Write upper byte to adjacent address
     // (here we are byteswapped, so address is already 'adjacent')
     vr[a] = high;
+    if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_VRAM|(a>>1), Pico.vram[a>>1]);
+    PicoTileCacheDirty(a, 1);
 
     // Increment address register
     a=(u16)(a+inc);
@@ -284,7 +315,7 @@ static void DmaFill(int data)
   // update length
   Pico.video.reg[0x13] = Pico.video.reg[0x14] = 0; // Dino Dini's Soccer (E) (by Haze)
 
-  rendstatus|=0x10;
+  VRAM_CHANGED();
 }
 
 static void CommandDma(void)
@@ -324,6 +355,7 @@ PICO_INTERNAL_ASM void PicoVideoWrite(unsigned int a,unsigned short d)
 {
   struct PicoVideo *pvid=&Pico.video;
 
+  LINE_SYNC();
   a&=0x1c;
 
   if (a==0x00) // Data port 0 or 2
@@ -347,6 +379,10 @@ PICO_INTERNAL_ASM void PicoVideoWrite(unsigned int a,unsigned short d)
         pvid->lwrite_cnt++;
         if (pvid->lwrite_cnt >= 4) pvid->status|=0x100; // FIFO full
         if (pvid->lwrite_cnt >  4) {
+#ifdef EVENT_SCHED
+          // stall now, the run may be several lines long
+          if (PicoLineSync) SekSetCyclesLeftNoMCD(SekCyclesLeftNoMCD - 32); else
+#endif
           SekCyclesBurn(32); // penalty // 488/12-8
           if (SekCycleCnt>=SekCycleAim) SekEndRun(0);
         }
@@ -378,6 +414,8 @@ PICO_INTERNAL_ASM void PicoVideoWrite(unsigned int a,unsigned short d)
         //if(num==01) dprintf("set_blank: %i @ %06x [%i|%i]", !((d&0x40)>>6), SekPc, Pico.m.scanline, SekCyclesDone());
         //if(num==10) dprintf("hint_set: %i @ %06x [%i|%i]", (unsigned char)d, SekPc, Pico.m.scanline, SekCyclesDone());
         pvid->reg[num]=(unsigned char)d;
+        if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_REG|num, d&0xff);
+        if (num < 2) LINE_SYNC_STOP(); // irq enable changes are events for the scheduler
 #ifndef EMU_CORE_DEBUG
         // update IRQ level (Lemmings, Wiz 'n' Liz intro, ... )
         // may break if done improperly:
@@ -399,7 +437,7 @@ PICO_INTERNAL_ASM void PicoVideoWrite(unsigned int a,unsigned short d)
         }
         else
 #endif
-        if(num == 5) rendstatus|=1;
+        if(num == 5) { if (PicoDrawLogGet == NULL) rendstatus|=1; }
         else if(num == 0xc) Pico.m.dirtyPal = 2; // renderers should update their palettes if sh/hi mode is changed
         pvid->type=0; // register writes clear command (else no Sega logo in Golden Axe II)
       } else {
@@ -412,10 +450,24 @@ PICO_INTERNAL_ASM void PicoVideoWrite(unsigned int a,unsigned short d)
   }
 }
 
+// status register, without the side effects of reading it
+PICO_INTERNAL unsigned int PicoVideoStatus(void)
+{
+  struct PicoVideo *pv=&Pico.video;
+  unsigned int d=pv->status;
+  if (PicoOpt&0x10)         d|=0x0020; // sprite collision (Shadow of the Beast)
+  if (!(pv->reg[1]&0x40))   d|=0x0008; // set V-Blank if display is disabled
+  if (SekCyclesLeftLine < 84+4) d|=0x0004; // H-Blank (Sonic3 vs)
+
+  d|=(pv->pending_ints&0x20)<<2; // V-int pending?
+  return d;
+}
+
 PICO_INTERNAL_ASM unsigned int PicoVideoRead(unsigned int a)
 {
   unsigned int d=0;
 
+  LINE_SYNC();
   a&=0x1c;
 
 
@@ -428,12 +480,7 @@ PICO_INTERNAL_ASM unsigned int PicoVideoRead(unsigned int a)
   if (a==0x04) // control port
   {
     struct PicoVideo *pv=&Pico.video;
-    d=pv->status;
-    if (PicoOpt&0x10)         d|=0x0020; // sprite collision (Shadow of the Beast)
-    if (!(pv->reg[1]&0x40))   d|=0x0008; // set V-Blank if display is disabled
-    if (SekCyclesLeft < 84+4) d|=0x0004; // H-Blank (Sonic3 vs)
-
-    d|=(pv->pending_ints&0x20)<<2; // V-int pending?
+    d=PicoVideoStatus();
     if (d&0x100) pv->status&=~0x100; // FIFO no longer full
 
     pv->pending=0; // ctrl port reads clear write-pending flag (Charles MacDonald)
@@ -462,7 +509,7 @@ PICO_INTERNAL_ASM unsigned int PicoVideoRead(unsigned int a)
     unsigned int hc;
 
     if(Pico.m.scanline != -1) {
-      int lineCycles=(488-SekCyclesLeft)&0x1ff;
+      int lineCycles=(488-SekCyclesLeftLine)&0x1ff;
       d=Pico.m.scanline; // V-Counter
 
       if(Pico.video.reg[12]&1)
@@ -1,4 +1,4 @@
-// Savestate handling for emulated Sega/Mega CD machine.
+// Loading of old (before v2, see Area.c) savestates for emulated Sega/Mega CD machine.
 // (c) Copyright 2007, Grazvydas "notaz" Ignotas
 
 
@@ -13,139 +13,6 @@ extern int *sn76496_regs;
 void (*PicoStateProgressCB)(const char *str) = 0;
 
 
-typedef enum {
-	CHUNK_M68K = 1,
-	CHUNK_RAM,
-	CHUNK_VRAM,
-	CHUNK_ZRAM,
-	CHUNK_CRAM,	// 5
-	CHUNK_VSRAM,
-	CHUNK_MISC,
-	CHUNK_VIDEO,
-	CHUNK_Z80,
-	CHUNK_PSG,	// 10
-	CHUNK_FM,
-	// CD stuff
-	CHUNK_S68K,
-	CHUNK_PRG_RAM,
-	CHUNK_WORD_RAM,
-	CHUNK_PCM_RAM,	// 15
-	CHUNK_BRAM,
-	CHUNK_GA_REGS,
-	CHUNK_PCM,
-	CHUNK_CDC,
-	CHUNK_CDD,	// 20
-	CHUNK_SCD,
-	CHUNK_RC,
-	CHUNK_MISC_CD,
-} chunk_name_e;
-
-
-static char *chunk_names[] = {
-	"INVALID!",
-	"Saving.. M68K state",
-	"Saving.. RAM",
-	"Saving.. VRAM",
-	"Saving.. ZRAM",
-	"Saving.. CRAM",	// 5
-	"Saving.. VSRAM",
-	"Saving.. emu state",
-	"Saving.. VIDEO",
-	"Saving.. Z80 state",
-	"Saving.. PSG",		// 10
-	"Saving.. FM",
-	// CD stuff
-	"Saving.. S68K state",
-	"Saving.. PRG_RAM",
-	"Saving.. WORD_RAM",
-	"Saving.. PCM_RAM",	// 15
-	"Saving.. BRAM",
-	"Saving.. GATE ARRAY regs",
-	"Saving.. PCM state",
-	"Saving.. CDC",
-	"Saving.. CDD",		// 20
-	"Saving.. SCD",
-	"Saving.. GFX chip",
-	"Saving.. MCD state",
-};
-
-
-static int write_chunk(chunk_name_e name, int len, void *data, void *file)
-{
-	size_t bwritten = 0;
-	bwritten += areaWrite(&name, 1, 1, file);
-	bwritten += areaWrite(&len, 1, 4, file);
-	bwritten += areaWrite(data, 1, len, file);
-
-	return (bwritten == len + 4 + 1);
-}
-
-
-#define CHECKED_WRITE(name,len,data) \
-	if (PicoStateProgressCB) PicoStateProgressCB(chunk_names[name]); \
-	if (!write_chunk(name, len, data, file)) return 1;
-
-#define CHECKED_WRITE_BUFF(name,buff) \
-	if (PicoStateProgressCB) PicoStateProgressCB(chunk_names[name]); \
-	if (!write_chunk(name, sizeof(buff), &buff, file)) return 1;
-
-PICO_INTERNAL int PicoCdSaveState(void *file)
-{
-	unsigned char buff[0x60];
-	void *ym2612_regs = YM2612GetRegs();
-
-	areaWrite("PicoSMCD", 1, 8, file);
-	areaWrite(&PicoVer, 1, 4, file);
-
-	memset(buff, 0, sizeof(buff));
-	PicoAreaPackCpu(buff, 0);
-	CHECKED_WRITE_BUFF(CHUNK_M68K,  buff);
-	CHECKED_WRITE_BUFF(CHUNK_RAM,   Pico.ram);
-	CHECKED_WRITE_BUFF(CHUNK_VRAM,  Pico.vram);
-	CHECKED_WRITE_BUFF(CHUNK_ZRAM,  Pico.zram);
-	CHECKED_WRITE_BUFF(CHUNK_CRAM,  Pico.cram);
-	CHECKED_WRITE_BUFF(CHUNK_VSRAM, Pico.vsram);
-	CHECKED_WRITE_BUFF(CHUNK_MISC,  Pico.m);
-	CHECKED_WRITE_BUFF(CHUNK_VIDEO, Pico.video);
-	if(PicoOpt&7) {
-		memset(buff, 0, sizeof(buff));
-		z80_pack(buff);
-		CHECKED_WRITE_BUFF(CHUNK_Z80, buff);
-	}
-	if(PicoOpt&3)
-		CHECKED_WRITE(CHUNK_PSG, 28*4, sn76496_regs);
-	if(PicoOpt&1)
-		CHECKED_WRITE(CHUNK_FM, 0x200+4, ym2612_regs);
-
-	if (PicoMCD & 1)
-	{
-		Pico_mcd->m.audio_offset = mp3_get_offset();
-		memset(buff, 0, sizeof(buff));
-		PicoAreaPackCpu(buff, 1);
-		if (Pico_mcd->s68k_regs[3]&4) // 1M mode?
-			wram_1M_to_2M(Pico_mcd->word_ram2M);
-        	Pico_mcd->m.hint_vector = *(unsigned short *)(Pico_mcd->bios + 0x72);
-
-		CHECKED_WRITE_BUFF(CHUNK_S68K,     buff);
-		CHECKED_WRITE_BUFF(CHUNK_PRG_RAM,  Pico_mcd->prg_ram);
-		CHECKED_WRITE_BUFF(CHUNK_WORD_RAM, Pico_mcd->word_ram2M); // in 2M format
-		CHECKED_WRITE_BUFF(CHUNK_PCM_RAM,  Pico_mcd->pcm_ram);
-		CHECKED_WRITE_BUFF(CHUNK_BRAM,     Pico_mcd->bram);
-		CHECKED_WRITE_BUFF(CHUNK_GA_REGS,  Pico_mcd->s68k_regs); // GA regs, not CPU regs
-		CHECKED_WRITE_BUFF(CHUNK_PCM,      Pico_mcd->pcm);
-		CHECKED_WRITE_BUFF(CHUNK_CDD,      Pico_mcd->cdd);
-		CHECKED_WRITE_BUFF(CHUNK_CDC,      Pico_mcd->cdc);
-		CHECKED_WRITE_BUFF(CHUNK_SCD,      Pico_mcd->scd);
-		CHECKED_WRITE_BUFF(CHUNK_RC,       Pico_mcd->rot_comp);
-		CHECKED_WRITE_BUFF(CHUNK_MISC_CD,  Pico_mcd->m);
-
-		if (Pico_mcd->s68k_regs[3]&4) // convert back
-			wram_2M_to_1M(Pico_mcd->word_ram2M);
-	}
-
-	return 0;
-}
-
 static int g_read_offs = 0;
 
 #define R_ERROR_RETURN(error) \
@@ -241,7 +108,15 @@ PICO_INTERNAL int PicoCdLoadState(void *file)
 		}
 	}
 
-	/* after load events */
+	PicoCdStateLoaded();
+	PicoTileCacheDirty(0, 0x10000);
+
+	return 0;
+}
+
+/* after load events, for v2 states too (Area.c) */
+PICO_INTERNAL void PicoCdStateLoaded(void)
+{
 	if (Pico_mcd->s68k_regs[3]&4) // 1M mode?
 		wram_2M_to_1M(Pico_mcd->word_ram2M);
 	PicoMemResetCD(Pico_mcd->s68k_regs[3]);
@@ -253,8 +128,6 @@ PICO_INTERNAL int PicoCdLoadState(void *file)
 		mp3_start_play(Pico_mcd->TOC.Tracks[Pico_mcd->m.audio_track].F, Pico_mcd->m.audio_offset);
 	// restore hint vector
         *(unsigned short *)(Pico_mcd->bios + 0x72) = Pico_mcd->m.hint_vector;
-
-	return 0;
 }
 
 
@@ -286,6 +159,7 @@ int PicoCdLoadStateGfx(void *file)
 				break;
 		}
 	}
+	PicoTileCacheDirty(0, 0x10000);
 
 	return 0;
 }
@@ -37,12 +37,28 @@ extern int lrp_cyc, lwp_cyc;
 // int m68k_poll_addr, m68k_poll_cnt;
 unsigned int s68k_poll_adclk, s68k_poll_cnt;
 
+// sub 68k may run on another thread (cd/s68k_thread.c), wait for the other CPU
+// before touching regs both of them use. BARRIER_* is for things which change
+// the other CPU's context or memory map.
+#ifdef S68K_THREAD
+#define SYNC_M68K()    { if (s68k_thread_active) s68k_thread_sync_m68k(0); }
+#define BARRIER_M68K() { if (s68k_thread_active) s68k_thread_sync_m68k(1); }
+#define SYNC_S68K(a)   { if (s68k_thread_active && ((a) < 0x30 || ((a)|1) == 0x33)) s68k_thread_sync_s68k(0); }
+#define BARRIER_S68K() { if (s68k_thread_active) s68k_thread_sync_s68k(1); }
+#else
+#define SYNC_M68K()
+#define BARRIER_M68K()
+#define SYNC_S68K(a)
+#define BARRIER_S68K()
+#endif
+
 #ifndef _ASM_CD_MEMORY_C
 static u32 m68k_reg_read16(u32 a)
 {
   u32 d=0;
   a &= 0x3e;
   // dprintf("m68k_regs r%2i: [%02x] @%06x", realsize&~1, a+(realsize&1), SekPc);
+  SYNC_M68K();
 
   switch (a) {
     case 0:
@@ -93,10 +109,12 @@ void m68k_reg_write8(u32 a, u32 d)
 {
   a &= 0x3f;
   // dprintf("m68k_regs w%2i: [%02x] %02x @%06x", realsize, a, d, SekPc);
+  SYNC_M68K();
 
   switch (a) {
     case 0:
       d &= 1;
+      if (d&1) BARRIER_M68K();
       if ((d&1) && (Pico_mcd->s68k_regs[0x33]&(1<<2))) { elprintf(EL_INTS, "m68k: s68k irq 2"); SekInterruptS68k(2); }
       return;
     case 1:
@@ -105,6 +123,10 @@ void m68k_reg_write8(u32 a, u32 d)
       if ( (Pico_mcd->m.busreq&1) != (d&1)) dprintf("m68k: s68k reset %i", !(d&1));
       if ( (Pico_mcd->m.busreq&2) != (d&2)) dprintf("m68k: s68k brq %i", (d&2)>>1);
       if ((Pico_mcd->m.state_flags&1) && (d&3)==1) {
+#ifdef S68K_THREAD
+        if (s68k_thread_active) s68k_thread_reset = 1; // done when worker is finished with the line
+        else
+#endif
         SekResetS68k(); // S68k comes out of RESET or BRQ state
         Pico_mcd->m.state_flags&=~1;
         dprintf("m68k: resetting s68k, cycles=%i", SekCyclesLeft);
@@ -113,6 +135,7 @@ void m68k_reg_write8(u32 a, u32 d)
       return;
     case 2:
       dprintf("m68k: prg wp=%02x", d);
+      BARRIER_M68K(); // s68k checks it on every prg RAM write
       Pico_mcd->s68k_regs[2] = d; // really use s68k side register
       return;
     case 3: {
@@ -140,6 +163,7 @@ void m68k_reg_write8(u32 a, u32 d)
       Pico_mcd->s68k_regs[3] = d | dold; // really use s68k side register
 #ifdef USE_POLL_DETECT
       if ((s68k_poll_adclk&0xfe) == 2 && s68k_poll_cnt > POLL_LIMIT) {
+        BARRIER_M68K();
         SekSetStopS68k(0); s68k_poll_adclk = 0;
         elprintf(EL_CDPOLL, "s68k poll release, a=%02x", a);
       }
@@ -160,6 +184,7 @@ void m68k_reg_write8(u32 a, u32 d)
       Pico_mcd->s68k_regs[0xe] = d;
 #ifdef USE_POLL_DETECT
       if ((s68k_poll_adclk&0xfe) == 0xe && s68k_poll_cnt > POLL_LIMIT) {
+        BARRIER_M68K();
         SekSetStopS68k(0); s68k_poll_adclk = 0;
         elprintf(EL_CDPOLL, "s68k poll release, a=%02x", a);
       }
@@ -171,6 +196,7 @@ void m68k_reg_write8(u32 a, u32 d)
       Pico_mcd->s68k_regs[a] = d;
 #ifdef USE_POLL_DETECT
       if ((a&0xfe) == (s68k_poll_adclk&0xfe) && s68k_poll_cnt > POLL_LIMIT) {
+        BARRIER_M68K();
         SekSetStopS68k(0); s68k_poll_adclk = 0;
         elprintf(EL_CDPOLL, "s68k poll release, a=%02x", a);
       }
@@ -287,6 +313,8 @@ void s68k_reg_write8(u32 a, u32 d)
       //printf("s68k_regs w3: %02x @%06x\n", (u8)d, SekPcS68k);
       d &= 0x1d;
       d |= dold&0xc2;
+      if (((d | dold) & 4) && ((d ^ dold) & 5))
+        BARRIER_S68K(); // main 68k Fetch and word RAM layout is about to change
       if (d&4) {
         if ((d ^ dold) & 5) {
           d &= ~2; // in case of mode or bank change we clear DMNA (m68k req) bit
@@ -927,6 +955,7 @@ static u32 PicoReadS68k8(u32 a)
   if ((a&0xfffe00) == 0xff8000) {
     a &= 0x1ff;
     rdprintf("s68k_regs r8: [%02x] @ %06x", a, SekPcS68k);
+    SYNC_S68K(a);
     if (a >= 0x0e && a < 0x30) {
       d = Pico_mcd->s68k_regs[a];
       s68k_poll_detect(a, d);
@@ -1029,6 +1058,7 @@ static u32 PicoReadS68k16(u32 a)
   if ((a&0xfffe00) == 0xff8000) {
     a &= 0x1fe;
     rdprintf("s68k_regs r16: [%02x] @ %06x", a, SekPcS68k);
+    SYNC_S68K(a);
     if (a >= 0x58 && a < 0x68)
          d = gfx_cd_read(a);
     else d = s68k_reg_read16(a);
@@ -1125,6 +1155,7 @@ static u32 PicoReadS68k32(u32 a)
   if ((a&0xfffe00) == 0xff8000) {
     a &= 0x1fe;
     rdprintf("s68k_regs r32: [%02x] @ %06x", a, SekPcS68k);
+    SYNC_S68K(a);
     if (a >= 0x58 && a < 0x68)
          d = (gfx_cd_read(a)<<16)|gfx_cd_read(a+2);
     else d = (s68k_reg_read16(a)<<16)|s68k_reg_read16(a+2);
@@ -1289,6 +1320,7 @@ static void PicoWriteS68k8(u32 a,u8 d)
   if ((a&0xfffe00) == 0xff8000) {
     a &= 0x1ff;
     rdprintf("s68k_regs w8: [%02x] %02x @ %06x", a, d, SekPcS68k);
+    SYNC_S68K(a);
     if (a >= 0x58 && a < 0x68)
          gfx_cd_write16(a&~1, (d<<8)|d);
     else s68k_reg_write8(a,d);
@@ -1368,6 +1400,7 @@ static void PicoWriteS68k16(u32 a,u16 d)
   if ((a&0xfffe00) == 0xff8000) {
     a &= 0x1fe;
     rdprintf("s68k_regs w16: [%02x] %04x @ %06x", a, d, SekPcS68k);
+    SYNC_S68K(a);
     if (a >= 0x58 && a < 0x68)
       gfx_cd_write16(a, d);
     else {
@@ -1457,6 +1490,7 @@ static void PicoWriteS68k32(u32 a,u32 d)
   if ((a&0xfffe00) == 0xff8000) {
     a &= 0x1fe;
     rdprintf("s68k_regs w32: [%02x] %08x @ %06x", a, d, SekPcS68k);
+    SYNC_S68K(a);
     if (a >= 0x58 && a < 0x68) {
       gfx_cd_write16(a,   d>>16);
       gfx_cd_write16(a+2, d&0xffff);
@@ -89,6 +89,7 @@ static __inline void SekRunM68k(int cyc)
   int cyc_do;
   SekCycleAim+=cyc;
   if ((cyc_do=SekCycleAim-SekCycleCnt) <= 0) return;
+  pprof_start(m68k);
 #if defined(EMU_CORE_DEBUG)
   SekCycleCnt+=CM_compareRun(cyc_do, 0);
 #elif defined(EMU_C68K)
@@ -102,6 +103,7 @@ static __inline void SekRunM68k(int cyc)
   g_m68kcontext=&PicoCpuFM68k;
   SekCycleCnt+=fm68k_emulate(cyc_do, 0);
 #endif
+  pprof_end(m68k);
 }
 
 static __inline void SekRunS68k(int cyc)
@@ -109,6 +111,7 @@ static __inline void SekRunS68k(int cyc)
   int cyc_do;
   SekCycleAimS68k+=cyc;
   if ((cyc_do=SekCycleAimS68k-SekCycleCntS68k) <= 0) return;
+  pprof_start(s68k);
 #if defined(EMU_CORE_DEBUG)
   SekCycleCntS68k+=CM_compareRun(cyc_do, 1);
 #elif defined(EMU_C68K)
@@ -122,35 +125,25 @@ static __inline void SekRunS68k(int cyc)
   g_m68kcontext=&PicoCpuFS68k;
   SekCycleCntS68k+=fm68k_emulate(cyc_do, 0);
 #endif
+  pprof_end(s68k);
 }
 
 #define PS_STEP_M68K ((488<<16)/20) // ~24
 //#define PS_STEP_S68K 13
 
-#if defined(_ASM_CD_PICO_C)
-extern void SekRunPS(int cyc_m68k, int cyc_s68k);
-#elif defined(EMU_F68K)
-static __inline void SekRunPS(int cyc_m68k, int cyc_s68k)
-{
-  SekCycleAim+=cyc_m68k;
-  SekCycleAimS68k+=cyc_s68k;
-  fm68k_emulate(0, 1);
-}
-#else
-static __inline void SekRunPS(int cyc_m68k, int cyc_s68k)
+#if !defined(_ASM_CD_PICO_C)
+// main and sub 68k take turns, up to where each should be at the slice end,
+// prof: time each turn (see pprof.h)
+static __inline void SekRunPSSlices(int prof)
 {
   int cycn, cycn_s68k, cyc_do;
-  SekCycleAim+=cyc_m68k;
-  SekCycleAimS68k+=cyc_s68k;
-
-//  fprintf(stderr, "=== start %3i/%3i [%3i/%3i] {%05i.%i} ===\n", cyc_m68k, cyc_s68k,
-//  		SekCycleAim-SekCycleCnt, SekCycleAimS68k-SekCycleCntS68k, Pico.m.frame_count, Pico.m.scanline);
 
   /* loop 488 downto 0 in steps of PS_STEP */
   for (cycn = (488<<16)-PS_STEP_M68K; cycn >= 0; cycn -= PS_STEP_M68K)
   {
     cycn_s68k = (cycn + cycn/2 + cycn/8) >> 16;
     if ((cyc_do = SekCycleAim-SekCycleCnt-(cycn>>16)) > 0) {
+      if (prof) pprof_start(ps_m68k);
 #if defined(EMU_C68K)
       PicoCpuCM68k.cycles = cyc_do;
       CycloneRun(&PicoCpuCM68k);
@@ -162,8 +155,10 @@ static __inline void SekRunPS(int cyc_m68k, int cyc_s68k)
       g_m68kcontext = &PicoCpuFM68k;
       SekCycleCnt += fm68k_emulate(cyc_do, 0);
 #endif
+      if (prof) pprof_end(ps_m68k);
     }
     if ((cyc_do = SekCycleAimS68k-SekCycleCntS68k-cycn_s68k) > 0) {
+      if (prof) pprof_start(ps_s68k);
 #if defined(EMU_C68K)
       PicoCpuCS68k.cycles = cyc_do;
       CycloneRun(&PicoCpuCS68k);
@@ -175,11 +170,47 @@ static __inline void SekRunPS(int cyc_m68k, int cyc_s68k)
       g_m68kcontext = &PicoCpuFS68k;
       SekCycleCntS68k += fm68k_emulate(cyc_do, 0);
 #endif
+      if (prof) pprof_end(ps_s68k);
     }
   }
 }
 #endif
 
+#if defined(_ASM_CD_PICO_C)
+extern void SekRunPS(int cyc_m68k, int cyc_s68k);
+#elif defined(EMU_F68K)
+static __inline void SekRunPS(int cyc_m68k, int cyc_s68k)
+{
+  SekCycleAim+=cyc_m68k;
+  SekCycleAimS68k+=cyc_s68k;
+#ifdef S68K_THREAD
+  if ((PicoOpt & 0x200000) && s68k_thread_run())
+    return; // sub 68k ran on it's own thread
+#endif
+  if (pprof_sampled(Pico.m.scanline + Pico.m.frame_count)) {
+    SekRunPSSlices(1); // same as famec does below, but each CPU is timed
+    return;
+  }
+  pprof_start(ps);
+  fm68k_emulate(0, 1);
+  pprof_end(ps);
+}
+#else
+static __inline void SekRunPS(int cyc_m68k, int cyc_s68k)
+{
+  int prof = pprof_sampled(Pico.m.scanline + Pico.m.frame_count);
+  SekCycleAim+=cyc_m68k;
+  SekCycleAimS68k+=cyc_s68k;
+
+//  fprintf(stderr, "=== start %3i/%3i [%3i/%3i] {%05i.%i} ===\n", cyc_m68k, cyc_s68k,
+//  		SekCycleAim-SekCycleCnt, SekCycleAimS68k-SekCycleCntS68k, Pico.m.frame_count, Pico.m.scanline);
+
+  if (!prof) pprof_start(ps);
+  SekRunPSSlices(prof);
+  if (!prof) pprof_end(ps);
+}
+#endif
+
 
 static __inline void check_cd_dma(void)
 {
@@ -195,7 +226,9 @@ static __inline void check_cd_dma(void)
 	}
 	if (ddx == 6) return; // invalid
 
+	pprof_start(cd);
 	Update_CDC_TRansfer(ddx); // now go and do the actual transfer
+	pprof_end(cd);
 }
 
 static __inline void update_chips(void)
@@ -203,6 +236,8 @@ static __inline void update_chips(void)
 	int counter_timer, int3_set;
 	int counter75hz_lim = Pico.m.pal ? 2080 : 2096;
 
+	pprof_start(cd);
+
 	// 75Hz CDC update
 	if ((Pico_mcd->m.counter75hz+=10) >= counter75hz_lim) {
 		Pico_mcd->m.counter75hz -= counter75hz_lim;
@@ -242,6 +277,8 @@ static __inline void update_chips(void)
 #endif
 		}
 	}
+
+	pprof_end(cd);
 }
 
 
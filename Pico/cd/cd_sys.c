@@ -25,7 +25,7 @@
 #define PLAYING		0x0100		// PLAYING audio track CDD status
 
 
-static int CD_Present = 0;
+int CD_Present = 0; // also switched with emulator instances (Area.c)
 
 
 #define CHECK_TRAY_OPEN				\
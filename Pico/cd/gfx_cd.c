@@ -443,11 +443,13 @@ PICO_INTERNAL void DmaSlowCell(unsigned int source, unsigned int a, int len, uns
         asrc |= source & 2;
         // if(a&1) d=(d<<8)|(d>>8); // ??
         r[a>>1] = *(u16 *)(base + asrc);
+        if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_VRAM|(a>>1), r[a>>1]);
+        PicoTileCacheDirty(a&~1, 2);
 	source += 2;
         // AutoIncrement
         a=(u16)(a+inc);
       }
-      rendstatus|=0x10;
+      if (PicoDrawLogGet == NULL) rendstatus|=0x10; // see VideoPort.c
       break;
 
     case 3: // cram
@@ -458,6 +460,7 @@ PICO_INTERNAL void DmaSlowCell(unsigned int source, unsigned int a, int len, uns
         asrc = cell_map(source >> 2) << 2;
         asrc |= source & 2;
         r[a2>>1] = *(u16 *)(base + asrc);
+        if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_CRAM|(a2>>1), r[a2>>1]);
 	source += 2;
         // AutoIncrement
         a2+=inc;
@@ -474,6 +477,7 @@ PICO_INTERNAL void DmaSlowCell(unsigned int source, unsigned int a, int len, uns
         asrc = cell_map(source >> 2) << 2;
         asrc |= source & 2;
         r[a2>>1] = *(u16 *)(base + asrc);
+        if (PicoDrawLogCur) PicoDrawLogWrite(DRAW_LOG_VSRAM|(a2>>1), r[a2>>1]);
 	source += 2;
         // AutoIncrement
         a2+=inc;
@@ -0,0 +1,236 @@
+// MCD sub 68k on a worker thread, for multicore hosts (PicoOpt 0x200000).
+// In better sync mode (PicoOpt 0x2000) SekRunPS() alternates main and sub 68k
+// in 1/20 line slices on one thread. Here the worker runs the sub 68k slices
+// of a line while the emu thread runs the main 68k ones, and the two only wait
+// for each other where they share something:
+// - gate array regs (comm flags/words, DMNA/RET, CDC, stopwatch, irq mask) are
+//   sync points. Each CPU publishes it's position in the line (in common units,
+//   main cycles*13 ~ sub cycles*8), and the one which is ahead waits there
+//   until the other catches up. Main wins ties, so the regs see the same
+//   sequence of accesses every run.
+// - word RAM mode/bank changes by sub remap main 68k Fetch and reshuffle word
+//   RAM, so sub waits until main is done with the line before doing them.
+// - anything done to sub 68k context by main (irq 2, poll release) waits until
+//   the sub is done with the line (or parked as above), reset is done after it.
+// RAM contents are not synced, DMNA/RET ownership takes care of that.
+
+#include <limits.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+
+#include "../PicoInt.h"
+
+#if !defined(EMU_F68K) || defined(_ASM_CD_MEMORY_C)
+#error "s68k_thread needs FAME and the C memory handlers"
+#endif
+
+#define PS_STEP_M68K ((488<<16)/20) // same slices as SekRunPS()
+
+#define POS_START (INT_MIN/2)
+#define POS_END   (INT_MAX/2)
+
+volatile int s68k_thread_active = 0; // worker is running sub 68k for this line
+int s68k_thread_reset = 0;           // sub 68k reset requested while it was
+
+static pthread_t s68k_thread;
+static int s68k_thread_running = 0;
+static int s68k_thread_failed = 0;
+static sem_t s68k_sem_wake;
+
+static volatile unsigned int line_seq;
+static volatile int worker_sleeping;
+
+static volatile int m68k_pos, s68k_pos;  // published position in the line
+static volatile int m68k_done, s68k_done, s68k_parked;
+static int m68k_left, s68k_left;         // cycles left after current fm68k_emulate() run
+
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __asm__ __volatile__("pause")
+#else
+#define cpu_relax()
+#endif
+
+// the other CPU is normally only a few instructions away, but don't starve
+// it if we are sharing a core
+#define WAIT_WHILE(cond) { \
+	int spins_ = 0; \
+	while (cond) { \
+		if (++spins_ < 1000) cpu_relax(); \
+		else sched_yield(); \
+	} \
+	__sync_synchronize(); \
+}
+
+
+static void *s68k_worker(void *arg)
+{
+	unsigned int seq = 0;
+	int cycn, cycn_s68k, cyc_do, i;
+
+	g_m68kcontext = &PicoCpuFS68k; // ours only
+
+	for (;;)
+	{
+		// next line is usually a few microseconds away, sleep if it's not
+		for (i = 0; line_seq == seq; i++) {
+			if (i < 20000) { cpu_relax(); continue; }
+			worker_sleeping = 1;
+			__sync_synchronize();
+			if (line_seq == seq)
+				sem_wait(&s68k_sem_wake);
+			worker_sleeping = 0;
+		}
+		__sync_synchronize();
+		seq = line_seq;
+
+		pprof_start(s68k);
+		for (cycn = (488<<16)-PS_STEP_M68K; cycn >= 0; cycn -= PS_STEP_M68K)
+		{
+			cycn_s68k = (cycn + cycn/2 + cycn/8) >> 16;
+			s68k_left = cycn_s68k;
+			if ((cyc_do = SekCycleAimS68k-SekCycleCntS68k-cycn_s68k) > 0)
+				SekCycleCntS68k += fm68k_emulate(cyc_do, 0);
+			if (s68k_pos != POS_END) {
+				s68k_pos = -8 * (SekCycleAimS68k-SekCycleCntS68k);
+				__sync_synchronize();
+			}
+		}
+		pprof_end(s68k);
+
+		s68k_pos = POS_END;
+		__sync_synchronize();
+		s68k_done = 1;
+	}
+
+	return NULL;
+}
+
+/* fork() only keeps the calling thread, start a new worker in the child on next use */
+static void s68k_atfork_child(void)
+{
+	s68k_thread_running = 0;
+}
+
+static int s68k_thread_start(void)
+{
+	static int atfork_done = 0;
+
+	// the two CPUs wait for each other all the time, only worth it with a core each
+	if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+		elprintf(EL_STATUS, "s68k: single CPU host, using one thread only");
+		return -1;
+	}
+
+	line_seq = 0;
+	worker_sleeping = 0;
+	sem_init(&s68k_sem_wake, 0, 0);
+
+	if (pthread_create(&s68k_thread, NULL, s68k_worker, NULL) != 0) {
+		elprintf(EL_STATUS, "s68k: failed to create worker thread, using one thread only");
+		return -1;
+	}
+	pthread_detach(s68k_thread);
+
+	if (!atfork_done) {
+		pthread_atfork(NULL, NULL, s68k_atfork_child);
+		atfork_done = 1;
+	}
+	s68k_thread_running = 1;
+	return 0;
+}
+
+// SekRunPS() replacement, cycle aims are already set
+PICO_INTERNAL int s68k_thread_run(void)
+{
+	int cycn, cyc_do;
+
+	if (!s68k_thread_running) {
+		if (s68k_thread_failed) return 0;
+		if (s68k_thread_start() != 0) {
+			s68k_thread_failed = 1;
+			return 0;
+		}
+	}
+
+	m68k_pos = s68k_pos = POS_START;
+	m68k_done = s68k_done = s68k_parked = 0;
+	s68k_thread_active = 1;
+	__sync_synchronize();
+	line_seq++;
+	__sync_synchronize();
+	if (worker_sleeping)
+		sem_post(&s68k_sem_wake);
+
+	g_m68kcontext = &PicoCpuFM68k;
+	pprof_start(m68k);
+	for (cycn = (488<<16)-PS_STEP_M68K; cycn >= 0; cycn -= PS_STEP_M68K)
+	{
+		m68k_left = cycn >> 16;
+		if ((cyc_do = SekCycleAim-SekCycleCnt-m68k_left) > 0)
+			SekCycleCnt += fm68k_emulate(cyc_do, 0);
+		if (m68k_pos != POS_END) {
+			m68k_pos = -13 * (SekCycleAim-SekCycleCnt);
+			__sync_synchronize();
+		}
+	}
+	pprof_end(m68k);
+
+	m68k_pos = POS_END;
+	__sync_synchronize();
+	m68k_done = 1;
+	WAIT_WHILE(!s68k_done);
+
+	s68k_thread_active = 0;
+	if (s68k_thread_reset) {
+		s68k_thread_reset = 0;
+		SekResetS68k();
+	}
+
+	return 1;
+}
+
+// main 68k is about to access something shared,
+// barrier: ..or about to touch sub 68k context
+PICO_INTERNAL void s68k_thread_sync_m68k(int barrier)
+{
+	int pos;
+
+	if (m68k_pos == POS_END) return; // sub is done or waits for us to be
+
+	if (barrier) {
+		m68k_pos = POS_END;
+		__sync_synchronize();
+		WAIT_WHILE(!s68k_done && !s68k_parked);
+		return;
+	}
+
+	pos = -13 * (m68k_left + PicoCpuFM68k.io_cycle_counter);
+	m68k_pos = pos;
+	__sync_synchronize();
+	WAIT_WHILE(s68k_pos < pos);
+}
+
+// same for sub 68k,
+// barrier: ..or about to remap word RAM
+PICO_INTERNAL void s68k_thread_sync_s68k(int barrier)
+{
+	int pos;
+
+	if (barrier) {
+		s68k_parked = 1;
+		s68k_pos = POS_END;
+		__sync_synchronize();
+		WAIT_WHILE(!m68k_done);
+		return;
+	}
+
+	if (s68k_pos == POS_END) return;
+
+	pos = -8 * (s68k_left + PicoCpuFS68k.io_cycle_counter);
+	s68k_pos = pos;
+	__sync_synchronize();
+	WAIT_WHILE(m68k_pos <= pos);
+}
+
@@ -34,7 +34,7 @@ short *PsndOut=NULL; // PCM data buffer
 extern int *sn76496_regs;
 
 
-static void dac_recalculate(void)
+PICO_INTERNAL void dac_recalculate(void)
 {
   int i, dac_cnt, pos, len, lines = Pico.m.pal ? 312 : 262, mid = Pico.m.pal ? 68 : 93;
 
@@ -232,6 +232,8 @@ PICO_INTERNAL int PsndRender(int offset, int length)
   int do_pcm = (PicoMCD&1) && (PicoOpt&0x400) && (Pico_mcd->pcm.control & 0x80) && Pico_mcd->pcm.enabled;
   offset <<= stereo;
 
+  pprof_start(sound);
+
   if (offset == 0) { // should happen once per frame
     // compensate for float part of PsndLen
     PsndLen_exc_cnt += PsndLen_exc_add;
@@ -267,6 +269,8 @@ PICO_INTERNAL int PsndRender(int offset, int length)
   // convert + limit to normal 16bit output
   PsndMix_32_to_16l(PsndOut+offset, buf32, length);
 
+  pprof_end(sound);
+
   return length;
 }
 
@@ -376,10 +380,15 @@ PICO_INTERNAL void z80_init(void)
   Cz80_Init(&CZ80);
   Cz80_Set_Fetch(&CZ80, 0x0000, 0x1fff, (UINT32)Pico.zram); // main RAM
   Cz80_Set_Fetch(&CZ80, 0x2000, 0x3fff, (UINT32)Pico.zram); // mirror
-  Cz80_Set_ReadB(&CZ80, (UINT8 (*)(UINT32 address))z80_read); // unused (hacked in)
+  Cz80_Set_ReadB(&CZ80, (UINT8 (*)(UINT32 address))z80_read); // hacked in, only cz80_drc uses it
   Cz80_Set_WriteB(&CZ80, z80_write);
   Cz80_Set_INPort(&CZ80, z80_in);
   Cz80_Set_OUTPort(&CZ80, z80_out);
+#ifdef CZ80_DRC
+  if (cz80_drc_init() != 0)
+    elprintf(EL_STATUS, "z80 translator init failed, using cz80 only");
+  cz80_drc_set_ram(Pico.zram);
+#endif
 #endif
 }
 
@@ -401,6 +410,9 @@ PICO_INTERNAL void z80_reset(void)
   Cz80_Set_Reg(&CZ80, CZ80_IX, 0xffff);
   Cz80_Set_Reg(&CZ80, CZ80_IY, 0xffff);
   Cz80_Set_Reg(&CZ80, CZ80_SP, 0x2000);
+#ifdef CZ80_DRC
+  cz80_drc_flush();
+#endif
 #endif
   Pico.m.z80_fakeval = 0; // for faking when Z80 is disabled
 }
@@ -452,6 +464,9 @@ PICO_INTERNAL void z80_unpack(unsigned char *data)
   if (*(int *)data == 0x00007a43) { // "Cz" save?
     memcpy(&CZ80, data+8, (INT32)&CZ80.BasePC - (INT32)&CZ80);
     Cz80_Set_Reg(&CZ80, CZ80_PC, *(int *)(data+4));
+#ifdef CZ80_DRC
+    cz80_drc_flush(); // RAM was loaded before
+#endif
   } else {
     z80_reset();
     z80_int();
@@ -459,11 +474,210 @@ PICO_INTERNAL void z80_unpack(unsigned char *data)
 #endif
 }
 
+#ifdef Z80_IDLE
+// Idle loop detection. Sound drivers spend much of their time in short loops which
+// only read z80 RAM or YM status and branch back, waiting for the 68k or V-Int.
+// If such loop can't exit with what is in memory now, the whole run is skipped.
+int z80_idle_ym = 1; // YM status can't change during a run (timers are done between runs)
+static int idle_runs, idle_skips;
+
+#define IDLE_A 1 // known values
+#define IDLE_Z 2
+#define IDLE_C 4
+#define IDLE_S 8
+
+struct idle_state {
+  int known, a, zf, cf, sf, hl;
+  int jmp, cond, taken; // branch target (-1 if not a branch), taken (-1 if not known)
+};
+
+// memory which can only change between runs, -1 if it's not safe to read
+static int idle_read(int a)
+{
+  a &= 0xffff;
+  if (a < 0x4000) return Pico.zram[a&0x1fff];
+  if ((a>>13) == 2 && z80_idle_ym) return (PicoOpt&1) ? YM2612Read() : 0;
+  return -1;
+}
+
+static void idle_flags(struct idle_state *s)
+{
+  s->zf = s->a == 0;
+  s->sf = s->a & 0x80;
+  s->cf = 0;
+  s->known |= IDLE_Z|IDLE_C|IDLE_S;
+}
+
+// c: nz z nc c po pe p m
+static int idle_cond(struct idle_state *s, int c)
+{
+  static const int need[8] = { IDLE_Z, IDLE_Z, IDLE_C, IDLE_C, 0, 0, IDLE_S, IDLE_S };
+  int f;
+
+  if (!need[c] || !(s->known & need[c])) return -1;
+  f = c < 2 ? s->zf : c < 4 ? s->cf : s->sf;
+  return !f ^ (c & 1);
+}
+
+// decode and evaluate one instruction of a possible idle loop,
+// returns it's length or 0 if such loop can't have it
+static int idle_op(int p, struct idle_state *s)
+{
+  unsigned char *z = Pico.zram;
+  int op = z[p&0x1fff], n = z[(p+1)&0x1fff], v;
+
+  s->jmp = -1;
+  switch (op)
+  {
+    case 0x00: // nop
+      return 1;
+
+    case 0x3a: // ld a,(nn)
+    case 0x7e: // ld a,(hl)
+      v = idle_read(op == 0x3a ? (n | (z[(p+2)&0x1fff] << 8)) : s->hl);
+      if (v < 0) return 0;
+      s->a = v;
+      s->known |= IDLE_A;
+      return op == 0x3a ? 3 : 1;
+
+    case 0xa7: case 0xb7:                       // and a, or a
+    case 0xe6: case 0xf6: case 0xee: case 0xfe: // and n, or n, xor n, cp n
+      if (!(s->known & IDLE_A)) { s->known = 0; break; }
+      switch (op) {
+        case 0xe6: s->a &= n; break;
+        case 0xf6: s->a |= n; break;
+        case 0xee: s->a ^= n; break;
+        case 0xfe:
+          s->zf = s->a == n; s->cf = s->a < n; s->sf = (s->a - n) & 0x80;
+          s->known |= IDLE_Z|IDLE_C|IDLE_S;
+          return 2;
+      }
+      idle_flags(s);
+      break;
+
+    case 0x07: // rlca
+    case 0x0f: // rrca
+      if (!(s->known & IDLE_A)) { s->known &= ~IDLE_C; return 1; }
+      if (op == 0x07) { s->cf = s->a >> 7;  s->a = ((s->a << 1) | s->cf) & 0xff; }
+      else            { s->cf = s->a & 1;   s->a = (s->a >> 1) | (s->cf << 7); }
+      s->known |= IDLE_C;
+      return 1;
+
+    case 0xcb: // bit b,(hl), bit b,a
+      if      ((n & 0xc7) == 0x46) v = idle_read(s->hl);
+      else if ((n & 0xc7) == 0x47) v = (s->known & IDLE_A) ? s->a : -2;
+      else return 0;
+      if (v == -1) return 0;
+      if (v == -2) { s->known &= ~(IDLE_Z|IDLE_S); return 2; }
+      v &= 1 << ((n >> 3) & 7);
+      s->zf = v == 0; s->sf = v & 0x80;
+      s->known |= IDLE_Z|IDLE_S;
+      return 2;
+
+    case 0x18: // jr e
+    case 0x20: case 0x28: case 0x30: case 0x38: // jr cc,e
+      s->jmp = p + 2 + (signed char)n;
+      s->cond = op != 0x18;
+      s->taken = s->cond ? idle_cond(s, (op >> 3) - 4) : 1;
+      return 2;
+
+    case 0xc3: // jp nn
+    case 0xc2: case 0xca: case 0xd2: case 0xda: // jp cc,nn
+    case 0xe2: case 0xea: case 0xf2: case 0xfa:
+      s->jmp = n | (z[(p+2)&0x1fff] << 8);
+      s->cond = op != 0xc3;
+      s->taken = s->cond ? idle_cond(s, (op >> 3) & 7) : 1;
+      return 3;
+
+    default:
+      return 0;
+  }
+
+  return op < 0xc0 ? 1 : 2;
+}
+
+// z80 at pc is idle if it's in a short loop which keeps looping with current memory
+static int z80_idle(int pc, int hl)
+{
+  struct idle_state s;
+  int p, i, len, start = -1, end = -1, in_loop = 0;
+
+  if (pc >= 0x4000) return 0;
+
+  // find the branch back to pc or a bit before it
+  memset(&s, 0, sizeof(s));
+  s.hl = hl;
+  for (p = pc, i = 0; i < 8; i++, p += len) {
+    len = idle_op(p, &s);
+    if (len == 0) return 0;
+    if (s.jmp < 0) continue;
+    if (s.jmp <= pc && s.jmp >= pc - 16) { start = s.jmp; end = p; break; }
+    if (!s.cond || s.jmp < pc) return 0; // only forward exits are allowed
+  }
+  if (start < 0) return 0;
+
+  // do one pass over it
+  memset(&s, 0, sizeof(s));
+  s.hl = hl;
+  for (p = start; p <= end; p += len) {
+    len = idle_op(p, &s);
+    if (len == 0) return 0;
+    if (p == pc) in_loop = 1;
+    if (s.jmp < 0) continue;
+    if (s.taken < 0) return 0;
+    if (p == end) return s.taken && in_loop;
+    if (s.taken) return 0;
+  }
+  return 0;
+}
+
+PICO_INTERNAL int z80_run_idle(int cycles)
+{
+  int pc, hl, irq = 0;
+#if defined(_USE_MZ80)
+  struct mz80context z80;
+  mz80GetContext(&z80);
+  pc = z80.z80pc; hl = z80.z80HL;
+#elif defined(_USE_DRZ80)
+  pc = drZ80.Z80PC - drZ80.Z80PC_BASE; hl = drZ80.Z80HL >> 16;
+  irq = drZ80.Z80_IRQ && (drZ80.Z80IF & 1); // taken by next DrZ80Run
+#elif defined(_USE_CZ80)
+  pc = Cz80_Get_Reg(&CZ80, CZ80_PC); hl = Cz80_Get_Reg(&CZ80, CZ80_HL);
+#endif
+
+  idle_runs++;
+  if (!irq && z80_idle(pc, hl)) {
+    idle_skips++;
+    return cycles;
+  }
+  return z80_exec(cycles);
+}
+#endif
+
+// for PicoContextSave() (Area.c)
+struct PicoArea PsndCtxVars[] =
+{
+#ifdef Z80_IDLE
+  CTX_VAR(z80_idle_ym),
+  CTX_VAR(idle_runs),
+  CTX_VAR(idle_skips),
+#endif
+  { NULL }
+};
+
 PICO_INTERNAL void z80_exit(void)
 {
 #if defined(_USE_MZ80)
   mz80shutdown();
 #endif
+#ifdef CZ80_DRC
+  cz80_drc_exit();
+#endif
+#ifdef Z80_IDLE
+  if (idle_runs)
+    elprintf(EL_STATUS, "z80 idle skips: %i/%i (%i%%)\n", idle_skips, idle_runs,
+      (int)((double)idle_skips * 100 / idle_runs));
+#endif
 }
 
 #if 1 // defined(__DEBUG_PRINT) || defined(__GP2X__) || defined(__GIZ__)
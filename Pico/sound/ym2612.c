@@ -116,7 +116,7 @@
 #ifndef EXTERNAL_YM2612
 #include <stdlib.h>
 // let it be 1 global to simplify things
-static YM2612 ym2612;
+static YM2612_TLS YM2612 ym2612;
 
 #else
 extern YM2612 *ym2612_940;
@@ -515,9 +515,9 @@ static INT32 lfo_pm_table[128*8*32]; /* 128 combinations of 7 bits meaningful (o
 
 /* there are 2048 FNUMs that can be generated using FNUM/BLK registers
 	but LFO works with one more bit of a precision so we really need 4096 elements */
-static UINT32 fn_table[4096];	/* fnumber->increment counter */
+static YM2612_TLS UINT32 fn_table[4096];	/* fnumber->increment counter */
 
-static int g_lfo_ampm = 0;
+static YM2612_TLS int g_lfo_ampm = 0;
 
 /* register number to channel number , slot offset */
 #define OPN_CHAN(N) (N&3)
@@ -1297,10 +1297,14 @@ static void reset_channels(FM_CH *CH)
 /* initialize generic tables */
 static void init_tables(void)
 {
+	static int tables_done = 0; // notaz: these don't depend on rate, build once
 	signed int i,x,y,p;
 	signed int n;
 	double o,m;
 
+	if (tables_done) return;
+	tables_done = 1;
+
 	for (i=0; i < 256; i++)
 	{
 		/* non-standard sinus */
@@ -1584,9 +1588,9 @@ static int OPNWriteReg(int r, int v)
 /*      YM2612 local section                                                   */
 /*******************************************************************************/
 
-int   *ym2612_dacen;
-INT32 *ym2612_dacout;
-FM_ST *ym2612_st;
+YM2612_TLS int   *ym2612_dacen;
+YM2612_TLS INT32 *ym2612_dacout;
+YM2612_TLS FM_ST *ym2612_st;
 
 
 /* Generate samples for YM2612 */
@@ -1902,5 +1906,24 @@ void *YM2612GetRegs(void)
 {
 	return ym2612.REGS;
 }
+
+/* complete chip state (not just regs) for emulator instance switching, see Area.c.
+ * Tables depending on sample rate are shared, so all instances must use the same rate. */
+int YM2612ContextSize(void)
+{
+	return sizeof(ym2612) + sizeof(g_lfo_ampm);
+}
+
+void YM2612ContextSave(void *buf)
+{
+	memcpy(buf, &ym2612, sizeof(ym2612));
+	memcpy((char *)buf + sizeof(ym2612), &g_lfo_ampm, sizeof(g_lfo_ampm));
+}
+
+void YM2612ContextLoad(const void *buf)
+{
+	memcpy(&ym2612, buf, sizeof(ym2612));
+	memcpy(&g_lfo_ampm, (const char *)buf + sizeof(ym2612), sizeof(g_lfo_ampm));
+}
 #endif
 
@@ -17,6 +17,14 @@ typedef signed short	INT16;   /* signed 16bit   */
 typedef signed int		INT32;   /* signed 32bit   */
 #endif
 
+/* with YM2612_THREAD every thread has it's own chip: the worker thread renders
+ * (platform/common/ym2612_thread.c), while the emu thread keeps regs and timers */
+#ifdef YM2612_THREAD
+#define YM2612_TLS __thread
+#else
+#define YM2612_TLS
+#endif
+
 #if 1
 /* struct describing a single operator (SLOT) */
 typedef struct
@@ -141,9 +149,9 @@ typedef struct
 } YM2612;
 #endif
 
-extern int   *ym2612_dacen;
-extern INT32 *ym2612_dacout;
-extern FM_ST *ym2612_st;
+extern YM2612_TLS int   *ym2612_dacen;
+extern YM2612_TLS INT32 *ym2612_dacout;
+extern YM2612_TLS FM_ST *ym2612_st;
 
 
 #define YM2612Read() ym2612_st->status
@@ -175,8 +183,32 @@ int  YM2612PicoTick_(int n);
 void YM2612PicoStateLoad_(void);
 
 void *YM2612GetRegs(void);
+int  YM2612ContextSize(void);
+void YM2612ContextSave(void *buf);
+void YM2612ContextLoad(const void *buf);
 
-#ifndef __GP2X__
+#if defined(YM2612_THREAD)
+/* worker thread, uses the same interface as GP2X 940 code */
+#include "../../platform/gp2x/940ctl.h"
+extern int PicoOpt;
+#define YM2612Init(baseclock,rate) { \
+	if (PicoOpt&0x200) YM2612Init_940(baseclock, rate); \
+	else               YM2612Init_(baseclock, rate); \
+}
+#define YM2612ResetChip() { \
+	if (PicoOpt&0x200) YM2612ResetChip_940(); \
+	else               YM2612ResetChip_(); \
+}
+#define YM2612UpdateOne(buffer,length,stereo,is_buf_empty) \
+	((PicoOpt&0x200) ? YM2612UpdateOne_940(buffer, length, stereo, is_buf_empty) : \
+	                   YM2612UpdateOne_(buffer, length, stereo, is_buf_empty))
+#define YM2612Write(a,v) \
+	((PicoOpt&0x200) ? YM2612Write_940(a, v) : YM2612Write_(a, v))
+#define YM2612PicoStateLoad() { \
+	if (PicoOpt&0x200) YM2612PicoStateLoad_940(); \
+	else               YM2612PicoStateLoad_(); \
+}
+#elif !defined(__GP2X__)
 #define YM2612Init          YM2612Init_
 #define YM2612ResetChip     YM2612ResetChip_
 #define YM2612UpdateOne     YM2612UpdateOne_
@@ -248,6 +248,17 @@ Cz80_Exec:
 		if (CPU->ICount > 0)
 		{
 			union16 *data = pzHL;
+#ifdef CZ80_DRC
+			if (CPU == cz80_drc_ctx)
+			{
+				CPU->PC = PC;
+				if (cz80_drc_run(CPU))
+				{
+					PC = CPU->PC;
+					goto Cz80_Exec;
+				}
+			}
+#endif
 			Opcode = READ_OP();
 #if CZ80_EMULATE_R_EXACTLY
 			zR++;
@@ -297,6 +297,18 @@ void Cz80_Set_OUTPort(cz80_struc *CPU, void (*Func)(UINT16 port, UINT8 value));
 
 void Cz80_Set_IRQ_Callback(cz80_struc *CPU, INT32 (*Func)(INT32 irqline));
 
+#ifdef CZ80_DRC
+/* x86-64 block translator (cz80_drc.c), used by Cz80_Exec() */
+extern cz80_struc *cz80_drc_ctx;         // context to run translated code for, or NULL
+extern unsigned char *cz80_drc_code;     // RAM bytes (of 8K) with translated code
+int  cz80_drc_init(void);
+void cz80_drc_exit(void);
+void cz80_drc_set_ram(void *ram);
+void cz80_drc_flush(void);
+void cz80_drc_invalidate(unsigned int offs); // RAM write to a marked byte
+int  cz80_drc_run(cz80_struc *CPU);
+#endif
+
 #ifdef __cplusplus
 };
 #endif
@@ -0,0 +1,1472 @@
+// Z80 -> x86-64 block translator for cz80.
+// Sound drivers run from the 8K of z80 RAM, so only code there is translated,
+// cz80 itself still runs everything else (block instructions, HALT, EI, DAA..)
+// and takes interrupts. Translated code keeps z80 registers in the context,
+// makes the same memory and port accesses as cz80 and counts the same cycles,
+// so both can be mixed at any instruction boundary.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "cz80.h"
+
+typedef unsigned char  u8;
+typedef signed char    s8;
+typedef unsigned short u16;
+typedef unsigned int   u32;
+typedef signed int     s32;
+
+#define DRC_CACHE_SIZE  (1024*1024)
+#define DRC_BLOCKS      0x1000
+#define DRC_BLOCK_OPS   64      // max z80 instructions in one block
+#define DRC_OP_SPACE    0x200   // max host code for one instruction (ex (sp),hl)
+#define DRC_RAM_INVALS  32      // RAM page is left to cz80 after this many invalidations
+
+cz80_struc *cz80_drc_ctx; // context to translate for, NULL disables
+
+// state shared with translated code (addressed through r12)
+struct drc_state {
+	u8 *table[0x4000]; // code by z80 pc, NULL: not translated yet, drc_leave: cz80 runs it
+	u8 code[0x2000];   // RAM bytes holding translated code
+	u32 pc;            // z80 pc translated code stopped at
+	u8 exit;           // set by flush/invalidate: leave after current instruction
+};
+
+static struct drc_state drc_st;
+unsigned char *cz80_drc_code = drc_st.code;
+
+#define ST_TABLE offsetof(struct drc_state, table)
+#define ST_CODE  offsetof(struct drc_state, code)
+#define ST_PC    offsetof(struct drc_state, pc)
+#define ST_EXIT  offsetof(struct drc_state, exit)
+
+struct drc_block {
+	u16 pc;   // z80 address
+	u16 offs; // RAM offset of it
+	u16 len;  // RAM bytes covered, 0 once dropped
+};
+
+static struct drc_block *blocks;
+static int block_count;
+static u8 *ram;
+static u8 ram_invals[0x20];
+
+static u8 *tcache, *tcache_ptr, *tcache_base, *tcache_end;
+static u8 *drc_enter_ptr, *drc_dispatch, *drc_leave, *drc_leave_pc;
+
+// ----------------------------------------------------------------------------
+// x86-64 emitter
+
+enum { xAX = 0, xCX, xDX, xBX, xSP, xBP, xSI, xDI, xR8, xR9, xR10, xR11, xR12, xR13, xR14, xR15 };
+
+#define xCTX xBX   // cz80_struc
+#define xRAM xBP   // z80 RAM
+#define xST  xR12  // drc_st
+#define xADR xR13  // z80 address of memory operand
+#define xCYC xR14  // ICount, copied to/from the context around handler calls
+#define xTMP xR15  // kept over handler calls
+#define xAH  xSP   // as byte register (no REX)
+
+enum { ALU_ADD = 0, ALU_OR, ALU_ADC, ALU_SBB, ALU_AND, ALU_SUB, ALU_XOR, ALU_CMP };
+enum { SH_ROL = 0, SH_ROR, SH_RCL, SH_RCR, SH_SHL, SH_SHR, SH_SAL, SH_SAR };
+enum { CC_O = 0, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A, CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G };
+
+#define OP_MOVZX8  0x0fb6
+#define OP_MOVZX16 0x0fb7
+#define OP_SETCC   0x0f90
+
+#define EMIT(b) *tcache_ptr++ = (u8)(b)
+
+static void emit32(u32 v)
+{
+	memcpy(tcache_ptr, &v, 4);
+	tcache_ptr += 4;
+}
+
+static void emit_imm(int size, u32 v)
+{
+	if (size == 1) EMIT(v);
+	else if (size == 2) { EMIT(v); EMIT(v >> 8); }
+	else emit32(v);
+}
+
+// operand size prefix and REX; byte ops must only use al, cl, dl (or ah w/o REX)
+static void emit_prefix(int size, int reg, int index, int rm)
+{
+	int rex = 0;
+	if (size == 2) EMIT(0x66);
+	if (size == 8) rex |= 8;
+	if (reg & 8) rex |= 4;
+	if (index & 8) rex |= 2;
+	if (rm & 8) rex |= 1;
+	if (rex) EMIT(0x40 | rex);
+}
+
+static void emit_opcode(int opc)
+{
+	if (opc > 0xff) EMIT(opc >> 8);
+	EMIT(opc);
+}
+
+static void emit_disp(int base, int disp, int modrm, int sib)
+{
+	int mod = (disp == 0 && (base & 7) != xBP) ? 0 : (disp >= -128 && disp < 128) ? 1 : 2;
+	EMIT((mod << 6) | modrm);
+	if (sib >= 0) EMIT(sib);
+	if (mod == 1) EMIT(disp);
+	if (mod == 2) emit32(disp);
+}
+
+// opc with reg and [base+disp] operands
+static void emit_rm(int size, int opc, int reg, int base, int disp)
+{
+	emit_prefix(size, reg, 0, base);
+	emit_opcode(opc);
+	emit_disp(base, disp, ((reg & 7) << 3) | (base & 7), (base & 7) == xSP ? 0x24 : -1);
+}
+
+// opc with reg and [base+index*(1<<scale)+disp] operands
+static void emit_rmx(int size, int opc, int reg, int base, int index, int scale, int disp)
+{
+	emit_prefix(size, reg, index, base);
+	emit_opcode(opc);
+	emit_disp(base, disp, ((reg & 7) << 3) | 4, (scale << 6) | ((index & 7) << 3) | (base & 7));
+}
+
+// opc with two register operands
+static void emit_rr(int size, int opc, int reg, int rm)
+{
+	emit_prefix(size, reg, 0, rm);
+	emit_opcode(opc);
+	EMIT(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void emit_mov_rm(int size, int r, int base, int disp)
+{
+	emit_rm(size, size == 1 ? 0x8a : 0x8b, r, base, disp);
+}
+
+static void emit_mov_mr(int size, int base, int disp, int r)
+{
+	emit_rm(size, size == 1 ? 0x88 : 0x89, r, base, disp);
+}
+
+static void emit_mov_rr(int dst, int src)
+{
+	emit_rr(4, 0x8b, dst, src);
+}
+
+static void emit_mov_imm(int r, u32 imm)
+{
+	emit_prefix(4, 0, 0, r);
+	EMIT(0xb8 | (r & 7));
+	emit32(imm);
+}
+
+static void emit_mov_mimm(int size, int base, int disp, u32 imm)
+{
+	emit_rm(size, size == 1 ? 0xc6 : 0xc7, 0, base, disp);
+	emit_imm(size, imm);
+}
+
+// dst (register) op= src (register)
+static void emit_alu_rr(int size, int alu, int dst, int src)
+{
+	emit_rr(size, (alu << 3) | (size != 1), src, dst);
+}
+
+static void emit_alu_imm(int size, int alu, int r, s32 imm)
+{
+	if (size == 1) {
+		emit_rr(1, 0x80, alu, r);
+		EMIT(imm);
+	} else if (imm >= -128 && imm < 128) {
+		emit_rr(size, 0x83, alu, r);
+		EMIT(imm);
+	} else {
+		emit_rr(size, 0x81, alu, r);
+		emit_imm(size, imm);
+	}
+}
+
+static void emit_alu_mimm(int size, int alu, int base, int disp, s32 imm)
+{
+	if (size == 1) {
+		emit_rm(1, 0x80, alu, base, disp);
+		EMIT(imm);
+	} else if (imm >= -128 && imm < 128) {
+		emit_rm(size, 0x83, alu, base, disp);
+		EMIT(imm);
+	} else {
+		emit_rm(size, 0x81, alu, base, disp);
+		emit_imm(size, imm);
+	}
+}
+
+static void emit_test_rr(int size, int a, int b)
+{
+	emit_rr(size, size == 1 ? 0x84 : 0x85, a, b);
+}
+
+static void emit_shift_imm(int size, int op, int r, int n)
+{
+	emit_rr(size, size == 1 ? 0xc0 : 0xc1, op, r);
+	EMIT(n);
+}
+
+static void emit_lea(int dst, int base, int disp)
+{
+	emit_rm(4, 0x8d, dst, base, disp);
+}
+
+static u8 *emit_jcc(int cc)
+{
+	EMIT(0x0f);
+	EMIT(0x80 | cc);
+	emit32(0);
+	return tcache_ptr - 4;
+}
+
+static u8 *emit_jmp(void)
+{
+	EMIT(0xe9);
+	emit32(0);
+	return tcache_ptr - 4;
+}
+
+static void patch_rel32(u8 *p, u8 *target)
+{
+	s32 rel = target - (p + 4);
+	memcpy(p, &rel, 4);
+}
+
+static void emit_jmp_to(u8 *target)
+{
+	patch_rel32(emit_jmp(), target);
+}
+
+static void emit_jcc_to(int cc, u8 *target)
+{
+	patch_rel32(emit_jcc(cc), target);
+}
+
+static void emit_mov_imm64(int r, void *p)
+{
+	emit_prefix(8, 0, 0, r);
+	EMIT(0xb8 | (r & 7));
+	memcpy(tcache_ptr, &p, 8);
+	tcache_ptr += 8;
+}
+
+static void emit_call_abs(void *func)
+{
+	emit_mov_imm64(xAX, func);
+	emit_rr(4, 0xff, 2, xAX); // call rax
+}
+
+// ----------------------------------------------------------------------------
+// z80 context access
+
+#define CTX(f)     offsetof(cz80_struc, f)
+#define CTX_A      CTX(AF.B.H)
+#define CTX_F      CTX(AF.B.L)
+#define CTX_B      CTX(BC.B.H)
+#define CTX_HL     CTX(HL)
+#define CTX_SP     CTX(SP)
+#define CTX_ICOUNT CTX(ICount)
+
+static const u8 r8_offs[8] = {
+	CTX(BC.B.H), CTX(BC.B.L), CTX(DE.B.H), CTX(DE.B.L),
+	CTX(HL.B.H), CTX(HL.B.L), CTX(AF.B.L), CTX(AF.B.H)
+};
+static const u8 r16_offs[4] = { CTX(BC), CTX(DE), CTX(HL), CTX(SP) };
+
+static int xy;      // IX/IY offset for DD/FD prefixed instructions, else 0
+static int cyc_pre; // cycles cz80 takes for the prefix
+static int op_cyc;  // cycles of current instruction cz80 has used at its memory access
+static int op_wrote;
+
+// HL, or IX/IY with DD/FD prefix
+static int hl_off(void)
+{
+	return xy ? xy : CTX_HL;
+}
+
+// r8 operand, IXh/IXl/IYh/IYl where cz80 takes them
+static int r8_off(int r, int use_xy)
+{
+	if (use_xy && xy && (r == 4 || r == 5))
+		return xy + (r == 4);
+	return r8_offs[r];
+}
+
+static int r16_off(int r)
+{
+	return r == 2 ? hl_off() : r16_offs[r];
+}
+
+// handlers may look at (and change) the cycle counter
+static void emit_call_handler(int off)
+{
+	emit_lea(xAX, xCYC, -op_cyc);
+	emit_mov_mr(4, xCTX, CTX_ICOUNT, xAX);
+	emit_rm(4, 0xff, 2, xCTX, off); // call [rbx+off]
+	emit_mov_rm(4, xCYC, xCTX, CTX_ICOUNT);
+	if (op_cyc)
+		emit_alu_imm(4, ALU_ADD, xCYC, op_cyc);
+}
+
+static void drc_invalidate(u32 offs);
+
+// read z80 byte at low 16 bits of xADR to eax, RAM directly, the rest through Read_Byte
+static void emit_read8(void)
+{
+	u8 *j_slow, *j_done;
+
+	emit_rr(4, OP_MOVZX16, xDI, xADR);
+	emit_alu_imm(4, ALU_CMP, xDI, 0x4000);
+	j_slow = emit_jcc(CC_AE);
+	emit_alu_imm(4, ALU_AND, xDI, 0x1fff);
+	emit_rmx(4, OP_MOVZX8, xAX, xRAM, xDI, 0, 0);
+	j_done = emit_jmp();
+	patch_rel32(j_slow, tcache_ptr);
+	emit_call_handler(CTX(Read_Byte));
+	emit_rr(4, OP_MOVZX8, xAX, xAX);
+	patch_rel32(j_done, tcache_ptr);
+}
+
+static void emit_read8_at(u32 a)
+{
+	a &= 0xffff;
+	if (a < 0x4000) {
+		emit_rm(4, OP_MOVZX8, xAX, xRAM, a & 0x1fff);
+		return;
+	}
+	emit_mov_imm(xDI, a);
+	emit_call_handler(CTX(Read_Byte));
+	emit_rr(4, OP_MOVZX8, xAX, xAX);
+}
+
+// write low byte of hr (eax, ecx or edx) to z80 address in low 16 bits of xADR,
+// dropping translated code in RAM it hits
+static void emit_write8(int hr)
+{
+	u8 *j_slow, *j_done, *j_done2;
+
+	op_wrote = 1;
+	emit_rr(4, OP_MOVZX16, xDI, xADR);
+	emit_alu_imm(4, ALU_CMP, xDI, 0x4000);
+	j_slow = emit_jcc(CC_AE);
+	emit_alu_imm(4, ALU_AND, xDI, 0x1fff);
+	emit_rmx(1, 0x88, hr, xRAM, xDI, 0, 0);
+	emit_rmx(1, 0x80, ALU_CMP, xST, xDI, 0, ST_CODE);
+	EMIT(0);
+	j_done = emit_jcc(CC_E);
+	emit_call_abs(drc_invalidate);
+	j_done2 = emit_jmp();
+	patch_rel32(j_slow, tcache_ptr);
+	emit_rr(4, OP_MOVZX8, xSI, hr);
+	emit_call_handler(CTX(Write_Byte));
+	patch_rel32(j_done, tcache_ptr);
+	patch_rel32(j_done2, tcache_ptr);
+}
+
+static void emit_write8_at(u32 a, int hr)
+{
+	u8 *j_done;
+
+	op_wrote = 1;
+	a &= 0xffff;
+	if (a < 0x4000) {
+		a &= 0x1fff;
+		emit_mov_mr(1, xRAM, a, hr);
+		emit_alu_mimm(1, ALU_CMP, xST, ST_CODE + a, 0);
+		j_done = emit_jcc(CC_E);
+		emit_mov_imm(xDI, a);
+		emit_call_abs(drc_invalidate);
+		patch_rel32(j_done, tcache_ptr);
+		return;
+	}
+	emit_rr(4, OP_MOVZX8, xSI, hr);
+	emit_mov_imm(xDI, a);
+	emit_call_handler(CTX(Write_Byte));
+}
+
+// LD rr,(nn) / LD (nn),rr
+static void emit_read16_at(u32 a, int off)
+{
+	emit_read8_at(a);
+	emit_mov_mr(1, xCTX, off, xAX);
+	emit_read8_at(a + 1);
+	emit_mov_mr(1, xCTX, off + 1, xAX);
+}
+
+static void emit_write16_at(u32 a, int off)
+{
+	emit_rm(4, OP_MOVZX16, xTMP, xCTX, off);
+	emit_mov_rr(xAX, xTMP);
+	emit_write8_at(a, xAX);
+	emit_mov_rr(xAX, xTMP);
+	emit_shift_imm(4, SH_SHR, xAX, 8);
+	emit_write8_at(a + 1, xAX);
+}
+
+// push register pair at off, or xTMP if off < 0
+static void emit_push(int off)
+{
+	emit_alu_mimm(2, ALU_SUB, xCTX, CTX_SP, 2);
+	emit_rm(4, OP_MOVZX16, xADR, xCTX, CTX_SP);
+	if (off >= 0)
+		emit_rm(4, OP_MOVZX16, xTMP, xCTX, off);
+	emit_mov_rr(xAX, xTMP);
+	emit_write8(xAX);
+	emit_alu_imm(4, ALU_ADD, xADR, 1);
+	emit_mov_rr(xAX, xTMP);
+	emit_shift_imm(4, SH_SHR, xAX, 8);
+	emit_write8(xAX);
+}
+
+// pop to register pair at off, or edi if off < 0
+static void emit_pop(int off)
+{
+	emit_rm(4, OP_MOVZX16, xADR, xCTX, CTX_SP);
+	emit_read8();
+	if (off >= 0)
+		emit_mov_mr(1, xCTX, off, xAX);
+	else
+		emit_mov_rr(xTMP, xAX);
+	emit_alu_imm(4, ALU_ADD, xADR, 1);
+	emit_read8();
+	if (off >= 0)
+		emit_mov_mr(1, xCTX, off + 1, xAX);
+	else {
+		emit_shift_imm(4, SH_SHL, xAX, 8);
+		emit_alu_rr(4, ALU_OR, xAX, xTMP);
+		emit_mov_rr(xDI, xAX);
+	}
+	emit_alu_mimm(2, ALU_ADD, xCTX, CTX_SP, 2);
+}
+
+// ----------------------------------------------------------------------------
+// flags
+
+enum { ZA_ADD = 0, ZA_ADC, ZA_SUB, ZA_SBC, ZA_AND, ZA_XOR, ZA_OR, ZA_CP };
+
+// A op= cl, sets F like cz80 tables do
+static void emit_alu8(int op)
+{
+	static const u8 x86op[8] = { ALU_ADD, ALU_ADC, ALU_SUB, ALU_SBB, ALU_AND, ALU_XOR, ALU_OR, ALU_CMP };
+
+	emit_mov_rm(1, xAX, xCTX, CTX_A);
+	if (op == ZA_ADC || op == ZA_SBC) {
+		emit_mov_rm(1, xDX, xCTX, CTX_F);
+		emit_shift_imm(1, SH_SHR, xDX, 1); // CF = z80 C
+	}
+	emit_alu_rr(1, x86op[op], xAX, xCX);
+	EMIT(0x9f); // lahf
+	if (op >= ZA_AND && op <= ZA_OR) {
+		emit_mov_mr(1, xCTX, CTX_A, xAX);
+		emit_alu_imm(1, ALU_AND, xAX, 0x28);
+		emit_alu_imm(1, ALU_AND, xAH, 0xc4);
+		emit_alu_rr(1, ALU_OR, xAX, xAH);
+		if (op == ZA_AND)
+			emit_alu_imm(1, ALU_OR, xAX, 0x10);
+	} else {
+		emit_rr(1, OP_SETCC | CC_O, 0, xDX);
+		emit_alu_imm(1, ALU_AND, xAH, 0xd1);
+		emit_shift_imm(1, SH_SHL, xDX, 2);
+		emit_alu_rr(1, ALU_OR, xAH, xDX);
+		if (op == ZA_CP)
+			emit_rr(1, 0x8a, xAX, xCX); // Y and X come from the operand
+		else
+			emit_mov_mr(1, xCTX, CTX_A, xAX);
+		emit_alu_imm(1, ALU_AND, xAX, 0x28);
+		emit_alu_rr(1, ALU_OR, xAX, xAH);
+		if (op >= ZA_SUB)
+			emit_alu_imm(1, ALU_OR, xAX, 0x02);
+	}
+	emit_mov_mr(1, xCTX, CTX_F, xAX);
+}
+
+// inc/dec al, F keeps C
+static void emit_incdec8(int dec)
+{
+	emit_rr(1, 0xfe, dec, xAX);
+	EMIT(0x9f); // lahf
+	emit_rr(1, OP_SETCC | CC_O, 0, xDX);
+	emit_mov_rr(xCX, xAX);
+	emit_alu_imm(1, ALU_AND, xCX, 0x28);
+	emit_alu_imm(1, ALU_AND, xAH, 0xd0);
+	emit_alu_rr(1, ALU_OR, xCX, xAH);
+	emit_shift_imm(1, SH_SHL, xDX, 2);
+	emit_alu_rr(1, ALU_OR, xCX, xDX);
+	emit_mov_rm(1, xDX, xCTX, CTX_F);
+	emit_alu_imm(1, ALU_AND, xDX, 0x01);
+	emit_alu_rr(1, ALU_OR, xCX, xDX);
+	if (dec)
+		emit_alu_imm(1, ALU_OR, xCX, 0x02);
+	emit_mov_mr(1, xCTX, CTX_F, xCX);
+}
+
+// CB shifts/rotates of al: rlc rrc rl rr sla sra sll srl
+static void emit_shift8(int n)
+{
+	static const u8 sh[8] = { SH_ROL, SH_ROR, SH_RCL, SH_RCR, SH_SHL, SH_SAR, SH_SHL, SH_SHR };
+
+	if (n == 2 || n == 3) {
+		emit_mov_rm(1, xCX, xCTX, CTX_F);
+		emit_shift_imm(1, SH_SHR, xCX, 1);
+	}
+	emit_shift_imm(1, sh[n], xAX, 1);
+	emit_rr(1, OP_SETCC | CC_B, 0, xDX);
+	if (n == 6)
+		emit_alu_imm(1, ALU_OR, xAX, 0x01);
+	emit_test_rr(1, xAX, xAX);
+	EMIT(0x9f); // lahf
+	emit_mov_rr(xCX, xAX);
+	emit_alu_imm(1, ALU_AND, xCX, 0x28);
+	emit_alu_imm(1, ALU_AND, xAH, 0xc4);
+	emit_alu_rr(1, ALU_OR, xCX, xAH);
+	emit_alu_rr(1, ALU_OR, xCX, xDX);
+	emit_mov_mr(1, xCTX, CTX_F, xCX);
+}
+
+// BIT n,al; Y and X from the value, or from high byte of xADR for (IX+d)
+static void emit_bit8(int n, int adr_yx)
+{
+	emit_alu_imm(1, ALU_AND, xAX, 1 << n);
+	EMIT(0x9f); // lahf, P and Z are both set for zero
+	emit_alu_imm(1, ALU_AND, xAH, 0xc4);
+	if (adr_yx) {
+		emit_mov_rr(xCX, xADR);
+		emit_shift_imm(4, SH_SHR, xCX, 8);
+	} else
+		emit_mov_rr(xCX, xAX);
+	emit_alu_imm(1, ALU_AND, xCX, 0x28);
+	emit_alu_rr(1, ALU_OR, xCX, xAH);
+	emit_alu_imm(1, ALU_OR, xCX, 0x10);
+	emit_mov_rm(1, xDX, xCTX, CTX_F);
+	emit_alu_imm(1, ALU_AND, xDX, 0x01);
+	emit_alu_rr(1, ALU_OR, xCX, xDX);
+	emit_mov_mr(1, xCTX, CTX_F, xCX);
+}
+
+// RLCA RRCA RLA RRA
+static void emit_rot_a(int n)
+{
+	static const u8 sh[4] = { SH_ROL, SH_ROR, SH_RCL, SH_RCR };
+
+	emit_mov_rm(1, xAX, xCTX, CTX_A);
+	if (n >= 2) {
+		emit_mov_rm(1, xCX, xCTX, CTX_F);
+		emit_shift_imm(1, SH_SHR, xCX, 1);
+	}
+	emit_shift_imm(1, sh[n], xAX, 1);
+	emit_rr(1, OP_SETCC | CC_B, 0, xDX);
+	emit_mov_mr(1, xCTX, CTX_A, xAX);
+	emit_alu_imm(1, ALU_AND, xAX, 0x28);
+	emit_alu_rr(1, ALU_OR, xAX, xDX);
+	emit_mov_rm(1, xCX, xCTX, CTX_F);
+	emit_alu_imm(1, ALU_AND, xCX, 0xc4);
+	emit_alu_rr(1, ALU_OR, xAX, xCX);
+	emit_mov_mr(1, xCTX, CTX_F, xAX);
+}
+
+// ADD HL,rr
+static void emit_add16(int dst, int src)
+{
+	emit_rm(4, OP_MOVZX16, xAX, xCTX, dst);
+	emit_rm(4, OP_MOVZX16, xCX, xCTX, src);
+	emit_mov_rr(xDX, xAX);
+	emit_alu_rr(4, ALU_ADD, xDX, xCX);
+	emit_mov_mr(2, xCTX, dst, xDX);
+	emit_alu_rr(4, ALU_XOR, xAX, xCX);
+	emit_alu_rr(4, ALU_XOR, xAX, xDX);
+	emit_shift_imm(4, SH_SHR, xAX, 8);
+	emit_alu_imm(4, ALU_AND, xAX, 0x10);     // H
+	emit_shift_imm(4, SH_SHR, xDX, 8);
+	emit_mov_rr(xCX, xDX);
+	emit_shift_imm(4, SH_SHR, xCX, 8);
+	emit_alu_rr(4, ALU_OR, xAX, xCX);        // C
+	emit_alu_imm(4, ALU_AND, xDX, 0x28);
+	emit_alu_rr(4, ALU_OR, xAX, xDX);        // Y X
+	emit_mov_rm(1, xCX, xCTX, CTX_F);
+	emit_alu_imm(1, ALU_AND, xCX, 0xc4);
+	emit_alu_rr(1, ALU_OR, xAX, xCX);
+	emit_mov_mr(1, xCTX, CTX_F, xAX);
+}
+
+// ADC/SBC HL,rr
+static void emit_adc16(int sub, int src)
+{
+	emit_rm(4, OP_MOVZX16, xSI, xCTX, CTX_HL);
+	emit_rm(4, OP_MOVZX16, xCX, xCTX, src);
+	emit_mov_rr(xDX, xSI);
+	emit_mov_rm(1, xAX, xCTX, CTX_F);
+	emit_shift_imm(1, SH_SHR, xAX, 1);       // CF = z80 C
+	emit_alu_rr(2, sub ? ALU_SBB : ALU_ADC, xDX, xCX);
+	EMIT(0x9f); // lahf
+	emit_rr(1, OP_SETCC | CC_O, 0, xAX);
+	emit_mov_mr(2, xCTX, CTX_HL, xDX);
+	emit_alu_rr(4, ALU_XOR, xSI, xCX);
+	emit_alu_rr(4, ALU_XOR, xSI, xDX);
+	emit_shift_imm(4, SH_SHR, xSI, 8);
+	emit_alu_imm(4, ALU_AND, xSI, 0x10);     // H
+	emit_mov_rr(xCX, xDX);
+	emit_shift_imm(4, SH_SHR, xCX, 8);
+	emit_alu_imm(4, ALU_AND, xCX, 0x28);     // Y X
+	emit_alu_rr(4, ALU_OR, xCX, xSI);
+	emit_shift_imm(1, SH_SHL, xAX, 2);       // V
+	emit_alu_rr(1, ALU_OR, xCX, xAX);
+	emit_alu_imm(1, ALU_AND, xAH, 0xc1);     // S Z C
+	emit_alu_rr(1, ALU_OR, xCX, xAH);
+	if (sub)
+		emit_alu_imm(1, ALU_OR, xCX, 0x02);
+	emit_mov_mr(1, xCTX, CTX_F, xCX);
+}
+
+// test z80 condition, returns x86 condition for "not taken"
+static int emit_cond(int cc)
+{
+	static const u8 masks[4] = { 0x40, 0x01, 0x04, 0x80 }; // Z C P/V S
+
+	emit_rm(1, 0xf6, 0, xCTX, CTX_F); // test byte [F], mask
+	EMIT(masks[cc >> 1]);
+	return (cc & 1) ? CC_E : CC_NE;
+}
+
+// ----------------------------------------------------------------------------
+// translation state
+
+static u32 insn_pc, op_pc;
+
+static struct {
+	u8 *jmp;
+	u8 *stub;
+	u32 pc;
+	int link;
+} exits[DRC_BLOCK_OPS * 4];
+static int exit_count;
+
+static u32 blk_op_pc[DRC_BLOCK_OPS];
+static u8 *blk_op_code[DRC_BLOCK_OPS];
+static int blk_ops;
+
+static u32 fetch8(void)
+{
+	return ram[op_pc++ & 0x1fff];
+}
+
+static u32 fetch16(void)
+{
+	u32 v = fetch8();
+	return v | (fetch8() << 8);
+}
+
+// leave translated code, cz80 continues at pc (cc < 0: always)
+static void emit_exit(int cc, u32 pc)
+{
+	exits[exit_count].jmp = cc < 0 ? emit_jmp() : emit_jcc(cc);
+	exits[exit_count].pc = pc;
+	exits[exit_count].link = 0;
+	exit_count++;
+}
+
+// continue at z80 pc known at translation time
+static void emit_goto(u32 pc)
+{
+	int i;
+
+	for (i = 0; i < blk_ops; i++) {
+		if (blk_op_pc[i] == pc) {
+			emit_jmp_to(blk_op_code[i]);
+			return;
+		}
+	}
+
+	exits[exit_count].jmp = emit_jmp();
+	exits[exit_count].pc = pc;
+	exits[exit_count].link = 1;
+	exit_count++;
+}
+
+// continue at z80 pc in edi
+static void emit_goto_dynamic(int cycles)
+{
+	emit_alu_imm(4, ALU_SUB, xCYC, cyc_pre + cycles);
+	emit_jcc_to(CC_LE, drc_leave_pc);
+	emit_jmp_to(drc_dispatch);
+}
+
+static void emit_insn_end(int cycles)
+{
+	emit_alu_imm(4, ALU_SUB, xCYC, cyc_pre + cycles);
+	emit_exit(CC_LE, op_pc);
+	if (op_wrote) {
+		emit_alu_mimm(1, ALU_CMP, xST, ST_EXIT, 0);
+		emit_exit(CC_NE, op_pc);
+	}
+}
+
+static void emit_branch_end(int cycles, u32 target)
+{
+	emit_alu_imm(4, ALU_SUB, xCYC, cyc_pre + cycles);
+	emit_exit(CC_LE, target);
+	if (op_wrote) {
+		emit_alu_mimm(1, ALU_CMP, xST, ST_EXIT, 0);
+		emit_exit(CC_NE, target);
+	}
+	emit_goto(target);
+}
+
+// xADR = HL, or IX/IY + d like cz80 calculates it (not wrapped to 16 bits)
+static void emit_adr_hl(void)
+{
+	emit_rm(4, OP_MOVZX16, xADR, xCTX, hl_off());
+	if (xy) {
+		s8 d = fetch8();
+		if (d != 0)
+			emit_alu_imm(4, ALU_ADD, xADR, d);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// instructions
+
+static int tr_cb(void)
+{
+	u32 op = fetch8();
+	int n = (op >> 3) & 7, s = op & 7;
+
+	if (s == 6) {
+		emit_adr_hl();
+		emit_read8();
+	} else
+		emit_rm(4, OP_MOVZX8, xAX, xCTX, r8_offs[s]);
+
+	switch (op >> 6) {
+	case 0: emit_shift8(n); break;
+	case 1:
+		emit_bit8(n, 0);
+		emit_insn_end(s == 6 ? 12 : 8);
+		return 0;
+	case 2: emit_alu_imm(1, ALU_AND, xAX, ~(1 << n)); break;
+	case 3: emit_alu_imm(1, ALU_OR, xAX, 1 << n); break;
+	}
+
+	if (s == 6) {
+		emit_write8(xAX);
+		emit_insn_end(15);
+	} else {
+		emit_mov_mr(1, xCTX, r8_offs[s], xAX);
+		emit_insn_end(8);
+	}
+	return 0;
+}
+
+// DD/FD CB d op, result also goes to a register for s != 6
+static int tr_xycb(void)
+{
+	u32 op;
+	int n, s;
+
+	emit_adr_hl();
+	op = fetch8();
+	n = (op >> 3) & 7;
+	s = op & 7;
+	emit_read8();
+
+	switch (op >> 6) {
+	case 0: emit_shift8(n); break;
+	case 1:
+		emit_bit8(n, 1);
+		emit_insn_end(16);
+		return 0;
+	case 2: emit_alu_imm(1, ALU_AND, xAX, ~(1 << n)); break;
+	case 3: emit_alu_imm(1, ALU_OR, xAX, 1 << n); break;
+	}
+
+	if (s != 6)
+		emit_mov_mr(1, xCTX, r8_offs[s], xAX);
+	emit_write8(xAX);
+	emit_insn_end(19);
+	return 0;
+}
+
+static int tr_ed(u32 op)
+{
+	int rr = (op >> 4) & 3;
+
+	switch (op) {
+	case 0x43: case 0x53: case 0x63: case 0x73: // LD (nn),rr
+		emit_write16_at(fetch16(), r16_offs[rr]);
+		emit_insn_end(16);
+		return 0;
+	case 0x4b: case 0x5b: case 0x6b: case 0x7b: // LD rr,(nn)
+		emit_read16_at(fetch16(), r16_offs[rr]);
+		emit_insn_end(16);
+		return 0;
+	case 0x44: case 0x4c: case 0x54: case 0x5c:
+	case 0x64: case 0x6c: case 0x74: case 0x7c: // NEG
+		emit_mov_rm(1, xCX, xCTX, CTX_A);
+		emit_mov_mimm(1, xCTX, CTX_A, 0);
+		emit_alu8(ZA_SUB);
+		emit_insn_end(4);
+		return 0;
+	case 0x42: case 0x52: case 0x62: case 0x72: // SBC HL,rr
+	case 0x4a: case 0x5a: case 0x6a: case 0x7a: // ADC HL,rr
+		emit_adc16(!(op & 8), r16_offs[rr]);
+		emit_insn_end(11);
+		return 0;
+	case 0x46: case 0x4e: case 0x66: case 0x6e: // IM 0
+	case 0x56: case 0x76: // IM 1
+	case 0x5e: case 0x7e: // IM 2
+		emit_mov_mimm(1, xCTX, CTX(IM), (op & 0x18) == 0x18 ? 2 : (op & 0x18) == 0x10 ? 1 : 0);
+		emit_insn_end(4);
+		return 0;
+	case 0x47: // LD I,A
+		emit_mov_rm(1, xAX, xCTX, CTX_A);
+		emit_mov_mr(1, xCTX, CTX(I), xAX);
+		emit_insn_end(5);
+		return 0;
+	case 0x4d: case 0x5d: case 0x6d: case 0x7d: // RETI
+		emit_pop(-1);
+		emit_goto_dynamic(10);
+		return 1;
+	case 0xa0: case 0xa8: // LDI, LDD
+		emit_rm(4, OP_MOVZX16, xADR, xCTX, CTX_HL);
+		emit_alu_mimm(2, op == 0xa0 ? ALU_ADD : ALU_SUB, xCTX, CTX_HL, 1);
+		emit_read8();
+		emit_mov_rr(xTMP, xAX);
+		emit_rm(4, OP_MOVZX16, xADR, xCTX, CTX(DE));
+		emit_alu_mimm(2, op == 0xa0 ? ALU_ADD : ALU_SUB, xCTX, CTX(DE), 1);
+		emit_write8(xAX);
+		emit_rm(4, OP_MOVZX8, xAX, xCTX, CTX_A);
+		emit_alu_rr(4, ALU_ADD, xAX, xTMP);
+		emit_mov_rr(xCX, xAX);
+		emit_alu_imm(4, ALU_AND, xCX, 0x02);
+		emit_shift_imm(4, SH_SHL, xCX, 4);       // Y from bit 1
+		emit_alu_imm(4, ALU_AND, xAX, 0x08);     // X
+		emit_alu_rr(4, ALU_OR, xCX, xAX);
+		emit_mov_rm(1, xAX, xCTX, CTX_F);
+		emit_alu_imm(1, ALU_AND, xAX, 0xc1);
+		emit_alu_rr(1, ALU_OR, xCX, xAX);
+		emit_alu_mimm(2, ALU_SUB, xCTX, CTX(BC), 1);
+		emit_rr(1, OP_SETCC | CC_NE, 0, xAX);
+		emit_shift_imm(1, SH_SHL, xAX, 2);       // V: BC != 0
+		emit_alu_rr(1, ALU_OR, xCX, xAX);
+		emit_mov_mr(1, xCTX, CTX_F, xCX);
+		emit_insn_end(12);
+		return 0;
+	}
+	return -1;
+}
+
+// unprefixed and DD/FD prefixed instructions
+static int tr_op(u32 op)
+{
+	int r = (op >> 3) & 7, s = op & 7;
+	u32 v, t;
+	u8 *j;
+
+	if (op >= 0x40 && op < 0x80 && op != 0x76) {
+		if (r == 6) { // LD (HL),r
+			emit_adr_hl();
+			emit_mov_rm(1, xDX, xCTX, r8_offs[s]);
+			emit_write8(xDX);
+			emit_insn_end(xy ? 15 : 7);
+		} else if (s == 6) { // LD r,(HL)
+			emit_adr_hl();
+			emit_read8();
+			emit_mov_mr(1, xCTX, r8_offs[r], xAX);
+			emit_insn_end(xy ? 15 : 7);
+		} else {
+			if (r != s) {
+				emit_mov_rm(1, xAX, xCTX, r8_off(s, 1));
+				emit_mov_mr(1, xCTX, r8_off(r, 1), xAX);
+			}
+			emit_insn_end(xy && r != s && (r == 4 || r == 5 || s == 4 || s == 5) ? 5 : 4);
+		}
+		return 0;
+	}
+
+	if (op >= 0x80 && op < 0xc0) { // ALU A,r
+		if (s == 6) {
+			emit_adr_hl();
+			emit_read8();
+			emit_mov_rr(xCX, xAX);
+		} else
+			emit_mov_rm(1, xCX, xCTX, r8_off(s, 1));
+		emit_alu8(r);
+		emit_insn_end(s == 6 ? (xy ? 15 : 7) : (xy && (s == 4 || s == 5)) ? 5 : 4);
+		return 0;
+	}
+
+	switch (op & 0xc7) {
+	case 0x04: case 0x05: // INC/DEC r
+		if (r == 6) {
+			emit_adr_hl();
+			if (xy) op_cyc += 8;
+			emit_read8();
+			emit_incdec8(op & 1);
+			emit_write8(xAX);
+			emit_insn_end(xy ? 8 + 11 : 11);
+		} else {
+			emit_mov_rm(1, xAX, xCTX, r8_off(r, 1));
+			emit_incdec8(op & 1);
+			emit_mov_mr(1, xCTX, r8_off(r, 1), xAX);
+			emit_insn_end(xy && (r == 4 || r == 5) ? 5 : 4);
+		}
+		return 0;
+	case 0x06: // LD r,n
+		if (r == 6) {
+			emit_adr_hl();
+			emit_mov_imm(xDX, fetch8());
+			emit_write8(xDX);
+			emit_insn_end(xy ? 15 : 10);
+		} else {
+			emit_mov_mimm(1, xCTX, r8_off(r, 1), fetch8());
+			emit_insn_end(xy && (r == 4 || r == 5) ? 5 : 7);
+		}
+		return 0;
+	case 0xc6: // ALU A,n
+		emit_mov_imm(xCX, fetch8());
+		emit_alu8(r);
+		emit_insn_end(7);
+		return 0;
+	case 0xc0: // RET cc
+		j = emit_jcc(emit_cond(r));
+		op_cyc += 1;
+		emit_pop(-1);
+		emit_goto_dynamic(11);
+		patch_rel32(j, tcache_ptr);
+		op_cyc -= 1;
+		emit_insn_end(5);
+		return 0;
+	case 0xc2: // JP cc,nn
+		t = fetch16();
+		j = emit_jcc(emit_cond(r));
+		emit_branch_end(10, t);
+		patch_rel32(j, tcache_ptr);
+		emit_insn_end(10);
+		return 0;
+	case 0xc4: // CALL cc,nn
+		t = fetch16();
+		j = emit_jcc(emit_cond(r));
+		emit_mov_imm(xTMP, op_pc);
+		emit_push(-1);
+		emit_branch_end(17, t);
+		patch_rel32(j, tcache_ptr);
+		op_wrote = 0;
+		emit_insn_end(10);
+		return 0;
+	case 0xc7: // RST
+		emit_mov_imm(xTMP, op_pc);
+		emit_push(-1);
+		emit_branch_end(11, op & 0x38);
+		return 1;
+	}
+
+	switch (op & 0xcf) {
+	case 0x01: // LD rr,nn
+		emit_mov_mimm(2, xCTX, r16_off(op >> 4), fetch16());
+		emit_insn_end(10);
+		return 0;
+	case 0x03: case 0x0b: // INC/DEC rr
+		emit_alu_mimm(2, (op & 8) ? ALU_SUB : ALU_ADD, xCTX, r16_off(op >> 4), 1);
+		emit_insn_end(6);
+		return 0;
+	case 0x09: // ADD HL,rr
+		emit_add16(hl_off(), r16_off(op >> 4));
+		emit_insn_end(11);
+		return 0;
+	case 0xc1: // POP
+		emit_pop((op >> 4) == 0xf ? CTX(AF) : r16_off((op >> 4) & 3));
+		emit_insn_end(10);
+		return 0;
+	case 0xc5: // PUSH
+		emit_push((op >> 4) == 0xf ? CTX(AF) : r16_off((op >> 4) & 3));
+		emit_insn_end(11);
+		return 0;
+	}
+
+	switch (op) {
+	case 0x00: // NOP
+		emit_insn_end(4);
+		return 0;
+	case 0x02: case 0x12: // LD (BC),A / LD (DE),A
+		emit_rm(4, OP_MOVZX16, xADR, xCTX, r16_offs[op >> 4]);
+		emit_mov_rm(1, xDX, xCTX, CTX_A);
+		emit_write8(xDX);
+		emit_insn_end(7);
+		return 0;
+	case 0x0a: case 0x1a: // LD A,(BC) / LD A,(DE)
+		emit_rm(4, OP_MOVZX16, xADR, xCTX, r16_offs[op >> 4]);
+		emit_read8();
+		emit_mov_mr(1, xCTX, CTX_A, xAX);
+		emit_insn_end(7);
+		return 0;
+	case 0x22: // LD (nn),HL
+		emit_write16_at(fetch16(), hl_off());
+		emit_insn_end(16);
+		return 0;
+	case 0x2a: // LD HL,(nn)
+		emit_read16_at(fetch16(), hl_off());
+		emit_insn_end(16);
+		return 0;
+	case 0x32: // LD (nn),A
+		v = fetch16();
+		emit_mov_rm(1, xDX, xCTX, CTX_A);
+		emit_write8_at(v, xDX);
+		emit_insn_end(13);
+		return 0;
+	case 0x3a: // LD A,(nn)
+		emit_read8_at(fetch16());
+		emit_mov_mr(1, xCTX, CTX_A, xAX);
+		emit_insn_end(13);
+		return 0;
+	case 0x07: case 0x0f: case 0x17: case 0x1f: // RLCA RRCA RLA RRA
+		emit_rot_a(r);
+		emit_insn_end(4);
+		return 0;
+	case 0x2f: // CPL
+		emit_mov_rm(1, xAX, xCTX, CTX_A);
+		emit_alu_imm(1, ALU_XOR, xAX, 0xff);
+		emit_mov_mr(1, xCTX, CTX_A, xAX);
+		emit_alu_imm(1, ALU_AND, xAX, 0x28);
+		emit_alu_imm(1, ALU_OR, xAX, 0x12);
+		emit_mov_rm(1, xCX, xCTX, CTX_F);
+		emit_alu_imm(1, ALU_AND, xCX, 0xc5);
+		emit_alu_rr(1, ALU_OR, xAX, xCX);
+		emit_mov_mr(1, xCTX, CTX_F, xAX);
+		emit_insn_end(4);
+		return 0;
+	case 0x37: case 0x3f: // SCF, CCF
+		emit_mov_rm(1, xAX, xCTX, CTX_A);
+		emit_alu_imm(1, ALU_AND, xAX, 0x28);
+		emit_rm(4, OP_MOVZX8, xCX, xCTX, CTX_F);
+		if (op == 0x37) {
+			emit_alu_imm(1, ALU_AND, xCX, 0xc4);
+			emit_alu_imm(1, ALU_OR, xCX, 0x01);
+		} else {
+			emit_mov_rr(xDX, xCX);
+			emit_alu_imm(1, ALU_AND, xDX, 0x01);
+			emit_shift_imm(1, SH_SHL, xDX, 4);
+			emit_alu_imm(1, ALU_AND, xCX, 0xc5);
+			emit_alu_rr(1, ALU_OR, xCX, xDX);
+			emit_alu_imm(1, ALU_XOR, xCX, 0x01);
+		}
+		emit_alu_rr(1, ALU_OR, xAX, xCX);
+		emit_mov_mr(1, xCTX, CTX_F, xAX);
+		emit_insn_end(4);
+		return 0;
+	case 0x08: // EX AF,AF'
+		emit_rm(4, OP_MOVZX16, xAX, xCTX, CTX(AF));
+		emit_rm(4, OP_MOVZX16, xCX, xCTX, CTX(AF2));
+		emit_mov_mr(2, xCTX, CTX(AF), xCX);
+		emit_mov_mr(2, xCTX, CTX(AF2), xAX);
+		emit_insn_end(4);
+		return 0;
+	case 0xeb: // EX DE,HL
+		emit_rm(4, OP_MOVZX16, xAX, xCTX, CTX(DE));
+		emit_rm(4, OP_MOVZX16, xCX, xCTX, CTX_HL);
+		emit_mov_mr(2, xCTX, CTX(DE), xCX);
+		emit_mov_mr(2, xCTX, CTX_HL, xAX);
+		emit_insn_end(4);
+		return 0;
+	case 0xd9: // EXX
+		for (v = 0; v < 3; v++) {
+			emit_rm(4, OP_MOVZX16, xAX, xCTX, CTX(BC) + v * 2);
+			emit_rm(4, OP_MOVZX16, xCX, xCTX, CTX(BC2) + v * 2);
+			emit_mov_mr(2, xCTX, CTX(BC) + v * 2, xCX);
+			emit_mov_mr(2, xCTX, CTX(BC2) + v * 2, xAX);
+		}
+		emit_insn_end(4);
+		return 0;
+	case 0xe3: // EX (SP),HL
+		emit_rm(4, OP_MOVZX16, xADR, xCTX, CTX_SP);
+		emit_rm(4, OP_MOVZX16, xTMP, xCTX, hl_off());
+		emit_read8();
+		emit_mov_mr(1, xCTX, hl_off(), xAX);
+		emit_alu_imm(4, ALU_ADD, xADR, 1);
+		emit_read8();
+		emit_mov_mr(1, xCTX, hl_off() + 1, xAX);
+		emit_rm(4, OP_MOVZX16, xADR, xCTX, CTX_SP);
+		emit_mov_rr(xAX, xTMP);
+		emit_write8(xAX);
+		emit_alu_imm(4, ALU_ADD, xADR, 1);
+		emit_mov_rr(xAX, xTMP);
+		emit_shift_imm(4, SH_SHR, xAX, 8);
+		emit_write8(xAX);
+		emit_insn_end(19);
+		return 0;
+	case 0xf9: // LD SP,HL
+		emit_rm(4, OP_MOVZX16, xAX, xCTX, hl_off());
+		emit_mov_mr(2, xCTX, CTX_SP, xAX);
+		emit_insn_end(6);
+		return 0;
+	case 0xf3: // DI
+		emit_mov_mimm(2, xCTX, CTX(IFF), 0);
+		emit_insn_end(4);
+		return 0;
+	case 0xd3: case 0xdb: // OUT (n),A / IN A,(n)
+		emit_rm(4, OP_MOVZX8, xDI, xCTX, CTX_A);
+		emit_shift_imm(4, SH_SHL, xDI, 8);
+		emit_alu_imm(4, ALU_OR, xDI, fetch8());
+		if (op == 0xd3) {
+			emit_rm(4, OP_MOVZX8, xSI, xCTX, CTX_A);
+			emit_call_handler(CTX(OUT_Port));
+		} else {
+			emit_call_handler(CTX(IN_Port));
+			emit_mov_mr(1, xCTX, CTX_A, xAX);
+		}
+		emit_insn_end(11);
+		return 0;
+	case 0xc3: // JP nn
+		emit_branch_end(10, fetch16());
+		return 1;
+	case 0xe9: // JP (HL)
+		emit_rm(4, OP_MOVZX16, xDI, xCTX, hl_off());
+		emit_goto_dynamic(4);
+		return 1;
+	case 0xcd: // CALL nn
+		t = fetch16();
+		emit_mov_imm(xTMP, op_pc);
+		emit_push(-1);
+		emit_branch_end(17, t);
+		return 1;
+	case 0xc9: // RET
+		emit_pop(-1);
+		emit_goto_dynamic(10);
+		return 1;
+	case 0x10: case 0x18: // DJNZ, JR
+	case 0x20: case 0x28: case 0x30: case 0x38: // JR cc
+		v = (s8)fetch8();
+		// cz80 doesn't wrap the host pc, don't follow it out of RAM
+		if ((op_pc & 0x1fff) + v >= 0x2000)
+			return -1;
+		t = op_pc + v;
+		if (op == 0x18) {
+			emit_branch_end(12, t);
+			return 1;
+		}
+		if (op == 0x10) {
+			emit_alu_mimm(1, ALU_SUB, xCTX, CTX_B, 1);
+			j = emit_jcc(CC_E);
+			emit_branch_end(13, t);
+			patch_rel32(j, tcache_ptr);
+			emit_insn_end(8);
+			return 0;
+		}
+		j = emit_jcc(emit_cond(r & 3));
+		emit_branch_end(12, t);
+		patch_rel32(j, tcache_ptr);
+		emit_insn_end(7);
+		return 0;
+	}
+
+	// DAA, HALT, EI, double prefixes
+	return -1;
+}
+
+static int translate_op(void)
+{
+	u32 op = fetch8();
+
+	xy = cyc_pre = 0;
+	switch (op) {
+	case 0xcb:
+		op_cyc = 0;
+		return tr_cb();
+	case 0xed:
+		op_cyc = cyc_pre = 4;
+		return tr_ed(fetch8());
+	case 0xdd: case 0xfd:
+		xy = op == 0xdd ? CTX(IX) : CTX(IY);
+		op_cyc = cyc_pre = 4;
+		op = fetch8();
+		if (op == 0xcb)
+			return tr_xycb();
+		if (op == 0xdd || op == 0xfd || op == 0xed)
+			return -1;
+		return tr_op(op);
+	}
+	op_cyc = 0;
+	return tr_op(op);
+}
+
+// ----------------------------------------------------------------------------
+// block cache
+
+// invals: forget which RAM pages are written too often to translate
+static void flush(int invals)
+{
+	memset(drc_st.table, 0, sizeof(drc_st.table));
+	memset(drc_st.code, 0, sizeof(drc_st.code));
+	if (invals)
+		memset(ram_invals, 0, sizeof(ram_invals));
+	block_count = 0;
+	tcache_ptr = tcache_base;
+	drc_st.exit = 1;
+}
+
+static int ram_page_ok(u32 offs)
+{
+	return ram_invals[(offs & 0x1fff) >> 8] < DRC_RAM_INVALS;
+}
+
+static void emit_stubs(void)
+{
+	int i, j;
+
+	for (i = 0; i < exit_count; i++) {
+		for (j = 0; j < i; j++)
+			if (exits[j].pc == exits[i].pc && exits[j].link == exits[i].link)
+				break;
+		if (j < i) {
+			patch_rel32(exits[i].jmp, exits[j].stub);
+			continue;
+		}
+		exits[i].stub = tcache_ptr;
+		patch_rel32(exits[i].jmp, tcache_ptr);
+		emit_mov_imm(xDI, exits[i].pc);
+		emit_jmp_to(exits[i].link ? drc_dispatch : drc_leave_pc);
+	}
+}
+
+static u8 *translate(u32 pc)
+{
+	struct drc_block *b;
+	u8 *code;
+	int r;
+
+	if (block_count >= DRC_BLOCKS || tcache_end - tcache_ptr < DRC_BLOCK_OPS * DRC_OP_SPACE)
+		flush(0);
+
+	// only RAM, as cz80 sees it through Fetch, and not the pages which keep
+	// getting written (those are not marked in code[], so writes there stay cheap)
+	drc_st.table[pc] = drc_leave;
+	if (cz80_drc_ctx->Fetch[pc >> CZ80_FETCH_SFT] + pc != (u32)(unsigned long)(ram + (pc & 0x1fff))
+	    || !ram_page_ok(pc))
+		return drc_leave;
+
+	b = &blocks[block_count++];
+	b->pc = pc;
+	b->offs = pc & 0x1fff;
+	b->len = 1;
+
+	blk_ops = exit_count = 0;
+	op_pc = pc;
+	code = tcache_ptr;
+
+	for (;;) {
+		u8 *ptr0 = tcache_ptr;
+		int exit_count0 = exit_count;
+
+		if (blk_ops >= DRC_BLOCK_OPS || exit_count > DRC_BLOCK_OPS * 4 - 8
+		    || (op_pc & 0x1fff) + 4 > 0x2000 || !ram_page_ok(op_pc) || !ram_page_ok(op_pc + 3)) {
+			if (blk_ops > 0)
+				emit_goto(op_pc);
+			break;
+		}
+
+		insn_pc = op_pc;
+		blk_op_pc[blk_ops] = op_pc;
+		blk_op_code[blk_ops] = tcache_ptr;
+		blk_ops++;
+		op_wrote = 0;
+		r = translate_op();
+		if (r < 0) {
+			tcache_ptr = ptr0;
+			op_pc = insn_pc;
+			exit_count = exit_count0;
+			blk_ops--;
+			if (blk_ops > 0)
+				emit_exit(-1, op_pc);
+			break;
+		}
+		if (r > 0)
+			break;
+	}
+
+	if (blk_ops == 0) {
+		tcache_ptr = code;
+		drc_st.code[b->offs] = 1;
+		return drc_leave;
+	}
+
+	emit_stubs();
+	b->len = op_pc - pc;
+	memset(drc_st.code + b->offs, 1, b->len);
+	drc_st.table[pc] = code;
+	return code;
+}
+
+static u8 *dispatch_lookup(u32 pc)
+{
+	u8 *code = drc_st.table[pc];
+	return code != NULL ? code : translate(pc);
+}
+
+// RAM byte at offs was written and there is code on it
+static void drc_invalidate(u32 offs)
+{
+	u32 lo = 0x2000, hi = 0, p;
+	int i;
+
+	for (i = 0; i < block_count; i++) {
+		struct drc_block *b = &blocks[i];
+		if (offs - b->offs >= b->len)
+			continue;
+		drc_st.table[b->pc] = NULL;
+		if (b->offs < lo) lo = b->offs;
+		if (b->offs + b->len > hi) hi = b->offs + b->len;
+		b->len = 0;
+	}
+	drc_st.exit = 1;
+	if (ram_invals[offs >> 8] < DRC_RAM_INVALS)
+		ram_invals[offs >> 8]++;
+
+	// remark what other blocks still cover
+	drc_st.code[offs] = 0;
+	if (lo >= hi)
+		return;
+	memset(drc_st.code + lo, 0, hi - lo);
+	for (i = 0; i < block_count; i++) {
+		struct drc_block *b = &blocks[i];
+		for (p = b->offs; p < b->offs + b->len; p++)
+			if (p >= lo && p < hi)
+				drc_st.code[p] = 1;
+	}
+}
+
+static void emit_dispatcher(void)
+{
+	u8 *j_lookup;
+
+	emit_mov_mr(4, xST, ST_PC, xDI);
+	emit_alu_mimm(1, ALU_CMP, xST, ST_EXIT, 0);
+	emit_jcc_to(CC_NE, drc_leave);
+	emit_alu_imm(4, ALU_CMP, xDI, 0x4000);
+	emit_jcc_to(CC_AE, drc_leave);
+	emit_rmx(8, 0x8b, xAX, xST, xDI, 3, ST_TABLE);
+	emit_test_rr(8, xAX, xAX);
+	j_lookup = emit_jcc(CC_E);
+	emit_rr(4, 0xff, 4, xAX);       // jmp rax
+	patch_rel32(j_lookup, tcache_ptr);
+	emit_call_abs(dispatch_lookup);
+	emit_rr(4, 0xff, 4, xAX);       // jmp rax
+}
+
+// entry(code, ctx, st, ram), dispatcher and exits, kept over flushes
+static void emit_trampolines(void)
+{
+	static const u8 regs[] = { xBX, xBP, xR12, xR13, xR14, xR15 };
+	int i;
+
+	drc_leave_pc = tcache_ptr;
+	emit_mov_mr(4, xST, ST_PC, xDI);
+	drc_leave = tcache_ptr;
+	emit_mov_mr(4, xCTX, CTX_ICOUNT, xCYC);
+	emit_alu_imm(8, ALU_ADD, xSP, 8);
+	for (i = 5; i >= 0; i--) {
+		emit_prefix(4, 0, 0, regs[i]);
+		EMIT(0x58 | (regs[i] & 7)); // pop
+	}
+	EMIT(0xc3); // ret
+
+	drc_enter_ptr = tcache_ptr;
+	for (i = 0; i < 6; i++) {
+		emit_prefix(4, 0, 0, regs[i]);
+		EMIT(0x50 | (regs[i] & 7)); // push
+	}
+	emit_alu_imm(8, ALU_SUB, xSP, 8);
+	emit_rr(8, 0x8b, xCTX, xSI);
+	emit_rr(8, 0x8b, xST, xDX);
+	emit_rr(8, 0x8b, xRAM, xCX);
+	emit_mov_rm(4, xCYC, xCTX, CTX_ICOUNT);
+	emit_rr(4, 0xff, 4, xDI); // jmp rdi
+
+	drc_dispatch = tcache_ptr;
+	emit_dispatcher();
+
+	tcache_base = tcache_ptr;
+}
+
+// ----------------------------------------------------------------------------
+
+int cz80_drc_init(void)
+{
+	if (tcache != NULL)
+		return 0;
+
+	tcache = mmap(NULL, DRC_CACHE_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	blocks = malloc(DRC_BLOCKS * sizeof(blocks[0]));
+	if (tcache == MAP_FAILED || blocks == NULL) {
+		if (tcache != MAP_FAILED) munmap(tcache, DRC_CACHE_SIZE);
+		free(blocks);
+		tcache = NULL;
+		blocks = NULL;
+		return -1;
+	}
+	tcache_ptr = tcache;
+	tcache_end = tcache + DRC_CACHE_SIZE;
+	emit_trampolines();
+	flush(1);
+	return 0;
+}
+
+void cz80_drc_exit(void)
+{
+	if (tcache == NULL)
+		return;
+	munmap(tcache, DRC_CACHE_SIZE);
+	free(blocks);
+	tcache = NULL;
+	blocks = NULL;
+	cz80_drc_ctx = NULL;
+}
+
+void cz80_drc_set_ram(void *zram)
+{
+	ram = zram;
+	if (tcache != NULL)
+		flush(1);
+}
+
+void cz80_drc_flush(void)
+{
+	if (tcache != NULL)
+		flush(1);
+}
+
+void cz80_drc_invalidate(unsigned int offs)
+{
+	if (tcache != NULL)
+		drc_invalidate(offs);
+}
+
+// run translated code at CPU->PC, returns 0 if there is none
+int cz80_drc_run(cz80_struc *CPU)
+{
+	u32 pc = CPU->PC - CPU->BasePC;
+	u8 *code;
+
+	if (tcache == NULL || pc >= 0x4000 || CPU->BasePC != CPU->Fetch[pc >> CZ80_FETCH_SFT])
+		return 0;
+	code = dispatch_lookup(pc);
+	if (code == drc_leave)
+		return 0;
+
+	drc_st.exit = 0;
+	((void (*)(u8 *, cz80_struc *, void *, u8 *))drc_enter_ptr)(code, CPU, &drc_st, ram);
+
+	pc = drc_st.pc;
+	CPU->BasePC = CPU->Fetch[pc >> CZ80_FETCH_SFT];
+	CPU->PC = pc + CPU->BasePC;
+	return 1;
+}
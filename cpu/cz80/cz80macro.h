@@ -73,7 +73,10 @@
 #define WRITE_MEM8(A, D) { \
 	unsigned short a = A; \
 	unsigned char d = D; \
-	if (a < 0x4000) Pico.zram[a&0x1fff] = d; \
+	if (a < 0x4000) { \
+		Pico.zram[a&0x1fff] = d; \
+		Z80_RAM_WRITTEN(a); \
+	} \
 	else z80_write(a, d); \
 }
 #else
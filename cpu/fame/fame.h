@@ -125,7 +125,13 @@ typedef struct
 	unsigned int   Fetch[M68K_FETCHBANK1];
 } M68K_CONTEXT;
 
+#ifdef S68K_THREAD
+// MCD sub 68k can run on it's own thread (Pico/cd/s68k_thread.c), so the
+// current context is per thread
+extern __thread M68K_CONTEXT *g_m68kcontext;
+#else
 extern M68K_CONTEXT *g_m68kcontext;
+#endif
 
 /************************/
 /* Function definition  */
@@ -139,6 +145,18 @@ int  fm68k_would_interrupt(void); // to be called from fm68k_emulate()
 
 unsigned fm68k_get_pc(M68K_CONTEXT *context);
 
+#ifdef FAMEC_DRC
+/* x86-64 block translator (famec_drc.c), used by fm68k_emulate() */
+extern M68K_CONTEXT *fm68k_drc_ctx;           // context to run translated code for, or NULL
+extern unsigned char fm68k_drc_ram_code[256]; // RAM pages (of 256 bytes) with translated code
+int  fm68k_drc_init(void);
+void fm68k_drc_exit(void);
+void fm68k_drc_set_ram(void *ram, unsigned int size);
+void fm68k_drc_flush(void); // code (ROM) or its mapping changed
+void fm68k_drc_invalidate(unsigned int offs, int len); // RAM write to a marked page
+int  fm68k_drc_run(unsigned int *pc, unsigned int *ccr);
+#endif
+
 
 #ifdef __cplusplus
 }
@@ -248,7 +248,14 @@ typedef signed int	s32;
     FETCH_WORD(Opcode);         \
     goto *JumpTable[Opcode];
 
-#ifdef FAMEC_ROLL_INLINE
+#if defined(FAMEC_ROLL_INLINE) && defined(FAMEC_DRC)
+// back to famec_Exec only when the translator should be tried there
+#define RET(A)                                      \
+    m68kcontext.io_cycle_counter -= (A);                        \
+    if (m68kcontext.io_cycle_counter <= 0) goto famec_Exec_End;	\
+    if (drc_try) goto famec_Exec;                   \
+    NEXT
+#elif defined(FAMEC_ROLL_INLINE)
 #define RET(A)                                      \
     m68kcontext.io_cycle_counter -= (A);                        \
     if (m68kcontext.io_cycle_counter <= 0) goto famec_Exec_End;	\
@@ -279,6 +286,16 @@ typedef signed int	s32;
 #define GET_PC                  \
 	((u32)PC - BasePC)
 
+#ifdef FAMEC_DRC
+#ifdef FAMEC_NO_GOTOS
+#error FAMEC_DRC needs FAMEC_NO_GOTOS off
+#endif
+// translated code is looked for at branch and exception targets
+#define DRC_TRY drc_try = drc_on;
+#else
+#define DRC_TRY
+#endif
+
 
 #ifdef FAMEC_CHECK_BRANCHES
 #define FORCE_ALIGNMENT(pc)
@@ -294,6 +311,7 @@ typedef signed int	s32;
     FORCE_ALIGNMENT(pc); \
     BasePC = m68kcontext.Fetch[(pc >> M68K_FETCHSFT) & M68K_FETCHMASK];    \
     PC = (u16*)((pc & M68K_ADR_MASK) + BasePC);	\
+    DRC_TRY \
 }
 
 #else
@@ -305,6 +323,7 @@ typedef signed int	s32;
     BasePC = m68kcontext.Fetch[(pc >> M68K_FETCHSFT) & M68K_FETCHMASK];    \
     BasePC -= pc & 0xFF000000;    \
     PC = (u16*)(pc + BasePC); \
+    DRC_TRY \
 }
 
 #endif
@@ -506,27 +525,35 @@ static int init_jump_table(void);
 // global variable
 ///////////////////
 
+// with S68K_THREAD main and sub 68k may run at the same time on two threads,
+// so everything below that isn't kept in fm68k_emulate() locals is per thread
+#ifdef S68K_THREAD
+#define FAMEC_TLS __thread
+#else
+#define FAMEC_TLS
+#endif
+
 /* Current CPU context */
-M68K_CONTEXT *g_m68kcontext;
+FAMEC_TLS M68K_CONTEXT *g_m68kcontext;
 #define m68kcontext (*g_m68kcontext)
 
 #ifdef FAMEC_NO_GOTOS
-static u32 Opcode;
-static s32 cycles_needed;
-static u16 *PC;
-static u32 BasePC;
-static u32 flag_C;
-static u32 flag_V;
-static u32 flag_NotZ;
-static u32 flag_N;
-static u32 flag_X;
+static FAMEC_TLS u32 Opcode;
+static FAMEC_TLS s32 cycles_needed;
+static FAMEC_TLS u16 *PC;
+static FAMEC_TLS u32 BasePC;
+static FAMEC_TLS u32 flag_C;
+static FAMEC_TLS u32 flag_V;
+static FAMEC_TLS u32 flag_NotZ;
+static FAMEC_TLS u32 flag_N;
+static FAMEC_TLS u32 flag_X;
 #endif
 
 #ifdef FAMEC_EMULATE_TRACE
-static u32 flag_T;
+static FAMEC_TLS u32 flag_T;
 #endif
-static u32 flag_S;
-static u32 flag_I;
+static FAMEC_TLS u32 flag_S;
+static FAMEC_TLS u32 flag_I;
 
 static u32 initialised = 0;
 
@@ -794,6 +821,9 @@ int fm68k_emulate(s32 cycles, int dualcore)
 	u32 flag_N;
 	u32 flag_X;
 #endif
+#ifdef FAMEC_DRC
+	u32 drc_on, drc_try;
+#endif
 
 	if (!initialised)
 	{
@@ -832,6 +862,11 @@ famec_restart:
 	/* Poner la CPU en estado de ejecucion */
 	m68kcontext.execinfo |= M68K_RUNNING;
 
+#ifdef FAMEC_DRC
+	drc_on = (g_m68kcontext == fm68k_drc_ctx);
+	drc_try = drc_on;
+#endif
+
 	// Cache SR
 	SET_SR(m68kcontext.sr)
 
@@ -884,6 +919,22 @@ famec_Exec:
 	printf("Antes de NEXT... PC = %p\n", PC);
 #endif
 
+#ifdef FAMEC_DRC
+	if (drc_try)
+	{
+		u32 drc_pc = GET_PC, drc_ccr = GET_CCR;
+		drc_try = 0; // nothing here, famec runs until next branch
+		if (fm68k_drc_run(&drc_pc, &drc_ccr))
+		{
+			SET_CCR(drc_ccr)
+			SET_PC(drc_pc)
+			CHECK_BRANCH_EXCEPTION(drc_pc)
+			if (m68kcontext.io_cycle_counter <= 0) goto famec_Exec_End;
+			drc_try = 1; // stopped at an instruction it can't do, retry after it
+		}
+	}
+#endif
+
 	NEXT
 
 #ifndef FAMEC_NO_GOTOS
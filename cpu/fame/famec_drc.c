@@ -0,0 +1,1662 @@
+// 68000 -> x86-64 block translator for FAME.
+// Straight runs of the more common instructions are translated to host code,
+// famec itself still runs everything else (and takes exceptions/interrupts).
+// Translated code keeps 68k registers in the context, does the same memory
+// handler calls in the same order and counts the same cycles as famec, so
+// both can be mixed at any instruction boundary and compared (Pico/Debug.c).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "fame.h"
+
+typedef unsigned char  u8;
+typedef signed char    s8;
+typedef unsigned short u16;
+typedef signed short   s16;
+typedef unsigned int   u32;
+typedef signed int     s32;
+
+#define DRC_CACHE_SIZE  (8*1024*1024)
+#define DRC_BLOCKS      0x8000
+#define DRC_HASH_SIZE   0x4000  // power of 2
+#define DRC_BLOCK_OPS   64      // max 68k instructions in one block
+#define DRC_OP_SPACE    0x1000  // max host code for one instruction (movem.l with all regs)
+#define DRC_RAM_INVALS  32      // RAM page is left to famec after this many invalidations
+
+M68K_CONTEXT *fm68k_drc_ctx;         // context to translate for, NULL disables
+unsigned char fm68k_drc_ram_code[256]; // 256 byte RAM pages holding translated code
+
+// flags/state shared with translated code (addressed through r12)
+static struct {
+	u8  v;     // V, as stored by seto
+	u8  f;     // N, Z, C as stored by lahf (x86 SF, ZF, CF)
+	u8  x;     // X
+	u8  exit;  // set by flush/invalidate: leave after current instruction
+	u32 pc;    // 68k pc translated code stopped at
+} drc_st;
+
+#define ST_V    0
+#define ST_F    1
+#define ST_X    2
+#define ST_EXIT 3
+#define ST_PC   4
+
+struct drc_block {
+	u32 pc;        // 68k address
+	u32 host;      // famec's host address for it (bank switching changes it)
+	u32 len;       // 68k code bytes covered
+	u8 *code;      // NULL: nothing translatable here, famec must run it
+	struct drc_block *next;     // hash chain
+	struct drc_block *ram_next; // blocks in RAM, for invalidation
+};
+
+static struct drc_block *blocks, *hash_table[DRC_HASH_SIZE], *ram_blocks;
+static int block_count, drc_gen;
+static u32 ram_base, ram_size;
+static u8 ram_invals[256];
+
+static u8 *tcache, *tcache_ptr, *tcache_base, *tcache_end;
+static u8 *drc_enter_ptr, *drc_dispatch, *drc_dispatch_link, *drc_leave;
+
+// ----------------------------------------------------------------------------
+// x86-64 emitter
+
+enum { xAX = 0, xCX, xDX, xBX, xSP, xBP, xSI, xDI, xR8, xR9, xR10, xR11, xR12, xR13, xR14, xR15 };
+
+#define xCTX xBX   // M68K_CONTEXT
+#define xST  xR12  // drc_st
+#define xADR xR13  // 68k address of memory operand
+#define xCYC xR14  // io_cycle_counter, copied to/from the context around handler calls
+#define xTMP xR15  // kept over handler calls
+#define xIDX xR11  // scratch
+
+enum { ALU_ADD = 0, ALU_OR, ALU_ADC, ALU_SBB, ALU_AND, ALU_SUB, ALU_XOR, ALU_CMP };
+enum { SH_ROL = 0, SH_ROR, SH_RCL, SH_RCR, SH_SHL, SH_SHR, SH_SAL, SH_SAR };
+enum { CC_O = 0, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A, CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G };
+
+#define OP_MOVZX8  0x0fb6
+#define OP_MOVZX16 0x0fb7
+#define OP_MOVSX8  0x0fbe
+#define OP_MOVSX16 0x0fbf
+#define OP_SETCC   0x0f90
+#define OP_IMUL    0x0faf
+#define OP_BT      0x0fa3
+#define OP_BTS     0x0fab
+#define OP_BTR     0x0fb3
+#define OP_BTC     0x0fbb
+#define OP_BTI     0x0fba // /4 bt, /5 bts, /6 btr, /7 btc
+
+#define EMIT(b) *tcache_ptr++ = (u8)(b)
+
+static void emit32(u32 v)
+{
+	memcpy(tcache_ptr, &v, 4);
+	tcache_ptr += 4;
+}
+
+static void emit_imm(int size, u32 v)
+{
+	if (size == 1) EMIT(v);
+	else if (size == 2) { EMIT(v); EMIT(v >> 8); }
+	else emit32(v);
+}
+
+// operand size prefix and REX; byte ops must only use al, cl, dl (or ah w/o REX)
+static void emit_prefix(int size, int reg, int rm)
+{
+	int rex = 0;
+	if (size == 2) EMIT(0x66);
+	if (size == 8) rex |= 8;
+	if (reg & 8) rex |= 4;
+	if (rm & 8) rex |= 1;
+	if (rex) EMIT(0x40 | rex);
+}
+
+static void emit_opcode(int opc)
+{
+	if (opc > 0xff) EMIT(opc >> 8);
+	EMIT(opc);
+}
+
+// opc with reg and [base+disp] operands
+static void emit_rm(int size, int opc, int reg, int base, int disp)
+{
+	int mod = (disp == 0 && (base & 7) != xBP) ? 0 : (disp >= -128 && disp < 128) ? 1 : 2;
+	emit_prefix(size, reg, base);
+	emit_opcode(opc);
+	EMIT((mod << 6) | ((reg & 7) << 3) | (base & 7));
+	if ((base & 7) == xSP) EMIT(0x24);
+	if (mod == 1) EMIT(disp);
+	if (mod == 2) emit32(disp);
+}
+
+// opc with two register operands
+static void emit_rr(int size, int opc, int reg, int rm)
+{
+	emit_prefix(size, reg, rm);
+	emit_opcode(opc);
+	EMIT(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void emit_mov_rm(int size, int r, int base, int disp)
+{
+	emit_rm(size, size == 1 ? 0x8a : 0x8b, r, base, disp);
+}
+
+static void emit_mov_mr(int size, int base, int disp, int r)
+{
+	emit_rm(size, size == 1 ? 0x88 : 0x89, r, base, disp);
+}
+
+static void emit_mov_rr(int dst, int src)
+{
+	emit_rr(4, 0x8b, dst, src);
+}
+
+static void emit_mov_imm(int r, u32 imm)
+{
+	emit_prefix(4, 0, r);
+	EMIT(0xb8 | (r & 7));
+	emit32(imm);
+}
+
+static void emit_mov_mimm(int size, int base, int disp, u32 imm)
+{
+	emit_rm(size, size == 1 ? 0xc6 : 0xc7, 0, base, disp);
+	emit_imm(size, imm);
+}
+
+// dst (register) op= src (register)
+static void emit_alu_rr(int size, int alu, int dst, int src)
+{
+	emit_rr(size, (alu << 3) | (size != 1), src, dst);
+}
+
+// r op= [base+disp]
+static void emit_alu_rm(int size, int alu, int r, int base, int disp)
+{
+	emit_rm(size, (alu << 3) | 2 | (size != 1), r, base, disp);
+}
+
+// [base+disp] op= r
+static void emit_alu_mr(int size, int alu, int base, int disp, int r)
+{
+	emit_rm(size, (alu << 3) | (size != 1), r, base, disp);
+}
+
+static void emit_alu_imm(int size, int alu, int r, s32 imm)
+{
+	if (size == 1) {
+		emit_rr(1, 0x80, alu, r);
+		EMIT(imm);
+	} else if (imm >= -128 && imm < 128) {
+		emit_rr(size, 0x83, alu, r);
+		EMIT(imm);
+	} else {
+		emit_rr(size, 0x81, alu, r);
+		emit_imm(size, imm);
+	}
+}
+
+static void emit_alu_mimm(int size, int alu, int base, int disp, s32 imm)
+{
+	if (size == 1) {
+		emit_rm(1, 0x80, alu, base, disp);
+		EMIT(imm);
+	} else if (imm >= -128 && imm < 128) {
+		emit_rm(size, 0x83, alu, base, disp);
+		EMIT(imm);
+	} else {
+		emit_rm(size, 0x81, alu, base, disp);
+		emit_imm(size, imm);
+	}
+}
+
+static void emit_test_rr(int size, int a, int b)
+{
+	emit_rr(size, size == 1 ? 0x84 : 0x85, a, b);
+}
+
+static void emit_shift_imm(int size, int op, int r, int n)
+{
+	emit_rr(size, size == 1 ? 0xc0 : 0xc1, op, r);
+	EMIT(n);
+}
+
+// neg/not
+static void emit_unary(int size, int op, int r)
+{
+	emit_rr(size, size == 1 ? 0xf6 : 0xf7, op, r);
+}
+
+static void emit_lea(int dst, int base, int disp)
+{
+	emit_rm(4, 0x8d, dst, base, disp);
+}
+
+static u8 *emit_jcc(int cc)
+{
+	EMIT(0x0f);
+	EMIT(0x80 | cc);
+	emit32(0);
+	return tcache_ptr - 4;
+}
+
+static u8 *emit_jmp(void)
+{
+	EMIT(0xe9);
+	emit32(0);
+	return tcache_ptr - 4;
+}
+
+static void patch_rel32(u8 *p, u8 *target)
+{
+	s32 rel = target - (p + 4);
+	memcpy(p, &rel, 4);
+}
+
+static void emit_jmp_to(u8 *target)
+{
+	patch_rel32(emit_jmp(), target);
+}
+
+static void emit_mov_imm64(int r, void *p)
+{
+	emit_prefix(8, 0, r);
+	EMIT(0xb8 | (r & 7));
+	memcpy(tcache_ptr, &p, 8);
+	tcache_ptr += 8;
+}
+
+// ----------------------------------------------------------------------------
+// 68k context access
+
+#define CTX_D(r)   (offsetof(M68K_CONTEXT, dreg) + (r) * 4) // 8-15 are A0-A7
+#define CTX_A(r)   CTX_D((r) + 8)
+#define CTX_CYC    offsetof(M68K_CONTEXT, io_cycle_counter)
+#define CTX_RB     offsetof(M68K_CONTEXT, read_byte)
+#define CTX_RW     offsetof(M68K_CONTEXT, read_word)
+#define CTX_RL     offsetof(M68K_CONTEXT, read_long)
+#define CTX_WB     offsetof(M68K_CONTEXT, write_byte)
+#define CTX_WW     offsetof(M68K_CONTEXT, write_word)
+#define CTX_WL     offsetof(M68K_CONTEXT, write_long)
+
+static void emit_load_reg(int hr, int r, int size, int sx)
+{
+	if (size == 4)
+		emit_mov_rm(4, hr, xCTX, CTX_D(r));
+	else if (size == 2)
+		emit_rm(4, sx ? OP_MOVSX16 : OP_MOVZX16, hr, xCTX, CTX_D(r));
+	else
+		emit_rm(4, sx ? OP_MOVSX8 : OP_MOVZX8, hr, xCTX, CTX_D(r));
+}
+
+static void emit_store_reg(int hr, int r, int size)
+{
+	emit_mov_mr(size, xCTX, CTX_D(r), hr);
+}
+
+// handlers may look at or change the cycle counter (SekEndRun)
+static void emit_call_handler(int off)
+{
+	emit_mov_mr(4, xCTX, CTX_CYC, xCYC);
+	emit_rm(4, 0xff, 2, xCTX, off); // call [rbx+off]
+	emit_mov_rm(4, xCYC, xCTX, CTX_CYC);
+}
+
+static int op_wrote;
+
+// read from xADR to eax, extended like famec does it
+static void emit_read(int size, int sx)
+{
+	emit_mov_rr(xDI, xADR);
+	if (size == 1) {
+		emit_call_handler(CTX_RB);
+		emit_rr(4, sx ? OP_MOVSX8 : OP_MOVZX8, xAX, xAX);
+	} else if (size == 2) {
+		emit_call_handler(CTX_RW);
+		emit_rr(4, sx ? OP_MOVSX16 : OP_MOVZX16, xAX, xAX);
+	} else
+		emit_call_handler(CTX_RL);
+}
+
+// write hr (eax, ecx or edx) to xADR. famec writes longs to -(An) as two
+// words, low one first
+static void emit_write(int size, int hr, int predec)
+{
+	op_wrote = 1;
+	emit_mov_rr(xDI, xADR);
+	if (size == 4 && predec) {
+		emit_mov_rr(xTMP, hr);
+		emit_lea(xDI, xADR, 2);
+		emit_rr(4, OP_MOVZX16, xSI, hr);
+		emit_call_handler(CTX_WW);
+		emit_mov_rr(xDI, xADR);
+		emit_mov_rr(xSI, xTMP);
+		emit_shift_imm(4, SH_SHR, xSI, 16);
+		emit_call_handler(CTX_WW);
+	} else if (size == 4) {
+		emit_mov_rr(xSI, hr);
+		emit_call_handler(CTX_WL);
+	} else if (size == 2) {
+		emit_rr(4, OP_MOVZX16, xSI, hr);
+		emit_call_handler(CTX_WW);
+	} else {
+		emit_rr(4, OP_MOVZX8, xSI, hr);
+		emit_call_handler(CTX_WB);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// flags
+
+// N, Z, C and V from last x86 op, optionally X = C
+static void emit_flags(int set_x)
+{
+	if (set_x)
+		emit_rm(1, OP_SETCC | CC_B, 0, xST, ST_X);
+	EMIT(0x9f);                         // lahf
+	emit_rr(1, OP_SETCC | CC_O, 0, xAX); // seto al
+	emit_mov_mr(2, xST, ST_V, xAX);
+}
+
+// flags for a known result
+static void emit_flags_const(u32 v, int size)
+{
+	int f = 0;
+	if (size == 1) v = (s8)v;
+	if (size == 2) v = (s16)v;
+	if (v == 0) f |= 0x40;
+	if ((s32)v < 0) f |= 0x80;
+	emit_mov_mimm(2, xST, ST_V, f << 8);
+}
+
+// only Z, from x86 CF (bit test)
+static void emit_flag_z_nc(void)
+{
+	emit_rr(1, OP_SETCC | CC_AE, 0, xAX);
+	emit_shift_imm(1, SH_SHL, xAX, 6);
+	emit_alu_mimm(1, ALU_AND, xST, ST_F, ~0x40);
+	emit_alu_mr(1, ALU_OR, xST, ST_F, xAX);
+}
+
+static const s8 cc_x86[16] = {
+	-1, -1, CC_A, CC_BE, CC_AE, CC_B, CC_NE, CC_E,
+	CC_NO, CC_O, CC_NS, CC_S, CC_GE, CC_L, CC_G, CC_LE
+};
+
+// load 68k flags to x86 ones, returns x86 condition for 68k cc 2-15
+static int emit_cond(int cc)
+{
+	emit_mov_rm(2, xAX, xST, ST_V);
+	if (cc >= 8 && cc != 10 && cc != 11)
+		emit_alu_imm(1, ALU_ADD, xAX, 0x7f); // OF = V
+	EMIT(0x9e); // sahf
+	return cc_x86[cc];
+}
+
+// ----------------------------------------------------------------------------
+// translation state
+
+static u32 insn_pc, op_pc, blk_pc;
+static u16 *op_ptr;
+static int blk_linkable;
+
+static struct {
+	u8 *jmp;
+	u8 *stub;
+	u32 pc;
+	int link;
+} exits[DRC_BLOCK_OPS * 8];
+static int exit_count;
+
+static u32 blk_op_pc[DRC_BLOCK_OPS];
+static u8 *blk_op_code[DRC_BLOCK_OPS];
+static int blk_ops;
+
+static u32 fetch_word(void)
+{
+	op_pc += 2;
+	return *op_ptr++;
+}
+
+static u32 fetch_imm(int size, int sx)
+{
+	u32 v = fetch_word();
+	if (size == 4) return (v << 16) | fetch_word();
+	if (size == 1) return sx ? (u32)(s8)v : (v & 0xff);
+	return sx ? (u32)(s16)v : v;
+}
+
+// leave translated code, famec continues at pc (cc < 0: always)
+static void emit_exit(int cc, u32 pc)
+{
+	exits[exit_count].jmp = cc < 0 ? emit_jmp() : emit_jcc(cc);
+	exits[exit_count].pc = pc;
+	exits[exit_count].link = 0;
+	exit_count++;
+}
+
+// continue at 68k pc known at translation time
+static void emit_goto(u32 pc)
+{
+	int i;
+
+	for (i = 0; i < blk_ops; i++) {
+		if (blk_op_pc[i] == pc) {
+			emit_jmp_to(blk_op_code[i]);
+			return;
+		}
+	}
+
+	// blocks in the same 64k fetch bank of ROM are linked directly on
+	// first use, they only go away on flush
+	exits[exit_count].jmp = emit_jmp();
+	exits[exit_count].pc = pc;
+	exits[exit_count].link = blk_linkable && !((pc ^ blk_pc) & 0xffff0000) ? 1 : 2;
+	exit_count++;
+}
+
+// continue at 68k pc in edi. famec takes the address error for an odd one,
+// in that case the instruction is done but its cycles are not counted
+static void emit_goto_dynamic(int cycles)
+{
+	u8 *j;
+
+	emit_rr(4, 0xf7, 0, xDI); // test edi, 1
+	emit32(1);
+	j = emit_jcc(CC_NE);
+	emit_alu_imm(4, ALU_SUB, xCYC, cycles);
+	emit_jmp_to(drc_dispatch);
+	patch_rel32(j, tcache_ptr);
+	emit_mov_mr(4, xST, ST_PC, xDI);
+	emit_jmp_to(drc_leave);
+}
+
+static void emit_insn_end(int cycles)
+{
+	emit_alu_imm(4, ALU_SUB, xCYC, cycles);
+	emit_exit(CC_LE, op_pc);
+	if (op_wrote) {
+		emit_alu_mimm(1, ALU_CMP, xST, ST_EXIT, 0);
+		emit_exit(CC_NE, op_pc);
+	}
+}
+
+// cycles and jump to target
+static void emit_branch_end(int cycles, u32 target)
+{
+	emit_alu_imm(4, ALU_SUB, xCYC, cycles);
+	emit_exit(CC_LE, target);
+	if (op_wrote) {
+		emit_alu_mimm(1, ALU_CMP, xST, ST_EXIT, 0);
+		emit_exit(CC_NE, target);
+	}
+	emit_goto(target);
+}
+
+// ----------------------------------------------------------------------------
+// effective addresses
+
+// calculation times, famec uses the same (Dn An (An) (An)+ -(An) d16 d8 abs.w abs.l d16pc d8pc imm)
+static const u8 ea_cycles[2][12] = {
+	{ 0, 0, 4, 4,  6,  8, 10,  8, 12,  8, 10, 4 },
+	{ 0, 0, 8, 8, 10, 12, 14, 12, 16, 12, 14, 8 },
+};
+
+#define EAM_ALL   0xfff
+#define EAM_DATA  0xffd // no An
+#define EAM_DALT  0x1fd // data alterable
+#define EAM_MALT  0x1fc // memory alterable
+#define EAM_ALT   0x1ff
+#define EAM_CTRL  0x7e4
+
+static int ea_idx(int mode, int reg)
+{
+	return mode < 7 ? mode : 7 + reg;
+}
+
+static int ea_ok(int mode, int reg, int mask)
+{
+	if (mode == 7 && reg > 4) return 0;
+	return (mask >> ea_idx(mode, reg)) & 1;
+}
+
+static int ea_cyc(int mode, int reg, int size)
+{
+	return ea_cycles[size == 4][ea_idx(mode, reg)];
+}
+
+static void emit_index(u32 ext)
+{
+	if ((s8)ext)
+		emit_alu_imm(4, ALU_ADD, xADR, (s8)ext);
+	if (ext & 0x800)
+		emit_alu_rm(4, ALU_ADD, xADR, xCTX, CTX_D(ext >> 12));
+	else {
+		emit_rm(4, OP_MOVSX16, xIDX, xCTX, CTX_D(ext >> 12));
+		emit_alu_rr(4, ALU_ADD, xADR, xIDX);
+	}
+}
+
+// address of memory operand to xADR, does (An)+ and -(An) updates
+static void emit_ea_adr(int mode, int reg, int size)
+{
+	int step = (size == 1 && reg == 7) ? 2 : size;
+	u32 a;
+
+	switch (mode) {
+	case 2:
+		emit_mov_rm(4, xADR, xCTX, CTX_A(reg));
+		break;
+	case 3:
+		emit_mov_rm(4, xADR, xCTX, CTX_A(reg));
+		emit_alu_mimm(4, ALU_ADD, xCTX, CTX_A(reg), step);
+		break;
+	case 4:
+		emit_alu_mimm(4, ALU_SUB, xCTX, CTX_A(reg), step);
+		emit_mov_rm(4, xADR, xCTX, CTX_A(reg));
+		break;
+	case 5:
+		emit_mov_rm(4, xADR, xCTX, CTX_A(reg));
+		emit_alu_imm(4, ALU_ADD, xADR, (s16)fetch_word());
+		break;
+	case 6:
+		emit_mov_rm(4, xADR, xCTX, CTX_A(reg));
+		emit_index(fetch_word());
+		break;
+	case 7:
+		switch (reg) {
+		case 0:
+			emit_mov_imm(xADR, (s16)fetch_word());
+			break;
+		case 1:
+			a = fetch_word() << 16;
+			a |= fetch_word();
+			emit_mov_imm(xADR, a);
+			break;
+		case 2:
+			a = op_pc;
+			emit_mov_imm(xADR, a + (s16)fetch_word());
+			break;
+		case 3:
+			emit_mov_imm(xADR, op_pc);
+			emit_index(fetch_word());
+			break;
+		}
+		break;
+	}
+}
+
+// operand to hr (ecx or edx)
+static void emit_ea_read(int hr, int mode, int reg, int size, int sx)
+{
+	if (mode < 2)
+		emit_load_reg(hr, mode * 8 + reg, size, sx);
+	else if (mode == 7 && reg == 4)
+		emit_mov_imm(hr, fetch_imm(size, sx));
+	else {
+		emit_ea_adr(mode, reg, size);
+		emit_read(size, sx);
+		emit_mov_rr(hr, xAX);
+	}
+}
+
+// result in hr to Dn or xADR (operand was read with emit_ea_read)
+static void emit_ea_writeback(int hr, int mode, int reg, int size)
+{
+	if (mode == 0)
+		emit_store_reg(hr, reg, size);
+	else
+		emit_write(size, hr, 0);
+}
+
+// ----------------------------------------------------------------------------
+// instructions. return -1 if famec must do it, 1 if it ends the block
+
+static const u8 lea_cycles[12] = { 0, 0, 4, 0, 0, 8, 12, 8, 12, 8, 12, 0 };
+static const u8 jmp_cycles[12] = { 0, 0, 8, 0, 0, 10, 14, 10, 12, 10, 14, 0 };
+static const u8 movem_r_cycles[12] = { 0, 0, 12, 12, 0, 16, 18, 16, 20, 16, 18, 0 };
+static const u8 movem_w_cycles[12] = { 0, 0, 8, 0, 8, 12, 14, 12, 16, 0, 0, 0 };
+
+static int size_bits(int s)
+{
+	return s == 0 ? 1 : s == 1 ? 2 : 4;
+}
+
+static int tr_move(u32 op)
+{
+	int size = (op >> 12) == 1 ? 1 : (op >> 12) == 2 ? 4 : 2;
+	int smode = (op >> 3) & 7, sreg = op & 7;
+	int dmode = (op >> 6) & 7, dreg = (op >> 9) & 7;
+	int cycles;
+
+	if (!ea_ok(smode, sreg, EAM_ALL) || (size == 1 && smode == 1))
+		return -1;
+	cycles = 4 + ea_cyc(smode, sreg, size);
+
+	if (dmode == 1) {
+		if (size == 1) return -1;
+		emit_ea_read(xDX, smode, sreg, size, 1);
+		emit_store_reg(xDX, dreg + 8, 4);
+		emit_insn_end(cycles);
+		return 0;
+	}
+
+	if (!ea_ok(dmode, dreg, EAM_DALT))
+		return -1;
+	emit_ea_read(xDX, smode, sreg, size, 0);
+	emit_test_rr(size, xDX, xDX);
+	emit_flags(0);
+	if (dmode == 0)
+		emit_store_reg(xDX, dreg, size);
+	else {
+		emit_ea_adr(dmode, dreg, size);
+		emit_write(size, xDX, dmode == 4);
+		cycles += ea_cyc(dmode, dreg, size) - (dmode == 4 ? 2 : 0);
+	}
+	emit_insn_end(cycles);
+	return 0;
+}
+
+static int tr_moveq(u32 op)
+{
+	u32 v = (s8)op;
+	if (op & 0x100) return -1;
+	emit_mov_mimm(4, xCTX, CTX_D((op >> 9) & 7), v);
+	emit_flags_const(v, 4);
+	emit_insn_end(4);
+	return 0;
+}
+
+static int tr_lea_pea(u32 op, int pea)
+{
+	int mode = (op >> 3) & 7, reg = op & 7;
+
+	if (!ea_ok(mode, reg, EAM_CTRL))
+		return -1;
+	emit_ea_adr(mode, reg, 4);
+	if (!pea) {
+		emit_store_reg(xADR, ((op >> 9) & 7) + 8, 4);
+		emit_insn_end(lea_cycles[ea_idx(mode, reg)]);
+		return 0;
+	}
+	emit_mov_rr(xDX, xADR);
+	emit_alu_mimm(4, ALU_SUB, xCTX, CTX_A(7), 4);
+	emit_mov_rm(4, xADR, xCTX, CTX_A(7));
+	emit_write(4, xDX, 0);
+	emit_insn_end(lea_cycles[ea_idx(mode, reg)] + 8);
+	return 0;
+}
+
+// clr, neg, not
+static int tr_unary(u32 op)
+{
+	int type = (op >> 9) & 7, size = size_bits((op >> 6) & 3);
+	int mode = (op >> 3) & 7, reg = op & 7;
+	int cycles;
+
+	if (!ea_ok(mode, reg, EAM_DALT))
+		return -1;
+	if (mode == 0)
+		cycles = size == 4 ? 6 : 4;
+	else
+		cycles = (size == 4 ? 12 : 8) + ea_cyc(mode, reg, size);
+
+	if (type == 1) { // clr, doesn't read
+		emit_alu_rr(4, ALU_XOR, xDX, xDX);
+		if (mode == 0)
+			emit_store_reg(xDX, reg, size);
+		else {
+			emit_ea_adr(mode, reg, size);
+			emit_write(size, xDX, 0);
+		}
+		emit_flags_const(0, size);
+		emit_insn_end(cycles);
+		return 0;
+	}
+
+	emit_ea_read(xDX, mode, reg, size, 0);
+	if (type == 2) {
+		emit_unary(size, 3, xDX);
+		emit_flags(1);
+	} else {
+		emit_unary(size, 2, xDX);
+		emit_test_rr(size, xDX, xDX);
+		emit_flags(0);
+	}
+	emit_ea_writeback(xDX, mode, reg, size);
+	emit_insn_end(cycles);
+	return 0;
+}
+
+static int tr_tst(u32 op)
+{
+	int size = size_bits((op >> 6) & 3), mode = (op >> 3) & 7, reg = op & 7;
+
+	if (!ea_ok(mode, reg, EAM_DALT))
+		return -1;
+	emit_ea_read(xDX, mode, reg, size, 0);
+	emit_test_rr(size, xDX, xDX);
+	emit_flags(0);
+	emit_insn_end(4 + ea_cyc(mode, reg, size));
+	return 0;
+}
+
+static int tr_movem(u32 op)
+{
+	int size = (op & 0x40) ? 4 : 2, mode = (op >> 3) & 7, reg = op & 7;
+	int to_regs = op & 0x400, i, n = 0, cycles;
+	u32 mask = fetch_word();
+
+	if (to_regs) {
+		if (mode == 4 || !ea_ok(mode, reg, EAM_CTRL | 8))
+			return -1;
+		cycles = movem_r_cycles[ea_idx(mode, reg)];
+	} else {
+		if (mode == 3 || !ea_ok(mode, reg, EAM_MALT))
+			return -1;
+		cycles = movem_w_cycles[ea_idx(mode, reg)];
+	}
+	if (mode == 3 || mode == 4)
+		emit_mov_rm(4, xADR, xCTX, CTX_A(reg));
+	else
+		emit_ea_adr(mode, reg, size);
+
+	for (i = 0; i < 16; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+		n++;
+		if (to_regs) {
+			emit_read(size, 1);
+			emit_store_reg(xAX, i, 4);
+			emit_alu_imm(4, ALU_ADD, xADR, size);
+		} else if (mode == 4) {
+			// -(An): mask is reversed, the original An is stored
+			emit_alu_imm(4, ALU_SUB, xADR, size);
+			emit_load_reg(xDX, 15 - i, size, 0);
+			emit_write(size, xDX, 1);
+		} else {
+			emit_load_reg(xDX, i, size, 0);
+			emit_write(size, xDX, 0);
+			emit_alu_imm(4, ALU_ADD, xADR, size);
+		}
+	}
+	if (mode == 3 || mode == 4)
+		emit_store_reg(xADR, reg + 8, 4);
+
+	emit_insn_end(cycles + n * size * 2);
+	return 0;
+}
+
+static int tr_jmp_jsr(u32 op)
+{
+	int jsr = !(op & 0x40), mode = (op >> 3) & 7, reg = op & 7;
+	int cycles;
+
+	if (!ea_ok(mode, reg, EAM_CTRL))
+		return -1;
+	cycles = jmp_cycles[ea_idx(mode, reg)] + (jsr ? 8 : 0);
+	emit_ea_adr(mode, reg, 4);
+	if (jsr) {
+		emit_mov_rr(xTMP, xADR);
+		emit_alu_mimm(4, ALU_SUB, xCTX, CTX_A(7), 4);
+		emit_mov_rm(4, xADR, xCTX, CTX_A(7));
+		emit_mov_imm(xDX, op_pc);
+		emit_write(4, xDX, 0);
+		emit_mov_rr(xADR, xTMP);
+	}
+	emit_mov_rr(xDI, xADR);
+	emit_goto_dynamic(cycles);
+	return 1;
+}
+
+static int tr_misc4e(u32 op)
+{
+	int reg = op & 7;
+
+	if (op == 0x4e71) { // nop
+		emit_insn_end(4);
+		return 0;
+	}
+	if (op == 0x4e75) { // rts
+		emit_mov_rm(4, xADR, xCTX, CTX_A(7));
+		emit_read(4, 0);
+		emit_alu_mimm(4, ALU_ADD, xCTX, CTX_A(7), 4);
+		emit_mov_rr(xDI, xAX);
+		emit_goto_dynamic(16);
+		return 1;
+	}
+	if ((op & 0xfff8) == 0x4e50 && reg != 7) { // link
+		s32 disp = (s16)fetch_word();
+		emit_alu_mimm(4, ALU_SUB, xCTX, CTX_A(7), 4);
+		emit_mov_rm(4, xADR, xCTX, CTX_A(7));
+		emit_load_reg(xDX, reg + 8, 4, 0);
+		emit_write(4, xDX, 0);
+		emit_load_reg(xDX, 15, 4, 0);
+		emit_store_reg(xDX, reg + 8, 4);
+		emit_alu_mimm(4, ALU_ADD, xCTX, CTX_A(7), disp);
+		emit_insn_end(16);
+		return 0;
+	}
+	if ((op & 0xfff8) == 0x4e58) { // unlk
+		emit_mov_rm(4, xADR, xCTX, CTX_A(reg));
+		emit_lea(xDX, xADR, 4);
+		emit_store_reg(xDX, 15, 4);
+		emit_read(4, 0);
+		emit_store_reg(xAX, reg + 8, 4);
+		emit_insn_end(12);
+		return 0;
+	}
+	return -1;
+}
+
+static int tr_line4(u32 op)
+{
+	int mode = (op >> 3) & 7, reg = op & 7;
+
+	if ((op & 0xf1c0) == 0x41c0)
+		return tr_lea_pea(op, 0);
+	switch (op & 0xffc0) {
+	case 0x4200: case 0x4240: case 0x4280:
+	case 0x4400: case 0x4440: case 0x4480:
+	case 0x4600: case 0x4640: case 0x4680:
+		return tr_unary(op);
+	case 0x4a00: case 0x4a40: case 0x4a80:
+		return tr_tst(op);
+	case 0x4840:
+		if (mode == 0) { // swap
+			emit_load_reg(xDX, reg, 4, 0);
+			emit_shift_imm(4, SH_ROL, xDX, 16);
+			emit_store_reg(xDX, reg, 4);
+			emit_test_rr(4, xDX, xDX);
+			emit_flags(0);
+			emit_insn_end(4);
+			return 0;
+		}
+		return tr_lea_pea(op, 1);
+	case 0x4880: case 0x48c0:
+		if (mode == 0) { // ext
+			int size = (op & 0x40) ? 4 : 2;
+			emit_load_reg(xDX, reg, size >> 1, 1);
+			emit_store_reg(xDX, reg, size);
+			emit_test_rr(4, xDX, xDX);
+			emit_flags(0);
+			emit_insn_end(4);
+			return 0;
+		}
+		return tr_movem(op);
+	case 0x4c80: case 0x4cc0:
+		return tr_movem(op);
+	case 0x4e80: case 0x4ec0:
+		return tr_jmp_jsr(op);
+	case 0x4e40:
+		return tr_misc4e(op);
+	}
+	return -1;
+}
+
+// addq, subq, scc, dbcc
+static int tr_line5(u32 op)
+{
+	int mode = (op >> 3) & 7, reg = op & 7, cc = (op >> 8) & 15;
+	int size, cycles, x86cc = 0;
+	u8 *j_true = NULL, *j_expired, *j_done;
+
+	if ((op & 0xc0) != 0xc0) {
+		int sub = op & 0x100;
+		s32 data = (((op >> 9) - 1) & 7) + 1;
+
+		size = size_bits((op >> 6) & 3);
+		if (!ea_ok(mode, reg, EAM_ALT) || (mode == 1 && size == 1))
+			return -1;
+		if (mode == 1) { // no flags, whole register
+			emit_alu_mimm(4, sub ? ALU_SUB : ALU_ADD, xCTX, CTX_A(reg), data);
+			emit_insn_end((sub || size == 4) ? 8 : 4);
+			return 0;
+		}
+		emit_ea_read(xDX, mode, reg, size, 0);
+		emit_alu_imm(size, sub ? ALU_SUB : ALU_ADD, xDX, data);
+		emit_flags(1);
+		emit_ea_writeback(xDX, mode, reg, size);
+		if (mode == 0)
+			cycles = size == 4 ? 8 : 4;
+		else
+			cycles = (size == 4 ? 12 : 8) + ea_cyc(mode, reg, size);
+		emit_insn_end(cycles);
+		return 0;
+	}
+
+	if (mode == 1) { // dbcc
+		s32 disp = (s16)fetch_word();
+		u32 target = insn_pc + 2 + disp;
+		if (target & 1)
+			return -1;
+		if (cc == 0) {
+			emit_insn_end(12);
+			return 0;
+		}
+		if (cc != 1) {
+			x86cc = emit_cond(cc);
+			j_true = emit_jcc(x86cc);
+		}
+		emit_alu_mimm(2, ALU_SUB, xCTX, CTX_D(reg), 1);
+		j_expired = emit_jcc(CC_B);
+		emit_branch_end(10, target);
+		patch_rel32(j_expired, tcache_ptr);
+		emit_alu_imm(4, ALU_SUB, xCYC, 14);
+		emit_exit(CC_LE, op_pc);
+		if (j_true == NULL)
+			return 0;
+		j_done = emit_jmp();
+		patch_rel32(j_true, tcache_ptr);
+		emit_insn_end(12);
+		patch_rel32(j_done, tcache_ptr);
+		return 0;
+	}
+
+	// scc
+	if (!ea_ok(mode, reg, EAM_DALT))
+		return -1;
+	if (mode == 0) {
+		if (cc < 2) {
+			emit_mov_mimm(1, xCTX, CTX_D(reg), cc ? 0 : 0xff);
+			emit_insn_end(cc ? 4 : 6);
+			return 0;
+		}
+		x86cc = emit_cond(cc);
+		emit_rr(1, OP_SETCC | x86cc, 0, xDX);
+		emit_rr(4, OP_MOVZX8, xDX, xDX);
+		emit_lea(xAX, xDX, 0);
+		emit_alu_rr(4, ALU_ADD, xAX, xAX);
+		emit_alu_rr(4, ALU_SUB, xCYC, xAX);
+		emit_unary(1, 3, xDX);
+		emit_store_reg(xDX, reg, 1);
+		emit_insn_end(4);
+		return 0;
+	}
+	emit_ea_adr(mode, reg, 1);
+	if (cc < 2)
+		emit_mov_imm(xDX, cc ? 0 : 0xff);
+	else {
+		x86cc = emit_cond(cc);
+		emit_rr(1, OP_SETCC | x86cc, 0, xDX);
+		emit_unary(1, 3, xDX);
+	}
+	emit_write(1, xDX, 0);
+	emit_insn_end(8 + ea_cyc(mode, reg, 1));
+	return 0;
+}
+
+static int tr_branch(u32 op)
+{
+	int cc = (op >> 8) & 15, x86cc;
+	u32 target = insn_pc + 2, ret;
+	s32 disp = (s8)op;
+	u8 *j;
+
+	if (disp == 0) {
+		disp = (s16)fetch_word();
+		target += disp;
+	} else if (cc < 2)
+		target += disp;
+	else
+		target += ((s8)(op & 0xfe)); // famec ignores bit0 here
+	ret = op_pc;
+	if (target & 1)
+		return -1;
+
+	if (cc == 0) {
+		emit_branch_end(10, target);
+		return 1;
+	}
+	if (cc == 1) { // bsr
+		emit_alu_mimm(4, ALU_SUB, xCTX, CTX_A(7), 4);
+		emit_mov_rm(4, xADR, xCTX, CTX_A(7));
+		emit_mov_imm(xDX, ret);
+		emit_write(4, xDX, 0);
+		emit_branch_end(18, target);
+		return 1;
+	}
+	x86cc = emit_cond(cc);
+	j = emit_jcc(x86cc ^ 1);
+	emit_branch_end(10, target);
+	patch_rel32(j, tcache_ptr);
+	emit_insn_end((op & 0xff) ? 8 : 12);
+	return 0;
+}
+
+enum { OPK_OR, OPK_SUB, OPK_CMP, OPK_EOR, OPK_AND, OPK_ADD };
+static const u8 opk_alu[] = { ALU_OR, ALU_SUB, ALU_CMP, ALU_XOR, ALU_AND, ALU_ADD };
+
+static void emit_alu_flags(int kind)
+{
+	if (kind == OPK_ADD || kind == OPK_SUB)
+		emit_flags(1);
+	else
+		emit_flags(0); // logic ops clear OF, CF; cmp leaves X alone
+}
+
+// or, sub, cmp, eor, and, add and friends (lines 8, 9, b, c, d)
+static int tr_alu(u32 op, int kind)
+{
+	int dn = (op >> 9) & 7, opmode = (op >> 6) & 7;
+	int mode = (op >> 3) & 7, reg = op & 7;
+	int size = size_bits(opmode & 3), cycles;
+	int alu = opk_alu[kind];
+
+	if ((opmode & 3) == 3) {
+		if (kind == OPK_SUB || kind == OPK_ADD || kind == OPK_CMP) {
+			// adda, suba, cmpa
+			size = (opmode & 4) ? 4 : 2;
+			if (!ea_ok(mode, reg, EAM_ALL))
+				return -1;
+			emit_ea_read(xCX, mode, reg, size, 1);
+			if (kind == OPK_CMP) {
+				emit_load_reg(xDX, dn + 8, 4, 0);
+				emit_alu_rr(4, ALU_CMP, xDX, xCX);
+				emit_flags(0);
+				emit_insn_end(6 + ea_cyc(mode, reg, size));
+				return 0;
+			}
+			emit_alu_mr(4, alu, xCTX, CTX_A(dn), xCX);
+			if (size == 2)
+				cycles = 8 + ea_cyc(mode, reg, 2);
+			else
+				cycles = (mode < 2 || (mode == 7 && reg == 4) ? 8 : 6) + ea_cyc(mode, reg, 4);
+			emit_insn_end(cycles);
+			return 0;
+		}
+		if (kind == OPK_AND) { // mulu, muls
+			int sx = opmode & 4;
+			if (!ea_ok(mode, reg, EAM_DATA))
+				return -1;
+			emit_ea_read(xCX, mode, reg, 2, sx);
+			emit_load_reg(xDX, dn, 2, sx);
+			emit_rr(4, OP_IMUL, xDX, xCX);
+			emit_store_reg(xDX, dn, 4);
+			emit_test_rr(4, xDX, xDX);
+			emit_flags(0);
+			emit_insn_end(54 + ea_cyc(mode, reg, 2));
+			return 0;
+		}
+		return -1; // div
+	}
+
+	if (!(opmode & 4) || kind == OPK_CMP) {
+		// <ea>,Dn (cmp only has this form, 'Dn,<ea>' is eor or cmpm)
+		if (kind == OPK_CMP && (opmode & 4)) {
+			if (mode == 1) { // cmpm
+				emit_ea_adr(3, reg, size);
+				emit_read(size, 0);
+				emit_mov_rr(xTMP, xAX);
+				emit_ea_adr(3, dn, size);
+				emit_read(size, 0);
+				emit_mov_rr(xDX, xAX);
+				emit_alu_rr(size, ALU_CMP, xDX, xTMP);
+				emit_flags(0);
+				emit_insn_end(size == 4 ? 20 : 12);
+				return 0;
+			}
+			kind = OPK_EOR;
+			alu = ALU_XOR;
+			goto dn_to_ea;
+		}
+		if (!ea_ok(mode, reg, (kind == OPK_AND || kind == OPK_OR) ? EAM_DATA : EAM_ALL))
+			return -1;
+		if (size == 1 && mode == 1)
+			return -1;
+		emit_ea_read(xCX, mode, reg, size, 0);
+		emit_load_reg(xDX, dn, size, 0);
+		emit_alu_rr(size, alu, xDX, xCX);
+		emit_alu_flags(kind);
+		if (kind != OPK_CMP)
+			emit_store_reg(xDX, dn, size);
+		if (size != 4)
+			cycles = 4 + ea_cyc(mode, reg, size);
+		else if (kind == OPK_CMP)
+			cycles = 6 + ea_cyc(mode, reg, size);
+		else
+			cycles = (mode < 2 || (mode == 7 && reg == 4) ? 8 : 6) + ea_cyc(mode, reg, size);
+		emit_insn_end(cycles);
+		return 0;
+	}
+
+	// Dn,<ea>
+	if (mode < 2) {
+		if (kind == OPK_AND && opmode == 5) { // exg
+			int r1 = dn + (mode == 1 ? 8 : 0), r2 = reg + (mode == 1 ? 8 : 0);
+			emit_load_reg(xDX, r1, 4, 0);
+			emit_load_reg(xCX, r2, 4, 0);
+			emit_store_reg(xCX, r1, 4);
+			emit_store_reg(xDX, r2, 4);
+			emit_insn_end(6);
+			return 0;
+		}
+		if (kind == OPK_AND && opmode == 6 && mode == 1) {
+			emit_load_reg(xDX, dn, 4, 0);
+			emit_load_reg(xCX, reg + 8, 4, 0);
+			emit_store_reg(xCX, dn, 4);
+			emit_store_reg(xDX, reg + 8, 4);
+			emit_insn_end(6);
+			return 0;
+		}
+		return -1; // abcd, sbcd, addx, subx
+	}
+dn_to_ea:
+	if (!ea_ok(mode, reg, kind == OPK_EOR ? EAM_DALT : EAM_MALT))
+		return -1;
+	emit_ea_read(xDX, mode, reg, size, 0);
+	emit_load_reg(xCX, dn, size, 0);
+	emit_alu_rr(size, alu, xDX, xCX);
+	emit_alu_flags(kind);
+	emit_ea_writeback(xDX, mode, reg, size);
+	if (mode == 0)
+		cycles = size == 4 ? 8 : 4;
+	else
+		cycles = (size == 4 ? 12 : 8) + ea_cyc(mode, reg, size);
+	emit_insn_end(cycles);
+	return 0;
+}
+
+// immediate ops and bit ops (line 0)
+static int tr_line0(u32 op)
+{
+	int mode = (op >> 3) & 7, reg = op & 7, type = (op >> 6) & 3;
+	int size, cycles, kind;
+	u32 imm;
+
+	if ((op & 0x138) == 0x108) // movep
+		return -1;
+
+	if ((op & 0x100) || (op & 0xf00) == 0x800) {
+		// btst, bchg, bclr, bset
+		static const u16 bt_op[4] = { OP_BT, OP_BTC, OP_BTR, OP_BTS };
+		int dynamic = op & 0x100;
+
+		if (!ea_ok(mode, reg, type == 0 ? EAM_DATA : EAM_DALT) || (mode == 7 && reg == 4))
+			return -1;
+		if (!dynamic)
+			imm = fetch_word() & (mode == 0 ? 31 : 7);
+		emit_ea_read(xDX, mode, reg, mode == 0 ? 4 : 1, 0);
+		if (dynamic) {
+			emit_load_reg(xCX, (op >> 9) & 7, 4, 0);
+			emit_alu_imm(4, ALU_AND, xCX, mode == 0 ? 31 : 7);
+		} else
+			emit_mov_imm(xCX, imm);
+		emit_rr(4, bt_op[0], xCX, xDX);
+		emit_flag_z_nc();
+		if (type != 0) {
+			emit_rr(4, bt_op[type], xCX, xDX);
+			emit_ea_writeback(xDX, mode, reg, mode == 0 ? 4 : 1);
+		}
+		if (mode == 0) {
+			static const u8 dn_cycles[4] = { 6, 8, 10, 8 };
+			cycles = dn_cycles[type] + (dynamic ? 0 : 4);
+		} else
+			cycles = (type == 0 ? 4 : 8) + (dynamic ? 0 : 4) + ea_cyc(mode, reg, 1);
+		emit_insn_end(cycles);
+		return 0;
+	}
+
+	switch (op & 0xf00) {
+	case 0x000: kind = OPK_OR;  break;
+	case 0x200: kind = OPK_AND; break;
+	case 0x400: kind = OPK_SUB; break;
+	case 0x600: kind = OPK_ADD; break;
+	case 0xa00: kind = OPK_EOR; break;
+	case 0xc00: kind = OPK_CMP; break;
+	default: return -1;
+	}
+	if (type == 3 || !ea_ok(mode, reg, EAM_DALT))
+		return -1;
+	size = size_bits(type);
+	imm = fetch_imm(size, 0);
+
+	emit_ea_read(xDX, mode, reg, size, 0);
+	emit_alu_imm(size, opk_alu[kind], xDX, imm);
+	emit_alu_flags(kind);
+	if (kind != OPK_CMP)
+		emit_ea_writeback(xDX, mode, reg, size);
+	if (mode == 0) {
+		cycles = size == 4 ? 16 : 8;
+		if (size == 4 && (kind == OPK_AND || kind == OPK_CMP))
+			cycles = 14;
+	} else if (kind == OPK_CMP)
+		cycles = (size == 4 ? 12 : 8) + ea_cyc(mode, reg, size);
+	else
+		cycles = (size == 4 ? 20 : 12) + ea_cyc(mode, reg, size);
+	emit_insn_end(cycles);
+	return 0;
+}
+
+// asl/asr/lsl/lsr/rol/ror of edx by n (1-8), result stays in edx
+static void emit_shift(int type, int left, int size, int n)
+{
+	int bits = size * 8;
+
+	if (type == 3) { // rol, ror: C is the bit rotated in
+		emit_shift_imm(size, left ? SH_ROL : SH_ROR, xDX, n);
+		emit_test_rr(size, xDX, xDX);
+		EMIT(0x9f); // lahf
+		emit_mov_rr(xCX, xDX);
+		if (!left)
+			emit_shift_imm(4, SH_SHR, xCX, bits - 1);
+		emit_alu_imm(4, ALU_AND, xCX, 1);
+		emit_rr(1, 0x08, xCX, 4); // or ah, cl
+		emit_rr(1, 0x88, 4, xAX);  // mov al, ah
+		emit_mov_mimm(1, xST, ST_V, 0);
+		emit_mov_mr(1, xST, ST_F, xAX);
+		return;
+	}
+
+	if (left) {
+		// top aligned, so that x86 flags are right for any size
+		if (bits < 32)
+			emit_shift_imm(4, SH_SHL, xDX, 32 - bits);
+		if (type == 0) { // asl: V if any of the bits shifted through the top changed
+			emit_mov_rr(xCX, xDX);
+			emit_shift_imm(4, SH_SAR, xCX, 31 - n);
+			emit_alu_imm(4, ALU_ADD, xCX, 1);
+			emit_alu_imm(4, ALU_CMP, xCX, 1);
+			emit_rr(1, OP_SETCC | CC_A, 0, xCX);
+		}
+		emit_shift_imm(4, SH_SHL, xDX, n);
+	} else {
+		if (bits < 32)
+			emit_rr(4, type == 0 ? (bits == 8 ? OP_MOVSX8 : OP_MOVSX16) :
+				(bits == 8 ? OP_MOVZX8 : OP_MOVZX16), xDX, xDX);
+		emit_shift_imm(4, type == 0 ? SH_SAR : SH_SHR, xDX, n);
+	}
+	emit_rm(1, OP_SETCC | CC_B, 0, xST, ST_X);
+	EMIT(0x9f); // lahf
+	emit_rr(1, 0x88, 4, xAX); // mov al, ah
+	emit_mov_mr(1, xST, ST_F, xAX);
+	if (left && type == 0)
+		emit_mov_mr(1, xST, ST_V, xCX);
+	else
+		emit_mov_mimm(1, xST, ST_V, 0);
+	if (left && bits < 32)
+		emit_shift_imm(4, SH_SHR, xDX, 32 - bits);
+}
+
+static int tr_shift(u32 op)
+{
+	int left = op & 0x100, mode = (op >> 3) & 7, reg = op & 7;
+	int type, size, n;
+
+	if ((op & 0xc0) == 0xc0) { // memory, word by 1
+		type = (op >> 9) & 3;
+		if ((op & 0x800) || type == 2 || !ea_ok(mode, reg, EAM_MALT))
+			return -1;
+		emit_ea_read(xDX, mode, reg, 2, 0);
+		emit_shift(type, left, 2, 1);
+		emit_write(2, xDX, 0);
+		emit_insn_end(8 + ea_cyc(mode, reg, 2));
+		return 0;
+	}
+
+	type = (op >> 3) & 3;
+	if ((op & 0x20) || type == 2)
+		return -1;
+	size = size_bits((op >> 6) & 3);
+	n = (((op >> 9) - 1) & 7) + 1;
+	emit_load_reg(xDX, reg, size, 0);
+	emit_shift(type, left, size, n);
+	emit_store_reg(xDX, reg, size);
+	emit_insn_end((size == 4 ? 8 : 6) + n * 2);
+	return 0;
+}
+
+static int translate_op(u32 op)
+{
+	switch (op >> 12) {
+	case 0x0: return tr_line0(op);
+	case 0x1: case 0x2: case 0x3:
+		return tr_move(op);
+	case 0x4: return tr_line4(op);
+	case 0x5: return tr_line5(op);
+	case 0x6: return tr_branch(op);
+	case 0x7: return tr_moveq(op);
+	case 0x8: return tr_alu(op, OPK_OR);
+	case 0x9: return tr_alu(op, OPK_SUB);
+	case 0xb: return tr_alu(op, OPK_CMP);
+	case 0xc: return tr_alu(op, OPK_AND);
+	case 0xd: return tr_alu(op, OPK_ADD);
+	case 0xe: return tr_shift(op);
+	}
+	return -1;
+}
+
+// ----------------------------------------------------------------------------
+// block cache
+
+static struct drc_block **hash_slot(u32 pc)
+{
+	return &hash_table[(pc >> 1) & (DRC_HASH_SIZE - 1)];
+}
+
+static void flush(void)
+{
+	memset(hash_table, 0, sizeof(hash_table));
+	memset(fm68k_drc_ram_code, 0, sizeof(fm68k_drc_ram_code));
+	memset(ram_invals, 0, sizeof(ram_invals));
+	ram_blocks = NULL;
+	block_count = 0;
+	tcache_ptr = tcache_base;
+	drc_st.exit = 1;
+	drc_gen++;
+}
+
+static int host_in_ram(u32 host)
+{
+	return host - ram_base < ram_size;
+}
+
+static int ram_page_ok(u32 host)
+{
+	return !host_in_ram(host) || ram_invals[(host - ram_base) >> 8] < DRC_RAM_INVALS;
+}
+
+static void emit_stubs(void)
+{
+	int i, j;
+
+	for (i = 0; i < exit_count; i++) {
+		for (j = 0; j < i; j++)
+			if (exits[j].pc == exits[i].pc && exits[j].link == exits[i].link)
+				break;
+		if (j < i) {
+			patch_rel32(exits[i].jmp, exits[j].stub);
+			continue;
+		}
+		exits[i].stub = tcache_ptr;
+		patch_rel32(exits[i].jmp, tcache_ptr);
+		switch (exits[i].link) {
+		case 0:
+			emit_mov_mimm(4, xST, ST_PC, exits[i].pc);
+			emit_jmp_to(drc_leave);
+			break;
+		case 1:
+			emit_mov_imm(xDI, exits[i].pc);
+			emit_mov_imm64(xSI, exits[i].jmp);
+			emit_jmp_to(drc_dispatch_link);
+			break;
+		default:
+			emit_mov_imm(xDI, exits[i].pc);
+			emit_jmp_to(drc_dispatch);
+			break;
+		}
+	}
+}
+
+static struct drc_block *translate(u32 pc, u32 host)
+{
+	struct drc_block *b, **hb;
+	u32 end;
+	u8 *code;
+	int r;
+
+	if (block_count >= DRC_BLOCKS || tcache_end - tcache_ptr < DRC_OP_SPACE * 16)
+		flush();
+
+	b = &blocks[block_count++];
+	b->pc = pc;
+	b->host = host;
+	b->code = NULL;
+	hb = hash_slot(pc);
+	b->next = *hb;
+	*hb = b;
+
+	blk_pc = pc;
+	blk_linkable = !host_in_ram(host);
+	blk_ops = exit_count = 0;
+	op_pc = pc;
+	op_ptr = (u16 *)(unsigned long)host;
+	code = tcache_ptr;
+
+	for (;;) {
+		u8 *ptr0 = tcache_ptr;
+		u16 *op_ptr0 = op_ptr;
+		int exit_count0 = exit_count;
+
+		if (blk_ops >= DRC_BLOCK_OPS || ((op_pc + 10) ^ pc) & 0xffff0000
+		    || !ram_page_ok(host + (op_pc - pc)) || !ram_page_ok(host + (op_pc - pc) + 10)) {
+			emit_goto(op_pc);
+			break;
+		}
+
+		insn_pc = op_pc;
+		blk_op_pc[blk_ops] = op_pc;
+		blk_op_code[blk_ops] = tcache_ptr;
+		blk_ops++;
+		op_wrote = 0;
+		r = translate_op(fetch_word());
+		if (r < 0) {
+			tcache_ptr = ptr0;
+			op_ptr = op_ptr0;
+			op_pc = insn_pc;
+			exit_count = exit_count0;
+			blk_ops--;
+			if (blk_ops > 0)
+				emit_exit(-1, op_pc);
+			break;
+		}
+		if (r > 0)
+			break;
+	}
+
+	if (blk_ops == 0) {
+		tcache_ptr = code;
+		b->len = 2;
+		return b;
+	}
+
+	emit_stubs();
+	b->code = code;
+	end = op_pc;
+	b->len = end - pc;
+
+	if (host_in_ram(host)) {
+		u32 p;
+		b->ram_next = ram_blocks;
+		ram_blocks = b;
+		for (p = (host - ram_base) >> 8; p <= (host - ram_base + b->len - 1) >> 8 && p < 256; p++)
+			fm68k_drc_ram_code[p] = 1;
+	}
+
+	return b;
+}
+
+static struct drc_block *block_get(u32 pc)
+{
+	u32 host = fm68k_drc_ctx->Fetch[(pc >> 16) & 0xff] + (pc & 0xffffff);
+	struct drc_block *b;
+
+	for (b = *hash_slot(pc); b != NULL; b = b->next)
+		if (b->pc == pc && b->host == host)
+			return b;
+
+	return translate(pc, host);
+}
+
+static u8 *dispatch_lookup(u32 pc)
+{
+	return block_get(pc)->code;
+}
+
+static u8 *dispatch_link(u32 pc, u8 *jmp)
+{
+	int gen = drc_gen;
+	u8 *code = block_get(pc)->code;
+
+	// translating may have flushed the block jmp is in
+	if (code != NULL && gen == drc_gen)
+		patch_rel32(jmp, code);
+	return code;
+}
+
+static void emit_dispatcher(void *lookup)
+{
+	u8 *j_leave[3];
+
+	emit_mov_mr(4, xST, ST_PC, xDI);
+	emit_test_rr(4, xCYC, xCYC);
+	j_leave[0] = emit_jcc(CC_LE);
+	emit_alu_mimm(1, ALU_CMP, xST, ST_EXIT, 0);
+	j_leave[1] = emit_jcc(CC_NE);
+	emit_mov_imm64(xAX, lookup);
+	emit_rr(4, 0xff, 2, xAX);       // call rax
+	emit_test_rr(8, xAX, xAX);
+	j_leave[2] = emit_jcc(CC_E);
+	emit_rr(4, 0xff, 4, xAX);       // jmp rax
+	patch_rel32(j_leave[0], drc_leave);
+	patch_rel32(j_leave[1], drc_leave);
+	patch_rel32(j_leave[2], drc_leave);
+}
+
+// entry(code, ctx, st), dispatchers and exit, kept over flushes
+static void emit_trampolines(void)
+{
+	static const u8 regs[] = { xBX, xBP, xR12, xR13, xR14, xR15 };
+	int i;
+
+	drc_leave = tcache_ptr;
+	emit_mov_mr(4, xCTX, CTX_CYC, xCYC);
+	emit_alu_imm(8, ALU_ADD, xSP, 8);
+	for (i = 5; i >= 0; i--) {
+		emit_prefix(4, 0, regs[i]);
+		EMIT(0x58 | (regs[i] & 7)); // pop
+	}
+	EMIT(0xc3); // ret
+
+	drc_enter_ptr = tcache_ptr;
+	for (i = 0; i < 6; i++) {
+		emit_prefix(4, 0, regs[i]);
+		EMIT(0x50 | (regs[i] & 7)); // push
+	}
+	emit_alu_imm(8, ALU_SUB, xSP, 8);
+	emit_rr(8, 0x8b, xCTX, xSI);
+	emit_rr(8, 0x8b, xST, xDX);
+	emit_mov_rm(4, xCYC, xCTX, CTX_CYC);
+	emit_rr(4, 0xff, 4, xDI); // jmp rdi
+
+	drc_dispatch = tcache_ptr;
+	emit_dispatcher(dispatch_lookup);
+
+	drc_dispatch_link = tcache_ptr;
+	emit_dispatcher(dispatch_link);
+
+	tcache_base = tcache_ptr;
+}
+
+// ----------------------------------------------------------------------------
+
+int fm68k_drc_init(void)
+{
+	if (tcache != NULL)
+		return 0;
+
+	tcache = mmap(NULL, DRC_CACHE_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	blocks = malloc(DRC_BLOCKS * sizeof(blocks[0]));
+	if (tcache == MAP_FAILED || blocks == NULL) {
+		if (tcache != MAP_FAILED) munmap(tcache, DRC_CACHE_SIZE);
+		free(blocks);
+		tcache = NULL;
+		blocks = NULL;
+		return -1;
+	}
+	tcache_ptr = tcache;
+	tcache_end = tcache + DRC_CACHE_SIZE;
+	emit_trampolines();
+	flush();
+	return 0;
+}
+
+void fm68k_drc_exit(void)
+{
+	if (tcache == NULL)
+		return;
+	munmap(tcache, DRC_CACHE_SIZE);
+	free(blocks);
+	tcache = NULL;
+	blocks = NULL;
+	fm68k_drc_ctx = NULL;
+}
+
+void fm68k_drc_set_ram(void *ram, unsigned int size)
+{
+	ram_base = (u32)(unsigned long)ram;
+	ram_size = size;
+	if (tcache != NULL)
+		flush();
+}
+
+void fm68k_drc_flush(void)
+{
+	if (tcache != NULL)
+		flush();
+}
+
+// RAM at offs, len bytes was written and there is code in the page
+void fm68k_drc_invalidate(unsigned int offs, int len)
+{
+	u32 a = ram_base + offs, p, p0 = offs >> 8, p1 = (offs + len - 1) >> 8;
+	struct drc_block **pb, *b;
+
+	for (pb = &ram_blocks; (b = *pb) != NULL; ) {
+		if (a < b->host + b->len && a + len > b->host) {
+			struct drc_block **hb;
+			for (hb = hash_slot(b->pc); *hb != b; hb = &(*hb)->next)
+				;
+			*hb = b->next;
+			*pb = b->ram_next;
+			drc_st.exit = 1;
+			continue;
+		}
+		pb = &b->ram_next;
+	}
+
+	// recount the marks of touched pages
+	for (p = p0; p <= p1 && p < 256; p++) {
+		if (ram_invals[p] < DRC_RAM_INVALS)
+			ram_invals[p]++;
+		fm68k_drc_ram_code[p] = 0;
+	}
+	for (b = ram_blocks; b != NULL; b = b->ram_next) {
+		u32 b0 = (b->host - ram_base) >> 8, b1 = (b->host - ram_base + b->len - 1) >> 8;
+		for (p = p0; p <= p1 && p < 256; p++)
+			if (p >= b0 && p <= b1)
+				fm68k_drc_ram_code[p] = 1;
+	}
+}
+
+// run translated code at *pc, returns 0 if there is none.
+// pc may come back odd after a jump, the caller must raise the address error
+int fm68k_drc_run(unsigned int *pc, unsigned int *ccr)
+{
+	struct drc_block *b;
+	u32 c = *ccr;
+
+	if (tcache == NULL)
+		return 0;
+	b = block_get(*pc);
+	if (b->code == NULL)
+		return 0;
+
+	drc_st.f = ((c & 8) << 4) | ((c & 4) << 4) | (c & 1) | 2;
+	drc_st.v = (c >> 1) & 1;
+	drc_st.x = (c >> 4) & 1;
+	drc_st.exit = 0;
+	((void (*)(u8 *, M68K_CONTEXT *, void *))drc_enter_ptr)(b->code, fm68k_drc_ctx, &drc_st);
+
+	*pc = drc_st.pc;
+	*ccr = ((drc_st.f >> 4) & 8) | ((drc_st.f >> 4) & 4) | (drc_st.v ? 2 : 0) |
+		(drc_st.f & 1) | (drc_st.x ? 0x10 : 0);
+	return 1;
+}
@@ -0,0 +1,313 @@
+// batch mode for the benchmark port: runs jobs from a manifest file on a pool
+// of forked workers. Workers are forked from an already initialized process,
+// so FAME, cz80 and ym2612 tables are built only once, and a crashing or
+// hanging ROM can only take down its own worker.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <linux/limits.h>
+
+#include "../common/emu.h"
+#include "../common/menu.h"
+#include "bench.h"
+#include "pprof.h"
+
+#include <Pico/PicoInt.h>
+#include <zlib/zlib.h>
+
+enum { JOB_OK = 0, JOB_ERROR, JOB_CRASH, JOB_TIMEOUT, JOB_STATUS_COUNT };
+
+static const char *job_status_names[JOB_STATUS_COUNT] = { "ok", "error", "crash", "timeout" };
+
+// sent by worker through a pipe
+struct job_result
+{
+	int status;
+	double fps;
+	unsigned int ram_crc, vram_crc;
+	char msg[64];
+};
+
+struct job
+{
+	char *rom, *state, *movie; // state and movie may be NULL
+	int frames;
+	int line;  // in manifest
+	int done;
+	struct job_result res;
+};
+
+struct worker
+{
+	pid_t pid;
+	int fd;  // read end of result pipe
+	int job;
+};
+
+
+static char *job_field(char **p)
+{
+	char *f = *p, *e;
+
+	if (f == NULL) return NULL;
+	e = strchr(f, '\t');
+	if (e) { *e = 0; *p = e + 1; }
+	else *p = NULL;
+
+	if (*f == 0 || strcmp(f, "-") == 0) return NULL;
+	return strdup(f);
+}
+
+static struct job *manifest_load(const char *fname, int frames, int *count)
+{
+	struct job *jobs = NULL;
+	int n = 0, alloc = 0, line = 0;
+	char buf[3*PATH_MAX], *p, *f;
+	FILE *mf;
+
+	mf = fopen(fname, "r");
+	if (mf == NULL) {
+		fprintf(stderr, "can't open manifest %s\n", fname);
+		return NULL;
+	}
+
+	while (fgets(buf, sizeof(buf), mf))
+	{
+		line++;
+		buf[strcspn(buf, "\r\n")] = 0;
+		if (buf[0] == 0 || buf[0] == '#') continue;
+
+		if (n == alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			jobs = realloc(jobs, alloc * sizeof(jobs[0]));
+			if (jobs == NULL) {
+				fprintf(stderr, "out of memory\n");
+				fclose(mf);
+				return NULL;
+			}
+		}
+
+		memset(&jobs[n], 0, sizeof(jobs[n]));
+		p = buf;
+		jobs[n].rom   = job_field(&p);
+		jobs[n].state = job_field(&p);
+		jobs[n].movie = job_field(&p);
+		f = job_field(&p);
+		jobs[n].frames = f ? atoi(f) : frames;
+		jobs[n].line = line;
+		free(f);
+
+		if (jobs[n].rom == NULL || jobs[n].frames <= 0) {
+			fprintf(stderr, "%s:%i: bad job, skipped\n", fname, line);
+			free(jobs[n].state);
+			free(jobs[n].movie);
+			continue;
+		}
+		n++;
+	}
+
+	fclose(mf);
+	*count = n;
+	return jobs;
+}
+
+static int state_load(const char *fname)
+{
+	int ret, gz = strlen(fname) > 3 && strcmp(fname + strlen(fname) - 3, ".gz") == 0;
+	void *PmovFile;
+
+	PmovFile = gz ? (void *)gzopen(fname, "rb") : (void *)fopen(fname, "rb");
+	if (PmovFile == NULL) return -1;
+
+	emu_setSaveStateCbs(gz);
+	ret = PmovState(6, PmovFile);
+	areaClose(PmovFile);
+	Pico.m.dirtyPal = 1;
+
+	return ret;
+}
+
+// runs in the forked worker
+static void job_run(struct job *job, struct job_result *res)
+{
+	pprof_t start, total;
+
+	memset(res, 0, sizeof(*res));
+	res->status = JOB_ERROR;
+
+	strncpy(romFileName, job->rom, PATH_MAX);
+	romFileName[PATH_MAX-1] = 0;
+	if (!bench_load()) {
+		snprintf(res->msg, sizeof(res->msg), "%s", menuErrorMsg);
+		return;
+	}
+	if (job->state && state_load(job->state) != 0) {
+		snprintf(res->msg, sizeof(res->msg), "failed to load state");
+		return;
+	}
+	if (job->movie && !emu_loadMovie(job->movie)) {
+		snprintf(res->msg, sizeof(res->msg), "%s", menuErrorMsg);
+		return;
+	}
+
+	start = pprof_get_one();
+	bench_run(job->frames);
+	total = pprof_get_one() - start;
+
+	res->status = JOB_OK;
+	res->fps = total ? job->frames * 1000000000.0 / total : 0.0;
+	res->ram_crc  = crc32(0, Pico.ram, sizeof(Pico.ram));
+	res->vram_crc = crc32(0, (void *)Pico.vram, sizeof(Pico.vram));
+}
+
+static int job_start(struct worker *w, struct job *jobs, int j, int timeout)
+{
+	struct job_result res;
+	int fds[2];
+
+	if (pipe(fds) != 0) return -1;
+
+	fflush(stdout); // don't let the child inherit buffered output
+	w->pid = fork();
+	if (w->pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	if (w->pid == 0) {
+		close(fds[0]);
+		if (timeout > 0) alarm(timeout); // SIGALRM kills us if we hang
+		job_run(&jobs[j], &res);
+		write(fds[1], &res, sizeof(res));
+		_exit(0);
+	}
+
+	close(fds[1]);
+	w->fd = fds[0];
+	w->job = j;
+	return 0;
+}
+
+static void job_finish(struct worker *w, struct job *jobs, int wstatus)
+{
+	struct job *job = &jobs[w->job];
+	struct job_result res;
+	int got;
+
+	// the worker writes a single small result just before exiting
+	do {
+		got = read(w->fd, &res, sizeof(res));
+	} while (got < 0 && errno == EINTR);
+	close(w->fd);
+
+	if (WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGALRM) {
+		memset(&job->res, 0, sizeof(job->res));
+		job->res.status = JOB_TIMEOUT;
+	}
+	else if (WIFSIGNALED(wstatus)) {
+		memset(&job->res, 0, sizeof(job->res));
+		job->res.status = JOB_CRASH;
+		snprintf(job->res.msg, sizeof(job->res.msg), "signal %i", WTERMSIG(wstatus));
+	}
+	else if (got != sizeof(res)) {
+		memset(&job->res, 0, sizeof(job->res));
+		job->res.status = JOB_CRASH;
+		snprintf(job->res.msg, sizeof(job->res.msg), "exit %i without result",
+			WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1);
+	}
+	else
+		job->res = res;
+
+	job->done = 1;
+	w->pid = 0;
+}
+
+static void job_print(struct job *job)
+{
+	struct job_result *res = &job->res;
+
+	printf("%5i %-7s %8.2f fps ram %08x vram %08x %s%s%s%s\n", job->line,
+		job_status_names[res->status], res->fps, res->ram_crc, res->vram_crc, job->rom,
+		res->msg[0] ? " (" : "", res->msg, res->msg[0] ? ")" : "");
+}
+
+int bench_batch(const char *manifest, int frames, int jobs_max, int timeout)
+{
+	int count[JOB_STATUS_COUNT] = { 0, };
+	int njobs = 0, next = 0, running = 0, printed = 0, i, wstatus;
+	struct worker *workers;
+	struct job *jobs;
+	pprof_t start;
+	pid_t pid;
+
+	jobs = manifest_load(manifest, frames, &njobs);
+	if (jobs == NULL) return 1;
+
+	if (jobs_max <= 0) jobs_max = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs_max <= 0) jobs_max = 1;
+	workers = calloc(jobs_max, sizeof(workers[0]));
+	if (workers == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	start = pprof_get_one();
+
+	while (printed < njobs)
+	{
+		// keep all workers busy
+		for (i = 0; i < jobs_max && next < njobs; i++) {
+			if (workers[i].pid != 0) continue;
+			if (job_start(&workers[i], jobs, next, timeout) != 0) {
+				perror("fork");
+				break;
+			}
+			next++;
+			running++;
+		}
+
+		if (running == 0) break; // couldn't start anything
+
+		pid = waitpid(-1, &wstatus, 0);
+		if (pid < 0) {
+			if (errno == EINTR) continue;
+			perror("waitpid");
+			break;
+		}
+
+		for (i = 0; i < jobs_max; i++) {
+			if (workers[i].pid != pid) continue;
+			job_finish(&workers[i], jobs, wstatus);
+			running--;
+			break;
+		}
+
+		// print in manifest order, so that results of different builds can be diffed
+		for (; printed < njobs && jobs[printed].done; printed++) {
+			job_print(&jobs[printed]);
+			count[jobs[printed].res.status]++;
+		}
+		fflush(stdout);
+	}
+
+	printf("%i jobs in %.1f s: %i ok, %i error, %i crash, %i timeout\n", njobs,
+		(double)(pprof_get_one() - start) / 1000000000.0,
+		count[JOB_OK], count[JOB_ERROR], count[JOB_CRASH], count[JOB_TIMEOUT]);
+
+	for (i = 0; i < njobs; i++) {
+		free(jobs[i].rom);
+		free(jobs[i].state);
+		free(jobs[i].movie);
+	}
+	free(jobs);
+	free(workers);
+
+	return (printed < njobs || count[JOB_OK] != njobs) ? 1 : 0;
+}
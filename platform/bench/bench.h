@@ -0,0 +1,16 @@
+// headless benchmark port
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+extern void *bench_screen;
+extern char romFileName[];
+
+// main.c
+int  bench_load(void);
+void bench_run(int frames);
+
+// batch.c
+int  bench_batch(const char *manifest, int frames, int jobs, int timeout);
+
+#endif
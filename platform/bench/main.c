@@ -0,0 +1,346 @@
+// headless benchmark frontend: runs a number of frames as fast as possible
+// and reports time spent in each emulated subsystem.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <malloc.h>
+#include <linux/limits.h>
+
+#include "../common/emu.h"
+#include "../common/menu.h"
+#include "../common/lprintf.h"
+#include "../common/render_thread.h"
+#include "../common/rewind.h"
+#include "../gp2x/version.h"
+#include "bench.h"
+
+#include <Pico/PicoInt.h>
+
+char romFileName[PATH_MAX];
+char menuErrorMsg[64];
+char *homePath = NULL;
+char **g_argv;
+
+void *bench_screen; // only used for OSD text by common code
+unsigned char *PicoDraw2FB = NULL;  // buffer for alt renderer
+
+static short __attribute__((aligned(4))) sndBuffer[2*44100/50];
+static unsigned int scan_buffer[320];
+static int verbose = 0;
+
+// emu settings from the command line, applied after every ROM load
+static int opt_set = 0, opt_clr = 0, sound = 1, rate = 44100, color = 1, skip = 0, rthread = 0;
+static int rewind_kb = 0, rewind_interval = 1, runahead = 0;
+static pprof_t rewind_time;
+
+
+void lprintf(const char *fmt, ...)
+{
+	va_list vl;
+
+	if (!verbose) return;
+
+	va_start(vl, fmt);
+	vfprintf(stderr, fmt, vl);
+	va_end(vl);
+}
+
+/* stuff common/emu.c wants from us */
+void emu_noticeMsgUpdated(void)
+{
+}
+
+void emu_getMainDir(char *dst, int len)
+{
+	int j;
+
+	strncpy(dst, g_argv[0], len);
+	len -= 32; // reserve
+	if (len < 0) len = 0;
+	dst[len] = 0;
+	for (j = strlen(dst); j > 0; j--)
+		if (dst[j] == '/') { dst[j+1] = 0; break; }
+}
+
+void emu_setDefaultConfig(void)
+{
+	memset(&currentConfig, 0, sizeof(currentConfig));
+	currentConfig.EmuOpt  = 0;
+	currentConfig.PicoOpt = 0x0f | 0xc00; // | cd_pcm, cd_cdda (external_ym2612 only with -ymthread)
+	currentConfig.PsndRate = 44100;
+	currentConfig.PicoRegion = 0; // auto
+	currentConfig.PicoAutoRgnOrder = 0x184; // US, EU, JP
+	currentConfig.Frameskip = 0;
+	currentConfig.PicoCDBuffers = 64;
+}
+
+void menu_romload_prepare(const char *rom_name)
+{
+}
+
+void menu_romload_end(void)
+{
+}
+
+/* no mp3 decoder here, CDDA tracks stay silent */
+int mp3_get_bitrate(FILE *f, int size)
+{
+	return 128;
+}
+
+void mp3_start_play(FILE *f, int pos)
+{
+}
+
+int mp3_get_offset(void)
+{
+	return 0;
+}
+
+void mp3_update(int *buffer, int length, int stereo)
+{
+}
+
+/* null sinks */
+static int EmuScanNull(unsigned int num, void *sdata)
+{
+	DrawLineDest = scan_buffer;
+	return 0;
+}
+
+static void updateSoundNull(int len)
+{
+}
+
+
+/* load romFileName and set up the emu to run it */
+int bench_load(void)
+{
+	if (!emu_ReloadRom())
+		return 0;
+
+	// config might have been (re)loaded by emu_ReloadRom(), force our options again
+	PicoOpt = (currentConfig.PicoOpt | opt_set) & ~opt_clr;
+	PsndRate = rate;
+
+	PicoDrawSetColorFormat(color);
+	PicoScan = EmuScanNull;
+	DrawLineDest = scan_buffer;
+
+	if (sound) {
+		PsndRerate(0);
+		PsndOut = sndBuffer;
+		PicoWriteSound = updateSoundNull;
+	} else {
+		PsndOut = NULL;
+		PicoWriteSound = NULL;
+	}
+
+	if (PicoMCD & 1) PicoCDBufferInit();
+
+	if (rthread && render_thread_start() != 0)
+		fprintf(stderr, "can't start render thread, drawing on emu thread\n");
+
+	if (rewind_kb && rewind_init(rewind_kb, rewind_interval) != 0)
+		fprintf(stderr, "can't allocate rewind buffer\n");
+	rewind_reset();
+
+	PicoSkipFrame = skip;
+	Pico.m.dirtyPal = 1;
+
+	return 1;
+}
+
+void bench_run(int frames)
+{
+	int i;
+
+	for (i = 0; i < frames; i++)
+	{
+		if (movie_data) emu_updateMovie();
+		if (runahead) emu_runAheadFrame(runahead);
+		else PicoFrame();
+		if (rewind_kb) {
+			pprof_t t = pprof_get_one();
+			rewind_capture();
+			rewind_time += pprof_get_one() - t;
+		}
+	}
+
+	render_thread_sync();
+}
+
+
+static void usage(const char *argv0)
+{
+	printf("PicoDrive benchmark v" VERSION "\n");
+	printf("usage: %s [options] <romfile>\n", argv0);
+	printf( "options:\n"
+		"-frames <n>   number of frames to emulate (default 1000)\n"
+		"-alt          use the fast (full frame) renderer\n"
+		"-d2threads <n> alt renderer: draw in n bands on n threads (if built with draw2_threads)\n"
+		"-accurate     force accurate timing (H-ints)\n"
+		"-sync         MCD: better sync (main/sub 68k in lockstep)\n"
+		"-cdthread     MCD, -sync: run sub 68k on a separate thread (if built with s68k_thread)\n"
+		"-perline      accurate mode: run CPUs line by line (if built with event_sched)\n"
+		"-noidle       don't skip 68k wait loops (PicoOpt 0x40000)\n"
+		"-nodrc        run 68k with famec only, no translated code (PicoOpt 0x80000)\n"
+		"-nozdrc       run z80 with cz80 only, no translated code (PicoOpt 0x100000)\n"
+		"-skip         don't render, only emulate (PicoSkipFrame)\n"
+		"-rthread      draw on a separate thread, while the next frame is emulated\n"
+		"-nosound      don't render sound\n"
+		"-mono         render mono sound\n"
+		"-ymthread     render FM on a separate thread (if built with ym2612_thread)\n"
+		"-rate <hz>    sound rate (default 44100)\n"
+		"-color <n>    renderer output: 0=BGR444, 1=RGB555, 2=8bit, 3=RGB565, 4=XRGB8888 (default 1)\n"
+		"-rewind <kb>  capture states to a rewind ring of this size\n"
+		"-rwint <n>    ..every n frames (default 1)\n"
+		"-runahead <n> draw every frame from n frames ahead, then go back (state save/load)\n"
+		"-config <f>   load this config file before applying the options above\n"
+		"-batch <f>    run jobs from manifest file instead of a single ROM, one job per line:\n"
+		"              <rom>[<TAB><savestate>[<TAB><movie>[<TAB><frames>]]], '-' for none\n"
+		"-jobs <n>     number of batch workers (default: number of CPUs)\n"
+		"-timeout <s>  kill a batch job after this many seconds (default 120, 0 = never)\n"
+		"-v            print emu core messages\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int x, frames = 1000, jobs = 0, timeout = 120, ret;
+	char *batch = NULL;
+	pprof_t start, total;
+	double secs;
+
+	g_argv = argv;
+	PicoConfigFile = "";
+
+	// FAME and cz80 keep host pointers in 32bit fields, so on 64bit hosts
+	// everything must be allocated from the (low) brk heap, see Makefile
+	mallopt(M_MMAP_MAX, 0);
+	romFileName[0] = 0;
+
+	for (x = 1; x < argc; x++)
+	{
+		if (argv[x][0] != '-') {
+			strncpy(romFileName, argv[x], PATH_MAX);
+			romFileName[PATH_MAX-1] = 0;
+			continue;
+		}
+		if      (strcasecmp(argv[x], "-frames") == 0 && x+1 < argc)
+			frames = atoi(argv[++x]);
+		else if (strcasecmp(argv[x], "-alt") == 0)      opt_set |= 0x10;
+		else if (strcasecmp(argv[x], "-d2threads") == 0 && x+1 < argc)
+			PicoDraw2Threads = atoi(argv[++x]);
+		else if (strcasecmp(argv[x], "-accurate") == 0) opt_set |= 0x40;
+		else if (strcasecmp(argv[x], "-sync") == 0)     opt_set |= 0x2000;
+		else if (strcasecmp(argv[x], "-cdthread") == 0) opt_set |= 0x200000;
+		else if (strcasecmp(argv[x], "-perline") == 0)  opt_set |= 0x20000;
+		else if (strcasecmp(argv[x], "-noidle") == 0)   opt_set |= 0x40000;
+		else if (strcasecmp(argv[x], "-nodrc") == 0)    opt_set |= 0x80000;
+		else if (strcasecmp(argv[x], "-nozdrc") == 0)   opt_set |= 0x100000;
+		else if (strcasecmp(argv[x], "-skip") == 0)     skip = 1;
+		else if (strcasecmp(argv[x], "-rthread") == 0)  rthread = 1;
+		else if (strcasecmp(argv[x], "-nosound") == 0)  sound = 0;
+		else if (strcasecmp(argv[x], "-mono") == 0)     opt_clr |= 8;
+		else if (strcasecmp(argv[x], "-ymthread") == 0) opt_set |= 0x200;
+		else if (strcasecmp(argv[x], "-rate") == 0 && x+1 < argc)
+			rate = atoi(argv[++x]);
+		else if (strcasecmp(argv[x], "-color") == 0 && x+1 < argc)
+			color = atoi(argv[++x]);
+		else if (strcasecmp(argv[x], "-rewind") == 0 && x+1 < argc)
+			rewind_kb = atoi(argv[++x]);
+		else if (strcasecmp(argv[x], "-rwint") == 0 && x+1 < argc)
+			rewind_interval = atoi(argv[++x]);
+		else if (strcasecmp(argv[x], "-runahead") == 0 && x+1 < argc)
+			runahead = atoi(argv[++x]);
+		else if (strcasecmp(argv[x], "-config") == 0 && x+1 < argc)
+			PicoConfigFile = argv[++x];
+		else if (strcasecmp(argv[x], "-batch") == 0 && x+1 < argc)
+			batch = argv[++x];
+		else if (strcasecmp(argv[x], "-jobs") == 0 && x+1 < argc)
+			jobs = atoi(argv[++x]);
+		else if (strcasecmp(argv[x], "-timeout") == 0 && x+1 < argc)
+			timeout = atoi(argv[++x]);
+		else if (strcasecmp(argv[x], "-v") == 0)        verbose = 1;
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((romFileName[0] == 0 && batch == NULL) || frames <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	emu_setDefaultConfig();
+	emu_ReadConfig(0, 1);
+	currentConfig.PicoOpt |=  opt_set;
+	currentConfig.PicoOpt &= ~opt_clr;
+	currentConfig.PsndRate = rate;
+	currentConfig.EmuOpt &= ~1; // never touch SRAM files
+	PicoOpt = currentConfig.PicoOpt;
+	PsndRate = currentConfig.PsndRate;
+
+	homePath = getenv("HOME");
+	if (homePath) {
+		char *p = malloc(PATH_MAX);
+		snprintf(p, PATH_MAX, "%s/.picodrive/", homePath);
+		homePath = p;
+	}
+
+	PicoDraw2FB = malloc((8+320)*(8+240+8));
+	bench_screen = calloc(1, 320*240*2);
+	if (PicoDraw2FB == NULL || bench_screen == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	PicoInit();
+
+	if (batch != NULL) {
+		// build the ym2612 tables now, so that workers inherit them
+		PsndRerate(0);
+		ret = bench_batch(batch, frames, jobs, timeout);
+		goto out;
+	}
+
+	if (!bench_load()) {
+		fprintf(stderr, "failed to load %s: %s\n", romFileName, menuErrorMsg);
+		return 1;
+	}
+
+	pprof_clear();
+
+	start = pprof_get_one();
+	bench_run(frames);
+	total = pprof_get_one() - start;
+
+	if (PicoMCD & 1) PicoCDBufferFree();
+
+	secs = (double)total / 1000000000.0;
+	printf("%s: %i frames (%s, %s) in %.3f s, %.2f fps\n", romFileName, frames,
+		(PicoMCD & 1) ? "MCD" : "MD", Pico.m.pal ? "PAL" : "NTSC",
+		secs, secs > 0 ? frames / secs : 0.0);
+	pprof_print(stdout, total, frames);
+	if (rewind_kb) {
+		int captures, bytes;
+		rewind_stats(&captures, &bytes);
+		printf("rewind: %i captures (%.1f s) in %i KB, %.1f us per frame\n",
+			captures, (double)captures * rewind_interval / (Pico.m.pal ? 50 : 60),
+			bytes / 1024, (double)rewind_time / 1000.0 / frames);
+	}
+	ret = 0;
+
+out:
+	render_thread_stop();
+	rewind_free();
+	PicoExit();
+	free(bench_screen);
+	free(PicoDraw2FB);
+
+	return ret;
+}
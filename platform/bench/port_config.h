@@ -0,0 +1,27 @@
+// port specific settings
+
+#ifndef PORT_CONFIG_H
+#define PORT_CONFIG_H
+
+#define NO_SYNC
+
+#define CASE_SENSITIVE_FS 1 // CS filesystem
+#define DONT_OPEN_MANY_FILES 0
+#define REDUCE_IO_CALLS 0
+
+// draw.c
+#define OVERRIDE_HIGHCOL 0
+
+// draw2.c
+#define START_ROW  0 // which row of tiles to start rendering at?
+#define END_ROW   28 // ..end
+
+// pico.c
+#define CAN_HANDLE_240_LINES	1
+
+// logging emu events
+#define EL_LOGMASK (EL_STATUS|EL_ANOMALY)
+
+#define dprintf(x...)
+
+#endif //PORT_CONFIG_H
@@ -0,0 +1,64 @@
+// simple profiler for the Pico library hot paths
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pprof.h"
+
+pprof_t pp_counters[pp_all_points];
+pprof_t pp_start[pp_all_points];
+
+static const char *pp_names[pp_total_points] = {
+  "m68k",
+  "s68k",
+  "z80",
+  "draw",
+  "sound",
+  "cd",
+};
+
+pprof_t pprof_get_one(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (pprof_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void pprof_clear(void)
+{
+  memset(pp_counters, 0, sizeof(pp_counters));
+}
+
+void pprof_print(FILE *f, pprof_t total, int frames)
+{
+  pprof_t rest = total, c, ps, ps_m68k, ps_s68k;
+  int i;
+
+  if (total == 0) total = 1;
+  if (frames == 0) frames = 1;
+
+  // better sync lines go to the CPUs like the sampled ones did
+  ps = pp_counters[pp_ps];
+  ps_m68k = pp_counters[pp_ps_m68k];
+  ps_s68k = pp_counters[pp_ps_s68k];
+  if (ps_m68k + ps_s68k != 0) {
+    c = (pprof_t)((double)ps * ps_m68k / (ps_m68k + ps_s68k));
+    ps_m68k += c;
+    ps_s68k += ps - c;
+  }
+  else ps_s68k += ps;
+
+  fprintf(f, "   point       ms  us/frame      %%\n");
+  for (i = 0; i < pp_total_points; i++)
+  {
+    c = pp_counters[i];
+    if (i == pp_m68k) c += ps_m68k;
+    if (i == pp_s68k) c += ps_s68k;
+    rest -= c < rest ? c : rest;
+    fprintf(f, "%8s %8llu %9llu %6.2f\n", pp_names[i], c / 1000000,
+      c / 1000 / frames, (double)c * 100.0 / total);
+  }
+  fprintf(f, "%8s %8llu %9llu %6.2f\n", "other", rest / 1000000,
+    rest / 1000 / frames, (double)rest * 100.0 / total);
+}
@@ -0,0 +1,48 @@
+// simple profiler for the Pico library hot paths
+
+// Enabled by -DPPROF, the emu core calls pprof_start()/pprof_end() around
+// CPU runs, rendering, sound and CD code. Points do not nest with themselves,
+// so a single start stamp per point is enough.
+
+#ifndef PPROF_H
+#define PPROF_H
+
+enum pprof_points {
+  pp_m68k,  // main 68k runs (including memory handlers and VDP access)
+  pp_s68k,  // sub 68k runs (MCD, also main 68k in "better sync" mode)
+  pp_z80,   // z80 runs
+  pp_draw,  // PicoLine() and PicoFrameFull()
+  pp_sound, // PsndRender()
+  pp_cd,    // MCD chip updates: CDC/CDD, timers, gfx, CD DMA
+  pp_total_points,
+  // MCD better sync mode, added to m68k and s68k when printed
+  pp_ps = pp_total_points, // lines which were timed as a whole
+  pp_ps_m68k,               // turns of each CPU in pprof_sampled() lines
+  pp_ps_s68k,
+  pp_all_points
+};
+
+// In better sync mode the two 68ks take turns every ~24 cycles, which takes
+// less than reading the clock. So the turns are only timed in every 32nd line
+// (line + frame number, so that it's not always the same lines), other lines
+// are timed as a whole and divided between the CPUs the same way.
+#define pprof_sampled(n) (((n) & 31) == 0)
+
+typedef unsigned long long pprof_t;
+
+extern pprof_t pp_counters[pp_all_points];
+extern pprof_t pp_start[pp_all_points];
+
+// nanoseconds, monotonic
+pprof_t pprof_get_one(void);
+
+#define pprof_start(point) \
+  pp_start[pp_##point] = pprof_get_one()
+
+#define pprof_end(point) \
+  pp_counters[pp_##point] += pprof_get_one() - pp_start[pp_##point]
+
+void pprof_clear(void);
+void pprof_print(FILE *f, pprof_t total, int frames);
+
+#endif // PPROF_H
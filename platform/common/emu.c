@@ -14,6 +14,9 @@
 #include "menu.h"
 #include "fonts.h"
 #include "lprintf.h"
+#ifdef SAVE_THREAD
+#include "save_thread.h"
+#endif
 
 #include <Pico/PicoInt.h>
 #include <Pico/Patch.h>
@@ -198,6 +201,75 @@ int emu_cdCheck(int *pregion)
 	return type;
 }
 
+static int movie_load(const char *fname)
+{
+	FILE *movie_file;
+
+	if(movie_data) {
+		free(movie_data);
+		movie_data = 0;
+	}
+
+	movie_file = fopen(fname, "rb");
+	if(!movie_file) {
+		sprintf(menuErrorMsg, "Failed to open movie.");
+		return 0;
+	}
+	fseek(movie_file, 0, SEEK_END);
+	movie_size = ftell(movie_file);
+	fseek(movie_file, 0, SEEK_SET);
+	if(movie_size < 64+3) {
+		sprintf(menuErrorMsg, "Invalid GMV file.");
+		fclose(movie_file);
+		return 0;
+	}
+	movie_data = malloc(movie_size);
+	if(movie_data == NULL) {
+		sprintf(menuErrorMsg, "low memory.");
+		fclose(movie_file);
+		return 0;
+	}
+	fread(movie_data, 1, movie_size, movie_file);
+	fclose(movie_file);
+	if (strncmp((char *)movie_data, "Gens Movie TEST", 15) != 0) {
+		sprintf(menuErrorMsg, "Invalid GMV file.");
+		free(movie_data);
+		movie_data = 0;
+		return 0;
+	}
+	return 1;
+}
+
+// apply movie settings, must be done after ROM is inserted
+static void movie_setup(void)
+{
+	if(movie_data[0x14] == '6')
+	     PicoOpt |=  0x20; // 6 button pad
+	else PicoOpt &= ~0x20;
+	PicoOpt |= 0x10040; // accurate timing, no VDP fifo timing
+	if(movie_data[0xF] >= 'A') {
+		if(movie_data[0x16] & 0x80) {
+			PicoRegionOverride = 8;
+		} else {
+			PicoRegionOverride = 4;
+		}
+		PicoReset(0);
+		// TODO: bits 6 & 5
+	}
+	movie_data[0x18+30] = 0;
+	sprintf(noticeMsg, "MOVIE: %s", (char *) &movie_data[0x18]);
+}
+
+/* play a movie on currently loaded ROM (emu_ReloadRom() takes care of .gmv files itself) */
+int emu_loadMovie(const char *fname)
+{
+	if (!movie_load(fname))
+		return 0;
+	movie_setup();
+	emu_noticeMsgUpdated();
+	return 1;
+}
+
 int emu_ReloadRom(void)
 {
 	unsigned int rom_size = 0;
@@ -226,31 +298,8 @@ int emu_ReloadRom(void)
 	if(!strcmp(ext, ".gmv")) {
 		// check for both gmv and rom
 		int dummy;
-		FILE *movie_file = fopen(romFileName, "rb");
-		if(!movie_file) {
-			sprintf(menuErrorMsg, "Failed to open movie.");
-			return 0;
-		}
-		fseek(movie_file, 0, SEEK_END);
-		movie_size = ftell(movie_file);
-		fseek(movie_file, 0, SEEK_SET);
-		if(movie_size < 64+3) {
-			sprintf(menuErrorMsg, "Invalid GMV file.");
-			fclose(movie_file);
-			return 0;
-		}
-		movie_data = malloc(movie_size);
-		if(movie_data == NULL) {
-			sprintf(menuErrorMsg, "low memory.");
-			fclose(movie_file);
+		if (!movie_load(romFileName))
 			return 0;
-		}
-		fread(movie_data, 1, movie_size, movie_file);
-		fclose(movie_file);
-		if (strncmp((char *)movie_data, "Gens Movie TEST", 15) != 0) {
-			sprintf(menuErrorMsg, "Invalid GMV file.");
-			return 0;
-		}
 		dummy = try_rfn_cut() || try_rfn_cut();
 		if (!dummy) {
 			sprintf(menuErrorMsg, "Could't find a ROM for movie.");
@@ -375,23 +424,8 @@ int emu_ReloadRom(void)
 	}
 
 	// additional movie stuff
-	if (movie_data) {
-		if(movie_data[0x14] == '6')
-		     PicoOpt |=  0x20; // 6 button pad
-		else PicoOpt &= ~0x20;
-		PicoOpt |= 0x10040; // accurate timing, no VDP fifo timing
-		if(movie_data[0xF] >= 'A') {
-			if(movie_data[0x16] & 0x80) {
-				PicoRegionOverride = 8;
-			} else {
-				PicoRegionOverride = 4;
-			}
-			PicoReset(0);
-			// TODO: bits 6 & 5
-		}
-		movie_data[0x18+30] = 0;
-		sprintf(noticeMsg, "MOVIE: %s", (char *) &movie_data[0x18]);
-	}
+	if (movie_data)
+		movie_setup();
 	else
 	{
 		PicoOpt &= ~0x10000;
@@ -618,6 +652,56 @@ void emu_updateMovie(void)
 }
 
 
+// run-ahead: the real frame is emulated without drawing, then the game is run
+// 'frames' frames further with the same PicoPad and only the last one is drawn.
+// Afterwards the state is put back, so input shows up that many frames sooner.
+// The frames run ahead are never heard, sound only comes from the real one.
+void emu_runAheadFrame(int frames)
+{
+	static void *state = NULL;
+	static size_t state_size = 0;
+	short *snd = PsndOut;
+	int i;
+#ifdef YM2612_THREAD
+	int ym_thread = PicoOpt & 0x200;
+#endif
+
+	if (frames > 0 && state_size != PicoStateSize()) {
+		free(state);
+		state_size = PicoStateSize();
+		state = malloc(state_size);
+		if (state == NULL) {
+			lprintf("run-ahead: out of memory\n");
+			state_size = 0;
+		}
+	}
+	if (frames <= 0 || state == NULL) {
+		PicoFrame();
+		return;
+	}
+
+	PicoSkipFrame = 1;
+	PicoFrame();
+	PicoStateSave(state, state_size);
+
+	// FM worker must not see any of this, our own chip is restored with the state
+#ifdef YM2612_THREAD
+	PicoOpt &= ~0x200;
+#endif
+	PsndOut = NULL;
+	for (i = 1; i < frames; i++)
+		PicoFrame();
+	PicoSkipFrame = 0;
+	PicoFrame();
+
+	PicoStateLoad(state, state_size);
+	PsndOut = snd;
+#ifdef YM2612_THREAD
+	PicoOpt |= ym_thread;
+#endif
+}
+
+
 static size_t gzRead2(void *p, size_t _size, size_t _n, void *file)
 {
 	return gzread(file, p, _n);
@@ -629,6 +713,72 @@ static size_t gzWrite2(void *p, size_t _size, size_t _n, void *file)
 	return gzwrite(file, p, _n);
 }
 
+#ifdef SAVE_THREAD
+// savestates are made in memory, save_thread compresses and writes them
+struct mem_file {
+	unsigned char *data;
+	int size, alloc, failed;
+};
+
+static size_t memWrite2(void *p, size_t _size, size_t _n, void *file)
+{
+	struct mem_file *f = file;
+
+	if (f->size + _n > f->alloc) {
+		int alloc = f->alloc * 2;
+		void *tmp;
+		if (alloc < f->size + _n) alloc = f->size + _n;
+		tmp = realloc(f->data, alloc);
+		if (tmp == NULL) { f->failed = 1; return 0; }
+		f->data = tmp;
+		f->alloc = alloc;
+	}
+	memcpy(f->data + f->size, p, _n);
+	f->size += _n;
+	return _n;
+}
+
+static int save_state_async(const char *saveFname)
+{
+	struct mem_file f = { NULL, 0, 0x40000, 0 };
+	int ret = -1, flags = SAVE_NOTIFY;
+
+	if (strcmp(saveFname + strlen(saveFname) - 3, ".gz") == 0)
+		flags |= SAVE_GZIP;
+
+	areaWrite = memWrite2;
+	f.data = malloc(f.alloc);
+	if (f.data != NULL && PmovState(5, &f) == 0 && !f.failed)
+		ret = save_thread_write(saveFname, f.data, f.size, flags); // it frees the data
+	else free(f.data);
+
+	// success is reported by emu_pollSaveWrites() once it's on disk
+	if (ret) {
+		strcpy(noticeMsg, "SAVE FAILED  ");
+		emu_noticeMsgUpdated();
+	}
+	return ret;
+}
+#endif
+
+void emu_pollSaveWrites(void)
+{
+#ifdef SAVE_THREAD
+	int ret = save_thread_poll();
+	if (ret == 0) return;
+
+	strcpy(noticeMsg, ret > 0 ? "GAME SAVED   " : "SAVE FAILED  ");
+	emu_noticeMsgUpdated();
+#endif
+}
+
+void emu_waitSaveWrites(void)
+{
+#ifdef SAVE_THREAD
+	save_thread_sync();
+#endif
+}
+
 static int try_ropen_file(const char *fname)
 {
 	FILE *f;
@@ -646,6 +796,9 @@ char *emu_GetSaveFName(int load, int is_sram, int slot)
 	static char saveFname[512];
 	char ext[16];
 
+#ifdef SAVE_THREAD
+	if (load) save_thread_sync(); // it might be still writing this one
+#endif
 	if (is_sram)
 	{
 		romfname_ext(saveFname, (PicoMCD&1) ? brmPath : srmPath, (PicoMCD&1) ? ".brm" : ".srm");
@@ -762,6 +915,12 @@ int emu_SaveLoadGame(int load, int sram)
 				if (sram_data[sram_size-1]) break;
 
 			if (sram_size) {
+#ifdef SAVE_THREAD
+				void *copy = malloc(sram_size);
+				if (!copy) return -1;
+				memcpy(copy, sram_data, sram_size);
+				ret = save_thread_write(saveFname, copy, sram_size, truncate ? 0 : SAVE_UPDATE);
+#else
 				sramFile = fopen(saveFname, truncate ? "wb" : "r+b");
 				if (!sramFile) sramFile = fopen(saveFname, "wb"); // retry
 				if (!sramFile) return -1;
@@ -770,6 +929,7 @@ int emu_SaveLoadGame(int load, int sram)
 				fclose(sramFile);
 #ifndef NO_SYNC
 				sync();
+#endif
 #endif
 			}
 		}
@@ -778,6 +938,9 @@ int emu_SaveLoadGame(int load, int sram)
 	else
 	{
 		void *PmovFile = NULL;
+#ifdef SAVE_THREAD
+		if (!load) return save_state_async(saveFname);
+#endif
 		if (strcmp(saveFname + strlen(saveFname) - 3, ".gz") == 0)
 		{
 			if( (PmovFile = gzopen(saveFname, load ? "rb" : "wb")) ) {
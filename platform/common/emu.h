@@ -11,7 +11,7 @@ typedef struct {
 					// squidgehack, no_save_cfg_on_exit, <unused>, 16_bit_mode
 					// craigix_ram, confirm_save, show_cd_leds, confirm_load
 					// A_SNs_gamma, perfect_vsync, giz_scanlines, giz_dblbuff
-					// vsync_mode, show_clock, no_frame_limitter
+					// vsync_mode, show_clock, no_frame_limitter, rewind, run_ahead
 	int PicoOpt;  // used for config saving only, see Pico.h
 	int PsndRate; // ditto
 	int PicoRegion; // ditto
@@ -43,6 +43,7 @@ extern char *mdsPath;
 extern char *srmPath;
 
 int   emu_ReloadRom(void);
+int   emu_loadMovie(const char *fname);
 int   emu_SaveLoadGame(int load, int sram);
 int   emu_ReadConfig(int game, int no_defaults);
 int   emu_WriteConfig(int game);
@@ -50,6 +51,9 @@ char *emu_GetSaveFName(int load, int is_sram, int slot);
 int   emu_checkSaveFile(int slot);
 void  emu_setSaveStateCbs(int gz);
 void  emu_updateMovie(void);
+void  emu_runAheadFrame(int frames);
+void  emu_pollSaveWrites(void); // call every frame, posts noticeMsg when a background save is done
+void  emu_waitSaveWrites(void); // before exit
 int   emu_cdCheck(int *pregion);
 int   emu_findBios(int region, char **bios_file);
 void  emu_textOut8 (int x, int y, const char *text);
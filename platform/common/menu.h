@@ -65,6 +65,8 @@ typedef enum
 	MA_OPT2_SQUIDGEHACK,	/* gp2x */
 	MA_OPT2_STATUS_LINE,	/* psp */
 	MA_OPT2_NO_FRAME_LIMIT,	/* psp */
+	MA_OPT2_REWIND,		/* gp2x, sdl */
+	MA_OPT2_RUNAHEAD,	/* gp2x, sdl */
 	MA_OPT2_DONE,
 	MA_OPT3_SCALE,		/* psp (all OPT3) */
 	MA_OPT3_HSCALE32,
@@ -13,6 +13,10 @@
     #include "../gizmondo/giz.h"
     #define SCREEN_WIDTH 321
     #define SCREEN_BUFFER giz_screen
+#elif defined(__BENCH__)
+    #include "../bench/bench.h"
+    #define SCREEN_WIDTH 320
+    #define SCREEN_BUFFER bench_screen
 #elif defined(PSP)
     #include "../psp/psp.h"
     #define SCREEN_WIDTH 512
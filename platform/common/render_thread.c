@@ -0,0 +1,138 @@
+// Render thread for pipelined drawing (see PicoDrawLogGet in Pico.h).
+// The emu thread records frame N+1 into one log while this thread replays
+// frame N from the other one, so rendering is off the emulation's critical path.
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "../../Pico/Pico.h"
+#include "render_thread.h"
+#include "lprintf.h"
+
+#define LOG_COUNT 2
+
+enum { LOG_FREE = 0, LOG_RECORDING, LOG_QUEUED };
+
+static struct PicoDrawLog *logs[LOG_COUNT];
+static int log_state[LOG_COUNT];
+static int rec_pos, draw_pos; // next log to record / to replay
+static int quit;
+
+static pthread_t rthread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cond = PTHREAD_COND_INITIALIZER;
+static int running = 0;
+
+
+static struct PicoDrawLog *log_get(void)
+{
+	struct PicoDrawLog *log;
+
+	pthread_mutex_lock(&lock);
+	while (log_state[rec_pos] != LOG_FREE)
+		pthread_cond_wait(&cond, &lock);
+	log_state[rec_pos] = LOG_RECORDING;
+	log = logs[rec_pos];
+	pthread_mutex_unlock(&lock);
+
+	return log;
+}
+
+static void log_put(struct PicoDrawLog *log)
+{
+	pthread_mutex_lock(&lock);
+	log_state[rec_pos] = LOG_QUEUED;
+	rec_pos = (rec_pos + 1) % LOG_COUNT;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+static void *render_thread(void *arg)
+{
+	pthread_mutex_lock(&lock);
+	for (;;)
+	{
+		while (log_state[draw_pos] != LOG_QUEUED && !quit)
+			pthread_cond_wait(&cond, &lock);
+		if (log_state[draw_pos] != LOG_QUEUED)
+			break;
+		pthread_mutex_unlock(&lock);
+
+		PicoDrawLogReplay(logs[draw_pos]);
+
+		pthread_mutex_lock(&lock);
+		log_state[draw_pos] = LOG_FREE;
+		draw_pos = (draw_pos + 1) % LOG_COUNT;
+		pthread_cond_broadcast(&cond);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+int render_thread_start(void)
+{
+	int i;
+
+	if (running) return 0;
+
+	for (i = 0; i < LOG_COUNT; i++) {
+		logs[i] = PicoDrawLogNew();
+		if (logs[i] == NULL) goto fail;
+		log_state[i] = LOG_FREE;
+	}
+	rec_pos = draw_pos = 0;
+	quit = 0;
+
+	if (pthread_create(&rthread, NULL, render_thread, NULL) != 0) {
+		lprintf("failed to create render thread\n");
+		goto fail;
+	}
+
+	PicoDrawLogPut = log_put;
+	PicoDrawLogGet = log_get;
+	running = 1;
+	return 0;
+
+fail:
+	for (i = 0; i < LOG_COUNT; i++) {
+		PicoDrawLogFree(logs[i]);
+		logs[i] = NULL;
+	}
+	return -1;
+}
+
+void render_thread_sync(void)
+{
+	int i;
+
+	if (!running) return;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < LOG_COUNT; i++)
+		while (log_state[i] == LOG_QUEUED)
+			pthread_cond_wait(&cond, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+void render_thread_stop(void)
+{
+	int i;
+
+	if (!running) return;
+
+	PicoDrawLogGet = NULL;
+	PicoDrawLogPut = NULL;
+
+	pthread_mutex_lock(&lock);
+	quit = 1;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+	pthread_join(rthread, NULL); // queued logs are still drawn
+
+	for (i = 0; i < LOG_COUNT; i++) {
+		PicoDrawLogFree(logs[i]);
+		logs[i] = NULL;
+	}
+	running = 0;
+}
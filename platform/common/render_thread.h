@@ -0,0 +1,6 @@
+// pipelined drawing: PicoFrame() only records VDP changes, a thread draws them
+// while the next frame is emulated. PicoScan is called from that thread.
+
+int  render_thread_start(void);
+void render_thread_sync(void); // wait until all recorded frames are drawn
+void render_thread_stop(void);
@@ -0,0 +1,212 @@
+// Rewind ring. The state is taken with PicoStateSave() and only the newest
+// one is kept whole, each ring entry is what has to be XORed into the state
+// captured after it to get the one before. So stepping back just applies the
+// newest entry and drops it, and when the ring is full the oldest entries
+// are dropped without touching anything else.
+// Deltas are done in 4K blocks: unchanged ones are skipped with memcmp(),
+// changed ones are stored as runs of (zero XOR word count, XOR words).
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../Pico/Pico.h"
+#include "rewind.h"
+#include "lprintf.h"
+
+#define BLOCK_WORDS 1024 // 4K
+#define DELTA_END   0xffffffff
+
+struct rw_entry { unsigned int offs, len; }; // in words
+
+static unsigned int *state_cur, *state_new; // last captured state, buffer for the next one
+static unsigned int state_size, state_words; // PicoStateSize(), words rounded up to blocks
+static unsigned int *delta;                  // worst case sized
+static unsigned int *ring, ring_words, ring_head; // ring_head: where next entry goes
+static struct rw_entry *entries;
+static int entry_max, entry_first, entry_count;
+static int capture_interval, frames_since, have_state;
+
+#define ENTRY(i) entries[(entry_first + (i)) % entry_max]
+
+
+// XOR delta which turns b into a, returns it's length in words
+static unsigned int delta_make(unsigned int *d, const unsigned int *a, const unsigned int *b)
+{
+	unsigned int *p = d, blk, end, i, *run, zeros, words;
+
+	for (blk = 0; blk < state_words; blk += BLOCK_WORDS)
+	{
+		if (memcmp(a + blk, b + blk, BLOCK_WORDS*4) == 0) continue;
+
+		*p++ = blk;
+		for (i = blk, end = blk + BLOCK_WORDS; i < end; )
+		{
+			run = p++;
+			for (zeros = 0; i < end && a[i] == b[i]; i++) zeros++;
+			for (words = 0; i < end && a[i] != b[i]; i++, words++) *p++ = a[i] ^ b[i];
+			*run = (zeros << 16) | words;
+		}
+	}
+	*p++ = DELTA_END;
+
+	return p - d;
+}
+
+static void delta_apply(unsigned int *s, const unsigned int *d)
+{
+	unsigned int blk, end, i, words;
+
+	while ((blk = *d++) != DELTA_END)
+	{
+		for (i = blk, end = blk + BLOCK_WORDS; i < end; d++)
+		{
+			i += *d >> 16;
+			for (words = *d & 0xffff; words > 0; words--)
+				s[i++] ^= *++d;
+		}
+	}
+}
+
+static void entry_drop_oldest(void)
+{
+	entry_first = (entry_first + 1) % entry_max;
+	entry_count--;
+}
+
+static void entry_add(const unsigned int *d, unsigned int len)
+{
+	if (len > ring_words) {
+		// can't go back past this one anyway
+		rewind_reset();
+		return;
+	}
+
+	if (ring_head + len > ring_words) {
+		// no room till the end, what's there is older than anything at the start
+		while (entry_count > 0 && ENTRY(0).offs >= ring_head)
+			entry_drop_oldest();
+		ring_head = 0;
+	}
+	while (entry_count > 0 && (entry_count == entry_max ||
+	       (ENTRY(0).offs < ring_head + len && ENTRY(0).offs + ENTRY(0).len > ring_head)))
+		entry_drop_oldest();
+
+	memcpy(ring + ring_head, d, len * 4);
+	ENTRY(entry_count).offs = ring_head;
+	ENTRY(entry_count).len  = len;
+	entry_count++;
+	ring_head += len;
+}
+
+static int state_alloc(void)
+{
+	unsigned int blocks;
+
+	free(state_cur); free(state_new); free(delta);
+	state_size  = PicoStateSize();
+	blocks      = (state_size + BLOCK_WORDS*4 - 1) / (BLOCK_WORDS*4);
+	state_words = blocks * BLOCK_WORDS;
+	state_cur = calloc(state_words, 4);
+	state_new = calloc(state_words, 4);
+	// block number, run per 2 words at most, the words, end mark
+	delta = malloc((blocks * (1 + BLOCK_WORDS/2 + BLOCK_WORDS) + 1) * 4);
+	if (state_cur == NULL || state_new == NULL || delta == NULL) {
+		lprintf("rewind: out of memory\n");
+		rewind_free();
+		return -1;
+	}
+	return 0;
+}
+
+int rewind_init(int size_kb, int interval)
+{
+	if (ring != NULL && ring_words == size_kb * 256 && capture_interval == interval)
+		return 0;
+
+	rewind_free();
+	ring_words = size_kb * 256;
+	entry_max = ring_words / 64 + 1; // a few K per capture is typical
+	ring = malloc(ring_words * 4);
+	entries = malloc(entry_max * sizeof(entries[0]));
+	if (ring == NULL || entries == NULL) {
+		lprintf("rewind: out of memory\n");
+		rewind_free();
+		return -1;
+	}
+	capture_interval = interval > 0 ? interval : 1;
+	rewind_reset();
+
+	return 0;
+}
+
+void rewind_free(void)
+{
+	free(ring); free(entries);
+	free(state_cur); free(state_new); free(delta);
+	ring = NULL; entries = NULL;
+	state_cur = state_new = delta = NULL;
+	state_size = 0;
+	have_state = 0;
+}
+
+void rewind_reset(void)
+{
+	entry_first = entry_count = 0;
+	ring_head = 0;
+	frames_since = 0;
+	have_state = 0;
+}
+
+void rewind_capture(void)
+{
+	unsigned int *tmp;
+
+	if (ring == NULL || ++frames_since < capture_interval) return;
+	frames_since = 0;
+
+	if (state_size != PicoStateSize()) {
+		// other game or MCD was started
+		rewind_reset();
+		if (state_alloc() != 0) return;
+	}
+
+	PicoStateSave(state_new, state_size);
+	if (have_state)
+		entry_add(delta, delta_make(delta, state_cur, state_new));
+
+	tmp = state_cur; state_cur = state_new; state_new = tmp;
+	have_state = 1;
+}
+
+int rewind_step(void)
+{
+	struct rw_entry *e;
+
+	if (!have_state) return -1;
+
+	// frames were run since the last capture: go back to it first
+	if (frames_since == 0) {
+		if (entry_count == 0) return -1;
+		e = &ENTRY(entry_count - 1);
+		delta_apply(state_cur, ring + e->offs);
+		ring_head = e->offs;
+		entry_count--;
+	}
+	frames_since = 0;
+
+	if (PicoStateLoad(state_cur, state_size) != 0) {
+		rewind_reset();
+		return -1;
+	}
+	return 0;
+}
+
+void rewind_stats(int *captures, int *bytes)
+{
+	int i, len = 0;
+
+	for (i = 0; i < entry_count; i++)
+		len += ENTRY(i).len;
+	*captures = entry_count + have_state;
+	*bytes = len * 4;
+}
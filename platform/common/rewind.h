@@ -0,0 +1,9 @@
+// rewind: the game state is captured every few frames into a ring of deltas,
+// rewind_step() then walks back through them one capture at a time.
+
+int  rewind_init(int size_kb, int interval); // ring size, capture every interval frames
+void rewind_free(void);
+void rewind_reset(void);   // forget the history (new game)
+void rewind_capture(void); // call after every emulated frame
+int  rewind_step(void);    // load an earlier state, -1 if there is none
+void rewind_stats(int *captures, int *bytes); // what is in the ring now
@@ -0,0 +1,196 @@
+// Background writer for savestates and SRAM. The emu thread only copies the
+// data to memory and queues it, this thread does the gzip, write and fsync,
+// which can take many frames on SD cards.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifndef NO_SYNC
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "../../zlib/zlib.h"
+#include "save_thread.h"
+#include "lprintf.h"
+
+#define JOB_COUNT 4
+
+struct save_job {
+	char fname[512];
+	void *data;
+	int size, flags;
+};
+
+static struct save_job jobs[JOB_COUNT];
+static int job_head, job_tail; // next free / next to write
+static int job_count;
+static int result; // of the last finished SAVE_NOTIFY job
+
+static pthread_t sthread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cond = PTHREAD_COND_INITIALIZER;
+static int running = 0;
+
+
+#ifndef NO_SYNC
+static int sync_file(const char *fname)
+{
+	int fd = open(fname, O_RDONLY), ret = -1;
+	if (fd >= 0) {
+		ret = fsync(fd);
+		close(fd);
+	}
+	return ret;
+}
+#else
+#define sync_file(fname) 0
+#endif
+
+// SAVE_UPDATE: the rest of the old file after the new data
+static int copy_tail(FILE *f, const char *fname, int offs)
+{
+	char buf[4096];
+	FILE *old = fopen(fname, "rb");
+	int ret = 0;
+	size_t n;
+
+	if (old == NULL) return 0; // nothing to keep
+	if (fseek(old, offs, SEEK_SET) == 0) {
+		while ((n = fread(buf, 1, sizeof(buf), old)) > 0)
+			if (fwrite(buf, 1, n, f) != n) { ret = -1; break; }
+	}
+	fclose(old);
+	return ret;
+}
+
+// data goes to fname.tmp, which replaces fname once it's on disk, so a crash
+// or a full disk in the middle leaves the old file as it was
+static int job_write(const struct save_job *job)
+{
+	char tmp[sizeof(job->fname) + 4];
+	int ret = -1;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", job->fname);
+
+	if (job->flags & SAVE_GZIP)
+	{
+		gzFile f = gzopen(tmp, "wb");
+		if (f != NULL) {
+			gzsetparams(f, 1, Z_DEFAULT_STRATEGY); // state chunks are compressed already
+			if (gzwrite(f, job->data, job->size) == job->size) ret = 0;
+			if (gzclose(f) != Z_OK) ret = -1;
+		}
+	}
+	else
+	{
+		FILE *f = fopen(tmp, "wb");
+		if (f != NULL) {
+			if (fwrite(job->data, 1, job->size, f) == job->size) ret = 0;
+			if (ret == 0 && (job->flags & SAVE_UPDATE))
+				ret = copy_tail(f, job->fname, job->size);
+			if (fclose(f) != 0) ret = -1;
+		}
+	}
+
+	if (ret == 0) ret = sync_file(tmp);
+	if (ret == 0) ret = rename(tmp, job->fname);
+	if (ret != 0) {
+		remove(tmp);
+		lprintf("save_thread: failed to write %s\n", job->fname);
+	}
+	return ret;
+}
+
+static void *save_thread(void *arg)
+{
+	struct save_job *job;
+	int ret;
+
+	pthread_mutex_lock(&lock);
+	for (;;)
+	{
+		while (job_count == 0)
+			pthread_cond_wait(&cond, &lock);
+		job = &jobs[job_tail];
+		pthread_mutex_unlock(&lock);
+
+		ret = job_write(job);
+		free(job->data);
+
+		pthread_mutex_lock(&lock);
+		if (job->flags & SAVE_NOTIFY)
+			result = ret == 0 ? 1 : -1;
+		job_tail = (job_tail + 1) % JOB_COUNT;
+		job_count--;
+		pthread_cond_broadcast(&cond);
+	}
+
+	return NULL;
+}
+
+int save_thread_write(const char *fname, void *data, int size, int flags)
+{
+	struct save_job *job;
+
+	if (!running) {
+		if (pthread_create(&sthread, NULL, save_thread, NULL) == 0) {
+			pthread_detach(sthread);
+			running = 1;
+		} else {
+			// write it here then
+			struct save_job tmp;
+			int ret;
+			lprintf("save_thread: failed to create thread\n");
+			strncpy(tmp.fname, fname, sizeof(tmp.fname));
+			tmp.fname[sizeof(tmp.fname)-1] = 0;
+			tmp.data = data;
+			tmp.size = size;
+			tmp.flags = flags;
+			ret = job_write(&tmp);
+			free(data);
+			if (flags & SAVE_NOTIFY)
+				result = ret == 0 ? 1 : -1;
+			return ret;
+		}
+	}
+
+	pthread_mutex_lock(&lock);
+	while (job_count == JOB_COUNT)
+		pthread_cond_wait(&cond, &lock);
+	job = &jobs[job_head];
+	strncpy(job->fname, fname, sizeof(job->fname));
+	job->fname[sizeof(job->fname)-1] = 0;
+	job->data = data;
+	job->size = size;
+	job->flags = flags;
+	job_head = (job_head + 1) % JOB_COUNT;
+	job_count++;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+int save_thread_poll(void)
+{
+	int ret;
+
+	pthread_mutex_lock(&lock);
+	ret = result;
+	result = 0;
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+void save_thread_sync(void)
+{
+	if (!running) return;
+
+	pthread_mutex_lock(&lock);
+	while (job_count > 0)
+		pthread_cond_wait(&cond, &lock);
+	pthread_mutex_unlock(&lock);
+}
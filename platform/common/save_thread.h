@@ -0,0 +1,10 @@
+// background writer: savestates and SRAM are handed over as a memory copy,
+// compression, file write and fsync happen on a separate thread.
+
+#define SAVE_GZIP   1 // gzip at level 1 (v2 state chunks are already compressed)
+#define SAVE_UPDATE 2 // replace the start of the file, keep the rest
+#define SAVE_NOTIFY 4 // report the result to save_thread_poll()
+
+int  save_thread_write(const char *fname, void *data, int size, int flags); // takes malloc'd data
+int  save_thread_poll(void); // last SAVE_NOTIFY write finished since the previous call: 1 ok, -1 failed, 0 none
+void save_thread_sync(void); // wait until everything queued is on disk
@@ -0,0 +1,328 @@
+// YM2612 on a worker thread, for multicore hosts.
+// Works like the GP2X 940 code: emu thread keeps it's own copy of the chip for
+// regs, timers and DAC, and queues all writes which affect sound. The worker
+// replays them on it's own copy (ym2612 state is per thread, see YM2612_THREAD)
+// and renders FM for a frame while the emu thread is busy with the next one.
+// So FM sound lags one frame behind, same as on GP2X.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "../../Pico/PicoInt.h"
+#include "../../Pico/sound/ym2612.h"
+
+/* queue commands, entries are (cmd<<24)|arg */
+enum {
+	YMQ_WRITE = 1,	/* (a<<8)|v */
+	YMQ_SPLIT,	/* len|(stereo<<16): rapid updates, render first part of the frame now */
+	YMQ_END,	/* len|(stereo<<16): end of frame, render the rest and publish */
+	YMQ_INIT,	/* followed by baseclock and rate words */
+	YMQ_RESET,
+	YMQ_STATELOAD,
+	YMQ_SET_A1,	/* restore address line after state load feed */
+};
+
+/* single producer (emu thread), single consumer (worker) ring */
+#define YMQ_SIZE 0x4000
+static unsigned int ymq[YMQ_SIZE];
+static volatile unsigned int ymq_head, ymq_tail;
+
+static pthread_t ym_thread;
+static int ym_thread_running = 0;
+static sem_t ym_sem_wake, ym_sem_done;
+
+/* double buffer: worker renders frame n to ym_buffer[n&1] while emu thread mixes the other one */
+static int ym_buffer[2][2*44100/50];
+static int ym_buffer_len[2], ym_buffer_stereo[2], ym_active_chs[2];
+static unsigned int ym_frames_queued = 0;	/* frame ends sent to worker */
+static int ym_jobs_pending = 0;			/* ..which we haven't waited for yet */
+
+/* emu thread side */
+static int ym_address, ym_a1;
+static int ym_split_done;
+
+
+static void ymq_push(const unsigned int *d, int count)
+{
+	int i;
+
+	while (YMQ_SIZE - (ymq_head - ymq_tail) < count) {
+		// full, let the worker drain it
+		sem_post(&ym_sem_wake);
+		sched_yield();
+	}
+
+	for (i = 0; i < count; i++)
+		ymq[(ymq_head + i) & (YMQ_SIZE-1)] = d[i];
+	__sync_synchronize();	/* entries must be visible before head moves */
+	ymq_head += count;
+
+	if (ymq_head - ymq_tail >= YMQ_SIZE/2)
+		sem_post(&ym_sem_wake);
+}
+
+static void ymq_push1(int cmd, int arg)
+{
+	unsigned int d = (cmd << 24) | arg;
+	ymq_push(&d, 1);
+}
+
+static void *ym_worker(void *arg)
+{
+	unsigned int frame = 0, d;
+	int pos = 0, len, stereo;
+	int *buf;
+
+	for (;;)
+	{
+		sem_wait(&ym_sem_wake);
+
+		while (ymq_tail != ymq_head)
+		{
+			__sync_synchronize();
+			d = ymq[ymq_tail & (YMQ_SIZE-1)];
+			len = d & 0xffff;
+			stereo = (d >> 16) & 1;
+			buf = ym_buffer[frame & 1];
+
+			switch (d >> 24)
+			{
+			case YMQ_WRITE:
+				YM2612Write_((d >> 8) & 3, d & 0xff);
+				break;
+
+			case YMQ_SPLIT:
+				ym_active_chs[frame & 1] = YM2612UpdateOne_(buf, len, stereo, 1);
+				pos = len;
+				break;
+
+			case YMQ_END:
+				if (pos > len) pos = len;
+				ym_active_chs[frame & 1] |=
+					YM2612UpdateOne_(buf + (pos << stereo), len - pos, stereo, 1);
+				ym_buffer_len[frame & 1] = len;
+				ym_buffer_stereo[frame & 1] = stereo;
+				frame++;
+				pos = 0;
+				ym_active_chs[frame & 1] = 0;
+				__sync_synchronize();
+				sem_post(&ym_sem_done);
+				break;
+
+			case YMQ_INIT: {
+				int baseclock = ymq[(ymq_tail + 1) & (YMQ_SIZE-1)];
+				int rate      = ymq[(ymq_tail + 2) & (YMQ_SIZE-1)];
+				YM2612Init_(baseclock, rate);
+				ymq_tail += 2;
+				break;
+			}
+
+			case YMQ_RESET:
+				YM2612ResetChip_();
+				break;
+
+			case YMQ_STATELOAD:
+				YM2612PicoStateLoad_();
+				break;
+
+			case YMQ_SET_A1:
+				*(INT32 *)((UINT8 *)YM2612GetRegs() + 0x200) = len;
+				break;
+			}
+
+			__sync_synchronize();	/* done with the entry before it's freed */
+			ymq_tail++;
+		}
+	}
+
+	return NULL;
+}
+
+/* fork() only keeps the calling thread, start a new worker in the child on next init */
+static void ym_atfork_child(void)
+{
+	ym_thread_running = 0;
+}
+
+static int ym_thread_start(void)
+{
+	static int atfork_done = 0;
+
+	ymq_head = ymq_tail = 0;
+	ym_frames_queued = 0;
+	ym_jobs_pending = 0;
+	memset(ym_buffer_len, 0, sizeof(ym_buffer_len));
+	sem_init(&ym_sem_wake, 0, 0);
+	sem_init(&ym_sem_done, 0, 0);
+
+	if (pthread_create(&ym_thread, NULL, ym_worker, NULL) != 0) {
+		lprintf("ym2612: failed to create worker thread\n");
+		return -1;
+	}
+	pthread_detach(ym_thread);
+
+	if (!atfork_done) {
+		pthread_atfork(NULL, NULL, ym_atfork_child);
+		atfork_done = 1;
+	}
+	ym_thread_running = 1;
+	return 0;
+}
+
+/* YM2612 write */
+/* a = address */
+/* v = value   */
+int YM2612Write_940(unsigned int a, unsigned int v)
+{
+	int upd;
+
+	v &= 0xff;
+	a &= 3;
+
+	/* local copy takes care of regs (for savestates), timers and DAC */
+	upd = YM2612Write_(a, v);
+
+	switch (a) {
+	case 0:	/* address port 0 */
+	case 2:	/* address port 1 */
+		if (ym_a1 == (a >> 1) && ym_address == v)
+			return 0;	/* address already selected */
+		ym_address = v;
+		ym_a1 = a >> 1;
+		/* DAC data and timers are never needed by worker */
+		if (!ym_a1 && (v == 0x24 || v == 0x25 || v == 0x26 || v == 0x2a))
+			return 0;
+		break;
+
+	case 1:	/* data port 0 */
+	case 3:	/* data port 1 */
+		if (!ym_a1 && (ym_address == 0x24 || ym_address == 0x25 ||
+				ym_address == 0x26 || ym_address == 0x2a))
+			return 0;
+		break;
+	}
+
+	/* detect rapid ym updates, like 940 code does */
+	if (upd && !ym_split_done && Pico.m.scanline < 224) {
+		int mid = Pico.m.pal ? 68 : 93;
+		if (Pico.m.scanline > mid) {
+			ymq_push1(YMQ_SPLIT, (PsndLen/2) | ((PicoOpt&8) << 13));
+			sem_post(&ym_sem_wake);
+			ym_split_done = 1;
+		}
+	}
+
+	ymq_push1(YMQ_WRITE, (a << 8) | v);
+
+	return 0; // cause the engine to do updates once per frame only
+}
+
+
+void YM2612PicoStateLoad_940(void)
+{
+	UINT8 *REGS = YM2612GetRegs();
+	int i, old_A1;
+
+	YM2612PicoStateLoad_();
+	old_A1 = *(INT32 *)(REGS + 0x200);
+
+	ymq_push1(YMQ_STATELOAD, 0);
+	ym_address = -1; // force address writes
+
+	// feed all the registers to the worker
+	for(i = 0; i < 0x100; i++) {
+		ymq_push1(YMQ_WRITE, (0 << 8) | i);
+		ymq_push1(YMQ_WRITE, (1 << 8) | REGS[i]);
+	}
+	for(i = 0; i < 0x100; i++) {
+		ymq_push1(YMQ_WRITE, (2 << 8) | i);
+		ymq_push1(YMQ_WRITE, (3 << 8) | REGS[i|0x100]);
+	}
+
+	ymq_push1(YMQ_SET_A1, old_A1);
+	ym_a1 = old_A1;
+	sem_post(&ym_sem_wake);
+}
+
+
+void YM2612Init_940(int baseclock, int rate)
+{
+	unsigned int d[3];
+
+	/* local copy, also builds the tables for both */
+	YM2612Init_(baseclock, rate);
+
+	if (!ym_thread_running && ym_thread_start() != 0) {
+		PicoOpt &= ~0x200; // fall back to rendering locally
+		return;
+	}
+
+	ym_address = ym_a1 = 0;
+	ym_split_done = 0;
+
+	d[0] = YMQ_INIT << 24;
+	d[1] = baseclock;
+	d[2] = rate;
+	ymq_push(d, 3);
+	sem_post(&ym_sem_wake);
+}
+
+
+void YM2612ResetChip_940(void)
+{
+	YM2612ResetChip_();
+
+	if (!ym_thread_running) return;
+
+	ym_address = ym_a1 = 0;
+	ymq_push1(YMQ_RESET, 0);
+}
+
+
+int YM2612UpdateOne_940(int *buffer, int length, int stereo, int is_buf_empty)
+{
+	int i, prev, len_next, *ym_buf, ym_len, ret = 0;
+
+	/* wait for the previous frame to be rendered */
+	if (ym_jobs_pending) {
+		sem_wait(&ym_sem_done);
+		ym_jobs_pending--;
+	}
+	__sync_synchronize();
+
+	/* predict sample counter for next frame */
+	len_next = PsndLen;
+	if (PsndLen_exc_add && PsndLen_exc_cnt + PsndLen_exc_add >= 0x10000)
+		len_next++;
+
+	/* let worker render this frame's writes while we emulate the next one */
+	ymq_push1(YMQ_END, len_next | (stereo << 16));
+	sem_post(&ym_sem_wake);
+	prev = ym_frames_queued++ & 1;
+	ym_jobs_pending++;
+	ym_split_done = 0;
+
+	/* mix in what was rendered last time */
+	ym_buf = ym_buffer[prev^1];
+	ym_len = ym_frames_queued > 1 ? ym_buffer_len[prev^1] : 0;
+	if (ym_buffer_stereo[prev^1] != stereo) ym_len = 0;
+	if (ym_len > length) ym_len = length;
+	if (ym_len > 0) ret = ym_active_chs[prev^1];
+
+	length <<= stereo;
+	ym_len <<= stereo;
+	if (is_buf_empty) {
+		memcpy32(buffer, ym_buf, ym_len);
+		if (length > ym_len) memset32(buffer + ym_len, 0, length - ym_len);
+	}
+	else {
+		for (i = 0; i < ym_len; i++)
+			buffer[i] += ym_buf[i];
+	}
+
+	return ret;
+}
@@ -561,17 +561,7 @@ static void draw_savestate_bg(int slot)
 	}
 
 	if (file) {
-		if (PicoMCD & 1) {
-			PicoCdLoadStateGfx(file);
-		} else {
-			areaSeek(file, 0x10020, SEEK_SET);  // skip header and RAM in state file
-			areaRead(Pico.vram, 1, sizeof(Pico.vram), file);
-			areaSeek(file, 0x2000, SEEK_CUR);
-			areaRead(Pico.cram, 1, sizeof(Pico.cram), file);
-			areaRead(Pico.vsram, 1, sizeof(Pico.vsram), file);
-			areaSeek(file, 0x221a0, SEEK_SET);
-			areaRead(&Pico.video, 1, sizeof(Pico.video), file);
-		}
+		PicoStateLoadGfx(file);
 		areaClose(file);
 	}
 
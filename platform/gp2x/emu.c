@@ -21,6 +21,7 @@
 #include "../common/arm_utils.h"
 #include "../common/fonts.h"
 #include "../common/emu.h"
+#include "../common/rewind.h"
 #include "cpuctrl.h"
 
 #include <Pico/PicoInt.h>
@@ -36,6 +37,16 @@
 #define OSD_FPS_X 260
 #endif
 
+// rewind ring, states are captured every other frame to spare the CPU
+#define REWIND_SIZE_KB  4096
+#define REWIND_INTERVAL 2
+// run-ahead: frames emulated past the real one for display
+#define RUNAHEAD_FRAMES 1
+// PicoDrawSetColorFormat() for 16bpp modes, port_config.h may override
+#ifndef EMU_COLOR_FORMAT16
+#define EMU_COLOR_FORMAT16 1
+#endif
+
 
 int engineState;
 int select_exits = 0;
@@ -47,6 +58,7 @@ extern int crashed_940;
 static short __attribute__((aligned(4))) sndBuffer[2*44100/50];
 static struct timeval noticeMsgTime = { 0, 0 };	// when started showing
 static int osd_fps_x;
+static int rewinding = 0; // rewind action is held
 static int combo_keys = 0, combo_acts = 0;	// keys and actions which need button combos
 static int gp2x_old_gamma = 100;
 char noticeMsg[64];			// notice msg to draw
@@ -158,6 +170,7 @@ void emu_Deinit(void)
 		emu_SaveLoadGame(0, 1);
 		SRam.changed = 0;
 	}
+	emu_waitSaveWrites();
 
 	if (!(currentConfig.EmuOpt & 0x20)) {
 		FILE *f = fopen(PicoConfigFile, "r+b");
@@ -374,7 +387,7 @@ static void vidResetMode(void)
 		gp2x_video_changemode(8);
 	} else if (currentConfig.EmuOpt&0x80) {
 		gp2x_video_changemode(16);
-		PicoDrawSetColorFormat(1);
+		PicoDrawSetColorFormat(EMU_COLOR_FORMAT16);
 		PicoScan = EmuScan16;
 		PicoScan(0, 0);
 	} else {
@@ -621,6 +634,8 @@ static void updateKeys(void)
 	if ((events ^ prevEvents) & 0x40)
 		change_fast_forward(events & 0x40);
 
+	rewinding = (events & 0x20) && (currentConfig.EmuOpt & 0x80000);
+
 	events &= ~prevEvents;
 	if (events) RunEvents(events);
 	if (movie_data) emu_updateMovie();
@@ -641,9 +656,11 @@ static void updateSound(int len)
 
 static void SkipFrame(int do_audio)
 {
+	if (rewinding) rewind_step();
 	PicoSkipFrame=do_audio ? 1 : 2;
 	PicoFrame();
 	PicoSkipFrame=0;
+	if (!rewinding) rewind_capture();
 }
 
 
@@ -657,7 +674,7 @@ void emu_forcedFrame(void)
 	currentConfig.EmuOpt |= 0x80;
 
 	//vidResetMode();
-	PicoDrawSetColorFormat(1);
+	PicoDrawSetColorFormat(EMU_COLOR_FORMAT16);
 	PicoScan = EmuScan16;
 	PicoScan(0, 0);
 	Pico.m.dirtyPal = 1;
@@ -735,6 +752,10 @@ void emu_Loop(void)
 	oldmodes = ((Pico.video.reg[12]&1)<<2) ^ 0xc;
 	find_combos();
 
+	if (currentConfig.EmuOpt & 0x80000)
+		rewind_init(REWIND_SIZE_KB, REWIND_INTERVAL);
+	else rewind_free();
+
 	// pal/ntsc might have changed, reset related stuff
 	target_fps = Pico.m.pal ? 50 : 60;
 	target_frametime = 1000000/target_fps;
@@ -792,6 +813,8 @@ void emu_Loop(void)
 			frames_shown = frames_done = tval.tv_usec/target_frametime;
 		}
 
+		emu_pollSaveWrites();
+
 		// show notice message?
 		if (noticeMsgTime.tv_sec)
 		{
@@ -898,7 +921,11 @@ void emu_Loop(void)
 		}
 
 		updateKeys();
-		PicoFrame();
+		if (rewinding) rewind_step(); // and show the frame which follows it
+		if (!rewinding && (currentConfig.EmuOpt & 0x100000))
+			emu_runAheadFrame(RUNAHEAD_FRAMES);
+		else PicoFrame();
+		if (!rewinding) rewind_capture();
 
 #if 0
 if (Pico.m.frame_count == 31563) {
@@ -13,6 +13,7 @@
 #include "menu.h"
 #include "../common/menu.h"
 #include "../common/emu.h"
+#include "../common/rewind.h"
 #include "emu.h"
 #include "940ctl.h"
 #include "version.h"
@@ -115,9 +116,10 @@ int main(int argc, char *argv[])
 				break;
 
 			case PGS_ReloadRom:
-				if (emu_ReloadRom())
+				if (emu_ReloadRom()) {
+					rewind_reset(); // history of the previous game
 					engineState = PGS_Running;
-				else {
+				} else {
 					printf("PGS_ReloadRom == 0\n");
 					engineState = PGS_Menu;
 				}
@@ -504,17 +504,7 @@ static void draw_savestate_bg(int slot)
 	}
 
 	if (file) {
-		if (PicoMCD & 1) {
-			PicoCdLoadStateGfx(file);
-		} else {
-			areaSeek(file, 0x10020, SEEK_SET);  // skip header and RAM in state file
-			areaRead(Pico.vram, 1, sizeof(Pico.vram), file);
-			areaSeek(file, 0x2000, SEEK_CUR);
-			areaRead(Pico.cram, 1, sizeof(Pico.cram), file);
-			areaRead(Pico.vsram, 1, sizeof(Pico.vsram), file);
-			areaSeek(file, 0x221a0, SEEK_SET);
-			areaRead(&Pico.video, 1, sizeof(Pico.video), file);
-		}
+		PicoStateLoadGfx(file);
 		areaClose(file);
 	}
 
@@ -839,6 +829,7 @@ static bind_action_t emuctrl_actions[] =
 	{ "Volume Down    ", 1<<30 },
 	{ "Volume Up      ", 1<<29 },
 	{ "Fast forward   ", 1<<22 },
+	{ "Rewind         ", 1<<21 },
 	{ "Enter Menu     ", 1<<23 },
 };
 
@@ -1031,6 +1022,8 @@ menu_entry opt2_entries[] =
 	{ "Emulate SN76496 (PSG)",     MB_ONOFF, MA_OPT2_ENABLE_SN76496,&currentConfig.PicoOpt,0x0002, 0, 0, 1 },
 	{ "gzip savestates",           MB_ONOFF, MA_OPT2_GZIP_STATES,   &currentConfig.EmuOpt, 0x0008, 0, 0, 1 },
 	{ "Don't save last used ROM",  MB_ONOFF, MA_OPT2_NO_LAST_ROM,   &currentConfig.EmuOpt, 0x0020, 0, 0, 1 },
+	{ "Rewind (hold action key)",  MB_ONOFF, MA_OPT2_REWIND,        &currentConfig.EmuOpt,0x80000, 0, 0, 1 },
+	{ "Run-ahead (less lag)",      MB_ONOFF, MA_OPT2_RUNAHEAD,      &currentConfig.EmuOpt,0x100000,0, 0, 1 },
 	{ "needs restart:",            MB_NONE,  MA_NONE,               NULL, 0, 0, 0, 1 },
 	{ "craigix's RAM timings",     MB_ONOFF, MA_OPT2_RAMTIMINGS,    &currentConfig.EmuOpt, 0x0100, 0, 0, 1 },
 	{ NULL,                        MB_ONOFF, MA_OPT2_SQUIDGEHACK,   &currentConfig.EmuOpt, 0x0010, 0, 0, 1 },
@@ -52,6 +52,9 @@ static int TileNorm(int sx,int addr,int pal)
   pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
   if (pack)
   {
+#ifdef DRAW_SIMD
+    DrawTileNorm(pd, pack, pal);
+#else
     t=pack&0x0000f000; if (t) pd[0]=(unsigned char)(pal|(t>>12));
     t=pack&0x00000f00; if (t) pd[1]=(unsigned char)(pal|(t>> 8));
     t=pack&0x000000f0; if (t) pd[2]=(unsigned char)(pal|(t>> 4));
@@ -60,6 +63,7 @@ static int TileNorm(int sx,int addr,int pal)
     t=pack&0x0f000000; if (t) pd[5]=(unsigned char)(pal|(t>>24));
     t=pack&0x00f00000; if (t) pd[6]=(unsigned char)(pal|(t>>20));
     t=pack&0x000f0000; if (t) pd[7]=(unsigned char)(pal|(t>>16));
+#endif
     return 0;
   }
 
@@ -74,6 +78,9 @@ static int TileFlip(int sx,int addr,int pal)
   pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
   if (pack)
   {
+#ifdef DRAW_SIMD
+    DrawTileFlip(pd, pack, pal);
+#else
     t=pack&0x000f0000; if (t) pd[0]=(unsigned char)(pal|(t>>16));
     t=pack&0x00f00000; if (t) pd[1]=(unsigned char)(pal|(t>>20));
     t=pack&0x0f000000; if (t) pd[2]=(unsigned char)(pal|(t>>24));
@@ -82,6 +89,7 @@ static int TileFlip(int sx,int addr,int pal)
     t=pack&0x000000f0; if (t) pd[5]=(unsigned char)(pal|(t>> 4));
     t=pack&0x00000f00; if (t) pd[6]=(unsigned char)(pal|(t>> 8));
     t=pack&0x0000f000; if (t) pd[7]=(unsigned char)(pal|(t>>12));
+#endif
     return 0;
   }
   return 1; // Tile blank
@@ -103,6 +111,9 @@ static int TileNormSH(int sx,int addr,int pal)
   pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
   if (pack)
   {
+#ifdef DRAW_SIMD
+    DrawTileNormSH(pd, pack, pal);
+#else
     t=(pack&0x0000f000)>>12; sh_pix(0);
     t=(pack&0x00000f00)>> 8; sh_pix(1);
     t=(pack&0x000000f0)>> 4; sh_pix(2);
@@ -111,6 +122,7 @@ static int TileNormSH(int sx,int addr,int pal)
     t=(pack&0x0f000000)>>24; sh_pix(5);
     t=(pack&0x00f00000)>>20; sh_pix(6);
     t=(pack&0x000f0000)>>16; sh_pix(7);
+#endif
     return 0;
   }
 
@@ -125,6 +137,9 @@ static int TileFlipSH(int sx,int addr,int pal)
   pack=*(unsigned int *)(Pico.vram+addr); // Get 8 pixels
   if (pack)
   {
+#ifdef DRAW_SIMD
+    DrawTileFlipSH(pd, pack, pal);
+#else
     t=(pack&0x000f0000)>>16; sh_pix(0);
     t=(pack&0x00f00000)>>20; sh_pix(1);
     t=(pack&0x0f000000)>>24; sh_pix(2);
@@ -133,6 +148,7 @@ static int TileFlipSH(int sx,int addr,int pal)
     t=(pack&0x000000f0)>> 4; sh_pix(5);
     t=(pack&0x00000f00)>> 8; sh_pix(6);
     t=(pack&0x0000f000)>>12; sh_pix(7);
+#endif
     return 0;
   }
   return 1; // Tile blank
@@ -5,6 +5,9 @@
 
 #define NO_SYNC
 
+// gp2x/emu.c: 16bpp output format, the GTK window takes full range RGB565
+#define EMU_COLOR_FORMAT16 3
+
 // draw2.c
 #define START_ROW  0 // which row of tiles to start rendering at?
 #define END_ROW   28 // ..end
@@ -22,6 +22,7 @@
 #include "../common/arm_utils.h"
 #include "../common/fonts.h"
 #include "../common/emu.h"
+#include "../common/rewind.h"
 
 #include <Pico/PicoInt.h>
 #include <Pico/Patch.h>
@@ -30,6 +31,12 @@
 
 #define OSD_FPS_X 260
 
+// rewind ring, a state is captured every frame
+#define REWIND_SIZE_KB  8192
+#define REWIND_INTERVAL 1
+// run-ahead: frames emulated past the real one for display
+#define RUNAHEAD_FRAMES 1
+
 int engineState;
 int select_exits = 0;
 
@@ -39,6 +46,7 @@ char *homePath;
 static short sndBuffer[2*44100/50];
 static struct timeval noticeMsgTime = { 0, 0 }; // when started showing
 static int osd_fps_x;
+static int rewinding = 0; // rewind action is held
 static int combo_keys = 0, combo_acts = 0; // keys and actions which need button combos
 
 char noticeMsg[64];  // notice msg to draw
@@ -175,6 +183,7 @@ void emu_Deinit(void)
 		emu_SaveLoadGame(0, 1);
 		SRam.changed = 0;
 	}
+	emu_waitSaveWrites();
 
 	if (!(currentConfig.EmuOpt & 0x20)) {
 		FILE *f = fopen(PicoConfigFile, "r+b");
@@ -239,7 +248,7 @@ void osd_text(int x, int y, const char *text)
 {
 	int len = strlen(text)*8;
 
-	if ((PicoOpt&0x10)||!(currentConfig.EmuOpt&0x80)) {
+	if (PicoOpt&0x10) {
 		int *p, i, h;
 		x &= ~3; // align x
 		len = (len+3) >> 2;
@@ -267,8 +276,8 @@ static void cd_leds(void)
 //	if (!((Pico_mcd->s68k_regs[0] ^ old_reg) & 3)) return; // no change // mmu hack problems?
 	old_reg = Pico_mcd->s68k_regs[0];
 
-	if ((PicoOpt&0x10)||!(currentConfig.EmuOpt&0x80)) {
-		// 8-bit modes
+	if (PicoOpt&0x10) {
+		// 8-bit mode
 		unsigned int col_g = (old_reg & 2) ? 0xc0c0c0c0 : 0xe0e0e0e0;
 		unsigned int col_r = (old_reg & 1) ? 0xd0d0d0d0 : 0xe0e0e0e0;
 		*(unsigned int *)((char *)sdl_screen + 320*2+ 4) =
@@ -278,7 +287,7 @@ static void cd_leds(void)
 		*(unsigned int *)((char *)sdl_screen + 320*3+12) =
 		*(unsigned int *)((char *)sdl_screen + 320*4+12) = col_r;
 	} else {
-		// 16-bit modes
+		// 16-bit mode
 		unsigned int *p = (unsigned int *)((short *)sdl_screen + 320*2+4);
 		unsigned int col_g = (old_reg & 2) ? 0x06000600 : 0;
 		unsigned int col_r = (old_reg & 1) ? 0xc000c000 : 0;
@@ -296,14 +305,6 @@ static int EmuScan16(unsigned int num, void *sdata)
 	return 0;
 }
 
-static int EmuScan8(unsigned int num, void *sdata)
-{
-	if (!(Pico.video.reg[1]&8)) num += 8;
-	DrawLineDest = (unsigned char *)  sdl_screen + 320*(num+1);
-
-	return 0;
-}
-
 int localPal[0x100];
 static void (*vidCpyM2)(void *dest, void *src) = NULL;
 
@@ -320,30 +321,6 @@ static void blit(const char *fps, const char *notice)
 			sdl_video_setpalette(localPal, 0x40);
 		}
 		vidCpyM2((unsigned char *)sdl_screen+320*8, PicoDraw2FB+328*8);
-	} else if (!(emu_opt&0x80)) {
-		// 8bit accurate renderer
-		if (Pico.m.dirtyPal) {
-			Pico.m.dirtyPal = 0;
-			if(Pico.video.reg[0xC]&8) { // shadow/hilight mode
-				vidConvCpyRGB32(localPal, Pico.cram, 0x40);
-				vidConvCpyRGB32sh(localPal+0x40, Pico.cram, 0x40);
-				vidConvCpyRGB32hi(localPal+0x80, Pico.cram, 0x40);
-				blockcpy(localPal+0xc0, localPal+0x40, 0x40*4);
-				localPal[0xc0] = 0x0000c000;
-				localPal[0xd0] = 0x00c00000;
-				localPal[0xe0] = 0x00000000; // reserved pixels for OSD
-				localPal[0xf0] = 0x00ffffff;
-				sdl_video_setpalette(localPal, 0x100);
-			} else if (rendstatus & 0x20) { // mid-frame palette changes
-				vidConvCpyRGB32(localPal, Pico.cram, 0x40);
-				vidConvCpyRGB32(localPal+0x40, HighPal, 0x40);
-				vidConvCpyRGB32(localPal+0x80, HighPal+0x40, 0x40);
-				sdl_video_setpalette(localPal, 0xc0);
-			} else {
-				vidConvCpyRGB32(localPal, Pico.cram, 0x40);
-				sdl_video_setpalette(localPal, 0x40);
-			}
-		}
 	}
 
 	if(notice || (emu_opt & 2)) {
@@ -358,11 +335,7 @@ static void blit(const char *fps, const char *notice)
 
 	if (!(PicoOpt&0x10)) {
 		if (!(Pico.video.reg[1]&8)) {
-			if (currentConfig.EmuOpt&0x80) {
-				DrawLineDest = (unsigned short *) sdl_screen + 320*8;
-			} else {
-				DrawLineDest = (unsigned char  *) sdl_screen + 320*8;
-			}
+			DrawLineDest = (unsigned short *) sdl_screen + 320*8;
 		} else {
 			DrawLineDest = sdl_screen;
 		}
@@ -372,8 +345,8 @@ static void blit(const char *fps, const char *notice)
 // clears whole screen or just the notice area (in all buffers)
 static void clearArea(int full)
 {
-	if ((PicoOpt&0x10)||!(currentConfig.EmuOpt&0x80)) {
-		// 8-bit renderers
+	if (PicoOpt&0x10) {
+		// 8-bit fast renderer
 		if (full) sdl_memset_all_buffers(0, 0xe0, 320*240);
 		else      sdl_memset_all_buffers(320*232, 0xe0, 320*8);
 	} else {
@@ -387,19 +360,15 @@ static void vidResetMode(void)
 {
 	if (PicoOpt&0x10) {
 		sdl_video_changemode(8);
-	} else if (currentConfig.EmuOpt&0x80) {
+	} else {
+		// accurate renderer writes the display format (RGB565) itself
 		sdl_video_changemode(16);
-		PicoDrawSetColorFormat(1);
+		PicoDrawSetColorFormat(3);
 		PicoScan = EmuScan16;
 		PicoScan(0, 0);
-	} else {
-		sdl_video_changemode(8);
-		PicoDrawSetColorFormat(2);
-		PicoScan = EmuScan8;
-		PicoScan(0, 0);
 	}
-	if ((PicoOpt&0x10)||!(currentConfig.EmuOpt&0x80)) {
-		// setup pal for 8-bit modes
+	if (PicoOpt&0x10) {
+		// setup pal for 8-bit mode
 		localPal[0xc0] = 0x0000c000; // MCD LEDs
 		localPal[0xd0] = 0x00c00000;
 		localPal[0xe0] = 0x00000000; // reserved pixels for OSD
@@ -417,8 +386,8 @@ static void vidResetMode(void)
 
 static void emu_msg_cb(const char *msg)
 {
-	if ((PicoOpt&0x10)||!(currentConfig.EmuOpt&0x80)) {
-		// 8-bit renderers
+	if (PicoOpt&0x10) {
+		// 8-bit fast renderer
 		sdl_memset_all_buffers(320*232, 0xe0, 320*8);
 		osd_text(4, 232, msg);
 		sdl_memcpy_all_buffers((char *)sdl_screen+320*232, 320*232, 320*8);
@@ -503,18 +472,14 @@ static void RunEvents(unsigned int which)
 	}
 	if (which & 0x0400) // switch renderer
 	{
-		if      (  PicoOpt&0x10)             { PicoOpt&=~0x10; currentConfig.EmuOpt |= 0x80; }
-		else if (!(currentConfig.EmuOpt&0x80)) PicoOpt|= 0x10;
-		else   currentConfig.EmuOpt &= ~0x80;
+		PicoOpt ^= 0x10;
 
 		vidResetMode();
 
 		if (PicoOpt&0x10) {
 			strcpy(noticeMsg, " 8bit fast renderer");
-		} else if (currentConfig.EmuOpt&0x80) {
-			strcpy(noticeMsg, "16bit accurate renderer");
 		} else {
-			strcpy(noticeMsg, " 8bit accurate renderer");
+			strcpy(noticeMsg, "16bit accurate renderer");
 		}
 
 		gettimeofday(&noticeMsgTime, 0);
@@ -583,6 +548,8 @@ static void updateKeys(void)
 	if ((events ^ prevEvents) & 0x40)
 		change_fast_forward(events & 0x40);
 
+	rewinding = (events & 0x20) && (currentConfig.EmuOpt & 0x80000);
+
 	events &= ~prevEvents;
 	if (events) RunEvents(events);
 	if (movie_data) emu_updateMovie();
@@ -602,9 +569,11 @@ static void updateSound(int len)
 
 static void SkipFrame(int do_audio)
 {
+	if (rewinding) rewind_step();
 	PicoSkipFrame=do_audio ? 1 : 2;
 	PicoFrame();
 	PicoSkipFrame=0;
+	if (!rewinding) rewind_capture();
 }
 
 
@@ -618,7 +587,7 @@ void emu_forcedFrame(void)
 	currentConfig.EmuOpt |= 0x80;
 
 	//vidResetMode();
-	PicoDrawSetColorFormat(1);
+	PicoDrawSetColorFormat(3);
 	PicoScan = EmuScan16;
 	PicoScan(0, 0);
 	Pico.m.dirtyPal = 1;
@@ -674,6 +643,10 @@ void emu_Loop(void)
 	oldmodes = ((Pico.video.reg[12]&1)<<2) ^ 0xc;
 	find_combos();
 
+	if (currentConfig.EmuOpt & 0x80000)
+		rewind_init(REWIND_SIZE_KB, REWIND_INTERVAL);
+	else rewind_free();
+
 	// pal/ntsc might have changed, reset related stuff
 	target_fps = Pico.m.pal ? 50 : 60;
 	target_frametime = 1000000/target_fps;
@@ -722,6 +695,8 @@ void emu_Loop(void)
 			frames_shown = frames_done = tval.tv_usec/target_frametime;
 		}
 
+		emu_pollSaveWrites();
+
 		// show notice message?
 		if (noticeMsgTime.tv_sec)
 		{
@@ -813,7 +788,11 @@ void emu_Loop(void)
 		}
 
 		updateKeys();
-		PicoFrame();
+		if (rewinding) rewind_step(); // and show the frame which follows it
+		if (!rewinding && (currentConfig.EmuOpt & 0x100000))
+			emu_runAheadFrame(RUNAHEAD_FRAMES);
+		else PicoFrame();
+		if (!rewinding) rewind_capture();
 
 		// check time
 		gettimeofday(&tval, 0);
@@ -849,7 +828,7 @@ void emu_Loop(void)
 	}
 
 	// if in 8bit mode, generate 16bit image for menu background
-	if ((PicoOpt&0x10) || !(currentConfig.EmuOpt&0x80))
+	if (PicoOpt&0x10)
 		emu_forcedFrame();
 }
 
@@ -494,17 +494,7 @@ static void draw_savestate_bg(int slot)
 	}
 
 	if (file) {
-		if (PicoMCD & 1) {
-			PicoCdLoadStateGfx(file);
-		} else {
-			areaSeek(file, 0x10020, SEEK_SET);  // skip header and RAM in state file
-			areaRead(Pico.vram, 1, sizeof(Pico.vram), file);
-			areaSeek(file, 0x2000, SEEK_CUR);
-			areaRead(Pico.cram, 1, sizeof(Pico.cram), file);
-			areaRead(Pico.vsram, 1, sizeof(Pico.vsram), file);
-			areaSeek(file, 0x221a0, SEEK_SET);
-			areaRead(&Pico.video, 1, sizeof(Pico.video), file);
-		}
+		PicoStateLoadGfx(file);
 		areaClose(file);
 	}
 
@@ -788,6 +778,7 @@ static bind_action_t emuctrl_actions[] =
 	{ "Volume Down    ", 1<<30 },
 	{ "Volume Up      ", 1<<29 },
 	{ "Fast forward   ", 1<<22 },
+	{ "Rewind         ", 1<<21 },
 	{ "Enter Menu     ", 1<<23 },
 };
 
@@ -978,6 +969,8 @@ menu_entry opt2_entries[] =
 	{ "Emulate SN76496 (PSG)",     MB_ONOFF, MA_OPT2_ENABLE_SN76496,&currentConfig.PicoOpt,0x0002, 0, 0, 1 },
 	{ "gzip savestates",           MB_ONOFF, MA_OPT2_GZIP_STATES,   &currentConfig.EmuOpt, 0x0008, 0, 0, 1 },
 	{ "Don't save last used ROM",  MB_ONOFF, MA_OPT2_NO_LAST_ROM,   &currentConfig.EmuOpt, 0x0020, 0, 0, 1 },
+	{ "Rewind (hold action key)",  MB_ONOFF, MA_OPT2_REWIND,        &currentConfig.EmuOpt,0x80000, 0, 0, 1 },
+	{ "Run-ahead (less lag)",      MB_ONOFF, MA_OPT2_RUNAHEAD,      &currentConfig.EmuOpt,0x100000,0, 0, 1 },
 	{ "done",                      MB_NONE,  MA_OPT2_DONE,          NULL, 0, 0, 0, 1 },
 };
 
@@ -1109,10 +1102,8 @@ static void menu_opt_cust_draw(const menu_entry *entry, int x, int y, void *para
 		case MA_OPT_RENDERER:
 			if (currentConfig.PicoOpt&0x10)
 				str = " 8bit fast";
-			else if (currentConfig.EmuOpt&0x80)
-				str = "16bit accurate";
 			else
-				str = " 8bit accurate";
+				str = "16bit accurate";
 			text_out16(x, y, "Renderer:            %s", str);
 			break;
 		case MA_OPT_FRAMESKIP:
@@ -1251,15 +1242,8 @@ static int menu_loop_options(void)
 						currentConfig.scaling ^= 1;
 						break;
 					case MA_OPT_RENDERER:
-						if (inp & GP2X_LEFT) {
-							if      (  currentConfig.PicoOpt&0x10) currentConfig.PicoOpt&= ~0x10;
-							else if (!(currentConfig.EmuOpt &0x80))currentConfig.EmuOpt |=  0x80;
-							else if (  currentConfig.EmuOpt &0x80) break;
-						} else {
-							if      (  currentConfig.PicoOpt&0x10) break;
-							else if (!(currentConfig.EmuOpt &0x80))currentConfig.PicoOpt|=  0x10;
-							else if (  currentConfig.EmuOpt &0x80) currentConfig.EmuOpt &= ~0x80;
-						}
+						if (inp & GP2X_LEFT) currentConfig.PicoOpt&= ~0x10;
+						else                 currentConfig.PicoOpt|=  0x10;
 						break;
 					case MA_OPT_SOUND_QUALITY:
 						if ((inp & GP2X_RIGHT) && currentConfig.PsndRate == 44100 && !(currentConfig.PicoOpt&0x08)) {